@@ -3,6 +3,10 @@
 #include "kt/Memory.h"
 #include "Renderer.h"
 #include "TaskSystem.h"
+#include "SIMDUtil.h"
+
+#include <float.h>
+#include <math.h>
 
 namespace sr
 {
@@ -45,22 +49,9 @@ enum VertexClipCode
 	Z_Far = 0x20
 };
 
-static uint8_t ComputeClipMask(kt::Vec4 const& _v)
-{
-	uint8_t mask = 0;
-
-	if (_v.x + _v.w < 0.0f) mask |= VertexClipCode::X_Neg;
-	if (_v.x - _v.w > 0.0f) mask |= VertexClipCode::X_Pos;
-	if (_v.y + _v.w < 0.0f) mask |= VertexClipCode::Y_Neg;
-	if (_v.y - _v.w > 0.0f) mask |= VertexClipCode::Y_Pos;
-	if (_v.z < 0.0f)		mask |= VertexClipCode::Z_Near;
-	if (_v.z - _v.w > 0.0f) mask |= VertexClipCode::Z_Far;
-
-	return mask;
-}
-
 // Each frustum plane can turn a point into an edge (1 vert -> 2 verts). Therefore each clip plane can add 1 vertex. 9 total (including 3 from initial tri)
 constexpr uint32_t CLIP_VERT_BUFFER_SIZE = 3 + 6;
+static_assert(CLIP_VERT_BUFFER_SIZE - 2 == c_maxTrisPerClippedTri, "Clipped triangle count no longer bounds front end spans.");
 
 struct ClipBuffer
 {
@@ -195,40 +186,323 @@ KT_FORCEINLINE static void FetchIndices(DrawCall const& _call, uint32_t _triIdx,
 	KT_ASSERT(o_indices[2] < _call.m_positionBuffer.m_num);
 }
 
-KT_FORCEINLINE static void FetchPositions(DrawCall const& _call, uint32_t const i_indices[3], kt::Vec4 o_positions[3])
+// Triangles are fetched in batches of 8: positions (and attributes with a VertexLayout) of each corner are decoded 8 vertices at a time.
+constexpr uint32_t c_triBatchSize = 8;
+
+static_assert(Config::c_maxVaryings == 8, "Attribute decode transposes 8 varyings of 8 vertices.");
+
+struct TriBatch
+{
+	// Corner major, m_indices[corner][tri].
+	KT_ALIGNAS(32) uint32_t m_indices[3][c_triBatchSize];
+
+	// Clip space positions.
+	KT_ALIGNAS(32) float m_x[3][c_triBatchSize];
+	KT_ALIGNAS(32) float m_y[3][c_triBatchSize];
+	KT_ALIGNAS(32) float m_z[3][c_triBatchSize];
+	KT_ALIGNAS(32) float m_w[3][c_triBatchSize];
+
+	KT_ALIGNAS(32) uint32_t m_clipMasks[3][c_triBatchSize];
+
+	// Decoded varyings, only filled for draws with a VertexLayout.
+	KT_ALIGNAS(32) float m_attribs[3][c_triBatchSize][Config::c_maxVaryings];
+};
+
+KT_FORCEINLINE static __m256i VertexByteOffsets(uint32_t const (&_indices)[c_triBatchSize], uint32_t _stride, uint32_t _offset)
+{
+	__m256i const indices = _mm256_load_si256((__m256i const*)_indices);
+	return _mm256_add_epi32(_mm256_mullo_epi32(indices, _mm256_set1_epi32(int32_t(_stride))), _mm256_set1_epi32(int32_t(_offset)));
+}
+
+KT_FORCEINLINE static void GatherFloats(uint8_t const* _base, __m256i _offsets, uint32_t _num, __m256* o_vals)
+{
+	for (uint32_t i = 0; i < _num; ++i)
+	{
+		o_vals[i] = _mm256_i32gather_ps((float const*)(_base + i * sizeof(float)), _offsets, 1);
+	}
+}
+
+KT_FORCEINLINE static void DecodeUnorm16x3(uint8_t const* _base, __m256i _offsets, kt::Vec3 const& _scale, kt::Vec3 const& _bias, __m256 (&o_xyz)[3])
+{
+	// xy, then yz from 2 bytes in so nothing past the 6 bytes of the attribute is read.
+	__m256i const xy = _mm256_i32gather_epi32((int const*)_base, _offsets, 1);
+	__m256i const yz = _mm256_i32gather_epi32((int const*)(_base + 2), _offsets, 1);
+
+	__m256 const x = _mm256_cvtepi32_ps(_mm256_and_si256(xy, _mm256_set1_epi32(0xFFFF)));
+	__m256 const y = _mm256_cvtepi32_ps(_mm256_srli_epi32(xy, 16));
+	__m256 const z = _mm256_cvtepi32_ps(_mm256_srli_epi32(yz, 16));
+
+	o_xyz[0] = _mm256_fmadd_ps(x, _mm256_set1_ps(_scale.x), _mm256_set1_ps(_bias.x));
+	o_xyz[1] = _mm256_fmadd_ps(y, _mm256_set1_ps(_scale.y), _mm256_set1_ps(_bias.y));
+	o_xyz[2] = _mm256_fmadd_ps(z, _mm256_set1_ps(_scale.z), _mm256_set1_ps(_bias.z));
+}
+
+KT_FORCEINLINE static void DecodeOctSnorm16x2(uint8_t const* _base, __m256i _offsets, __m256 (&o_xyz)[3])
+{
+	__m256i const packed = _mm256_i32gather_epi32((int const*)_base, _offsets, 1);
+
+	__m256 const snormScale = _mm256_set1_ps(1.0f / 32767.0f);
+	__m256 const minusOne = _mm256_set1_ps(-1.0f);
+
+	__m256 x = _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(packed, 16), 16)), snormScale), minusOne);
+	__m256 y = _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(packed, 16)), snormScale), minusOne);
+
+	__m256 const signMask = SR_AVX_LOAD_CONST_FLOAT(simdutil::c_avxSignBit);
+	__m256 const absMask = SR_AVX_LOAD_CONST_FLOAT(simdutil::c_avxSignMask);
+
+	// z = 1 - |x| - |y|, the lower hemisphere is folded over the diagonals.
+	__m256 const z = _mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), _mm256_and_ps(x, absMask)), _mm256_and_ps(y, absMask));
+	__m256 const fold = _mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(), z), _mm256_setzero_ps());
+
+	x = _mm256_sub_ps(x, _mm256_or_ps(fold, _mm256_and_ps(x, signMask)));
+	y = _mm256_sub_ps(y, _mm256_or_ps(fold, _mm256_and_ps(y, signMask)));
+
+	__m256 const lenSq = _mm256_fmadd_ps(x, x, _mm256_fmadd_ps(y, y, _mm256_mul_ps(z, z)));
+	__m256 const recipLen = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(lenSq));
+
+	o_xyz[0] = _mm256_mul_ps(x, recipLen);
+	o_xyz[1] = _mm256_mul_ps(y, recipLen);
+	o_xyz[2] = _mm256_mul_ps(z, recipLen);
+}
+
+KT_FORCEINLINE static void DecodeHalf2(uint8_t const* _base, __m256i _offsets, __m256 (&o_xy)[2])
+{
+	__m256i const packed = _mm256_i32gather_epi32((int const*)_base, _offsets, 1);
+
+	// Pack to 8 x halves then 8 y halves.
+	__m256i const lo = _mm256_and_si256(packed, _mm256_set1_epi32(0xFFFF));
+	__m256i const hi = _mm256_srli_epi32(packed, 16);
+	__m256i const halves = _mm256_permute4x64_epi64(_mm256_packus_epi32(lo, hi), _MM_SHUFFLE(3, 1, 2, 0));
+
+	o_xy[0] = _mm256_cvtph_ps(_mm256_castsi256_si128(halves));
+	o_xy[1] = _mm256_cvtph_ps(_mm256_extracti128_si256(halves, 1));
+}
+
+static void FetchAndTransformPositions(DrawCall const& _call, kt::Vec4 const (&_mvpCols)[4], uint32_t _corner, TriBatch& _batch)
+{
+	uint8_t const* base = (uint8_t const*)_call.m_positionBuffer.m_ptr;
+	__m256i const offsets = VertexByteOffsets(_batch.m_indices[_corner], _call.m_positionBuffer.m_stride, 0);
+
+	__m256 pos[3];
+
+	switch (_call.m_positionFormat)
+	{
+		case PositionFormat::Float3: GatherFloats(base, offsets, 3, pos); break;
+		case PositionFormat::Unorm16x3: DecodeUnorm16x3(base, offsets, _call.m_positionScale, _call.m_positionOffset, pos); break;
+		default: KT_UNREACHABLE;
+	}
+
+	__m256 clip[4];
+
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		clip[i] = _mm256_set1_ps(_mvpCols[3][i]);
+		clip[i] = _mm256_fmadd_ps(_mm256_set1_ps(_mvpCols[2][i]), pos[2], clip[i]);
+		clip[i] = _mm256_fmadd_ps(_mm256_set1_ps(_mvpCols[1][i]), pos[1], clip[i]);
+		clip[i] = _mm256_fmadd_ps(_mm256_set1_ps(_mvpCols[0][i]), pos[0], clip[i]);
+	}
+
+	_mm256_store_ps(_batch.m_x[_corner], clip[0]);
+	_mm256_store_ps(_batch.m_y[_corner], clip[1]);
+	_mm256_store_ps(_batch.m_z[_corner], clip[2]);
+	_mm256_store_ps(_batch.m_w[_corner], clip[3]);
+
+	// VertexClipCode bits, in order.
+	__m256 const zero = _mm256_setzero_ps();
+	__m256 const outside[6] =
+	{
+		_mm256_cmp_ps(_mm256_add_ps(clip[0], clip[3]), zero, _CMP_LT_OQ),
+		_mm256_cmp_ps(_mm256_sub_ps(clip[0], clip[3]), zero, _CMP_GT_OQ),
+		_mm256_cmp_ps(_mm256_add_ps(clip[1], clip[3]), zero, _CMP_LT_OQ),
+		_mm256_cmp_ps(_mm256_sub_ps(clip[1], clip[3]), zero, _CMP_GT_OQ),
+		_mm256_cmp_ps(clip[2], zero, _CMP_LT_OQ),
+		_mm256_cmp_ps(_mm256_sub_ps(clip[2], clip[3]), zero, _CMP_GT_OQ)
+	};
+
+	__m256i mask = _mm256_setzero_si256();
+
+	for (uint32_t i = 0; i < 6; ++i)
+	{
+		mask = _mm256_or_si256(mask, _mm256_and_si256(_mm256_castps_si256(outside[i]), _mm256_set1_epi32(1 << i)));
+	}
+
+	_mm256_store_si256((__m256i*)_batch.m_clipMasks[_corner], mask);
+}
+
+static void DecodeAttributes(DrawCall const& _call, uint32_t _corner, TriBatch& _batch)
+{
+	VertexLayout const& layout = _call.m_attributeLayout;
+	uint8_t const* base = (uint8_t const*)_call.m_attributeBuffer.m_ptr;
+
+	__m256 varyings[Config::c_maxVaryings];
+	uint32_t varyingIdx = 0;
+
+	for (uint32_t attribIdx = 0; attribIdx < layout.m_numAttributes; ++attribIdx)
+	{
+		VertexAttribute const& attrib = layout.m_attributes[attribIdx];
+		__m256i const offsets = VertexByteOffsets(_batch.m_indices[_corner], _call.m_attributeBuffer.m_stride, attrib.m_offset);
+
+		switch (attrib.m_format)
+		{
+			case AttributeFormat::Float: GatherFloats(base, offsets, 1, varyings + varyingIdx); varyingIdx += 1; break;
+			case AttributeFormat::Float2: GatherFloats(base, offsets, 2, varyings + varyingIdx); varyingIdx += 2; break;
+			case AttributeFormat::Float3: GatherFloats(base, offsets, 3, varyings + varyingIdx); varyingIdx += 3; break;
+
+			case AttributeFormat::Half2:
+			{
+				__m256 xy[2];
+				DecodeHalf2(base, offsets, xy);
+				varyings[varyingIdx++] = xy[0];
+				varyings[varyingIdx++] = xy[1];
+			} break;
+
+			case AttributeFormat::Unorm16x3:
+			case AttributeFormat::OctSnorm16x2:
+			{
+				__m256 xyz[3];
+				if (attrib.m_format == AttributeFormat::Unorm16x3)
+				{
+					DecodeUnorm16x3(base, offsets, _call.m_positionScale, _call.m_positionOffset, xyz);
+				}
+				else
+				{
+					DecodeOctSnorm16x2(base, offsets, xyz);
+				}
+
+				varyings[varyingIdx++] = xyz[0];
+				varyings[varyingIdx++] = xyz[1];
+				varyings[varyingIdx++] = xyz[2];
+			} break;
+
+			default: KT_UNREACHABLE;
+		}
+	}
+
+	KT_ASSERT(varyingIdx == layout.m_numVaryings);
+
+	for (; varyingIdx < Config::c_maxVaryings; ++varyingIdx)
+	{
+		varyings[varyingIdx] = _mm256_setzero_ps();
+	}
+
+	// Varying major to vertex major.
+	simdutil::Transpose8x8(varyings[0], varyings[1], varyings[2], varyings[3], varyings[4], varyings[5], varyings[6], varyings[7]);
+
+	for (uint32_t i = 0; i < c_triBatchSize; ++i)
+	{
+		_mm256_store_ps(_batch.m_attribs[_corner][i], varyings[i]);
+	}
+}
+
+// Fetch the indices of _batchSize triangles from _triIdxBegin, then transform their vertices and decode their attributes if needed.
+static void FetchTriBatch(DrawCall const& _call, kt::Vec4 const (&_mvpCols)[4], uint32_t _triIdxBegin, uint32_t _batchSize, TriBatch& _batch)
 {
-	uint8_t* buff = (uint8_t*)_call.m_positionBuffer.m_ptr;
-	o_positions[0] = kt::Vec4(*(kt::Vec3*)(buff + i_indices[0] * _call.m_positionBuffer.m_stride), 1.0f);
-	o_positions[1] = kt::Vec4(*(kt::Vec3*)(buff + i_indices[1] * _call.m_positionBuffer.m_stride), 1.0f);
-	o_positions[2] = kt::Vec4(*(kt::Vec3*)(buff + i_indices[2] * _call.m_positionBuffer.m_stride), 1.0f);
+	for (uint32_t i = 0; i < c_triBatchSize; ++i)
+	{
+		// Unused lanes repeat the first triangle so every lane has valid indices.
+		uint32_t indices[3];
+		FetchIndices(_call, _triIdxBegin + (i < _batchSize ? i : 0), indices);
+
+		_batch.m_indices[0][i] = indices[0];
+		_batch.m_indices[1][i] = indices[1];
+		_batch.m_indices[2][i] = indices[2];
+	}
+
+	for (uint32_t corner = 0; corner < 3; ++corner)
+	{
+		FetchAndTransformPositions(_call, _mvpCols, corner, _batch);
+	}
+
+	if (!_call.m_attributeLayout.m_numAttributes)
+	{
+		return;
+	}
+
+	// Skip decoding if every triangle is trivially culled.
+	__m256i const culled = _mm256_and_si256(_mm256_and_si256(_mm256_load_si256((__m256i const*)_batch.m_clipMasks[0]), _mm256_load_si256((__m256i const*)_batch.m_clipMasks[1])),
+											_mm256_load_si256((__m256i const*)_batch.m_clipMasks[2]));
+
+	if (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(culled, _mm256_setzero_si256()))) == 0)
+	{
+		return;
+	}
+
+	for (uint32_t corner = 0; corner < 3; ++corner)
+	{
+		DecodeAttributes(_call, corner, _batch);
+	}
 }
 
-KT_FORCEINLINE static void FetchAttribPointers(DrawCall const& _call, uint32_t const i_indices[3], float const* (&o_attribs)[3])
+KT_FORCEINLINE static void FetchAttribPointers(DrawCall const& _call, TriBatch const& _batch, uint32_t _batchIdx, float const* (&o_attribs)[3])
 {
+	if (_call.m_attributeLayout.m_numAttributes)
+	{
+		o_attribs[0] = _batch.m_attribs[0][_batchIdx];
+		o_attribs[1] = _batch.m_attribs[1][_batchIdx];
+		o_attribs[2] = _batch.m_attribs[2][_batchIdx];
+		return;
+	}
+
+	// Float attributes are used in place.
 	uint8_t* buff = (uint8_t*)_call.m_attributeBuffer.m_ptr;
 
-	o_attribs[0] = (float*)(buff + i_indices[0] * _call.m_attributeBuffer.m_stride);
-	o_attribs[1] = (float*)(buff + i_indices[1] * _call.m_attributeBuffer.m_stride);
-	o_attribs[2] = (float*)(buff + i_indices[2] * _call.m_attributeBuffer.m_stride);
+	o_attribs[0] = (float*)(buff + _batch.m_indices[0][_batchIdx] * _call.m_attributeBuffer.m_stride);
+	o_attribs[1] = (float*)(buff + _batch.m_indices[1][_batchIdx] * _call.m_attributeBuffer.m_stride);
+	o_attribs[2] = (float*)(buff + _batch.m_indices[2][_batchIdx] * _call.m_attributeBuffer.m_stride);
+}
+
+// Where a triangle came from, for ordering bin chunks.
+struct BinTriSource
+{
+	uint32_t m_globalTriIdx;
+	uint32_t m_spanBegin;
+};
+
+// Whether the span is at or past the end of the bin pass, so binning any more of it is wasted.
+static bool SpanPastPassEnd(BinContext const& _ctx, uint32_t _spanBegin)
+{
+	return _spanBegin >= std::atomic_load_explicit(&_ctx.m_passEnd, std::memory_order_relaxed);
 }
 
-static BinChunk& GetOrCreateBinForDrawCall(ThreadScratchAllocator& _alloc, BinContext& _ctx, ThreadBin& _bin, DrawCall const& _call)
+static void EndPassBefore(BinContext& _ctx, uint32_t _spanBegin)
+{
+	uint32_t passEnd = std::atomic_load_explicit(&_ctx.m_passEnd, std::memory_order_relaxed);
+	while (_spanBegin < passEnd && !std::atomic_compare_exchange_weak_explicit(&_ctx.m_passEnd, &passEnd, _spanBegin, std::memory_order_relaxed, std::memory_order_relaxed)) {}
+}
+
+// Null if the thread is out of bin memory, in which case the pass has been ended before the span.
+static BinChunk* GetOrCreateBinForDrawCall(ThreadScratchAllocator& _alloc, BinContext& _ctx, ThreadBin& _bin, DrawCall const& _call, BinTriSource const& _source)
 {
 	if (_bin.m_numChunks
 		&& _bin.m_binChunks[_bin.m_numChunks - 1]->m_drawCallIdx == _call.m_drawCallIdx
+		&& _bin.m_binChunks[_bin.m_numChunks - 1]->m_spanBegin == _source.m_spanBegin
 		&& _bin.m_binChunks[_bin.m_numChunks - 1]->m_numTris < c_trisPerBinChunk)
 	{
-		return *_bin.m_binChunks[_bin.m_numChunks - 1];
+		return _bin.m_binChunks[_bin.m_numChunks - 1];
+	}
+
+	bool const binFull = _bin.m_numChunks == c_maxThreadBinChunks;
+
+	// The first span of a pass has nothing before it to flush, so it can't end the pass. It is let over the memory budget, and c_maxFrontEndSpanTris keeps it within the chunks of a bin.
+	if (_source.m_spanBegin == _ctx.m_passBegin)
+	{
+		KT_ASSERT(!binFull && "First span of a bin pass overflowed a bin, c_maxFrontEndSpanTris is too large.");
+	}
+	else if (binFull || _alloc.BytesInUse() + sizeof(BinChunk) > Config::c_binMemoryPerThread)
+	{
+		EndPassBefore(_ctx, _source.m_spanBegin);
+		return nullptr;
 	}
 
-	KT_ASSERT(_bin.m_numChunks < c_maxThreadBinChunks);
 	BinChunk* newChunk = (BinChunk*)_alloc.Alloc(sizeof(BinChunk), KT_ALIGNOF(BinChunk));
 	uint32_t const chunkIdx = _bin.m_numChunks++;
 	newChunk->m_numTris = 0;
-	newChunk->m_attribsPerTri = _call.m_attributeBuffer.m_stride / sizeof(float);
+	newChunk->m_attribsPerTri = _call.NumVaryings();
 	newChunk->m_drawCallIdx = _call.m_drawCallIdx;
+	newChunk->m_sortKey = _source.m_globalTriIdx;
+	newChunk->m_spanBegin = _source.m_spanBegin;
 	_bin.m_binChunks[chunkIdx] = newChunk;
-	return *newChunk;
+	return newChunk;
 }
 
 static void SetupEdge(BinChunk::EdgeEq& _e, uint32_t const _idx, int32_t const (&_v0)[2], int32_t const (&_v1)[2])
@@ -277,7 +551,8 @@ static void BinTransformedAndClippedTri
 	kt::Vec4 const& _v1, 
 	kt::Vec4 const& _v2, 
 	float const* (&_attribPtrs)[3], 
-	DrawCall const& _call
+	DrawCall const& _call,
+	BinTriSource const& _source
 )
 {
 	uint32_t const height = _call.m_frameBuffer->m_height;
@@ -332,7 +607,7 @@ static void BinTransformedAndClippedTri
 
 	BinChunk::PlaneEq attribPlanes[Config::c_maxVaryings];
 
-	for (uint32_t i = 0; i < _call.m_attributeBuffer.m_stride / sizeof(float); ++i)
+	for (uint32_t i = 0; i < _call.NumVaryings(); ++i)
 	{
 		float const attrib_d10 = _attribPtrs[1][i] * invW[1] - _attribPtrs[0][i] * invW[0];
 		float const attrib_d20 = _attribPtrs[2][i] * invW[2] - _attribPtrs[0][i] * invW[0];
@@ -402,7 +677,14 @@ static void BinTransformedAndClippedTri
 			// todo full block
 			ThreadBin& bin = _ctx.LookupThreadBin(_threadIdx, binX, binY);
 
-			BinChunk& chunk = GetOrCreateBinForDrawCall(_alloc, _ctx, bin, _call);
+			BinChunk* chunkPtr = GetOrCreateBinForDrawCall(_alloc, _ctx, bin, _call, _source);
+
+			if (!chunkPtr)
+			{
+				return;
+			}
+
+			BinChunk& chunk = *chunkPtr;
 
 			KT_ASSERT(chunk.m_numTris < c_trisPerBinChunk);
 			uint32_t const chunkTriIdx = chunk.m_numTris++;
@@ -422,6 +704,8 @@ static void BinTransformedAndClippedTri
 			outEdge.blockMinY = uint8_t(kt::Clamp<int32_t>(int32_t(ymin) - int32_t(binScreenY0), 0, Config::c_binHeight));
 			outEdge.blockMaxY = uint8_t(kt::Clamp<int32_t>(int32_t(ymax) - int32_t(binScreenY0), 0, Config::c_binHeight));
 
+			bin.m_cost += c_binTriCost + (uint32_t(outEdge.blockMaxX - outEdge.blockMinX) * uint32_t(outEdge.blockMaxY - outEdge.blockMinY)) / 2;
+
 			// pre shift plane constants to tile top left
 			float const screenV0dx = (float)binScreenX0 - v0raster.x;
 			float const screenV0dy = (float)binScreenY0 - v0raster.y;
@@ -449,73 +733,377 @@ void BinContext::MicroprofileUpdateCounters()
 {
 }
 
-void BinTrisEntry(BinContext& _ctx, ThreadScratchAllocator& _alloc, uint32_t _threadIdx, uint32_t _triIdxBegin, uint32_t _triIdxEnd, DrawCall const& _drawCall)
+// Columns of the mvp, for transforming a batch of vertices without depending on the matrix layout.
+static void MvpColumns(DrawCall const& _drawCall, kt::Vec4 (&o_cols)[4])
+{
+	o_cols[0] = _drawCall.m_mvp * kt::Vec4(1.0f, 0.0f, 0.0f, 0.0f);
+	o_cols[1] = _drawCall.m_mvp * kt::Vec4(0.0f, 1.0f, 0.0f, 0.0f);
+	o_cols[2] = _drawCall.m_mvp * kt::Vec4(0.0f, 0.0f, 1.0f, 0.0f);
+	o_cols[3] = _drawCall.m_mvp * kt::Vec4(0.0f, 0.0f, 0.0f, 1.0f);
+}
+
+// _globalTriBase is the global index of the draw's first triangle.
+static void BinTris(BinContext& _ctx, ThreadScratchAllocator& _alloc, uint32_t _threadIdx, uint32_t _triIdxBegin, uint32_t _triIdxEnd, DrawCall const& _drawCall, kt::Vec4 const (&_mvpCols)[4], uint32_t _globalTriBase, uint32_t _spanBegin)
 {
-	for (uint32_t triIdx = _triIdxBegin; triIdx < _triIdxEnd; ++triIdx)
+	uint32_t const varyingBytes = _drawCall.NumVaryings() * sizeof(float);
+
+	TriBatch batch;
+
+	for (uint32_t batchBegin = _triIdxBegin; batchBegin < _triIdxEnd; batchBegin += c_triBatchSize)
 	{
-		KT_ASSERT(triIdx < _drawCall.m_indexBuffer.m_num);
+		if (SpanPastPassEnd(_ctx, _spanBegin))
+		{
+			return;
+		}
 
-		uint32_t indices[3];
-		kt::Vec4 vtx[3];
+		uint32_t const batchSize = kt::Min(c_triBatchSize, _triIdxEnd - batchBegin);
+		KT_ASSERT(batchBegin + batchSize <= _drawCall.m_indexBuffer.m_num);
 
-		FetchIndices(_drawCall, triIdx, indices);
-		FetchPositions(_drawCall, indices, vtx);
+		FetchTriBatch(_drawCall, _mvpCols, batchBegin, batchSize, batch);
 
-		vtx[0] = _drawCall.m_mvp * vtx[0];
-		vtx[1] = _drawCall.m_mvp * vtx[1];
-		vtx[2] = _drawCall.m_mvp * vtx[2];
+		for (uint32_t batchIdx = 0; batchIdx < batchSize; ++batchIdx)
+		{
+			BinTriSource const source = { _globalTriBase + batchBegin + batchIdx, _spanBegin };
 
-		uint32_t maskOr = 0;
+			kt::Vec4 vtx[3];
 
-		uint8_t clipv0 = ComputeClipMask(vtx[0]);
-		uint8_t clipv1 = ComputeClipMask(vtx[1]);
-		uint8_t clipv2 = ComputeClipMask(vtx[2]);
+			for (uint32_t corner = 0; corner < 3; ++corner)
+			{
+				vtx[corner] = kt::Vec4(batch.m_x[corner][batchIdx], batch.m_y[corner][batchIdx], batch.m_z[corner][batchIdx], batch.m_w[corner][batchIdx]);
+			}
 
-		maskOr = clipv0 | clipv1 | clipv2;
+			uint32_t const clipv0 = batch.m_clipMasks[0][batchIdx];
+			uint32_t const clipv1 = batch.m_clipMasks[1][batchIdx];
+			uint32_t const clipv2 = batch.m_clipMasks[2][batchIdx];
+
+			uint32_t maskOr = clipv0 | clipv1 | clipv2;
+
+			if (maskOr == 0)
+			{
+				float const* originalAttribs[3];
+				FetchAttribPointers(_drawCall, batch, batchIdx, originalAttribs);
+				BinTransformedAndClippedTri(_ctx, _alloc, _threadIdx, vtx[0], vtx[1], vtx[2], originalAttribs, _drawCall, source);
+				continue;
+			}
+			else if (clipv0 & clipv1 & clipv2)
+			{
+				// If clip AND mask has any bits set, all verts are the wrong side of a clip plane, so the whole triangle can be culled.
+				continue;
+			}
 
-		if (maskOr == 0)
-		{
 			float const* originalAttribs[3];
-			FetchAttribPointers(_drawCall, indices, originalAttribs);
-			BinTransformedAndClippedTri(_ctx, _alloc, _threadIdx, vtx[0], vtx[1], vtx[2], originalAttribs, _drawCall);
-			continue;
+			FetchAttribPointers(_drawCall, batch, batchIdx, originalAttribs);
+
+			ClipBuffer buf;
+
+			buf.numInputVerts = 3;
+			memcpy(buf.attribs[buf.inputIdx][0], originalAttribs[0], varyingBytes);
+			memcpy(buf.attribs[buf.inputIdx][1], originalAttribs[1], varyingBytes);
+			memcpy(buf.attribs[buf.inputIdx][2], originalAttribs[2], varyingBytes);
+			buf.verts[buf.inputIdx][0] = vtx[0];
+			buf.verts[buf.inputIdx][1] = vtx[1];
+			buf.verts[buf.inputIdx][2] = vtx[2];
+
+			{
+				do
+				{
+					uint32_t clipIdx = kt::Cnttz(maskOr);
+					maskOr ^= (1 << clipIdx);
+					ClipPlane(buf, clipIdx);
+				} while (maskOr && buf.numInputVerts);
+			}
+
+
+			// Fan triangulation
+			kt::Vec4(&input_vec)[CLIP_VERT_BUFFER_SIZE] = buf.verts[buf.inputIdx];
+			float(&input_attribs)[CLIP_VERT_BUFFER_SIZE][Config::c_maxVaryings] = buf.attribs[buf.inputIdx];
+			for (uint32_t i = 2; i < buf.numInputVerts; ++i)
+			{
+				float const* attribPtrs[3] = { input_attribs[0], input_attribs[i - 1], input_attribs[i] };
+				BinTransformedAndClippedTri(_ctx, _alloc, _threadIdx, input_vec[0], input_vec[i - 1], input_vec[i], attribPtrs, _drawCall, source);
+			}
 		}
-		else if (clipv0 & clipv1 & clipv2)
+	}
+}
+
+// Model space culling state of a draw call, derived from its mvp.
+struct MeshletCullState
+{
+	// Clip volume planes (-w <= x <= w, -w <= y <= w, 0 <= z <= w), normalized so the sphere test works in model units.
+	float m_planes[6][4];
+
+	// The model space eye position, where the projection's x, y and w rows are all zero.
+	float m_eye[3];
+
+	// 1 if the normals of front faces point away from the eye, -1 if towards it, depending on the handedness of the mvp.
+	// Zero if there is no eye position (orthographic), which disables cone culling.
+	float m_coneSign;
+};
+
+static void InitMeshletCullState(kt::Vec4 const (&_mvpCols)[4], MeshletCullState& o_state)
+{
+	// rows[i] dotted with (p, 1) is clip component i.
+	float rows[4][4];
+	for (uint32_t col = 0; col < 4; ++col)
+	{
+		rows[0][col] = _mvpCols[col].x;
+		rows[1][col] = _mvpCols[col].y;
+		rows[2][col] = _mvpCols[col].z;
+		rows[3][col] = _mvpCols[col].w;
+	}
+
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		o_state.m_planes[0][i] = rows[3][i] + rows[0][i];
+		o_state.m_planes[1][i] = rows[3][i] - rows[0][i];
+		o_state.m_planes[2][i] = rows[3][i] + rows[1][i];
+		o_state.m_planes[3][i] = rows[3][i] - rows[1][i];
+		o_state.m_planes[4][i] = rows[2][i];
+		o_state.m_planes[5][i] = rows[3][i] - rows[2][i];
+	}
+
+	for (float (&plane)[4] : o_state.m_planes)
+	{
+		float const len = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+
+		if (len > 0.0f)
 		{
-			// If clip AND mask has any bits set, all verts are the wrong side of a clip plane, so the whole triangle can be culled.
-			continue;
+			for (float& f : plane)
+			{
+				f /= len;
+			}
+		}
+		else
+		{
+			// e.g. the far plane of an infinite reverse z projection, nothing is outside it.
+			plane[0] = plane[1] = plane[2] = 0.0f;
+			plane[3] = 1.0f;
+		}
+	}
+
+	// Solve A * eye = -t, where A is the linear part of the x, y and w rows and t their translation. Cramer's rule: the inverse of A has
+	// the columns cross(a1, a2), cross(a2, a0) and cross(a0, a1) over det(A).
+	float const* a0 = rows[0];
+	float const* a1 = rows[1];
+	float const* a2 = rows[3];
+
+	float const c0[3] = { a1[1] * a2[2] - a1[2] * a2[1], a1[2] * a2[0] - a1[0] * a2[2], a1[0] * a2[1] - a1[1] * a2[0] };
+	float const c1[3] = { a2[1] * a0[2] - a2[2] * a0[1], a2[2] * a0[0] - a2[0] * a0[2], a2[0] * a0[1] - a2[1] * a0[0] };
+	float const c2[3] = { a0[1] * a1[2] - a0[2] * a1[1], a0[2] * a1[0] - a0[0] * a1[2], a0[0] * a1[1] - a0[1] * a1[0] };
+
+	float const det = a0[0] * c0[0] + a0[1] * c0[1] + a0[2] * c0[2];
+	float const scale = sqrtf(a0[0] * a0[0] + a0[1] * a0[1] + a0[2] * a0[2]) * sqrtf(a1[0] * a1[0] + a1[1] * a1[1] + a1[2] * a1[2]) * sqrtf(a2[0] * a2[0] + a2[1] * a2[1] + a2[2] * a2[2]);
+
+	if (fabsf(det) <= scale * 1e-6f)
+	{
+		o_state.m_eye[0] = o_state.m_eye[1] = o_state.m_eye[2] = 0.0f;
+		o_state.m_coneSign = 0.0f;
+		return;
+	}
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		o_state.m_eye[i] = -(a0[3] * c0[i] + a1[3] * c1[i] + a2[3] * c2[i]) / det;
+	}
+
+	// BinTransformedAndClippedTri keeps triangles that are counter clockwise in ndc. Those have cross(p1 - p0, p2 - p0) pointing
+	// away from the eye when det(A) is positive (e.g. w = view z, looking down +z), and towards it otherwise.
+	o_state.m_coneSign = det > 0.0f ? 1.0f : -1.0f;
+}
+
+static bool MeshletOutsideFrustum(MeshletCullState const& _state, Meshlet const& _meshlet)
+{
+	for (float const (&plane)[4] : _state.m_planes)
+	{
+		float const dist = plane[0] * _meshlet.m_center[0] + plane[1] * _meshlet.m_center[1] + plane[2] * _meshlet.m_center[2] + plane[3];
+		if (dist < -_meshlet.m_radius)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool MeshletBackFacing(MeshletCullState const& _state, Meshlet const& _meshlet)
+{
+	if (_state.m_coneSign == 0.0f || _meshlet.m_coneCutoff >= 1.0f)
+	{
+		return false;
+	}
+
+	float const toCenter[3] = { _meshlet.m_center[0] - _state.m_eye[0], _meshlet.m_center[1] - _state.m_eye[1], _meshlet.m_center[2] - _state.m_eye[2] };
+	float const dist = sqrtf(toCenter[0] * toCenter[0] + toCenter[1] * toCenter[1] + toCenter[2] * toCenter[2]);
+	float const dot = toCenter[0] * _meshlet.m_coneAxis[0] + toCenter[1] * _meshlet.m_coneAxis[1] + toCenter[2] * _meshlet.m_coneAxis[2];
+
+	// Back faces' normals point the opposite way to front faces', so flip the cone towards the eye where front faces point away from it.
+	return -_state.m_coneSign * dot >= _meshlet.m_coneCutoff * dist + _meshlet.m_radius;
+}
+
+// Whether the meshlet's bounding box is behind the farthest depth of every tile it covers in _plane.
+static bool MeshletOccluded(kt::Vec4 const (&_mvpCols)[4], Meshlet const& _meshlet, FrameBufferPlane const& _plane)
+{
+	float ndcMin[2] = { FLT_MAX, FLT_MAX };
+	float ndcMax[2] = { -FLT_MAX, -FLT_MAX };
+
+#if SR_USE_REVERSE_Z
+	float nearestDepth = -FLT_MAX;
+#else
+	float nearestDepth = FLT_MAX;
+#endif
+
+	for (uint32_t corner = 0; corner < 8; ++corner)
+	{
+		float const x = _meshlet.m_center[0] + ((corner & 1) ? _meshlet.m_radius : -_meshlet.m_radius);
+		float const y = _meshlet.m_center[1] + ((corner & 2) ? _meshlet.m_radius : -_meshlet.m_radius);
+		float const z = _meshlet.m_center[2] + ((corner & 4) ? _meshlet.m_radius : -_meshlet.m_radius);
+
+		kt::Vec4 const clip = _mvpCols[0] * x + _mvpCols[1] * y + _mvpCols[2] * z + _mvpCols[3];
+
+		if (clip.w <= 0.0f)
+		{
+			// Reaches behind the eye, the projected bounds are unbounded.
+			return false;
 		}
 
-		float const* originalAttribs[3];
-		FetchAttribPointers(_drawCall, indices, originalAttribs);
+		float const invW = 1.0f / clip.w;
+		ndcMin[0] = kt::Min(ndcMin[0], clip.x * invW);
+		ndcMin[1] = kt::Min(ndcMin[1], clip.y * invW);
+		ndcMax[0] = kt::Max(ndcMax[0], clip.x * invW);
+		ndcMax[1] = kt::Max(ndcMax[1], clip.y * invW);
+
+#if SR_USE_REVERSE_Z
+		nearestDepth = kt::Max(nearestDepth, clip.z * invW);
+#else
+		nearestDepth = kt::Min(nearestDepth, clip.z * invW);
+#endif
+	}
 
-		ClipBuffer buf;
+	// Same viewport transform as BinTransformedAndClippedTri, y is flipped.
+	float const halfWidth = float(_plane.m_width) * 0.5f;
+	float const halfHeight = float(_plane.m_height) * 0.5f;
 
-		buf.numInputVerts = 3;
-		memcpy(buf.attribs[buf.inputIdx][0], originalAttribs[0], _drawCall.m_attributeBuffer.m_stride);
-		memcpy(buf.attribs[buf.inputIdx][1], originalAttribs[1], _drawCall.m_attributeBuffer.m_stride);
-		memcpy(buf.attribs[buf.inputIdx][2], originalAttribs[2], _drawCall.m_attributeBuffer.m_stride);
-		buf.verts[buf.inputIdx][0] = vtx[0];
-		buf.verts[buf.inputIdx][1] = vtx[1];
-		buf.verts[buf.inputIdx][2] = vtx[2];
+	int32_t const xmin = kt::Clamp(int32_t(ndcMin[0] * halfWidth + halfWidth), 0, int32_t(_plane.m_width) - 1);
+	int32_t const xmax = kt::Clamp(int32_t(ndcMax[0] * halfWidth + halfWidth), 0, int32_t(_plane.m_width) - 1);
+	int32_t const ymin = kt::Clamp(int32_t(ndcMax[1] * -halfHeight + halfHeight), 0, int32_t(_plane.m_height) - 1);
+	int32_t const ymax = kt::Clamp(int32_t(ndcMin[1] * -halfHeight + halfHeight), 0, int32_t(_plane.m_height) - 1);
 
+	// Test against the depth range of each tile quadrant the bounds touch.
+	for (uint32_t cellY = uint32_t(ymin) >> (Config::c_binHeightLog2 - 1); cellY <= (uint32_t(ymax) >> (Config::c_binHeightLog2 - 1)); ++cellY)
+	{
+		for (uint32_t cellX = uint32_t(xmin) >> (Config::c_binWidthLog2 - 1); cellX <= (uint32_t(xmax) >> (Config::c_binWidthLog2 - 1)); ++cellX)
 		{
-			do
+			DepthTile const& tile = _plane.m_depthTiles[(cellY >> 1) * _plane.m_tilesX + (cellX >> 1)];
+			uint32_t const quadrant = (cellY & 1) * 2 + (cellX & 1);
+
+#if SR_USE_REVERSE_Z
+			if (nearestDepth >= tile.m_hiZmin[quadrant])
+#else
+			if (nearestDepth <= tile.m_hiZmax[quadrant])
+#endif
 			{
-				uint32_t clipIdx = kt::Cnttz(maskOr);
-				maskOr ^= (1 << clipIdx);
-				ClipPlane(buf, clipIdx);
-			} while (maskOr && buf.numInputVerts);
+				return false;
+			}
 		}
+	}
+
+	return true;
+}
 
+// Cull and bin the draw's meshlets whose first triangle is in [_triIdxBegin, _triIdxEnd), so each meshlet belongs to exactly one span.
+static void BinMeshlets(BinContext& _ctx, ThreadScratchAllocator& _alloc, uint32_t _threadIdx, uint32_t _triIdxBegin, uint32_t _triIdxEnd, DrawCall const& _drawCall, kt::Vec4 const (&_mvpCols)[4], uint32_t _globalTriBase, uint32_t _spanBegin)
+{
+	MeshletCullState cullState;
+	InitMeshletCullState(_mvpCols, cullState);
+
+	// Meshlets are consecutive runs of triangles, find the first starting in range.
+	uint32_t meshletIdx = 0;
+	uint32_t count = _drawCall.m_numMeshlets;
+
+	while (count)
+	{
+		uint32_t const half = count / 2;
+		if (_drawCall.m_meshlets[meshletIdx + half].m_firstTri < _triIdxBegin)
+		{
+			meshletIdx += half + 1;
+			count -= half + 1;
+		}
+		else
+		{
+			count = half;
+		}
+	}
 
-		// Fan triangulation
-		kt::Vec4(&input_vec)[CLIP_VERT_BUFFER_SIZE] = buf.verts[buf.inputIdx];
-		float(&input_attribs)[CLIP_VERT_BUFFER_SIZE][Config::c_maxVaryings] = buf.attribs[buf.inputIdx];
-		for (uint32_t i = 2; i < buf.numInputVerts; ++i)
+	for (; meshletIdx < _drawCall.m_numMeshlets && _drawCall.m_meshlets[meshletIdx].m_firstTri < _triIdxEnd; ++meshletIdx)
+	{
+		Meshlet const& meshlet = _drawCall.m_meshlets[meshletIdx];
+
+		if (SpanPastPassEnd(_ctx, _spanBegin))
+		{
+			return;
+		}
+
+		if (MeshletOutsideFrustum(cullState, meshlet)
+			|| MeshletBackFacing(cullState, meshlet)
+			|| (_drawCall.m_occlusionPlane && MeshletOccluded(_mvpCols, meshlet, *_drawCall.m_occlusionPlane)))
+		{
+			continue;
+		}
+
+		KT_ASSERT((meshlet.m_firstTri + meshlet.m_numTris) * 3 <= _drawCall.m_indexBuffer.m_num);
+		BinTris(_ctx, _alloc, _threadIdx, meshlet.m_firstTri, meshlet.m_firstTri + meshlet.m_numTris, _drawCall, _mvpCols, _globalTriBase, _spanBegin);
+	}
+}
+
+void BinTrisEntry(BinContext& _ctx, ThreadScratchAllocator& _alloc, uint32_t _threadIdx, FrontEndDraw const* _draws, uint32_t _numDraws, uint32_t _globalTriBegin, uint32_t _globalTriEnd)
+{
+	KT_ASSERT(_numDraws && _draws[0].m_globalTriBegin <= _globalTriBegin);
+
+	// Last draw starting at or before the span.
+	uint32_t drawIdx = 0;
+	uint32_t count = _numDraws;
+
+	while (count)
+	{
+		uint32_t const half = count / 2;
+		if (_draws[drawIdx + half].m_globalTriBegin <= _globalTriBegin)
+		{
+			drawIdx += half + 1;
+			count -= half + 1;
+		}
+		else
+		{
+			count = half;
+		}
+	}
+
+	--drawIdx;
+
+	// Switch draw state at each draw boundary inside the span.
+	for (; drawIdx < _numDraws && _draws[drawIdx].m_globalTriBegin < _globalTriEnd; ++drawIdx)
+	{
+		FrontEndDraw const& draw = _draws[drawIdx];
+		DrawCall const& call = *draw.m_call;
+
+		uint32_t const numTris = call.m_indexBuffer.m_num / 3;
+		uint32_t const triBegin = _globalTriBegin > draw.m_globalTriBegin ? _globalTriBegin - draw.m_globalTriBegin : 0;
+		uint32_t const triEnd = kt::Min(numTris, _globalTriEnd - draw.m_globalTriBegin);
+
+		if (triBegin >= triEnd)
+		{
+			continue;
+		}
+
+		kt::Vec4 mvpCols[4];
+		MvpColumns(call, mvpCols);
+
+		if (call.m_numMeshlets)
+		{
+			BinMeshlets(_ctx, _alloc, _threadIdx, triBegin, triEnd, call, mvpCols, draw.m_globalTriBegin, _globalTriBegin);
+		}
+		else
 		{
-			float const* attribPtrs[3] = { input_attribs[0], input_attribs[i - 1], input_attribs[i] };
-			BinTransformedAndClippedTri(_ctx, _alloc, _threadIdx, input_vec[0], input_vec[i - 1], input_vec[i], attribPtrs, _drawCall);
+			BinTris(_ctx, _alloc, _threadIdx, triBegin, triEnd, call, mvpCols, draw.m_globalTriBegin, _globalTriBegin);
 		}
 	}
 }
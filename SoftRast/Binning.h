@@ -15,6 +15,24 @@ struct DrawCall;
 static uint32_t const c_trisPerBinChunk = 32;
 static uint32_t const c_maxThreadBinChunks = 4096;
 
+// The front end splits the frame's triangles into about this many spans per thread.
+static uint32_t const c_frontEndSpansPerThread = 4;
+
+// Smallest front end span, below this the packet overhead outweighs the binning.
+static uint32_t const c_minFrontEndSpanTris = 512;
+
+// Most triangles clipping can turn one triangle into, one more per clip plane.
+static uint32_t const c_maxTrisPerClippedTri = 1 + 6;
+
+// Largest front end span. The first span of a bin pass must fit in empty bins, as nothing could be flushed to make room for it.
+// At worst every triangle of the span is from a different draw and starts a chunk in the same bin, and its clipped triangles fill chunks on top of that.
+static uint32_t const c_maxFrontEndSpanTris = c_maxThreadBinChunks * c_trisPerBinChunk / (c_trisPerBinChunk + c_maxTrisPerClippedTri);
+
+static_assert(c_minFrontEndSpanTris <= c_maxFrontEndSpanTris, "Bins hold less than the smallest front end span.");
+
+// Estimated raster cost of setting up a binned triangle, in the same units as a pixel of its bounds.
+static uint32_t const c_binTriCost = 32;
+
 struct BinChunk
 {
 	struct EdgeEq
@@ -52,6 +70,13 @@ struct BinChunk
 
 	// Todo: Should change the chunk behaviour so we don't have one draw call per chunk (lots of padding/wastage)
 	uint32_t m_drawCallIdx;
+
+	// Global index (see FrontEndDraw) of the first triangle binned to the chunk. Chunks only hold triangles of one span, in order,
+	// so sorting a bin's chunks by this gives submission order however the spans were spread over threads.
+	uint32_t m_sortKey;
+
+	// Global begin of the span that filled the chunk.
+	uint32_t m_spanBegin;
 };
 
 struct ThreadBin
@@ -59,11 +84,15 @@ struct ThreadBin
 	void Reset()
 	{
 		m_numChunks = 0;
+		m_cost = 0;
 	}
 
 	BinChunk* m_binChunks[c_maxThreadBinChunks];
 
 	uint32_t m_numChunks = 0;
+
+	// Estimated raster cost, c_binTriCost per triangle plus half its bounding box area inside the bin.
+	uint32_t m_cost = 0;
 };
 
 struct BinContext
@@ -81,8 +110,24 @@ struct BinContext
 	uint32_t m_numBinsX = 0;
 	uint32_t m_numBinsY = 0;
 	uint32_t m_numThreads = 0;
+
+	// A bin pass bins the global triangles from m_passBegin on, one span at a time in order, until a thread runs out of bin memory.
+	// That thread lowers m_passEnd to the start of its span, and the pass rasterizes only the spans before it (see BinTrisEntry).
+	uint32_t m_passBegin = 0;
+	std::atomic<uint32_t> m_passEnd{ UINT32_MAX };
+};
+
+// A draw's place in the frame's global triangle range, which is every unculled draw's triangles back to back in submission order.
+struct FrontEndDraw
+{
+	DrawCall const* m_call;
+	uint32_t m_globalTriBegin;
 };
 
-void BinTrisEntry(BinContext& _ctx, ThreadScratchAllocator& _alloc, uint32_t _threadIdx, uint32_t _triIdxBegin, uint32_t _triIdxEnd, DrawCall const& _drawCall);
+// Bin the global triangles [_globalTriBegin, _globalTriEnd), which may cover several draws. _draws are in global order.
+// Meshlet draws cull and bin the meshlets whose first triangle is in the range.
+// If the thread's bins fill up or its bin memory passes Config::c_binMemoryPerThread, the pass is ended before the span and the rest of it is dropped.
+// Spans must be binned in order by each thread so that everything left in its bins is before the pass end.
+void BinTrisEntry(BinContext& _ctx, ThreadScratchAllocator& _alloc, uint32_t _threadIdx, FrontEndDraw const* _draws, uint32_t _numDraws, uint32_t _globalTriBegin, uint32_t _globalTriEnd);
 
 }
\ No newline at end of file
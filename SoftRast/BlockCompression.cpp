@@ -0,0 +1,230 @@
+#include <string.h>
+
+#include <kt/kt.h>
+
+#include "BlockCompression.h"
+
+// Simple min/max endpoint BC1/BC3 encoders. Quality is below offline encoders but fast enough to run when building the model cache.
+// Palette interpolation matches the sampler decode exactly (see DecodeBC1Texels/DecodeBC3Alpha in Texture.cpp).
+
+namespace sr
+{
+
+namespace Tex
+{
+
+static uint16_t PackRGB565(uint8_t const _rgb[3])
+{
+	return uint16_t(((_rgb[0] >> 3) << 11) | ((_rgb[1] >> 2) << 5) | (_rgb[2] >> 3));
+}
+
+static void UnpackRGB565(uint16_t _c, uint8_t o_rgb[3])
+{
+	uint32_t const r = (_c >> 11) & 0x1F;
+	uint32_t const g = (_c >> 5) & 0x3F;
+	uint32_t const b = _c & 0x1F;
+	o_rgb[0] = uint8_t((r << 3) | (r >> 2));
+	o_rgb[1] = uint8_t((g << 2) | (g >> 4));
+	o_rgb[2] = uint8_t((b << 3) | (b >> 2));
+}
+
+// Weights are in sixths so both 3 and 4 colour modes share the same divide: (x * 10923) >> 16 == x / 6 for x <= 1530.
+static uint8_t InterpolateSixths(uint32_t _a, uint32_t _b, uint32_t _wa, uint32_t _wb)
+{
+	return uint8_t(((_a * _wa + _b * _wb) * 10923) >> 16);
+}
+
+static void DecodeBC1Palette(uint16_t _c0, uint16_t _c1, bool _forceFourColour, uint8_t o_palette[4][4])
+{
+	uint8_t rgb0[3];
+	uint8_t rgb1[3];
+	UnpackRGB565(_c0, rgb0);
+	UnpackRGB565(_c1, rgb1);
+
+	bool const fourColour = _forceFourColour || _c0 > _c1;
+
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		o_palette[0][i] = rgb0[i];
+		o_palette[1][i] = rgb1[i];
+
+		if (fourColour)
+		{
+			o_palette[2][i] = InterpolateSixths(rgb0[i], rgb1[i], 4, 2);
+			o_palette[3][i] = InterpolateSixths(rgb0[i], rgb1[i], 2, 4);
+		}
+		else
+		{
+			o_palette[2][i] = InterpolateSixths(rgb0[i], rgb1[i], 3, 3);
+			o_palette[3][i] = 0;
+		}
+	}
+
+	o_palette[0][3] = 255;
+	o_palette[1][3] = 255;
+	o_palette[2][3] = 255;
+	o_palette[3][3] = fourColour ? 255 : 0;
+}
+
+static uint32_t ColourDistSq(uint8_t const* _a, uint8_t const* _b)
+{
+	int32_t const dr = int32_t(_a[0]) - int32_t(_b[0]);
+	int32_t const dg = int32_t(_a[1]) - int32_t(_b[1]);
+	int32_t const db = int32_t(_a[2]) - int32_t(_b[2]);
+	return uint32_t(dr * dr + dg * dg + db * db);
+}
+
+static void EncodeColourBlock(uint8_t const (&_texels)[c_bcBlockTexels][4], bool _allowTransparent, uint8_t* o_block)
+{
+	uint8_t minCol[3] = { 255, 255, 255 };
+	uint8_t maxCol[3] = { 0, 0, 0 };
+
+	bool anyTransparent = false;
+
+	for (uint32_t texelIdx = 0; texelIdx < c_bcBlockTexels; ++texelIdx)
+	{
+		if (_allowTransparent && _texels[texelIdx][3] < 128)
+		{
+			anyTransparent = true;
+			continue;
+		}
+
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			minCol[i] = kt::Min(minCol[i], _texels[texelIdx][i]);
+			maxCol[i] = kt::Max(maxCol[i], _texels[texelIdx][i]);
+		}
+	}
+
+	// Inset the bounding box slightly, reduces error for the interpolated colours.
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		if (minCol[i] > maxCol[i])
+		{
+			// Fully transparent block.
+			minCol[i] = maxCol[i] = 0;
+		}
+
+		uint8_t const inset = uint8_t((maxCol[i] - minCol[i]) >> 4);
+		minCol[i] += inset;
+		maxCol[i] -= inset;
+	}
+
+	uint16_t c0 = PackRGB565(maxCol);
+	uint16_t c1 = PackRGB565(minCol);
+
+	if (anyTransparent)
+	{
+		// 3 colour mode requires c0 <= c1.
+		if (c0 > c1)
+		{
+			kt::Swap(c0, c1);
+		}
+	}
+	else if (c0 < c1)
+	{
+		kt::Swap(c0, c1);
+	}
+
+	uint8_t palette[4][4];
+	DecodeBC1Palette(c0, c1, false, palette);
+
+	// If c0 == c1 we get 3 colour mode, so only consider the opaque entries.
+	uint32_t const numOpaqueEntries = c0 > c1 ? 4 : 3;
+
+	uint32_t indices = 0;
+
+	for (uint32_t texelIdx = 0; texelIdx < c_bcBlockTexels; ++texelIdx)
+	{
+		uint32_t bestIdx = 0;
+
+		if (anyTransparent && _texels[texelIdx][3] < 128)
+		{
+			bestIdx = 3;
+		}
+		else
+		{
+			uint32_t bestDist = UINT32_MAX;
+			for (uint32_t paletteIdx = 0; paletteIdx < numOpaqueEntries; ++paletteIdx)
+			{
+				uint32_t const dist = ColourDistSq(_texels[texelIdx], palette[paletteIdx]);
+				if (dist < bestDist)
+				{
+					bestDist = dist;
+					bestIdx = paletteIdx;
+				}
+			}
+		}
+
+		indices |= bestIdx << (texelIdx * 2);
+	}
+
+	memcpy(o_block, &c0, sizeof(uint16_t));
+	memcpy(o_block + 2, &c1, sizeof(uint16_t));
+	memcpy(o_block + 4, &indices, sizeof(uint32_t));
+}
+
+static void EncodeAlphaBlock(uint8_t const (&_texels)[c_bcBlockTexels][4], uint8_t* o_block)
+{
+	uint8_t a0 = 0;
+	uint8_t a1 = 255;
+
+	for (uint32_t texelIdx = 0; texelIdx < c_bcBlockTexels; ++texelIdx)
+	{
+		a0 = kt::Max(a0, _texels[texelIdx][3]);
+		a1 = kt::Min(a1, _texels[texelIdx][3]);
+	}
+
+	// a0 > a1 selects 8 alpha mode: a0, a1 + 6 interpolated values in sevenths.
+	uint8_t palette[8];
+	palette[0] = a0;
+	palette[1] = a1;
+	for (uint32_t i = 2; i < 8; ++i)
+	{
+		palette[i] = uint8_t(((8 - i) * a0 + (i - 1) * a1 + 3) / 7);
+	}
+
+	uint64_t indices = 0;
+
+	if (a0 != a1)
+	{
+		for (uint32_t texelIdx = 0; texelIdx < c_bcBlockTexels; ++texelIdx)
+		{
+			uint32_t bestIdx = 0;
+			uint32_t bestDist = UINT32_MAX;
+			for (uint32_t paletteIdx = 0; paletteIdx < 8; ++paletteIdx)
+			{
+				int32_t const d = int32_t(palette[paletteIdx]) - int32_t(_texels[texelIdx][3]);
+				uint32_t const dist = uint32_t(d * d);
+				if (dist < bestDist)
+				{
+					bestDist = dist;
+					bestIdx = paletteIdx;
+				}
+			}
+			indices |= uint64_t(bestIdx) << (texelIdx * 3);
+		}
+	}
+
+	o_block[0] = a0;
+	o_block[1] = a1;
+	for (uint32_t i = 0; i < 6; ++i)
+	{
+		o_block[2 + i] = uint8_t(indices >> (i * 8));
+	}
+}
+
+void EncodeBC1Block(uint8_t const (&_texels)[c_bcBlockTexels][4], uint8_t* o_block)
+{
+	EncodeColourBlock(_texels, true, o_block);
+}
+
+void EncodeBC3Block(uint8_t const (&_texels)[c_bcBlockTexels][4], uint8_t* o_block)
+{
+	EncodeAlphaBlock(_texels, o_block);
+	EncodeColourBlock(_texels, false, o_block + 8);
+}
+
+}
+
+}
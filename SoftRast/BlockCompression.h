@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+
+namespace sr
+{
+
+namespace Tex
+{
+
+static uint32_t const c_bcBlockDimLog2 = 2;
+static uint32_t const c_bcBlockDim = 1 << c_bcBlockDimLog2;
+static uint32_t const c_bcBlockTexels = c_bcBlockDim * c_bcBlockDim;
+
+static uint32_t const c_bc1BlockBytes = 8;
+static uint32_t const c_bc3BlockBytes = 16;
+
+// Encode a 4x4 block of RGBA8 texels (row major). 
+// BC1 switches to 3 colour + transparent mode if any texel has alpha < 128.
+void EncodeBC1Block(uint8_t const (&_texels)[c_bcBlockTexels][4], uint8_t* o_block);
+void EncodeBC3Block(uint8_t const (&_texels)[c_bcBlockTexels][4], uint8_t* o_block);
+
+}
+
+}
@@ -5,6 +5,12 @@
 
 #define SR_DEBUG_SINGLE_THREADED (0)
 
+// Store textures in c_texTileSize^2 tiles with morton order inside tiles. Required for virtual textures.
+#define SR_TILE_TEXTURES (1)
+
+// Back thread scratch arenas with large pages when the process can get the "Lock pages in memory" privilege.
+#define SR_SCRATCH_LARGE_PAGES (1)
+
 namespace sr
 {
 
@@ -28,6 +34,31 @@ constexpr uint32_t c_maxVaryings = 8;
 
 constexpr uint32_t c_maxTexDimLog2 = 14; // 16k
 
+// Approximate number of texels generated per task when building mip chains.
+constexpr uint32_t c_mipGenTexelsPerTask = 64 * 1024;
+
+// Resident page memory of virtual textures, per texture format.
+constexpr uint32_t c_vtPoolBytesPerFormat = 64 * 1024 * 1024;
+
+// Max virtual texture pages queued for loading per frame.
+constexpr uint32_t c_vtMaxPageLoadsPerFrame = 256;
+
+// Per frame memory for draw call uniform blocks and the frame's task data, reset in BeginFrame.
+constexpr uint32_t c_frameMemSize = 4 * 1024 * 1024;
+
+// Tiles estimated to cost more than this fraction of a thread's share of the frame are rasterized as 4 quadrant tasks. 0 disables splitting.
+constexpr float c_tileSplitCostFraction = 0.5f;
+
+// Address space reserved for each block of a thread's scratch arena, committed c_scratchCommitSize at a time as it is used.
+constexpr uint32_t c_scratchReserveSize = 1024 * 1024 * 1024;
+constexpr uint32_t c_scratchCommitSize = 2 * 1024 * 1024;
+
+// Scratch arena blocks are this size when backed by large pages, which are committed up front.
+constexpr uint32_t c_scratchLargePageBlockSize = 32 * 1024 * 1024;
+
+// Scratch memory each thread may fill with binned triangles before the frame is rasterized so far and binning starts over from where it stopped.
+constexpr uint32_t c_binMemoryPerThread = 256 * 1024 * 1024;
+
 
 #if SR_USE_REVERSE_Z
 constexpr float c_depthMin = 1.0f;
@@ -6,6 +6,8 @@
 namespace sr
 {
 
+// Chunks a fragment buffer can index, see Frag::chunkIdx.
+static uint32_t const c_maxFragmentBufferChunks = 1 << 16;
 
 struct FragmentBuffer
 {
@@ -27,12 +29,11 @@ struct FragmentBuffer
 
 	ThreadScratchAllocator* m_allocator = nullptr;
 
+	// Fragments are kept contiguous at the top of the thread's arena, moved to a new block if they outgrow the current one.
 	void ReserveFragments(uint32_t _count)
 	{
 		KT_ASSERT(m_fragments);
-		void* p = m_allocator->Alloc(sizeof(Frag) * _count, 1);
-		KT_ASSERT(p);
-		KT_UNUSED(p);
+		m_fragments = (Frag*)m_allocator->GrowTop(m_fragments, sizeof(Frag) * m_numFragments, sizeof(Frag) * _count);
 	}
 
 	void AllocInterpolants(ThreadScratchAllocator& _alloc)
@@ -184,7 +185,8 @@ static uint64_t ComputeBlockMask8x8
 	return mask8x8;
 }
 
-static void RasterizeTrisInBin_OutputFragments(DrawCall const& _call, DepthTile* _depth, BinChunk const& _chunk, uint32_t _chunkIdx, FragmentBuffer& o_buffer)
+// Only blocks inside [_rectMin, _rectMax) (tile relative, multiples of 8) are rasterized.
+static void RasterizeTrisInBin_OutputFragments(DrawCall const& _call, DepthTile* _depth, BinChunk const& _chunk, uint32_t _chunkIdx, uint32_t const (&_rectMin)[2], uint32_t const (&_rectMax)[2], FragmentBuffer& o_buffer)
 {
 	__m256i const rampi = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
 	__m256 const rampf = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
@@ -193,11 +195,16 @@ static void RasterizeTrisInBin_OutputFragments(DrawCall const& _call, DepthTile*
 	{
 		BinChunk::EdgeEq const& edges = _chunk.m_edgeEq[triIdx];
 
-		uint32_t const xBlockBegin = edges.blockMinX & ~7;
-		uint32_t const yBlockBegin = edges.blockMinY & ~7;
+		uint32_t const xBlockBegin = kt::Max<uint32_t>(edges.blockMinX & ~7, _rectMin[0]);
+		uint32_t const yBlockBegin = kt::Max<uint32_t>(edges.blockMinY & ~7, _rectMin[1]);
 
-		uint32_t const xBlockEnd = edges.blockMaxX;
-		uint32_t const yBlockEnd = edges.blockMaxY;
+		uint32_t const xBlockEnd = kt::Min<uint32_t>(edges.blockMaxX, _rectMax[0]);
+		uint32_t const yBlockEnd = kt::Min<uint32_t>(edges.blockMaxY, _rectMax[1]);
+
+		if (xBlockBegin >= xBlockEnd || yBlockBegin >= yBlockEnd)
+		{
+			continue;
+		}
 
 		EdgeEquations8x8 blockEdgesSimd;
 
@@ -512,23 +519,80 @@ static void ShadeFragmentBuffer(ThreadRasterCtx const& _ctx, uint32_t const _til
 	KT_ASSERT(globalFragIdx == _buffer.m_numFragments);
 }
 
+// Depth range of the tile, for occlusion culling meshlets against it (see DrawCall::SetOcclusionCulling).
+static void UpdateHiZ(DepthTile& _tile, uint32_t _quadrant)
+{
+	uint32_t const quadWidth = Config::c_binWidth / 2;
+	uint32_t const quadHeight = Config::c_binHeight / 2;
+
+	float const* row = _tile.m_depth + (_quadrant >> 1) * quadHeight * Config::c_binWidth + (_quadrant & 1) * quadWidth;
+
+	__m256 minDepth = _mm256_load_ps(row);
+	__m256 maxDepth = minDepth;
+
+	for (uint32_t y = 0; y < quadHeight; ++y, row += Config::c_binWidth)
+	{
+		for (uint32_t x = 0; x < quadWidth; x += 8)
+		{
+			__m256 const depth = _mm256_load_ps(row + x);
+			minDepth = _mm256_min_ps(minDepth, depth);
+			maxDepth = _mm256_max_ps(maxDepth, depth);
+		}
+	}
+
+	KT_ALIGNAS(32) float mins[8];
+	KT_ALIGNAS(32) float maxs[8];
+	_mm256_store_ps(mins, minDepth);
+	_mm256_store_ps(maxs, maxDepth);
+
+	float hiZmin = mins[0];
+	float hiZmax = maxs[0];
+
+	for (uint32_t i = 1; i < 8; ++i)
+	{
+		hiZmin = kt::Min(hiZmin, mins[i]);
+		hiZmax = kt::Max(hiZmax, maxs[i]);
+	}
+
+	_tile.m_hiZmin[_quadrant] = hiZmin;
+	_tile.m_hiZmax[_quadrant] = hiZmax;
+}
+
 void RasterAndShadeBin(ThreadRasterCtx const& _ctx)
 {
-	ThreadScratchAllocator& threadAllocator = _ctx.m_ctx->ThreadAllocator();
+	ThreadScratchAllocator& threadAllocator = _ctx.m_ctx->ThreadAllocator(_ctx.m_scratchSet);
 	ThreadScratchAllocator::AllocScope const allocScope(threadAllocator);
 
 	// sort draw calls
+	uint32_t maxChunks = 0;
+
+	for (uint32_t threadBinIdx = 0; threadBinIdx < _ctx.m_binner->m_numThreads; ++threadBinIdx)
+	{
+		maxChunks += _ctx.m_binner->LookupThreadBin(threadBinIdx, _ctx.m_tileX, _ctx.m_tileY).m_numChunks;
+	}
+
+	if (!maxChunks)
+	{
+		return;
+	}
+
+	BinChunk** sortedChunks = (BinChunk**)threadAllocator.Alloc(maxChunks * sizeof(BinChunk*), KT_ALIGNOF(BinChunk*));
 	uint32_t numChunks = 0;
 
-	BinChunk** sortedChunks = (BinChunk**)threadAllocator.Align(KT_ALIGNOF(BinChunk*));
+	// Spans from the pass end on ran out of bin memory and are binned again by the next pass.
+	uint32_t const passEnd = std::atomic_load_explicit(&_ctx.m_binner->m_passEnd, std::memory_order_relaxed);
 
 	// gather draw calls from all threads
 	for (uint32_t threadBinIdx = 0; threadBinIdx < _ctx.m_binner->m_numThreads; ++threadBinIdx)
 	{
 		ThreadBin& bin = _ctx.m_binner->LookupThreadBin(threadBinIdx, _ctx.m_tileX, _ctx.m_tileY);
-		threadAllocator.Alloc(bin.m_numChunks * sizeof(BinChunk*));
-		memcpy(sortedChunks + numChunks, bin.m_binChunks, bin.m_numChunks * sizeof(BinChunk*));
-		numChunks += bin.m_numChunks;
+		for (uint32_t i = 0; i < bin.m_numChunks; ++i)
+		{
+			if (bin.m_binChunks[i]->m_spanBegin < passEnd)
+			{
+				sortedChunks[numChunks++] = bin.m_binChunks[i];
+			}
+		}
 	}
 
 	if (!numChunks)
@@ -536,30 +600,72 @@ void RasterAndShadeBin(ThreadRasterCtx const& _ctx)
 		return;
 	}
 
-	BinChunk** radixTemp = (BinChunk**)KT_ALLOCA(sizeof(BinChunk**) * numChunks);
+	BinChunk** radixTemp = (BinChunk**)threadAllocator.Alloc(sizeof(BinChunk*) * numChunks, KT_ALIGNOF(BinChunk*));
 
-	kt::RadixSort(sortedChunks, sortedChunks + numChunks, radixTemp, [](BinChunk const* _c) { return _c->m_drawCallIdx; });
+	kt::RadixSort(sortedChunks, sortedChunks + numChunks, radixTemp, [](BinChunk const* _c) { return _c->m_sortKey; });
 
 	uint32_t const tileIdx = _ctx.m_tileY * _ctx.m_binner->m_numBinsX + _ctx.m_tileX;
 
-	FragmentBuffer buffer;
-	buffer.m_fragments = (FragmentBuffer::Frag*)threadAllocator.Align(KT_ALIGNOF(FragmentBuffer::Frag));
-	buffer.m_allocator = &threadAllocator;
-	KT_ASSERT(buffer.m_fragments);
+	uint32_t rectMin[2] = { 0, 0 };
+	uint32_t rectMax[2] = { Config::c_binWidth, Config::c_binHeight };
+	uint32_t quadrantBegin = 0;
+	uint32_t quadrantEnd = 4;
 
+	if (_ctx.m_quadrant != ThreadRasterCtx::c_wholeTile)
 	{
-		//MICROPROFILE_SCOPE(RasterFragments);
-		for (uint32_t chunkIdx = 0; chunkIdx < numChunks; ++chunkIdx)
+		KT_ASSERT(_ctx.m_quadrant < 4);
+		rectMin[0] = (_ctx.m_quadrant & 1) * (Config::c_binWidth / 2);
+		rectMin[1] = (_ctx.m_quadrant >> 1) * (Config::c_binHeight / 2);
+		rectMax[0] = rectMin[0] + Config::c_binWidth / 2;
+		rectMax[1] = rectMin[1] + Config::c_binHeight / 2;
+		quadrantBegin = _ctx.m_quadrant;
+		quadrantEnd = _ctx.m_quadrant + 1;
+	}
+
+	// Fragments only have 16 bits of chunk index, so a tile with more chunks is rasterized and shaded a group of chunks at a time, in order.
+	for (uint32_t groupBegin = 0; groupBegin < numChunks; groupBegin += c_maxFragmentBufferChunks)
+	{
+		ThreadScratchAllocator::AllocScope const groupAllocScope(threadAllocator);
+
+		BinChunk** groupChunks = sortedChunks + groupBegin;
+		uint32_t const groupSize = kt::Min(c_maxFragmentBufferChunks, numChunks - groupBegin);
+
+		FragmentBuffer buffer;
+		buffer.m_fragments = (FragmentBuffer::Frag*)threadAllocator.Align(KT_ALIGNOF(FragmentBuffer::Frag));
+		buffer.m_allocator = &threadAllocator;
+		KT_ASSERT(buffer.m_fragments);
+
 		{
-			BinChunk& curChunk = *sortedChunks[chunkIdx];
-			DrawCall const& call = _ctx.m_drawCalls[curChunk.m_drawCallIdx];
-			RasterizeTrisInBin_OutputFragments(call, &call.m_frameBuffer->m_depthTiles[tileIdx], curChunk, chunkIdx, buffer);
+			//MICROPROFILE_SCOPE(RasterFragments);
+			for (uint32_t chunkIdx = 0; chunkIdx < groupSize; ++chunkIdx)
+			{
+				BinChunk& curChunk = *groupChunks[chunkIdx];
+				DrawCall const& call = _ctx.m_drawCalls[curChunk.m_drawCallIdx];
+				RasterizeTrisInBin_OutputFragments(call, &call.m_frameBuffer->m_depthTiles[tileIdx], curChunk, chunkIdx, rectMin, rectMax, buffer);
+			}
+		}
+
+		{
+			buffer.AllocInterpolants(threadAllocator);
+			ShadeFragmentBuffer(_ctx, tileIdx, groupChunks, buffer);
 		}
 	}
 
 	{
-		buffer.AllocInterpolants(threadAllocator);
-		ShadeFragmentBuffer(_ctx, tileIdx, sortedChunks, buffer);
+		FrameBufferPlane const* lastPlane = nullptr;
+
+		for (uint32_t chunkIdx = 0; chunkIdx < numChunks; ++chunkIdx)
+		{
+			DrawCall const& call = _ctx.m_drawCalls[sortedChunks[chunkIdx]->m_drawCallIdx];
+			if (call.m_depthWrite && call.m_frameBuffer != lastPlane)
+			{
+				lastPlane = call.m_frameBuffer;
+				for (uint32_t quadrant = quadrantBegin; quadrant < quadrantEnd; ++quadrant)
+				{
+					UpdateHiZ(lastPlane->m_depthTiles[tileIdx], quadrant);
+				}
+			}
+		}
 	}
 }
 
@@ -20,9 +20,17 @@ struct ThreadRasterCtx
 
 	BinContext* m_binner = nullptr;
 
+	// Of the thread scratch arenas (see TaskSystem::ThreadAllocator), one per frame in flight.
+	uint32_t m_scratchSet = 0;
+
 	uint32_t m_numDrawCalls = 0;
 	uint32_t m_tileX = 0;
 	uint32_t m_tileY = 0;
+
+	static uint32_t const c_wholeTile = 0xFFFFFFFF;
+
+	// Or 0-3 to only rasterize that quadrant of the tile (x then y), so a heavy tile can be split over threads.
+	uint32_t m_quadrant = c_wholeTile;
 };
 
 void RasterAndShadeBin(ThreadRasterCtx const& _ctx);
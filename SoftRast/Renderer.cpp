@@ -2,6 +2,7 @@
 #include "Rasterizer.h"
 #include "kt/Memory.h"
 #include "kt/Logging.h"
+#include "kt/Sort.h"
 
 namespace sr
 {
@@ -40,6 +41,16 @@ void FrameBufferPlane::Init(uint32_t _width, uint32_t _height, bool _colour /*=
 	if (_depth)
 	{
 		m_depthTiles = (DepthTile*)kt::Malloc(sizeof(DepthTile) * m_tilesX * m_tilesY, KT_ALIGNOF(DepthTile));
+
+		// Nothing is occluded by a plane that was never rendered to.
+		for (uint32_t i = 0; i < m_tilesX * m_tilesY; ++i)
+		{
+			for (uint32_t quadrant = 0; quadrant < 4; ++quadrant)
+			{
+				m_depthTiles[i].m_hiZmin[quadrant] = Config::c_depthMax;
+				m_depthTiles[i].m_hiZmax[quadrant] = Config::c_depthMax;
+			}
+		}
 	}
 }
 //
@@ -69,18 +80,52 @@ void FrameBufferPlane::Init(uint32_t _width, uint32_t _height, bool _colour /*=
 //	}
 //}
 
+static uint32_t AttributeFormatNumVaryings(AttributeFormat _format)
+{
+	switch (_format)
+	{
+		case AttributeFormat::Float: return 1;
+		case AttributeFormat::Float2: return 2;
+		case AttributeFormat::Float3: return 3;
+		case AttributeFormat::Half2: return 2;
+		case AttributeFormat::Unorm16x3: return 3;
+		case AttributeFormat::OctSnorm16x2: return 3;
+	}
+
+	KT_UNREACHABLE;
+}
+
+VertexLayout& VertexLayout::Add(AttributeFormat _format, uint32_t _offset, uint32_t* o_firstVarying)
+{
+	KT_ASSERT(m_numAttributes < Config::c_maxVaryings);
+	VertexAttribute& attrib = m_attributes[m_numAttributes++];
+	attrib.m_format = _format;
+	attrib.m_offset = _offset;
+
+	if (o_firstVarying)
+	{
+		*o_firstVarying = m_numVaryings;
+	}
+
+	m_numVaryings += AttributeFormatNumVaryings(_format);
+	KT_ASSERT(m_numVaryings <= Config::c_maxVaryings);
+	return *this;
+}
+
 DrawCall::DrawCall()
 	: m_colourWrite(1)
 	, m_depthWrite(1)
 	, m_depthRead(1)
+	, m_hasBounds(0)
 {
 }
 
 
-DrawCall& DrawCall::SetPixelShader(PixelShaderFn _fn, void const* _uniforms)
+DrawCall& DrawCall::SetPixelShader(PixelShaderFn _fn, void const* _uniforms, uint32_t _uniformSize)
 {
 	m_pixelShader = _fn;
 	m_pixelUniforms = _uniforms;
+	m_pixelUniformsSize = _uniformSize;
 	return *this;
 }
 
@@ -92,11 +137,12 @@ DrawCall& DrawCall::SetIndexBuffer(void const* _buffer, uint32_t const _stride,
 	return *this;
 }
 
-DrawCall& DrawCall::SetPositionBuffer(void const* _buffer, uint32_t const _stride, uint32_t const _num)
+DrawCall& DrawCall::SetPositionBuffer(void const* _buffer, uint32_t const _stride, uint32_t const _num, PositionFormat const _format)
 {
 	m_positionBuffer.m_num = _num;
 	m_positionBuffer.m_ptr = _buffer;
 	m_positionBuffer.m_stride = _stride;
+	m_positionFormat = _format;
 	return *this;
 }
 
@@ -109,6 +155,19 @@ DrawCall& DrawCall::SetAttributeBuffer(void const* _buffer, uint32_t const _stri
 	return *this;
 }
 
+DrawCall& DrawCall::SetAttributeLayout(VertexLayout const& _layout)
+{
+	m_attributeLayout = _layout;
+	return *this;
+}
+
+DrawCall& DrawCall::SetPositionQuantization(kt::Vec3 const& _scale, kt::Vec3 const& _offset)
+{
+	m_positionScale = _scale;
+	m_positionOffset = _offset;
+	return *this;
+}
+
 DrawCall& DrawCall::SetFrameBuffer(FrameBuffer* _buffer)
 {
 	m_frameBuffer = _buffer->WritePlane();
@@ -122,40 +181,97 @@ DrawCall& DrawCall::SetMVP(kt::Mat4 const& _mvp)
 	return *this;
 }
 
-RenderContext::RenderContext()
+DrawCall& DrawCall::SetMeshlets(Meshlet const* _meshlets, uint32_t _num)
+{
+	m_meshlets = _meshlets;
+	m_numMeshlets = _num;
+	return *this;
+}
+
+DrawCall& DrawCall::SetBoundingSphere(kt::Vec3 const& _center, float _radius)
+{
+	m_boundsCenter = _center;
+	m_boundsExtents = kt::Vec3(0.0f);
+	m_boundsRadius = _radius;
+	m_hasBounds = 1;
+	return *this;
+}
+
+DrawCall& DrawCall::SetBoundingBox(kt::Vec3 const& _min, kt::Vec3 const& _max)
+{
+	m_boundsCenter = (_min + _max) * 0.5f;
+	m_boundsExtents = (_max - _min) * 0.5f;
+	m_boundsRadius = 0.0f;
+	m_hasBounds = 1;
+	return *this;
+}
+
+DrawCall& DrawCall::SetOcclusionCulling(FrameBuffer* _buffer)
+{
+	m_occlusionPlane = _buffer->ReadPlane();
+	return *this;
+}
+
+RenderContext::RenderContext(WorkerConfig const& _workers, FrameMode _mode)
+	: m_mode(_mode)
 {
 #if !SR_DEBUG_SINGLE_THREADED
-	m_taskSystem.InitFromMainThread(kt::LogicalCoreCount() - 1);
+	m_taskSystem.InitFromMainThread(_workers);
 #else
-	m_taskSystem.InitFromMainThread(0);
+	WorkerConfig singleThreaded = _workers;
+	singleThreaded.m_numWorkers = 0;
+	m_taskSystem.InitFromMainThread(singleThreaded);
 #endif
 
-	// Todo: frame buffer size hardcoded!!
-	m_binner.Init(m_taskSystem.TotalThreadsIncludingMainThread(), uint32_t(kt::AlignUp(Config::c_screenWidth, Config::c_binWidth)) / Config::c_binWidth, 
-				  uint32_t(kt::AlignUp(Config::c_screenHeight, Config::c_binHeight)) / Config::c_binHeight);
+	static_assert(c_maxFrameSlots <= TaskSystem::c_userScratchSet, "Each frame slot needs its own scratch set, apart from the user set.");
+	m_numSlots = m_mode == FrameMode::Pipelined ? 2 : 1;
+
+	for (uint32_t i = 0; i < m_numSlots; ++i)
+	{
+		FrameSlot& slot = m_slots[i];
+
+		// Todo: frame buffer size hardcoded!!
+		slot.m_binner.Init(m_taskSystem.TotalThreadsIncludingMainThread(), uint32_t(kt::AlignUp(Config::c_screenWidth, Config::c_binWidth)) / Config::c_binWidth, 
+						   uint32_t(kt::AlignUp(Config::c_screenHeight, Config::c_binHeight)) / Config::c_binHeight);
 
+		slot.m_frameMem = kt::Malloc(Config::c_frameMemSize, 64);
+		slot.m_frameAllocator.Init(slot.m_frameMem, Config::c_frameMemSize);
+		slot.m_scratchSet = i;
+	}
 }
 
 RenderContext::~RenderContext()
 {
+	for (FrameSlot& slot : m_slots)
+	{
+		kt::Free(slot.m_frameMem);
+	}
 }
 
 void RenderContext::Shutdown()
 {
+	Flush();
 	m_taskSystem.WaitAndShutdown();
 }
 
 void RenderContext::DrawIndexed(DrawCall const& _call)
 {
 	KT_ASSERT(_call.m_indexBuffer.m_ptr && "No index buffer bound.");
-	m_drawCalls.PushBack(_call);
-	m_drawCalls.Back().m_drawCallIdx = m_drawCalls.Size() - 1;
+	kt::Array<DrawCall>& drawCalls = m_slots[m_curSlot].m_drawCalls;
+	drawCalls.PushBack(_call);
+	DrawCall& call = drawCalls.Back();
+	call.m_drawCallIdx = drawCalls.Size() - 1;
+
+	if (call.m_pixelUniformsSize)
+	{
+		void* uniforms = AllocFrameUniforms(call.m_pixelUniformsSize);
+		memcpy(uniforms, call.m_pixelUniforms, call.m_pixelUniformsSize);
+		call.m_pixelUniforms = uniforms;
+	}
 }
 
 void RenderContext::ClearFrameBuffer(FrameBuffer& _buffer, uint32_t _color, bool _clearColour /*= true*/, bool _clearDepth /*= true*/)
 {
-	KT_ASSERT(_buffer.m_jobs[_buffer.m_writePlane].m_counter.load() == 0);
-
 	// TODO: Fast clear
 	FrameBufferPlane const& plane = *_buffer.WritePlane();
 	if (_clearDepth)
@@ -166,6 +282,11 @@ void RenderContext::ClearFrameBuffer(FrameBuffer& _buffer, uint32_t _color, bool
 			{
 				plane.m_depthTiles[i].m_depth[j] = Config::c_depthMax;
 			}
+			for (uint32_t quadrant = 0; quadrant < 4; ++quadrant)
+			{
+				plane.m_depthTiles[i].m_hiZmin[quadrant] = Config::c_depthMax;
+				plane.m_depthTiles[i].m_hiZmax[quadrant] = Config::c_depthMax;
+			}
 		}
 	}
 
@@ -178,173 +299,631 @@ void RenderContext::ClearFrameBuffer(FrameBuffer& _buffer, uint32_t _color, bool
 	}
 }
 
-ThreadScratchAllocator& RenderContext::ThreadAllocator()
+ThreadScratchAllocator& RenderContext::ThreadAllocator(uint32_t _set)
+{
+	return m_taskSystem.ThreadAllocator(_set);
+}
+
+TaskSystem& RenderContext::GetTaskSystem()
+{
+	return m_taskSystem;
+}
+
+FrameStats const& RenderContext::GetFrameStats() const
+{
+	return m_frameStats;
+}
+
+void* RenderContext::AllocFrameMemory(FrameSlot& _slot, size_t _size, size_t _align)
+{
+	void* ptr = _slot.m_frameAllocator.Alloc(_size, _align);
+	KT_ASSERT(ptr && "Out of frame memory.");
+	return ptr;
+}
+
+void* RenderContext::AllocFrameUniforms(uint32_t _size, uint32_t _align)
 {
-	return m_taskSystem.ThreadAllocator();
+	return AllocFrameMemory(m_slots[m_curSlot], _size, _align);
 }
 
 void RenderContext::BeginFrame()
 {
-	m_drawCalls.Clear();
-	m_taskSystem.ResetAllocators();
+	FrameSlot& slot = m_slots[m_curSlot];
+
+	// The frame that last used the slot was retired by the previous EndFrame.
+	KT_ASSERT(!slot.m_inFlight);
+
+	slot.m_drawCalls.Clear();
+	slot.m_blits.Clear();
+	m_taskSystem.ResetAllocators(slot.m_scratchSet);
+	slot.m_frameAllocator.Reset();
 }
 
-void RenderContext::EndFrame()
+// Test the bounds of 8 draw calls at a time against the clip volume planes of their mvps (-w <= x <= w, -w <= y <= w, 0 <= z <= w).
+// Each plane is a sum or difference of two mvp rows, so it's unnormalized and the box and sphere reaches are scaled to match.
+static uint32_t FrustumCullDraws(DrawCall const* _draws, uint32_t _numDraws, uint8_t* o_culled)
 {
-	std::atomic<uint32_t> frontEndCounter(0);
+	uint32_t numCulled = 0;
 
+	for (uint32_t drawBegin = 0; drawBegin < _numDraws; drawBegin += 8)
 	{
-		for (uint32_t i = 0; i < m_binner.m_numBinsX * m_binner.m_numBinsY * m_binner.m_numThreads; ++i)
+		uint32_t const numLanes = kt::Min(8u, _numDraws - drawBegin);
+
+		// Transposed so each lane is one draw: cols[j][i] is component i of mvp column j.
+		KT_ALIGNAS(32) float cols[4][4][8] = {};
+		KT_ALIGNAS(32) float bounds[7][8] = {};
+		KT_ALIGNAS(32) uint32_t hasBounds[8] = {};
+
+		for (uint32_t lane = 0; lane < numLanes; ++lane)
 		{
-			// todo frame number dirty
-			m_binner.m_bins[i].Reset();
+			DrawCall const& draw = _draws[drawBegin + lane];
+
+			for (uint32_t j = 0; j < 4; ++j)
+			{
+				kt::Vec4 const col = draw.m_mvp * kt::Vec4(j == 0 ? 1.0f : 0.0f, j == 1 ? 1.0f : 0.0f, j == 2 ? 1.0f : 0.0f, j == 3 ? 1.0f : 0.0f);
+				for (uint32_t i = 0; i < 4; ++i)
+				{
+					cols[j][i][lane] = col[i];
+				}
+			}
+
+			bounds[0][lane] = draw.m_boundsCenter.x;
+			bounds[1][lane] = draw.m_boundsCenter.y;
+			bounds[2][lane] = draw.m_boundsCenter.z;
+			bounds[3][lane] = draw.m_boundsExtents.x;
+			bounds[4][lane] = draw.m_boundsExtents.y;
+			bounds[5][lane] = draw.m_boundsExtents.z;
+			bounds[6][lane] = draw.m_boundsRadius;
+			hasBounds[lane] = draw.m_hasBounds ? 0xFFFFFFFF : 0;
 		}
 
-		struct BinTrisTaskData
+		__m256 c[4][4];
+		for (uint32_t j = 0; j < 4; ++j)
 		{
-			DrawCall const* call;
-			RenderContext* ctx;
-		};
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				c[j][i] = _mm256_load_ps(cols[j][i]);
+			}
+		}
 
-		Task* drawCallTasks = (Task*)KT_ALLOCA(sizeof(Task) * m_drawCalls.Size());
-		BinTrisTaskData* drawCallTasksData = (BinTrisTaskData*)KT_ALLOCA(sizeof(BinTrisTaskData) * m_drawCalls.Size());
+		__m256 const center[3] = { _mm256_load_ps(bounds[0]), _mm256_load_ps(bounds[1]), _mm256_load_ps(bounds[2]) };
+		__m256 const extents[3] = { _mm256_load_ps(bounds[3]), _mm256_load_ps(bounds[4]), _mm256_load_ps(bounds[5]) };
+		__m256 const radius = _mm256_load_ps(bounds[6]);
+		__m256 const absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
 
+		__m256 outside = _mm256_setzero_ps();
 
-		for (uint32_t i = 0; i < m_drawCalls.Size(); ++i)
+		// Plane = row _a + _sign * row _b, or row _a alone for a zero sign.
+		auto testPlane = [&](uint32_t _a, uint32_t _b, float _sign)
 		{
-			DrawCall const& draw = m_drawCalls[i];
+			__m256 const sign = _mm256_set1_ps(_sign);
+			__m256 n[4];
+			for (uint32_t j = 0; j < 4; ++j)
+			{
+				n[j] = _mm256_fmadd_ps(sign, c[j][_b], c[j][_a]);
+			}
+
+			__m256 dist = n[3];
+			__m256 reach = _mm256_setzero_ps();
+			__m256 lenSq = _mm256_setzero_ps();
 
-			auto drawCallTaskFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+			for (uint32_t axis = 0; axis < 3; ++axis)
 			{
-				BinTrisTaskData* data = (BinTrisTaskData*)_task->m_userData;
-				BinTrisEntry(data->ctx->m_binner, data->ctx->ThreadAllocator(), _threadIdx, _start, _end, *data->call);
-			};
+				dist = _mm256_fmadd_ps(n[axis], center[axis], dist);
+				reach = _mm256_fmadd_ps(_mm256_and_ps(n[axis], absMask), extents[axis], reach);
+				lenSq = _mm256_fmadd_ps(n[axis], n[axis], lenSq);
+			}
 
-			BinTrisTaskData* taskData = drawCallTasksData + i;
+			reach = _mm256_fmadd_ps(radius, _mm256_sqrt_ps(lenSq), reach);
+			outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(dist, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+		};
 
-			Task* task = drawCallTasks + i;
+		testPlane(3, 0, 1.0f);
+		testPlane(3, 0, -1.0f);
+		testPlane(3, 1, 1.0f);
+		testPlane(3, 1, -1.0f);
+		testPlane(2, 2, 0.0f);
+		testPlane(3, 2, -1.0f);
 
-			kt::PlacementNew(task, drawCallTaskFn, draw.m_indexBuffer.m_num / 3, 2048, taskData, &frontEndCounter);
-			taskData->call = &draw;
-			taskData->ctx = this;
+		uint32_t const culledMask = uint32_t(_mm256_movemask_ps(_mm256_and_ps(outside, _mm256_load_ps((float const*)hasBounds))));
 
-			m_taskSystem.PushTask(task);
+		for (uint32_t lane = 0; lane < numLanes; ++lane)
+		{
+			o_culled[drawBegin + lane] = (culledMask >> lane) & 1;
 		}
+
+		numCulled += kt::Popcnt(culledMask);
 	}
 
+	return numCulled;
+}
+
+static void BlitTile(FrameBufferPlane const& _plane, uint8_t* _linearPixels, uint32_t _tileX, uint32_t _tileY)
+{
+	uint32_t* fb32 = (uint32_t*)_linearPixels;
+	ColourTile const& tile = _plane.m_colourTiles[_tileY * _plane.m_tilesX + _tileX];
+
+	uint32_t const yEnd = kt::Min(Config::c_binHeight, _plane.m_height - _tileY * Config::c_binHeight);
+	uint32_t const widthCopySize = kt::Min(Config::c_binWidth, _plane.m_width - _tileX * Config::c_binWidth);
+
+	for (uint32_t y = 0; y < yEnd; ++y)
 	{
-		m_taskSystem.WaitForCounter(&frontEndCounter);
+		uint8_t const* src = &tile.m_colour[y * 4 * Config::c_binWidth];
+
+		uint32_t* dest = fb32 + _tileY * Config::c_binHeight * _plane.m_width + _tileX * Config::c_binWidth + y * _plane.m_width;
+		memcpy(dest, src, 4 * widthCopySize);
 	}
+}
 
-	std::atomic<uint32_t> tileRasterCounter{ 0 };
+void RenderContext::EndFrame()
+{
+	FrameSlot& slot = m_slots[m_curSlot];
+	kt::Array<DrawCall>& drawCalls = slot.m_drawCalls;
+	std::atomic<uint32_t>* frameCounter = &slot.m_counter;
 
+#if KT_DEBUG
+	if (m_mode == FrameMode::Pipelined)
 	{
-		for (uint32_t binY = 0; binY < m_binner.m_numBinsY; ++binY)
+		for (DrawCall const& call : drawCalls)
 		{
-			for (uint32_t binX = 0; binX < m_binner.m_numBinsX; ++binX)
+			bool blitted = false;
+			for (BlitRequest const& blit : slot.m_blits)
 			{
-				bool anyTris = false;
-				for (uint32_t threadIdx = 0; threadIdx < m_binner.m_numThreads; ++threadIdx)
+				blitted |= blit.m_plane == call.m_frameBuffer;
+			}
+			KT_ASSERT(blitted && "Pipelined frames must blit every frame buffer drawn to, so it swaps planes before the next frame.");
+		}
+	}
+#endif
+
+	uint8_t* drawCulled = (uint8_t*)AllocFrameMemory(slot, drawCalls.Size() + 1, 1);
+	slot.m_stats.m_numDraws = drawCalls.Size();
+	slot.m_stats.m_numDrawsCulled = FrustumCullDraws(drawCalls.Data(), drawCalls.Size(), drawCulled);
+	slot.m_stats.m_numBinPasses = 0;
+
+	struct TileTaskData
+	{
+		Task t;
+		ThreadRasterCtx rasterCtx;
+	};
+
+	struct TileBlitTaskData
+	{
+		Task t;
+		FrameSlot* slot;
+		uint32_t tileX;
+		uint32_t tileY;
+		bool chained;
+	};
+
+	struct TileCost
+	{
+		uint32_t tileIdx;
+		uint32_t cost;
+	};
+
+	// One task over the global triangle range of every unculled draw, so small draws share packets and big ones are split finely.
+	struct FrontEndTaskData
+	{
+		Task t;
+		FrontEndDraw* draws;
+		uint32_t numDraws;
+		uint32_t numTris;
+		uint32_t spanTris;
+
+		// Of the current bin pass, from its begin.
+		std::atomic<uint32_t> nextSpan;
+
+		RenderContext* ctx;
+		FrameSlot* slot;
+	};
+
+	// Continuation of the front end task, pushes the tile raster tasks. Their blits are chained on in the last pass, the next pass otherwise.
+	// Pipelined frames are blitted whole once they are done instead (see RetireFrame), so there are no blit tasks.
+	struct SpawnTilesTaskData
+	{
+		Task t;
+		RenderContext* ctx;
+		FrameSlot* slot;
+		TileTaskData* tileTasks;
+		TileCost* tileCosts;
+		TileCost* tileCostsTemp;
+		TileBlitTaskData* blitTasks;
+		uint32_t blitTilesX;
+		uint32_t blitTilesY;
+		uint32_t numTris;
+		Task* nextPass;
+		std::atomic<uint32_t>* counter;
+	};
+
+	// Bins triangles from where the last pass ended (see BinContext::m_passEnd) until they are all binned or bin memory runs out.
+	struct BinPassTaskData
+	{
+		Task t;
+		RenderContext* ctx;
+		FrameSlot* slot;
+		FrontEndTaskData* frontEnd;
+		SpawnTilesTaskData* spawn;
+		std::atomic<uint32_t>* counter;
+	};
+
+	uint32_t blitTilesX = 0;
+	uint32_t blitTilesY = 0;
+
+	for (BlitRequest const& blit : slot.m_blits)
+	{
+		blitTilesX = kt::Max(blitTilesX, blit.m_plane->m_tilesX);
+		blitTilesY = kt::Max(blitTilesY, blit.m_plane->m_tilesY);
+	}
+
+	slot.m_blitTilesX = blitTilesX;
+	slot.m_blitTilesY = blitTilesY;
+
+	// Task data lives in the slot's frame memory, as a pipelined frame is still running after EndFrame returns.
+	uint32_t const numBins = slot.m_binner.m_numBinsX * slot.m_binner.m_numBinsY;
+	uint32_t const numBlitTasks = m_mode == FrameMode::Pipelined ? 0 : blitTilesX * blitTilesY;
+
+	FrontEndTaskData* frontEnd = kt::PlacementNew<FrontEndTaskData>((FrontEndTaskData*)AllocFrameMemory(slot, sizeof(FrontEndTaskData), KT_ALIGNOF(FrontEndTaskData)));
+	frontEnd->draws = (FrontEndDraw*)AllocFrameMemory(slot, sizeof(FrontEndDraw) * (drawCalls.Size() + 1), KT_ALIGNOF(FrontEndDraw));
+	frontEnd->numDraws = 0;
+	frontEnd->numTris = 0;
+	frontEnd->ctx = this;
+	frontEnd->slot = &slot;
+
+	for (uint32_t i = 0; i < drawCalls.Size(); ++i)
+	{
+		uint32_t const drawTris = drawCalls[i].m_indexBuffer.m_num / 3;
+
+		if (drawCulled[i] || !drawTris)
+		{
+			continue;
+		}
+
+		FrontEndDraw& draw = frontEnd->draws[frontEnd->numDraws++];
+		draw.m_call = &drawCalls[i];
+		draw.m_globalTriBegin = frontEnd->numTris;
+
+		KT_ASSERT(uint64_t(frontEnd->numTris) + drawTris <= UINT32_MAX);
+		frontEnd->numTris += drawTris;
+	}
+
+	// A few spans per thread so the spans that cost more than others (clipping, meshlet culling) even out.
+	uint32_t const numSpans = m_taskSystem.TotalThreadsIncludingMainThread() * c_frontEndSpansPerThread;
+	frontEnd->spanTris = kt::Clamp((frontEnd->numTris + numSpans - 1) / numSpans, c_minFrontEndSpanTris, c_maxFrontEndSpanTris);
+
+	SpawnTilesTaskData* spawn = kt::PlacementNew<SpawnTilesTaskData>((SpawnTilesTaskData*)AllocFrameMemory(slot, sizeof(SpawnTilesTaskData), KT_ALIGNOF(SpawnTilesTaskData)));
+	spawn->ctx = this;
+	spawn->slot = &slot;
+	spawn->tileTasks = (TileTaskData*)AllocFrameMemory(slot, sizeof(TileTaskData) * numBins, KT_ALIGNOF(TileTaskData));
+	spawn->tileCosts = (TileCost*)AllocFrameMemory(slot, sizeof(TileCost) * numBins, KT_ALIGNOF(TileCost));
+	spawn->tileCostsTemp = (TileCost*)AllocFrameMemory(slot, sizeof(TileCost) * numBins, KT_ALIGNOF(TileCost));
+	spawn->blitTasks = (TileBlitTaskData*)AllocFrameMemory(slot, sizeof(TileBlitTaskData) * (numBlitTasks + 1), KT_ALIGNOF(TileBlitTaskData));
+	spawn->blitTilesX = numBlitTasks ? blitTilesX : 0;
+	spawn->blitTilesY = numBlitTasks ? blitTilesY : 0;
+	spawn->numTris = frontEnd->numTris;
+	spawn->counter = frameCounter;
+
+	auto tileBlitFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+	{
+		TileBlitTaskData* data = (TileBlitTaskData*)_task->m_userData;
+		for (uint32_t i = _start; i < _end; ++i)
+		{
+			BlitRequest const& blit = data->slot->m_blits[i];
+			if (data->tileX < blit.m_plane->m_tilesX && data->tileY < blit.m_plane->m_tilesY)
+			{
+				BlitTile(*blit.m_plane, blit.m_linearPixels, data->tileX, data->tileY);
+			}
+		}
+	};
+
+	for (uint32_t tileY = 0; tileY < spawn->blitTilesY; ++tileY)
+	{
+		for (uint32_t tileX = 0; tileX < spawn->blitTilesX; ++tileX)
+		{
+			TileBlitTaskData* blit = &spawn->blitTasks[tileY * spawn->blitTilesX + tileX];
+			kt::PlacementNew(&blit->t, tileBlitFn, slot.m_blits.Size(), slot.m_blits.Size(), blit, frameCounter);
+			blit->slot = &slot;
+			blit->tileX = tileX;
+			blit->tileY = tileY;
+			blit->chained = false;
+		}
+	}
+
+	auto spawnTilesFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+	{
+		SpawnTilesTaskData* data = (SpawnTilesTaskData*)_task->m_userData;
+		RenderContext* ctx = data->ctx;
+		BinContext& binner = data->slot->m_binner;
+
+		auto tileRasterFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+		{
+			TileTaskData* data = (TileTaskData*)_task->m_userData;
+			if (_task->m_totalPartitions == 1)
+			{
+				RasterAndShadeBin(data->rasterCtx);
+				return;
+			}
+
+			// Split into quadrants, one per partition.
+			for (uint32_t quadrant = _start; quadrant < _end; ++quadrant)
+			{
+				ThreadRasterCtx quadrantCtx = data->rasterCtx;
+				quadrantCtx.m_quadrant = quadrant;
+				RasterAndShadeBin(quadrantCtx);
+			}
+		};
+
+		++data->slot->m_stats.m_numBinPasses;
+		bool const lastPass = std::atomic_load_explicit(&binner.m_passEnd, std::memory_order_relaxed) >= data->numTris;
+
+		uint32_t numTiles = 0;
+		uint64_t totalCost = 0;
+
+		for (uint32_t binY = 0; binY < binner.m_numBinsY; ++binY)
+		{
+			for (uint32_t binX = 0; binX < binner.m_numBinsX; ++binX)
+			{
+				uint32_t cost = 0;
+				for (uint32_t threadIdx = 0; threadIdx < binner.m_numThreads; ++threadIdx)
 				{
-					ThreadBin& bin = m_binner.LookupThreadBin(threadIdx, binX, binY);
-					anyTris |= bin.m_numChunks != 0;
-					if (anyTris)
-					{
-						break;
-					}
+					cost += binner.LookupThreadBin(threadIdx, binX, binY).m_cost;
 				}
 
-				if (anyTris)
+				if (cost)
 				{
-					struct TileTaskData
-					{
-						Task t;
-						ThreadRasterCtx rasterCtx;
-					};
+					TileCost& tile = data->tileCosts[numTiles++];
+					tile.tileIdx = binY * binner.m_numBinsX + binX;
+					tile.cost = cost;
+					totalCost += cost;
+				}
+			}
+		}
 
-					auto tileRasterFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
-					{
-						TileTaskData* data = (TileTaskData*)_task->m_userData;
-						RasterAndShadeBin(data->rasterCtx);
-					};
-
-					TileTaskData* t = (TileTaskData*)KT_ALLOCA(sizeof(TileTaskData));
-					t->rasterCtx.m_binner = &m_binner;
-					t->rasterCtx.m_tileX = binX;
-					t->rasterCtx.m_tileY = binY;
-					t->rasterCtx.m_drawCalls = m_drawCalls.Data();
-					t->rasterCtx.m_numDrawCalls = m_drawCalls.Size();
-					t->rasterCtx.m_ctx = this;
-					kt::PlacementNew(&t->t, tileRasterFn, 1, 1, t);
-
-					t->t.m_taskCounter = &tileRasterCounter;
-					m_taskSystem.PushTask(&t->t);
+		// Most expensive first, so the heavy tiles are not the ones left running at the end of the frame.
+		// Thieves take from the front of the queue, while the pushing thread works back from the cheap end.
+		kt::RadixSort(data->tileCosts, data->tileCosts + numTiles, data->tileCostsTemp, [](TileCost const& _tile) { return ~_tile.cost; });
+
+		uint32_t const numThreads = ctx->m_taskSystem.TotalThreadsIncludingMainThread();
+		uint64_t const splitCost = uint64_t(double(totalCost) / double(numThreads) * Config::c_tileSplitCostFraction);
+
+		// Every continuation is set before any tile is pushed, so the next pass can't start until the last tile is done.
+		for (uint32_t i = 0; i < numTiles; ++i)
+		{
+			uint32_t const tileIdx = data->tileCosts[i].tileIdx;
+			uint32_t const binX = tileIdx % binner.m_numBinsX;
+			uint32_t const binY = tileIdx / binner.m_numBinsX;
+
+			bool const split = numThreads > 1 && Config::c_tileSplitCostFraction > 0.0f && data->tileCosts[i].cost > splitCost;
+
+			TileTaskData* t = &data->tileTasks[tileIdx];
+			t->rasterCtx.m_binner = &binner;
+			t->rasterCtx.m_scratchSet = data->slot->m_scratchSet;
+			t->rasterCtx.m_tileX = binX;
+			t->rasterCtx.m_tileY = binY;
+			t->rasterCtx.m_drawCalls = data->slot->m_drawCalls.Data();
+			t->rasterCtx.m_numDrawCalls = data->slot->m_drawCalls.Size();
+			t->rasterCtx.m_ctx = ctx;
+			t->rasterCtx.m_quadrant = ThreadRasterCtx::c_wholeTile;
+			kt::PlacementNew(&t->t, tileRasterFn, split ? 4 : 1, 1, t, data->counter);
+
+			if (!lastPass)
+			{
+				t->t.SetContinuation(data->nextPass);
+			}
+			else if (binX < data->blitTilesX && binY < data->blitTilesY)
+			{
+				TileBlitTaskData& blit = data->blitTasks[binY * data->blitTilesX + binX];
+				blit.chained = true;
+				t->t.SetContinuation(&blit.t);
+			}
+		}
+
+		for (uint32_t i = 0; i < numTiles; ++i)
+		{
+			ctx->m_taskSystem.PushTask(&data->tileTasks[data->tileCosts[i].tileIdx].t);
+		}
+
+		if (!lastPass)
+		{
+			if (!numTiles)
+			{
+				ctx->m_taskSystem.PushTask(data->nextPass);
+			}
+
+			return;
+		}
+
+		// Tiles nothing was binned to are blitted straight away.
+		for (uint32_t i = 0; i < data->blitTilesX * data->blitTilesY; ++i)
+		{
+			if (!data->blitTasks[i].chained)
+			{
+				ctx->m_taskSystem.PushTask(&data->blitTasks[i].t);
+			}
+		}
+	};
+
+	kt::PlacementNew(&spawn->t, spawnTilesFn, 1, 1, spawn, frameCounter);
+
+	auto binPassFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+	{
+		BinPassTaskData* data = (BinPassTaskData*)_task->m_userData;
+		RenderContext* ctx = data->ctx;
+		BinContext& binner = data->slot->m_binner;
+		FrontEndTaskData* frontEnd = data->frontEnd;
+
+		auto frontEndFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+		{
+			FrontEndTaskData* data = (FrontEndTaskData*)_task->m_userData;
+			BinContext& binner = data->slot->m_binner;
+			ThreadScratchAllocator& allocator = data->ctx->ThreadAllocator(data->slot->m_scratchSet);
+
+			// Spans are claimed in order, so a thread that runs out of bin memory has only binned spans before the one it stops at.
+			for (;;)
+			{
+				uint64_t const spanBegin = binner.m_passBegin + uint64_t(std::atomic_fetch_add_explicit(&data->nextSpan, 1, std::memory_order_relaxed)) * data->spanTris;
+
+				if (spanBegin >= data->numTris || spanBegin >= std::atomic_load_explicit(&binner.m_passEnd, std::memory_order_relaxed))
+				{
+					return;
 				}
 
+				uint32_t const spanEnd = uint32_t(kt::Min(spanBegin + data->spanTris, uint64_t(data->numTris)));
+				BinTrisEntry(binner, allocator, _threadIdx, data->draws, data->numDraws, uint32_t(spanBegin), spanEnd);
 			}
+		};
+
+		// The previous pass's tiles are all done with the bins and the memory they point into.
+		uint32_t const passBegin = std::atomic_load_explicit(&binner.m_passEnd, std::memory_order_relaxed);
+
+		if (passBegin)
+		{
+			ctx->m_taskSystem.RewindAllocators(data->slot->m_scratchSet);
 		}
-	}
 
+		for (uint32_t i = 0; i < binner.m_numBinsX * binner.m_numBinsY * binner.m_numThreads; ++i)
+		{
+			// todo frame number dirty
+			binner.m_bins[i].Reset();
+		}
+
+		binner.m_passBegin = passBegin;
+		std::atomic_store_explicit(&binner.m_passEnd, UINT32_MAX, std::memory_order_relaxed);
+
+		if (passBegin >= frontEnd->numTris)
+		{
+			ctx->m_taskSystem.PushTask(&data->spawn->t);
+			return;
+		}
+
+		// One packet per thread that can be kept busy, each bins spans until there are none left.
+		uint32_t const passSpans = (frontEnd->numTris - passBegin + frontEnd->spanTris - 1) / frontEnd->spanTris;
+		uint32_t const numBinners = kt::Min(passSpans, ctx->m_taskSystem.TotalThreadsIncludingMainThread());
+
+		std::atomic_store_explicit(&frontEnd->nextSpan, 0u, std::memory_order_relaxed);
+		kt::PlacementNew(&frontEnd->t, frontEndFn, numBinners, 1, frontEnd, data->counter);
+		frontEnd->t.SetContinuation(&data->spawn->t);
+		ctx->m_taskSystem.PushTask(&frontEnd->t);
+	};
+
+	BinPassTaskData* binPass = kt::PlacementNew<BinPassTaskData>((BinPassTaskData*)AllocFrameMemory(slot, sizeof(BinPassTaskData), KT_ALIGNOF(BinPassTaskData)));
+	kt::PlacementNew(&binPass->t, binPassFn, 1, 1, binPass, frameCounter);
+	binPass->ctx = this;
+	binPass->slot = &slot;
+	binPass->frontEnd = frontEnd;
+	binPass->spawn = spawn;
+	binPass->counter = frameCounter;
+	spawn->nextPass = &binPass->t;
+
+	// The first pass begins at the start of the frame's triangles.
+	std::atomic_store_explicit(&slot.m_binner.m_passEnd, 0u, std::memory_order_relaxed);
+	slot.m_inFlight = true;
+	m_taskSystem.PushTask(&binPass->t);
+
+	m_curSlot = (m_curSlot + 1) % m_numSlots;
 
+	if (m_mode == FrameMode::Immediate)
 	{
-		m_taskSystem.WaitForCounter(&tileRasterCounter);
+		RetireFrame(slot);
+		return;
 	}
 
-	BinContext::MicroprofileUpdateCounters();
+	// The next frame records into the other planes while this one rasterizes.
+	for (BlitRequest const& blit : slot.m_blits)
+	{
+		blit.m_fb->SwapPlanes();
+	}
+
+	// Binning of this frame overlaps the end of the last one, which frees its slot for the next BeginFrame.
+	FrameSlot& prevSlot = m_slots[m_curSlot];
+
+	if (prevSlot.m_inFlight)
+	{
+		RetireFrame(prevSlot);
+	}
 }
 
-static void BlitJobFn(FrameBuffer::JobData const& _job)
+void RenderContext::RetireFrame(FrameSlot& _slot)
 {
-	FrameBufferPlane const& plane = *_job.m_plane;
-	uint32_t* fb32 = (uint32_t*)_job.m_linearPixels;
-	for (uint32_t tileY = 0; tileY < plane.m_tilesY; ++tileY)
+	KT_ASSERT(_slot.m_inFlight);
+	m_taskSystem.WaitForCounter(&_slot.m_counter);
+
+	if (m_mode == FrameMode::Pipelined)
 	{
-		for (uint32_t tileX = 0; tileX < plane.m_tilesX; ++tileX)
+		// Blitting while the frame rasterized could overwrite the pixels of the frame before it before they were shown, so it's done here in one go.
+		auto planeBlitFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
 		{
-			ColourTile const& tile = plane.m_colourTiles[tileY * plane.m_tilesX + tileX];
-
-			uint32_t const yEnd = kt::Min(Config::c_binHeight, plane.m_height - tileY * Config::c_binHeight);
-			uint32_t const widthCopySize = kt::Min(Config::c_binWidth, plane.m_width - tileX * Config::c_binWidth);
-
-			for (uint32_t y = 0; y < yEnd; ++y)
+			FrameSlot* slot = (FrameSlot*)_task->m_userData;
+			for (uint32_t i = _start; i < _end; ++i)
 			{
-				uint8_t const* src = &tile.m_colour[y * 4 * Config::c_binWidth];
+				uint32_t const tileX = i % slot->m_blitTilesX;
+				uint32_t const tileY = i / slot->m_blitTilesX;
 
-				uint32_t* dest = fb32 + tileY * Config::c_binHeight * plane.m_width + tileX * Config::c_binWidth + y * plane.m_width;
-				memcpy(dest, src, 4 * widthCopySize);
+				for (BlitRequest const& blit : slot->m_blits)
+				{
+					if (tileX < blit.m_plane->m_tilesX && tileY < blit.m_plane->m_tilesY)
+					{
+						BlitTile(*blit.m_plane, blit.m_linearPixels, tileX, tileY);
+					}
+				}
 			}
+		};
+
+		if (uint32_t const numTiles = _slot.m_blitTilesX * _slot.m_blitTilesY)
+		{
+			_slot.m_blitTask.Set(planeBlitFn, numTiles, 4, &_slot, &_slot.m_counter);
+			m_taskSystem.PushTask(&_slot.m_blitTask);
+			m_taskSystem.WaitForCounter(&_slot.m_counter);
 		}
 	}
 
-	if (_job.m_onFinishBlit)
+	for (BlitRequest const& blit : _slot.m_blits)
 	{
-		_job.m_onFinishBlit(_job.m_onFinishBlitUser);
+		if (m_mode == FrameMode::Immediate)
+		{
+			blit.m_fb->SwapPlanes();
+		}
+
+		if (blit.m_onFinishBlit)
+		{
+			blit.m_onFinishBlit(blit.m_onFinishBlitUser);
+		}
 	}
-}
 
+	_slot.m_blits.Clear();
+	_slot.m_inFlight = false;
 
-void RenderContext::Blit(FrameBuffer& _fb, uint8_t* _linearPixels, void(*_onFinishBlit)(void*), void* _onFinishUser)
-{
-	// Ensure last blit is finished
-	m_taskSystem.WaitForCounter(&_fb.m_jobs[_fb.m_writePlane ^ 1].m_counter);
+	// Wait stats cover whatever ran since the last frame was done, which in FrameMode::Pipelined includes some of the next frame.
+	_slot.m_stats.m_taskWaits = m_taskSystem.GetWaitStats();
+	m_taskSystem.ResetWaitStats();
+	_slot.m_stats.m_scratch = m_taskSystem.GetScratchStats(_slot.m_scratchSet);
+	m_frameStats = _slot.m_stats;
 
-	uint32_t const idx = _fb.m_writePlane;
-	std::atomic_store_explicit(&_fb.m_jobs[idx].m_counter, 0, std::memory_order_relaxed);
-	_fb.m_jobs[idx].m_linearPixels = _linearPixels;
-	_fb.m_jobs[idx].m_plane = _fb.WritePlane();
-	_fb.m_jobs[idx].m_onFinishBlit = _onFinishBlit;
-	_fb.m_jobs[idx].m_onFinishBlitUser = _onFinishUser;
+	BinContext::MicroprofileUpdateCounters();
+}
 
-	auto taskFN = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+void RenderContext::Flush()
+{
+	for (uint32_t i = 0; i < m_numSlots; ++i)
 	{
-		BlitJobFn(*(FrameBuffer::JobData*)_task->m_userData);
-	};
-
-	_fb.m_jobs[idx].m_task.Set(taskFN, 1, 1, &_fb.m_jobs[idx], &_fb.m_jobs[idx].m_counter);
+		// Oldest first, the slot after the one being recorded.
+		FrameSlot& slot = m_slots[(m_curSlot + 1 + i) % m_numSlots];
 
-	_fb.SwapPlanes();
+		if (slot.m_inFlight)
+		{
+			RetireFrame(slot);
+		}
+	}
+}
 
-	m_taskSystem.PushTask(&_fb.m_jobs[idx].m_task);
+void RenderContext::Blit(FrameBuffer& _fb, uint8_t* _linearPixels, void(*_onFinishBlit)(void*), void* _onFinishUser)
+{
+	BlitRequest& blit = m_slots[m_curSlot].m_blits.PushBack();
+	blit.m_fb = &_fb;
+	blit.m_plane = _fb.WritePlane();
+	blit.m_linearPixels = _linearPixels;
+	blit.m_onFinishBlit = _onFinishBlit;
+	blit.m_onFinishBlitUser = _onFinishUser;
 }
 
 }
\ No newline at end of file
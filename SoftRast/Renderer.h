@@ -3,7 +3,9 @@
 #include <stdint.h>
 
 #include <kt/Array.h>
+#include <kt/LinearAllocator.h>
 #include <kt/Mat4.h>
+#include <kt/Vec3.h>
 
 #include <atomic>
 
@@ -32,8 +34,10 @@ struct DepthTile
 	void Clear();
 
 	KT_ALIGNAS(32) float m_depth[Config::c_binWidth * Config::c_binWidth];
-	float m_hiZmin;
-	float m_hiZmax;
+
+	// Depth range of each quadrant of m_depth (c_binWidth / 2 square, x then y), updated after each tile or quadrant is rasterized.
+	float m_hiZmin[4];
+	float m_hiZmax[4];
 };
 
 struct Interpolants
@@ -95,16 +99,6 @@ struct FrameBuffer
 
 	FrameBufferPlane m_bufferedPlanes[2];
 	uint32_t m_writePlane = 0;
-
-	struct JobData
-	{
-		Task m_task;
-		FrameBufferPlane* m_plane = nullptr;
-		uint8_t* m_linearPixels = nullptr;
-		std::atomic<uint32_t> m_counter{ 0 };
-		void(*m_onFinishBlit)(void*) = nullptr;
-		void* m_onFinishBlitUser = nullptr;
-	} m_jobs[2];
 };
 
 using PixelShaderFn = void(void const* _uniforms, Interpolants const& _interpolants, uint32_t o_texels[8], uint32_t _execMask);
@@ -116,30 +110,87 @@ struct GenericDrawBuffer
 	uint32_t m_stride = 0;
 };
 
+struct VertexAttribute
+{
+	AttributeFormat m_format = AttributeFormat::Float;
+	uint32_t m_offset = 0; // Bytes from the start of the vertex.
+};
+
+// How each vertex of the attribute buffer is decoded into float varyings, attributes fill consecutive varyings in order.
+// Without a layout the attribute buffer is read directly as m_stride / sizeof(float) float varyings.
+struct VertexLayout
+{
+	// o_firstVarying (if non null) is set to the index of the attribute's first decoded float varying, e.g. for DrawCall::SetAttributeBuffer's _uvOffset.
+	VertexLayout& Add(AttributeFormat _format, uint32_t _offset, uint32_t* o_firstVarying = nullptr);
+
+	VertexAttribute m_attributes[Config::c_maxVaryings];
+	uint32_t m_numAttributes = 0;
+	uint32_t m_numVaryings = 0;
+};
+
 struct DrawCall
 {
 	static const uint32_t UV_OFFSET_INVALID = 0xFFFFFFFF;
 
 	DrawCall();
 
-	DrawCall& SetPixelShader(PixelShaderFn* _fn, void const* _uniforms);
+	// If _uniformSize is non zero the uniform block is copied into frame memory by RenderContext::DrawIndexed, so _uniforms only has to live until then.
+	DrawCall& SetPixelShader(PixelShaderFn* _fn, void const* _uniforms, uint32_t _uniformSize = 0);
 	DrawCall& SetIndexBuffer(void const* _buffer, uint32_t const _stride, uint32_t const _num);
-	DrawCall& SetPositionBuffer(void const* _buffer, uint32_t const _stride, uint32_t const _num);
+	DrawCall& SetPositionBuffer(void const* _buffer, uint32_t const _stride, uint32_t const _num, PositionFormat const _format = PositionFormat::Float3);
+	// _uvOffset is the index of the u varying, in floats from the start of the vertex, or in decoded float varyings if an attribute layout is set (see VertexLayout::Add).
 	DrawCall& SetAttributeBuffer(void const* _buffer, uint32_t const _stride, uint32_t const _num, uint32_t const _uvOffset = 0);
+	DrawCall& SetAttributeLayout(VertexLayout const& _layout);
+
+	// Applied to PositionFormat::Unorm16x3 positions and AttributeFormat::Unorm16x3 attributes: pos = unorm * _scale + _offset.
+	DrawCall& SetPositionQuantization(kt::Vec3 const& _scale, kt::Vec3 const& _offset);
 	DrawCall& SetFrameBuffer(FrameBuffer* _buffer);
 	DrawCall& SetMVP(kt::Mat4 const& _mvp);
 
+	// Bin the index buffer per meshlet, skipping meshlets outside the frustum or facing away from the eye. Meshlets must cover every triangle to be drawn.
+	DrawCall& SetMeshlets(Meshlet const* _meshlets, uint32_t _num);
+
+	// Optional model space bounds. Draws entirely outside the frustum are dropped by RenderContext::EndFrame before any binning work.
+	DrawCall& SetBoundingSphere(kt::Vec3 const& _center, float _radius);
+	DrawCall& SetBoundingBox(kt::Vec3 const& _min, kt::Vec3 const& _max);
+
+	// Also skip meshlets behind the depth of the last frame rendered to _buffer (its read plane), tested per tile against the frame's farthest depth.
+	// Not reprojected, so fast moving geometry can be missing for a frame. In FrameMode::Pipelined that frame may still be rasterizing,
+	// its depth ranges only get nearer as it does so culling against it is conservative.
+	DrawCall& SetOcclusionCulling(FrameBuffer* _buffer);
+
 	PixelShaderFn* m_pixelShader = nullptr;
 	void const* m_pixelUniforms = nullptr;
+	uint32_t m_pixelUniformsSize = 0;
 
 	GenericDrawBuffer m_indexBuffer;
 	GenericDrawBuffer m_positionBuffer;
 	GenericDrawBuffer m_attributeBuffer;
 
 	uint32_t m_uvOffset = 0;
+
+	PositionFormat m_positionFormat = PositionFormat::Float3;
+	kt::Vec3 m_positionScale = kt::Vec3(1.0f);
+	kt::Vec3 m_positionOffset = kt::Vec3(0.0f);
+
+	VertexLayout m_attributeLayout;
+
+	uint32_t NumVaryings() const
+	{
+		return m_attributeLayout.m_numAttributes ? m_attributeLayout.m_numVaryings : m_attributeBuffer.m_stride / sizeof(float);
+	}
 	
 	FrameBufferPlane const* m_frameBuffer = nullptr;
 
+	Meshlet const* m_meshlets = nullptr;
+	uint32_t m_numMeshlets = 0;
+	FrameBufferPlane const* m_occlusionPlane = nullptr;
+
+	// A box of half size m_boundsExtents grown by m_boundsRadius, so either a sphere or a box.
+	kt::Vec3 m_boundsCenter = kt::Vec3(0.0f);
+	kt::Vec3 m_boundsExtents = kt::Vec3(0.0f);
+	float m_boundsRadius = 0.0f;
+
 	kt::Mat4 m_mvp = kt::Mat4::Identity();
 
 	uint32_t m_drawCallIdx = 0;
@@ -147,35 +198,135 @@ struct DrawCall
 	uint32_t m_colourWrite		: 1;
 	uint32_t m_depthWrite		: 1;
 	uint32_t m_depthRead		: 1;
+	uint32_t m_hasBounds		: 1;
+};
+
+struct FrameStats
+{
+	uint32_t m_numDraws = 0;
+	uint32_t m_numDrawsCulled = 0; // Outside the frustum, by their DrawCall bounds.
+
+	// Of the main thread waiting on the frame and of any nested waits inside tasks.
+	TaskWaitStats m_taskWaits;
+
+	// More than one if bin memory ran out and the frame was rasterized part way through (see Config::c_binMemoryPerThread).
+	uint32_t m_numBinPasses = 0;
+
+	// High-water marks of the frame's thread scratch arenas.
+	ScratchStats m_scratch;
+};
+
+// How EndFrame overlaps a frame with the next.
+enum class FrameMode : uint32_t
+{
+	// EndFrame returns once the frame is rasterized and blitted.
+	Immediate,
+
+	// EndFrame returns once the frame is binning and the frame before it is rasterized and blitted, so the next frame's recording and binning overlap
+	// this frame's rasterization. Each frame in flight has its own bins, frame memory and scratch arenas, and results are a frame later.
+	// Frame buffers only swap planes when blitted, so every frame buffer drawn to must be blitted each frame. Anything draws read must be left alone
+	// until their frame is done, which is the end of the next EndFrame (or Flush), including the textures VirtualTextureCache::Update pages in.
+	Pipelined
 };
 
 
 class RenderContext
 {
 public:
-	RenderContext();
+	explicit RenderContext(WorkerConfig const& _workers = WorkerConfig(), FrameMode _mode = FrameMode::Immediate);
 	~RenderContext();
 
+	// Flushes any frame in flight.
 	void Shutdown();
 
 	void DrawIndexed(DrawCall const& _call);
 
 	void ClearFrameBuffer(FrameBuffer& _buffer, uint32_t _color = 0x00000000, bool _clearColour = true, bool _clearDepth = true);
 
-	ThreadScratchAllocator& ThreadAllocator();
+	// Frames use their own sets, the default is free for work outside of them.
+	ThreadScratchAllocator& ThreadAllocator(uint32_t _set = TaskSystem::c_userScratchSet);
+
+	// For offloading load time work (e.g. texture mip generation) onto the render workers.
+	TaskSystem& GetTaskSystem();
+
+	// Uniform memory that lives until the frame is done and its memory is reused by a later BeginFrame. Aligned for __m256 by default, so scalars can be stored pre-broadcast.
+	void* AllocFrameUniforms(uint32_t _size, uint32_t _align = 32);
+
+	template <typename T>
+	T* AllocFrameUniforms()
+	{
+		return (T*)AllocFrameUniforms(sizeof(T), KT_ALIGNOF(T));
+	}
 
 	void BeginFrame();
 	void EndFrame();
 
+	// Wait for the frame in flight in FrameMode::Pipelined, blit it and call its blit callbacks. Nothing to do otherwise.
+	void Flush();
+
+	// Call before EndFrame. Each tile of _fb's write plane is copied to _linearPixels as soon as it is rasterized, then EndFrame swaps the planes of _fb and calls _onFinishBlit.
+	// In FrameMode::Pipelined the planes are swapped as the frame is submitted, and the whole plane is copied and _onFinishBlit called once the frame is done.
 	void Blit(FrameBuffer& _fb, uint8_t* _linearPixels, void(*_onFinishBlit)(void*) = nullptr, void* _onFinishUser = nullptr);
 
+	// Of the last frame done.
+	FrameStats const& GetFrameStats() const;
+
 private:
+	struct BlitRequest
+	{
+		FrameBuffer* m_fb;
+		FrameBufferPlane const* m_plane;
+		uint8_t* m_linearPixels;
+		void(*m_onFinishBlit)(void*);
+		void* m_onFinishBlitUser;
+	};
+
+	// Everything a frame uses from BeginFrame until it is done. One in FrameMode::Immediate, two in FrameMode::Pipelined so a frame can be recorded and binned while the last one rasterizes.
+	struct FrameSlot
+	{
+		BinContext m_binner;
+		kt::Array<DrawCall> m_drawCalls;
+
+		// Uniforms and the frame's task data, reset when the slot is reused.
+		kt::LinearAllocator m_frameAllocator;
+		void* m_frameMem = nullptr;
+
+		// Of the thread scratch arenas.
+		uint32_t m_scratchSet = 0;
+
+		kt::Array<BlitRequest> m_blits;
+
+		// Every task of the frame, continuations included, is counted here so this is the only wait.
+		std::atomic<uint32_t> m_counter{ 0 };
+
+		// Copies every tile of m_blits once the frame is done, in FrameMode::Pipelined.
+		Task m_blitTask;
+		uint32_t m_blitTilesX = 0;
+		uint32_t m_blitTilesY = 0;
+
+		FrameStats m_stats;
+		bool m_inFlight = false;
+	};
+
+	static uint32_t const c_maxFrameSlots = 2;
+
+	// Wait for the frame in _slot, swap and blit if not done already, and make its stats current.
+	void RetireFrame(FrameSlot& _slot);
+
+	void* AllocFrameMemory(FrameSlot& _slot, size_t _size, size_t _align);
+
 	TaskSystem m_taskSystem;
 
-	BinContext m_binner;
-	kt::Array<DrawCall> m_drawCalls;
-};
+	FrameMode m_mode = FrameMode::Immediate;
 
+	FrameSlot m_slots[c_maxFrameSlots];
+	uint32_t m_numSlots = 1;
+
+	// Being recorded, between BeginFrame and EndFrame.
+	uint32_t m_curSlot = 0;
+
+	FrameStats m_frameStats;
+};
 
 
 
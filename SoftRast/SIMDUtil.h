@@ -20,6 +20,7 @@ namespace simdutil
 SR_AVX_CONST1_UINT(c_avxSignBit, 0x80000000);
 SR_AVX_CONST1_UINT(c_avxSignMask, 0x7FFFFFFF);
 SR_AVX_CONST1_UINT(c_avxExponentMask, 0x000000FF);
+SR_AVX_CONST1_UINT(c_avxMantissaMask, 0x007FFFFF);
 
 KT_FORCEINLINE __m256i ExtractExponent(__m256 _v)
 {
@@ -29,6 +30,20 @@ KT_FORCEINLINE __m256i ExtractExponent(__m256 _v)
 	return _mm256_sub_epi32(asuint, _mm256_set1_epi32(127));
 }
 
+// Approximate log2 (max abs error ~1e-4). Splits into exponent + log2(mantissa), with mantissa in [1, 2) fit by a 4th order polynomial.
+KT_FORCEINLINE __m256 Log2(__m256 _v)
+{
+	__m256 const exponent = _mm256_cvtepi32_ps(ExtractExponent(_v));
+	__m256 const m = _mm256_or_ps(_mm256_and_ps(_v, SR_AVX_LOAD_CONST_FLOAT(c_avxMantissaMask)), _mm256_set1_ps(1.0f));
+
+	__m256 poly = _mm256_fmadd_ps(_mm256_set1_ps(-0.081614486f), m, _mm256_set1_ps(0.64514372f));
+	poly = _mm256_fmadd_ps(poly, m, _mm256_set1_ps(-2.1206994f));
+	poly = _mm256_fmadd_ps(poly, m, _mm256_set1_ps(4.070135f));
+	poly = _mm256_fmadd_ps(poly, m, _mm256_set1_ps(-2.5128774f));
+
+	return _mm256_add_ps(exponent, poly);
+}
+
 KT_FORCEINLINE void Transpose8x8(__m256& _r0, __m256& _r1, __m256& _r2, __m256& _r3, __m256& _r4, __m256& _r5, __m256& _r6, __m256& _r7)
 {
 	// Reference:
@@ -144,6 +159,19 @@ KT_FORCEINLINE __m128 Lerp(__m128 _a, __m128 _b, __m128 _t)
 	return _mm_fmadd_ps(_t, _b, _mm_fnmadd_ps(_t, _a, _a));
 }
 
+// Lerp 4 packed 8 bit channels per 32 bit lane. Weights are 16 bit fixed point in [0, 256], replicated in both 16 bit halves of the lane.
+KT_FORCEINLINE __m256i LerpRGBA8(__m256i _a, __m256i _b, __m256i _w, __m256i _oneMinusW)
+{
+	__m256i const evenMask = _mm256_set1_epi32(0x00FF00FF);
+	__m256i const round = _mm256_set1_epi16(128);
+
+	// a * (256 - w) + b * w <= 255 * 256, fits in unsigned 16 bit.
+	__m256i const rb = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_and_si256(_a, evenMask), _oneMinusW), _mm256_mullo_epi16(_mm256_and_si256(_b, evenMask), _w)), round), 8);
+	__m256i const ga = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_srli_epi16(_a, 8), _oneMinusW), _mm256_mullo_epi16(_mm256_srli_epi16(_b, 8), _w)), round), 8);
+
+	return _mm256_or_si256(rb, _mm256_slli_epi16(ga, 8));
+}
+
 }
 
 }
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include <Windows.h>
+#include <string.h>
+
+#include "ScratchArena.h"
+#include "Config.h"
+
+namespace sr
+{
+
+// Large page size if they can be used by this process, otherwise 0. Needs the "Lock pages in memory" privilege, which is enabled here if the account holds it.
+static size_t LargePageSize()
+{
+#if SR_SCRATCH_LARGE_PAGES
+	static size_t const s_size = []() -> size_t
+	{
+		HANDLE token;
+		if (!::OpenProcessToken(::GetCurrentProcess(), TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token))
+		{
+			return 0;
+		}
+
+		TOKEN_PRIVILEGES privileges = {};
+		privileges.PrivilegeCount = 1;
+		privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+
+		// AdjustTokenPrivileges succeeds without the privilege being held, which is only reported through GetLastError.
+		bool const enabled = ::LookupPrivilegeValueA(nullptr, "SeLockMemoryPrivilege", &privileges.Privileges[0].Luid)
+			&& ::AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr, nullptr)
+			&& ::GetLastError() == ERROR_SUCCESS;
+
+		::CloseHandle(token);
+		return enabled ? ::GetLargePageMinimum() : 0;
+	}();
+
+	return s_size;
+#else
+	return 0;
+#endif
+}
+
+static size_t AlignedOffset(uint8_t const* _data, size_t _offset, size_t _align)
+{
+	uintptr_t const ptr = uintptr_t(_data) + _offset;
+	return _offset + (kt::AlignUp(ptr, uintptr_t(_align)) - ptr);
+}
+
+ScratchArena::~ScratchArena()
+{
+	Shutdown();
+}
+
+void ScratchArena::Init(uint32_t _numaNode)
+{
+	KT_ASSERT(!m_first);
+	m_numaNode = _numaNode;
+	m_largePages = LargePageSize() != 0;
+}
+
+void ScratchArena::Shutdown()
+{
+	Block* block = m_first;
+
+	while (block)
+	{
+		Block* next = block->m_next;
+		::VirtualFree(block, 0, MEM_RELEASE);
+		block = next;
+	}
+
+	m_first = nullptr;
+	m_current = nullptr;
+	m_offset = 0;
+	m_usedBeforeBlock = 0;
+	m_highWater = 0;
+}
+
+void* ScratchArena::Alloc(size_t _size, size_t _align)
+{
+	KT_ASSERT(kt::IsPow2(_align));
+
+	size_t begin = m_current ? AlignedOffset(m_current->Data(), m_offset, _align) : 0;
+
+	if (!m_current || begin + _size > m_current->m_capacity)
+	{
+		NextBlock(_size, _align);
+		begin = AlignedOffset(m_current->Data(), 0, _align);
+	}
+
+	size_t const end = begin + _size;
+	Commit(m_current, end);
+	m_offset = end;
+	m_highWater = kt::Max(m_highWater, m_usedBeforeBlock + m_offset);
+	return m_current->Data() + begin;
+}
+
+void* ScratchArena::Align(size_t _align)
+{
+	return Alloc(0, _align);
+}
+
+void* ScratchArena::GrowTop(void* _base, size_t _usedSize, size_t _extraSize)
+{
+	KT_ASSERT(m_current && (uint8_t*)_base + _usedSize == m_current->Data() + m_offset);
+
+	if (m_offset + _extraSize <= m_current->m_capacity)
+	{
+		Commit(m_current, m_offset + _extraSize);
+		m_offset += _extraSize;
+		m_highWater = kt::Max(m_highWater, m_usedBeforeBlock + m_offset);
+		return _base;
+	}
+
+	// Moved out, so the old copy is free again. Room to double, so growing one step at a time doesn't chain a block per step.
+	m_offset = (uint8_t*)_base - m_current->Data();
+	NextBlock(kt::Max(_usedSize + _extraSize, _usedSize * 2), c_headerSize);
+
+	uint8_t* newBase = m_current->Data();
+	Commit(m_current, _usedSize + _extraSize);
+	memcpy(newBase, _base, _usedSize);
+	m_offset = _usedSize + _extraSize;
+	m_highWater = kt::Max(m_highWater, m_usedBeforeBlock + m_offset);
+	return newBase;
+}
+
+void ScratchArena::Reset()
+{
+	m_current = m_first;
+	m_offset = 0;
+	m_usedBeforeBlock = 0;
+}
+
+ScratchArena::Stats ScratchArena::GetStats() const
+{
+	Stats stats;
+	stats.m_highWaterBytes = m_highWater;
+	stats.m_largePages = m_largePages;
+
+	for (Block const* block = m_first; block; block = block->m_next)
+	{
+		stats.m_committedBytes += block->m_committed + c_headerSize;
+		++stats.m_numBlocks;
+	}
+
+	return stats;
+}
+
+void ScratchArena::ResetHighWater()
+{
+	m_highWater = m_usedBeforeBlock + m_offset;
+}
+
+void ScratchArena::NextBlock(size_t _size, size_t _align)
+{
+	Block* prev = m_current;
+	Block* next = prev ? prev->m_next : m_first;
+
+	if (prev)
+	{
+		m_usedBeforeBlock += m_offset;
+	}
+
+	// Block data is aligned to the header size, so only larger alignments can need padding.
+	size_t const needed = _size + (_align > c_headerSize ? _align : 0);
+
+	if (!next || next->m_capacity < needed)
+	{
+		// Chained blocks double in size, so a frame that overflows settles into a few blocks.
+		Block* block = CreateBlock(kt::Max(needed, prev ? prev->m_capacity * 2 : 0));
+		block->m_next = next;
+
+		if (prev)
+		{
+			prev->m_next = block;
+		}
+		else
+		{
+			m_first = block;
+		}
+
+		next = block;
+	}
+
+	m_current = next;
+	m_offset = 0;
+}
+
+ScratchArena::Block* ScratchArena::CreateBlock(size_t _minCapacity)
+{
+	HANDLE const process = ::GetCurrentProcess();
+
+	if (m_largePages)
+	{
+		// Large pages can't be committed on demand, so each block is committed whole.
+		size_t const size = kt::AlignUp(kt::Max(size_t(Config::c_scratchLargePageBlockSize), _minCapacity + c_headerSize), LargePageSize());
+
+		if (void* ptr = ::VirtualAllocExNuma(process, nullptr, size, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE, m_numaNode))
+		{
+			Block* block = (Block*)ptr;
+			block->m_next = nullptr;
+			block->m_capacity = size - c_headerSize;
+			block->m_committed = block->m_capacity;
+			return block;
+		}
+
+		// Physical memory is too fragmented for large pages, use regular pages from now on.
+		m_largePages = false;
+	}
+
+	size_t const size = kt::AlignUp(kt::Max(size_t(Config::c_scratchReserveSize), _minCapacity + c_headerSize), size_t(Config::c_scratchCommitSize));
+
+	void* ptr = ::VirtualAllocExNuma(process, nullptr, size, MEM_RESERVE, PAGE_READWRITE, m_numaNode);
+	KT_ASSERT(ptr);
+
+	void* header = ::VirtualAllocExNuma(process, ptr, Config::c_scratchCommitSize, MEM_COMMIT, PAGE_READWRITE, m_numaNode);
+	KT_ASSERT(header);
+	KT_UNUSED(header);
+
+	Block* block = (Block*)ptr;
+	block->m_next = nullptr;
+	block->m_capacity = size - c_headerSize;
+	block->m_committed = Config::c_scratchCommitSize - c_headerSize;
+	return block;
+}
+
+void ScratchArena::Commit(Block* _block, size_t _end)
+{
+	if (_end <= _block->m_committed)
+	{
+		return;
+	}
+
+	// Commit boundaries are kept at multiples of c_scratchCommitSize from the start of the block.
+	size_t const committed = kt::Min(kt::AlignUp(_end + c_headerSize, size_t(Config::c_scratchCommitSize)) - c_headerSize, _block->m_capacity);
+
+	void* ptr = ::VirtualAllocExNuma(::GetCurrentProcess(), _block->Data() + _block->m_committed, committed - _block->m_committed, MEM_COMMIT, PAGE_READWRITE, m_numaNode);
+	KT_ASSERT(ptr);
+	KT_UNUSED(ptr);
+
+	_block->m_committed = committed;
+}
+
+ScratchArena::AllocScope::AllocScope(ScratchArena& _arena)
+	: m_arena(_arena)
+	, m_block(_arena.m_current)
+	, m_offset(_arena.m_offset)
+	, m_usedBeforeBlock(_arena.m_usedBeforeBlock)
+{
+}
+
+ScratchArena::AllocScope::~AllocScope()
+{
+	m_arena.m_current = m_block;
+	m_arena.m_offset = m_offset;
+	m_arena.m_usedBeforeBlock = m_usedBeforeBlock;
+}
+
+}
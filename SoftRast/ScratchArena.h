@@ -0,0 +1,100 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include <kt/kt.h>
+
+namespace sr
+{
+
+// Linear allocator over reserved address space, committed in Config::c_scratchCommitSize steps as it is first used.
+// When large pages can be enabled it is made of fully committed large page blocks instead. Either way running off the end of a block chains another, which is kept for reuse after Reset.
+class ScratchArena
+{
+	struct Block;
+
+public:
+	KT_NO_COPY(ScratchArena);
+
+	ScratchArena() = default;
+	~ScratchArena();
+
+	struct Stats
+	{
+		// Most bytes in use at once since the last ResetHighWater, alignment padding included.
+		size_t m_highWaterBytes = 0;
+		size_t m_committedBytes = 0;
+		uint32_t m_numBlocks = 0;
+		bool m_largePages = false;
+	};
+
+	// Frees everything allocated within its lifetime.
+	struct AllocScope
+	{
+		KT_NO_COPY(AllocScope);
+
+		explicit AllocScope(ScratchArena& _arena);
+		~AllocScope();
+
+		ScratchArena& m_arena;
+		Block* m_block;
+		size_t m_offset;
+		size_t m_usedBeforeBlock;
+	};
+
+	// Nothing is committed until the first allocation, which must be made by the thread that should first touch the memory.
+	void Init(uint32_t _numaNode);
+	void Shutdown();
+
+	void* Alloc(size_t _size, size_t _align = 16);
+
+	// Align the top of the arena and return it without allocating. Grow from there with GrowTop.
+	void* Align(size_t _align);
+
+	// Grow the allocation [_base, _base + _usedSize) at the top of the arena by _extraSize bytes.
+	// Returns the possibly moved base: if the block is full the used bytes are copied to the start of the next one.
+	void* GrowTop(void* _base, size_t _usedSize, size_t _extraSize);
+
+	void Reset();
+
+	// Since the last Reset, alignment padding included.
+	size_t BytesInUse() const { return m_usedBeforeBlock + m_offset; }
+
+	Stats GetStats() const;
+	void ResetHighWater();
+
+private:
+	struct Block
+	{
+		Block* m_next;
+
+		// Usable bytes follow the header.
+		size_t m_capacity;
+		size_t m_committed;
+
+		uint8_t* Data() { return (uint8_t*)this + c_headerSize; }
+	};
+
+	static size_t const c_headerSize = 64;
+
+	// Make the current block the next one able to hold _size bytes at _align, chaining a new block if there is none.
+	void NextBlock(size_t _size, size_t _align);
+	Block* CreateBlock(size_t _minCapacity);
+	void Commit(Block* _block, size_t _end);
+
+	Block* m_first = nullptr;
+	Block* m_current = nullptr;
+
+	// Into m_current.
+	size_t m_offset = 0;
+
+	// Bytes used in the blocks before m_current.
+	size_t m_usedBeforeBlock = 0;
+
+	size_t m_highWater = 0;
+
+	uint32_t m_numaNode = 0;
+	bool m_largePages = false;
+};
+
+}
@@ -18,5 +18,65 @@ enum class IndexType
 	u32
 };
 
+enum class TextureFormat : uint32_t
+{
+	RGBA8,
+	BC1,
+	BC3,
+	R8,
+	RG8,
+	R16F,
+	R32F,
+
+	// Creation only: BC1 if every texel is opaque, otherwise BC3.
+	BC_Auto
+};
+
+enum class AddressMode : uint32_t
+{
+	Wrap,
+	Clamp,
+	Mirror
+};
+
+enum class PositionFormat : uint32_t
+{
+	Float3,
+	Unorm16x3 // Dequantized with the draw call's position scale and offset.
+};
+
+// Formats of the attributes making up a VertexLayout, each decodes into one or more float varyings.
+enum class AttributeFormat : uint32_t
+{
+	Float,
+	Float2,
+	Float3,
+	Half2,
+	Unorm16x3, // 3 varyings, dequantized with the draw call's position scale and offset (i.e. a quantized position).
+	OctSnorm16x2 // 3 varyings, unit vector in octahedral encoding.
+};
+
+enum class FilterMode : uint32_t
+{
+	Point,
+	Bilinear,
+	Trilinear
+};
+
+// A cluster of consecutive triangles of an index buffer, with model space bounds for culling the whole cluster at once (see DrawCall::SetMeshlets).
+struct Meshlet
+{
+	float m_center[3];
+	float m_radius;
+
+	// Cone of the triangle normals cross(p1 - p0, p2 - p0): they all point away from any position p where
+	// dot(m_center - p, m_coneAxis) >= m_coneCutoff * |m_center - p| + m_radius. A cutoff of 1 is never satisfied, for clusters facing too many directions.
+	float m_coneAxis[3];
+	float m_coneCutoff;
+
+	uint32_t m_firstTri;
+	uint32_t m_numTris;
+};
+
 
 }
\ No newline at end of file
@@ -1,8 +1,13 @@
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <string.h>
 
 #include "TaskSystem.h"
 #include "kt/Strings.h"
+#include "kt/Memory.h"
+
+// WaitOnAddress/WakeByAddressAll
+#pragma comment(lib, "Synchronization.lib")
 
 thread_local uint32_t tls_threadIndex;
 
@@ -14,39 +19,180 @@ uint32_t TaskSystem::TlsThreadIdx()
 	return tls_threadIndex;
 }
 
-void TaskSystem::InitFromMainThread(uint32_t const _numWorkers)
+// A core a worker can be placed on.
+struct WorkerSlot
 {
-	// main thread is 0
+	GROUP_AFFINITY m_affinity;
+	uint32_t m_numaNode;
+	bool m_pinned;
+};
+
+static bool QueryProcessorInfo(LOGICAL_PROCESSOR_RELATIONSHIP _relationship, kt::Array<uint8_t>& o_buffer)
+{
+	DWORD size = 0;
+	::GetLogicalProcessorInformationEx(_relationship, nullptr, &size);
+
+	if (::GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+	{
+		return false;
+	}
+
+	o_buffer.Resize(size);
+	return ::GetLogicalProcessorInformationEx(_relationship, (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX*)o_buffer.Data(), &size) != 0;
+}
+
+template <typename FnT>
+static void ForEachProcessorInfo(kt::Array<uint8_t> const& _buffer, FnT&& _fn)
+{
+	for (uint32_t offset = 0; offset < _buffer.Size();)
+	{
+		SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const* info = (SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const*)(_buffer.Data() + offset);
+		_fn(*info);
+		offset += info->Size;
+	}
+}
+
+// Slots in the order workers take them. Empty if the topology can't be queried, in which case workers are left unpinned.
+static void BuildWorkerSlots(WorkerPlacement _placement, kt::Array<WorkerSlot>& o_slots)
+{
+	o_slots.Clear();
+
+	kt::Array<uint8_t> coreInfo;
+	kt::Array<uint8_t> nodeInfo;
+
+	if (_placement == WorkerPlacement::Unpinned
+		|| !QueryProcessorInfo(RelationProcessorCore, coreInfo)
+		|| !QueryProcessorInfo(RelationNumaNode, nodeInfo))
+	{
+		return;
+	}
+
+	auto nodeOf = [&nodeInfo](WORD _group, KAFFINITY _mask) -> uint32_t
+	{
+		uint32_t node = 0;
+		ForEachProcessorInfo(nodeInfo, [&](SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const& _info)
+		{
+			if (_info.NumaNode.GroupMask.Group == _group && (_info.NumaNode.GroupMask.Mask & _mask))
+			{
+				node = _info.NumaNode.NodeNumber;
+			}
+		});
+		return node;
+	};
 
-	m_packets = (TaskPacket*)kt::Malloc(sizeof(TaskPacket) * MAX_TASK_PACKETS);
+	auto nodeMask = [&nodeInfo](uint32_t _node, GROUP_AFFINITY& o_affinity)
+	{
+		ForEachProcessorInfo(nodeInfo, [&](SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const& _info)
+		{
+			if (_info.NumaNode.NodeNumber == _node)
+			{
+				o_affinity = _info.NumaNode.GroupMask;
+			}
+		});
+	};
 
-	tls_threadIndex = 0;
+	// Logical processors of each core, nth sibling of every core before the n+1th of any, so SMT siblings come last.
+	for (uint32_t sibling = 0; sibling < 64; ++sibling)
+	{
+		bool anyCore = false;
 
-	m_numWorkers = _numWorkers;
+		ForEachProcessorInfo(coreInfo, [&](SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX const& _info)
+		{
+			GROUP_AFFINITY const& coreMask = _info.Processor.GroupMask[0];
+
+			KAFFINITY mask = coreMask.Mask;
+			for (uint32_t i = 0; i < sibling && mask; ++i)
+			{
+				mask &= mask - 1;
+			}
+
+			if (!mask)
+			{
+				return;
+			}
+
+			anyCore = true;
+
+			if (_placement == WorkerPlacement::OnePerPhysicalCore && sibling > 0)
+			{
+				return;
+			}
+
+			KAFFINITY const logical = mask & (~mask + 1);
+
+			WorkerSlot& slot = o_slots.PushBack();
+			memset(&slot.m_affinity, 0, sizeof(slot.m_affinity));
+			slot.m_affinity.Group = coreMask.Group;
+			slot.m_numaNode = nodeOf(coreMask.Group, logical);
+			slot.m_pinned = true;
+
+			switch (_placement)
+			{
+				case WorkerPlacement::AllLogicalCores: slot.m_affinity.Mask = logical; break;
+				case WorkerPlacement::OnePerPhysicalCore: slot.m_affinity.Mask = coreMask.Mask; break;
+				case WorkerPlacement::NumaNodePools: nodeMask(slot.m_numaNode, slot.m_affinity); break;
+				default: break;
+			}
+		});
+
+		if (!anyCore)
+		{
+			break;
+		}
+	}
+}
+
+static uint32_t CurrentNumaNode()
+{
+	PROCESSOR_NUMBER processor;
+	::GetCurrentProcessorNumberEx(&processor);
+
+	USHORT node = 0;
+	return ::GetNumaProcessorNodeEx(&processor, &node) ? node : 0;
+}
+
+void TaskSystem::InitFromMainThread(WorkerConfig const& _config)
+{
+	kt::Array<WorkerSlot> slots;
+	BuildWorkerSlots(_config.m_placement, slots);
+
+	// The main thread stays where it is and counts as the first slot.
+	uint32_t const maxWorkers = slots.Size() ? slots.Size() - 1 : kt::LogicalCoreCount() - 1;
+	uint32_t const numWorkers = kt::Min(_config.m_numWorkers, maxWorkers);
+
+	// main thread is 0
+
+	m_numWorkers = numWorkers;
+
+	m_deques = new WorkerDeque[TotalThreadsIncludingMainThread()];
 
 	// including main thread
-	m_allocators = new PaddedScratchAllocator[TotalThreadsIncludingMainThread()];
+	m_allocators = new PaddedScratchAllocator[TotalThreadsIncludingMainThread() * c_maxScratchSets];
+
+	uint32_t const mainNode = CurrentNumaNode();
 
+	// Set up front, thieves read the nodes of every deque.
+	m_multipleNumaNodes = false;
 	for (uint32_t i = 0; i < TotalThreadsIncludingMainThread(); ++i)
 	{
-		static const size_t MEM_SIZE = 128 * 1024 * 1024;
+		uint32_t const node = i && slots.Size() ? slots[i].m_numaNode : mainNode;
+		m_deques[i].m_numaNode = node;
+		m_multipleNumaNodes |= node != mainNode;
 
-		ThreadScratchAllocator& alloc = m_allocators[i];
-		// Todo: virtual mem kt wrapper
-		void* ptr = ::VirtualAlloc(nullptr, MEM_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
-		KT_ASSERT(ptr);
-		alloc.Init(ptr, MEM_SIZE);
+		// Any non zero seed, distinct per thread.
+		m_deques[i].m_rng = 0x9E3779B9u * (i + 1);
 	}
 
-	if (!_numWorkers)
+	InitThreadLocal(0);
+
+	if (!numWorkers)
 	{
 		return;
 	}
 
-	m_threads = new kt::Thread[_numWorkers];
+	m_threads = new kt::Thread[numWorkers];
 	
-	std::atomic<uint32_t> initCounter{ _numWorkers };
-	m_numWorkers = _numWorkers;
+	std::atomic<uint32_t> initCounter{ numWorkers };
 
 	struct ThreadInitData
 	{
@@ -54,13 +200,14 @@ void TaskSystem::InitFromMainThread(uint32_t const _numWorkers)
 		uint32_t threadId;
 		TaskSystem* sys;
 		char const* name;
+		WorkerSlot slot;
 	};
 
-	ThreadInitData* initData = (ThreadInitData*)KT_ALLOCA(sizeof(ThreadInitData) * _numWorkers);
+	ThreadInitData* initData = (ThreadInitData*)KT_ALLOCA(sizeof(ThreadInitData) * numWorkers);
 
-	kt::String128* threadNames = (kt::String128*)KT_ALLOCA(sizeof(kt::String128) * _numWorkers);
+	kt::String128* threadNames = (kt::String128*)KT_ALLOCA(sizeof(kt::String128) * numWorkers);
 
-	for (uint32_t i = 0; i < _numWorkers; ++i)
+	for (uint32_t i = 0; i < numWorkers; ++i)
 	{
 		kt::Thread& t = m_threads[i];
 		ThreadInitData& data = initData[i];
@@ -73,13 +220,31 @@ void TaskSystem::InitFromMainThread(uint32_t const _numWorkers)
 		data.initCounter = &initCounter;
 		data.name = threadNames[i].Data();
 
+		if (slots.Size())
+		{
+			data.slot = slots[i + 1];
+		}
+		else
+		{
+			memset(&data.slot, 0, sizeof(data.slot));
+		}
+
 		t.Run([](kt::Thread* _self) 
 		{ 
 			ThreadInitData* data = (ThreadInitData*)_self->GetUserData();
 			TaskSystem* sys = data->sys;
-			tls_threadIndex = data->threadId;
-			std::atomic_fetch_sub_explicit(data->initCounter, 1, std::memory_order_acquire);
-			sys->WorkerLoop(data->threadId);
+			uint32_t const threadId = data->threadId;
+
+			// Pin first, so the scratch memory is touched from the right node.
+			if (data->slot.m_pinned)
+			{
+				::SetThreadGroupAffinity(::GetCurrentThread(), &data->slot.m_affinity, nullptr);
+			}
+
+			sys->InitThreadLocal(threadId);
+
+			std::atomic_fetch_sub_explicit(data->initCounter, 1, std::memory_order_acq_rel);
+			sys->WorkerLoop(threadId);
 		}, 
 		&data, threadNames[i].Data());
 	}
@@ -87,14 +252,30 @@ void TaskSystem::InitFromMainThread(uint32_t const _numWorkers)
 	while(std::atomic_load(&initCounter) != 0) {}
 }
 
+void TaskSystem::InitThreadLocal(uint32_t _threadIdx)
+{
+	tls_threadIndex = _threadIdx;
+
+	WorkerDeque& deque = m_deques[_threadIdx];
+	deque.m_packets = (TaskPacket*)kt::Malloc(sizeof(TaskPacket) * MAX_TASK_PACKETS);
+
+	for (uint32_t set = 0; set < c_maxScratchSets; ++set)
+	{
+		m_allocators[_threadIdx * c_maxScratchSets + set].Init(deque.m_numaNode);
+	}
+}
+
 void TaskSystem::WaitAndShutdown()
 {
-	while (std::atomic_load_explicit(&m_numEntriesInQueue, std::memory_order_acquire) > 0)
+	while (HasQueuedPackets())
 	{
-		TryRunOnePacket_NoLock();
+		TryRunOnePacket();
 	}
 
-	std::atomic_store_explicit(&m_keepRunning, 0, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lk(m_mutex);
+		std::atomic_store_explicit(&m_keepRunning, 0, std::memory_order_relaxed);
+	}
 
 	m_condVar.notify_all();
 
@@ -103,58 +284,81 @@ void TaskSystem::WaitAndShutdown()
 		m_threads[i].Join();
 	}
 
-	ResetAllocators();
+	for (uint32_t set = 0; set < c_maxScratchSets; ++set)
+	{
+		ResetAllocators(set);
+	}
+
+	for (uint32_t i = 0; i < TotalThreadsIncludingMainThread(); ++i)
+	{
+		kt::Free(m_deques[i].m_packets);
+	}
 
 	delete[] m_threads;
 	delete[] m_allocators;
-
-	kt::Free(m_packets);
+	delete[] m_deques;
 
 	m_threads = nullptr;
-	m_packets = nullptr;
+	m_deques = nullptr;
 	m_allocators = nullptr;
 }
 
 void TaskSystem::PushTask(Task* _task)
 {
-	uint32_t totalTasks = 0;
+	uint32_t const threadIdx = tls_threadIndex;
+	KT_ASSERT(threadIdx < TotalThreadsIncludingMainThread());
+	WorkerDeque& deque = m_deques[threadIdx];
+
+	uint32_t const totalTasks = (_task->m_totalPartitions + _task->m_granularity - 1) / _task->m_granularity;
+	KT_ASSERT(totalTasks);
+	KT_ASSERT(std::atomic_load_explicit(&_task->m_numDependencies, std::memory_order_relaxed) == 0);
+
+	if (_task->m_continuation)
 	{
-		std::lock_guard<std::mutex> lk(m_mutex);
+		std::atomic_store_explicit(&_task->m_numPacketsLeft, totalTasks, std::memory_order_relaxed);
+	}
 
-		// split up task
-		uint32_t lastEnd = 0;
+	// Counted up front, packets can be stolen and finished as soon as they are published.
+	if (_task->m_taskCounter)
+	{
+		std::atomic_fetch_add_explicit(_task->m_taskCounter, totalTasks, std::memory_order_acquire);
+	}
 
-		uint32_t tasksPushed = 0;
+	// Split up the task and publish it in batches, each with a single store to the bottom of the deque.
+	static uint32_t const c_batchSize = 64;
+	TaskPacket batch[c_batchSize];
 
-		totalTasks = (_task->m_totalPartitions + _task->m_granularity - 1) / _task->m_granularity;
-		KT_ASSERT(totalTasks);
+	uint32_t lastEnd = 0;
+	uint32_t tasksPushed = 0;
 
-		if (_task->m_taskCounter)
-		{
-			std::atomic_fetch_add_explicit(_task->m_taskCounter, totalTasks, std::memory_order_acquire);
-		}
+	while (lastEnd < _task->m_totalPartitions)
+	{
+		uint32_t batchCount = 0;
 
-		while (lastEnd < _task->m_totalPartitions)
+		while (batchCount < c_batchSize && lastEnd < _task->m_totalPartitions)
 		{
-			++tasksPushed;
-			if (m_numEntriesInQueue == MAX_TASK_PACKETS)
-			{
-				KT_ASSERT(false);
-				return;
-			}
-
-			TaskPacket& p = m_packets[m_queueHead];
-			m_queueHead = (m_queueHead + 1) & QUEUE_MASK;
-			std::atomic_fetch_add_explicit(&m_numEntriesInQueue, 1, std::memory_order_acquire);
+			TaskPacket& p = batch[batchCount++];
 			p.m_task = _task;
 			p.m_begin = lastEnd;
 			lastEnd = kt::Min(lastEnd + _task->m_granularity, _task->m_totalPartitions);
 			p.m_end = lastEnd;
 		}
-		KT_ASSERT(totalTasks == tasksPushed);
+
+		tasksPushed += batchCount;
+
+		if (!deque.Push(batch, batchCount))
+		{
+			// Deque is full, run the batch here rather than block.
+			for (uint32_t i = 0; i < batchCount; ++i)
+			{
+				RunPacket(batch[i], threadIdx);
+			}
+		}
 	}
 
-	m_condVar.notify_all();
+	KT_ASSERT(totalTasks == tasksPushed);
+
+	WakeWorkers(totalTasks);
 }
 
 void TaskSystem::SyncAndWaitForAll()
@@ -164,22 +368,102 @@ void TaskSystem::SyncAndWaitForAll()
 
 void TaskSystem::WaitForCounter(std::atomic<uint32_t>* _counter)
 {
-	for(;;)
+	// Pause iterations with nothing to steal before parking.
+	static uint32_t const c_spinsBeforePark = 256;
+
+	uint32_t const threadIdx = tls_threadIndex;
+	KT_ASSERT(threadIdx < TotalThreadsIncludingMainThread());
+	TaskWaitStats& stats = m_deques[threadIdx].m_waitStats;
+	++stats.m_numWaits;
+
+	for (;;)
 	{
-		if (std::atomic_load_explicit(_counter, std::memory_order_acquire) == 0)
+		// Help out while there is anything queued, the remaining packets may be running elsewhere.
+		while (std::atomic_load_explicit(_counter, std::memory_order_acquire) > 0 && TryRunOnePacket()) {}
+
+		uint32_t value = std::atomic_load_explicit(_counter, std::memory_order_acquire);
+
+		if (value == 0)
 		{
 			return;
 		}
-		if (!TryRunOnePacket_NoLock())
+
+		TaskPacket packet;
+		bool stolen = false;
+
+		kt::TimePoint const spinBegin = kt::TimePoint::Now();
+
+		for (uint32_t i = 0; i < c_spinsBeforePark; ++i)
 		{
-			break;
+			_mm_pause();
+
+			value = std::atomic_load_explicit(_counter, std::memory_order_acquire);
+			if (value == 0)
+			{
+				break;
+			}
+
+			if (TryPopOrStealPacket(threadIdx, packet))
+			{
+				stolen = true;
+				break;
+			}
+		}
+
+		stats.m_spinTime += kt::TimePoint::Now() - spinBegin;
+
+		if (stolen)
+		{
+			RunPacket(packet, threadIdx);
+			continue;
+		}
+
+		if (value == 0)
+		{
+			return;
 		}
+
+		// Register before the final check, pairs with RunPacket decrementing before looking for parked waiters.
+		std::atomic_fetch_add_explicit(&m_numParkedWaiters, 1, std::memory_order_seq_cst);
+
+		value = std::atomic_load_explicit(_counter, std::memory_order_seq_cst);
+
+		if (value != 0)
+		{
+			kt::TimePoint const parkBegin = kt::TimePoint::Now();
+
+			// Returns straight away if the counter no longer holds value. Spurious wake ups just go around again.
+			::WaitOnAddress(_counter, &value, sizeof(value), INFINITE);
+
+			stats.m_parkedTime += kt::TimePoint::Now() - parkBegin;
+			++stats.m_numParks;
+		}
+
+		std::atomic_fetch_sub_explicit(&m_numParkedWaiters, 1, std::memory_order_relaxed);
 	}
+}
 
-	while (std::atomic_load_explicit(_counter, std::memory_order_acquire) > 0)
+TaskWaitStats TaskSystem::GetWaitStats() const
+{
+	TaskWaitStats total;
+
+	for (uint32_t i = 0; i < TotalThreadsIncludingMainThread(); ++i)
 	{
-		// dumb spin, todo: semaphore wait?
-		_mm_pause();
+		TaskWaitStats const& stats = m_deques[i].m_waitStats;
+		total.m_spinTime += stats.m_spinTime;
+		total.m_parkedTime += stats.m_parkedTime;
+		total.m_numWaits += stats.m_numWaits;
+		total.m_numParks += stats.m_numParks;
+	}
+
+	return total;
+}
+
+void TaskSystem::ResetWaitStats()
+{
+	for (uint32_t i = 0; i < TotalThreadsIncludingMainThread(); ++i)
+	{
+		m_deques[i].m_waitStats = TaskWaitStats{};
 	}
 }
 
@@ -188,90 +472,314 @@ uint32_t TaskSystem::TotalThreadsIncludingMainThread() const
 	return m_numWorkers + 1;
 }
 
-ThreadScratchAllocator& TaskSystem::ThreadAllocator() const
+ThreadScratchAllocator& TaskSystem::ThreadAllocator(uint32_t _set) const
 {
 	uint32_t const idx = tls_threadIndex;
-	KT_ASSERT(idx < TotalThreadsIncludingMainThread());
-	return m_allocators[idx];
+	KT_ASSERT(idx < TotalThreadsIncludingMainThread() && _set < c_maxScratchSets);
+	return m_allocators[idx * c_maxScratchSets + _set];
 }
 
-void TaskSystem::ResetAllocators()
+void TaskSystem::ResetAllocators(uint32_t _set)
 {
+	KT_ASSERT(_set < c_maxScratchSets);
 	for (uint32_t i = 0; i < TotalThreadsIncludingMainThread(); ++i)
 	{
-		m_allocators[i].Reset();
+		m_allocators[i * c_maxScratchSets + _set].Reset();
+		m_allocators[i * c_maxScratchSets + _set].ResetHighWater();
+	}
+}
+
+void TaskSystem::RewindAllocators(uint32_t _set)
+{
+	KT_ASSERT(_set < c_maxScratchSets);
+	for (uint32_t i = 0; i < TotalThreadsIncludingMainThread(); ++i)
+	{
+		m_allocators[i * c_maxScratchSets + _set].Reset();
+	}
+}
+
+ScratchStats TaskSystem::GetScratchStats(uint32_t _set) const
+{
+	KT_ASSERT(_set < c_maxScratchSets);
+	ScratchStats stats;
+
+	for (uint32_t i = 0; i < TotalThreadsIncludingMainThread(); ++i)
+	{
+		ScratchArena::Stats const arena = m_allocators[i * c_maxScratchSets + _set].GetStats();
+		stats.m_maxThreadHighWaterBytes = kt::Max(stats.m_maxThreadHighWaterBytes, arena.m_highWaterBytes);
+		stats.m_totalHighWaterBytes += arena.m_highWaterBytes;
+		stats.m_committedBytes += arena.m_committedBytes;
+		stats.m_numBlocks += arena.m_numBlocks;
+		stats.m_numLargePageThreads += arena.m_largePages ? 1 : 0;
+	}
+
+	return stats;
+}
+
+TaskHandle::~TaskHandle()
+{
+	Wait();
+}
+
+void TaskHandle::Wait()
+{
+	if (m_taskSystem && !IsDone())
+	{
+		m_taskSystem->WaitForCounter(&m_counter);
 	}
 }
 
+bool TaskHandle::IsDone() const
+{
+	return std::atomic_load_explicit(&m_counter, std::memory_order_acquire) == 0;
+}
+
 void TaskSystem::WorkerLoop(uint32_t _threadId)
 {
-	std::unique_lock<std::mutex> lk(m_mutex);
+	// Failed steal rounds before going to sleep.
+	static uint32_t const c_spinsBeforeSleep = 64;
+
+	uint32_t spins = 0;
 
 	while (std::atomic_load_explicit(&m_keepRunning, std::memory_order_acquire))
 	{
+		TaskPacket packet;
+
+		if (TryPopOrStealPacket(_threadId, packet))
 		{
-			m_condVar.wait(lk, [this]() 
-			{
-				return std::atomic_load_explicit(&m_keepRunning, std::memory_order_acquire) == 0 
-						   || std::atomic_load_explicit(&m_numEntriesInQueue, std::memory_order_acquire) > 0; 
-			});
+			RunPacket(packet, _threadId);
+			spins = 0;
+			continue;
 		}
 
-		TaskPacket packet;
+		if (++spins < c_spinsBeforeSleep)
+		{
+			_mm_pause();
+			continue;
+		}
+
+		spins = 0;
 
-		if (TryPopPacket_WithLock(packet))
+		std::unique_lock<std::mutex> lk(m_mutex);
+
+		// Register as sleeping before the final check for work. Pushers publish before reading the sleeper count, so either we see their packets or they see us.
+		std::atomic_fetch_add_explicit(&m_numSleepingWorkers, 1, std::memory_order_seq_cst);
+
+		if (!HasQueuedPackets())
 		{
-			std::atomic_fetch_add_explicit(&m_numActiveWorkers, 1, std::memory_order_acquire);
+			m_condVar.wait(lk, [this]()
+			{
+				return m_numWakeTokens > 0 || std::atomic_load_explicit(&m_keepRunning, std::memory_order_acquire) == 0;
+			});
 
-			lk.unlock();
-			packet.m_task->m_fn(packet.m_task, tls_threadIndex, packet.m_begin, packet.m_end);
-			if (packet.m_task->m_taskCounter)
+			if (m_numWakeTokens)
 			{
-				std::atomic_fetch_sub_explicit(packet.m_task->m_taskCounter, 1, std::memory_order_release);
+				--m_numWakeTokens;
 			}
-			lk.lock();
-			std::atomic_fetch_sub_explicit(&m_numActiveWorkers, 1, std::memory_order_release);
 		}
 
+		std::atomic_fetch_sub_explicit(&m_numSleepingWorkers, 1, std::memory_order_relaxed);
 	}
+}
 
-	lk.unlock();
+void TaskSystem::WakeWorkers(uint32_t _numPackets)
+{
+	// Pairs with the sleeper registering itself before checking the deques.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	if (!std::atomic_load_explicit(&m_numSleepingWorkers, std::memory_order_relaxed))
+	{
+		return;
+	}
+
+	uint32_t numToWake = 0;
+	{
+		std::lock_guard<std::mutex> lk(m_mutex);
+		uint32_t const sleeping = std::atomic_load_explicit(&m_numSleepingWorkers, std::memory_order_relaxed);
+		uint32_t const notYetWoken = sleeping > m_numWakeTokens ? sleeping - m_numWakeTokens : 0;
+		numToWake = kt::Min(_numPackets, notYetWoken);
+		m_numWakeTokens += numToWake;
+	}
+
+	// Only as many as there is work for, the rest stay asleep.
+	for (uint32_t i = 0; i < numToWake; ++i)
+	{
+		m_condVar.notify_one();
+	}
 }
 
+void TaskSystem::RunPacket(TaskPacket const& _packet, uint32_t _threadIdx)
+{
+	Task* const task = _packet.m_task;
+	std::atomic<uint32_t>* counter = task->m_taskCounter;
+
+	task->m_fn(task, _threadIdx, _packet.m_begin, _packet.m_end);
+
+	if (task->m_continuation && std::atomic_fetch_sub_explicit(&task->m_numPacketsLeft, 1, std::memory_order_acq_rel) == 1)
+	{
+		Task* const next = task->m_continuation;
+		if (std::atomic_fetch_sub_explicit(&next->m_numDependencies, 1, std::memory_order_acq_rel) == 1)
+		{
+			PushTask(next);
+		}
+	}
+
+	// The counter may live on the waiter's stack, its address is only used as a key once it hits zero.
+	if (counter
+		&& std::atomic_fetch_sub_explicit(counter, 1, std::memory_order_seq_cst) == 1
+		&& std::atomic_load_explicit(&m_numParkedWaiters, std::memory_order_seq_cst))
+	{
+		::WakeByAddressAll(counter);
+	}
+}
 
-bool TaskSystem::TryRunOnePacket_NoLock()
+bool TaskSystem::TryRunOnePacket()
 {
+	uint32_t const threadIdx = tls_threadIndex;
 	TaskPacket packet;
-	bool popped = false;
+
+	if (TryPopOrStealPacket(threadIdx, packet))
 	{
-		std::lock_guard<std::mutex> mt(m_mutex);
+		RunPacket(packet, threadIdx);
+		return true;
+	}
 
-		popped = TryPopPacket_WithLock(packet);
+	return false;
+}
+
+bool TaskSystem::TryPopOrStealPacket(uint32_t _threadIdx, TaskPacket& o_packet)
+{
+	WorkerDeque& self = m_deques[_threadIdx];
+
+	if (self.Pop(o_packet))
+	{
+		return true;
 	}
 
-	if (popped)
+	uint32_t const numThreads = TotalThreadsIncludingMainThread();
+
+	if (numThreads == 1)
+	{
+		return false;
+	}
+
+	// Start at a random victim so thieves spread out rather than all hitting the same deque.
+	uint32_t rng = self.m_rng;
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	self.m_rng = rng;
+
+	uint32_t const first = rng % numThreads;
+
+	// Same node victims first, then the rest.
+	for (uint32_t pass = 0; pass < (m_multipleNumaNodes ? 2u : 1u); ++pass)
 	{
-		packet.m_task->m_fn(packet.m_task, tls_threadIndex, packet.m_begin, packet.m_end);
-		if (packet.m_task->m_taskCounter)
+		for (uint32_t i = 0; i < numThreads; ++i)
 		{
-			std::atomic_fetch_sub_explicit(packet.m_task->m_taskCounter, 1, std::memory_order_release);
+			uint32_t const victim = (first + i) % numThreads;
+			bool const sameNode = m_deques[victim].m_numaNode == self.m_numaNode;
+
+			if (victim != _threadIdx
+				&& (!m_multipleNumaNodes || sameNode == (pass == 0))
+				&& m_deques[victim].Steal(o_packet))
+			{
+				return true;
+			}
 		}
 	}
 
-	return popped;
+	return false;
 }
 
-bool TaskSystem::TryPopPacket_WithLock(TaskPacket& o_packet)
+bool TaskSystem::HasQueuedPackets() const
 {
-	if (std::atomic_load_explicit(&m_numEntriesInQueue, std::memory_order_relaxed))
+	for (uint32_t i = 0; i < TotalThreadsIncludingMainThread(); ++i)
 	{
-		o_packet = m_packets[m_queueTail];
-		m_queueTail = (m_queueTail + 1) & QUEUE_MASK;
-		std::atomic_fetch_sub_explicit(&m_numEntriesInQueue, 1, std::memory_order_relaxed);
-		return true;
+		if (!m_deques[i].Empty())
+		{
+			return true;
+		}
 	}
 
 	return false;
 }
 
+bool TaskSystem::WorkerDeque::Push(TaskPacket const* _packets, uint32_t _num)
+{
+	int64_t const b = std::atomic_load_explicit(&m_bottom, std::memory_order_relaxed);
+	int64_t const t = std::atomic_load_explicit(&m_top, std::memory_order_acquire);
+
+	if (b - t + _num > MAX_TASK_PACKETS)
+	{
+		return false;
+	}
+
+	for (uint32_t i = 0; i < _num; ++i)
+	{
+		m_packets[(b + i) & QUEUE_MASK] = _packets[i];
+	}
+
+	// Publishes every packet at once.
+	std::atomic_store_explicit(&m_bottom, b + _num, std::memory_order_release);
+	return true;
+}
+
+bool TaskSystem::WorkerDeque::Pop(TaskPacket& o_packet)
+{
+	int64_t const b = std::atomic_load_explicit(&m_bottom, std::memory_order_relaxed) - 1;
+	std::atomic_store_explicit(&m_bottom, b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = std::atomic_load_explicit(&m_top, std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		// Empty.
+		std::atomic_store_explicit(&m_bottom, b + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	o_packet = m_packets[b & QUEUE_MASK];
+
+	if (t == b)
+	{
+		// Last packet, race thieves for it.
+		bool const won = std::atomic_compare_exchange_strong_explicit(&m_top, &t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		std::atomic_store_explicit(&m_bottom, b + 1, std::memory_order_relaxed);
+		return won;
+	}
+
+	return true;
+}
+
+bool TaskSystem::WorkerDeque::Steal(TaskPacket& o_packet)
+{
+	int64_t t = std::atomic_load_explicit(&m_top, std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t const b = std::atomic_load_explicit(&m_bottom, std::memory_order_acquire);
+
+	if (t >= b)
+	{
+		return false;
+	}
+
+	// Read before claiming, the slot can only be reused once top has moved past it, in which case the exchange fails.
+	TaskPacket const packet = m_packets[t & QUEUE_MASK];
+
+	if (!std::atomic_compare_exchange_strong_explicit(&m_top, &t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+	{
+		return false;
+	}
+
+	o_packet = packet;
+	return true;
+}
+
+bool TaskSystem::WorkerDeque::Empty() const
+{
+	int64_t const t = std::atomic_load_explicit(&m_top, std::memory_order_acquire);
+	int64_t const b = std::atomic_load_explicit(&m_bottom, std::memory_order_acquire);
+	return t >= b;
+}
+
 }
\ No newline at end of file
@@ -2,15 +2,18 @@
 #include <stdint.h>
 #include <mutex>
 #include <condition_variable>
+#include <type_traits>
 
-#include <kt/LinearAllocator.h>
 #include <kt/Array.h>
 #include <kt/Concurrency.h>
+#include <kt/Timer.h>
+
+#include "ScratchArena.h"
 
 namespace sr
 {
 
-using ThreadScratchAllocator = kt::LinearAllocator;
+using ThreadScratchAllocator = ScratchArena;
 
 struct Task;
 
@@ -32,6 +35,15 @@ struct Task
 		m_userData = _user;
 		m_taskCounter = _counter;
 		m_totalPartitions = _numPartitions;
+		m_continuation = nullptr;
+	}
+
+	// Push _next once every packet of this task has finished. _next is pushed by whichever thread finishes the last of its dependencies, so it must not be pushed by hand.
+	void SetContinuation(Task* _next)
+	{
+		KT_ASSERT(!m_continuation);
+		m_continuation = _next;
+		std::atomic_fetch_add_explicit(&_next->m_numDependencies, 1, std::memory_order_relaxed);
 	}
 
 	// Task function
@@ -47,6 +59,15 @@ struct Task
 
 	// User defined data.
 	void* m_userData = nullptr;
+
+	// Optional, see SetContinuation.
+	Task* m_continuation = nullptr;
+
+	// Unfinished tasks this is the continuation of.
+	std::atomic<uint32_t> m_numDependencies{ 0 };
+
+	// Unfinished packets, only tracked for tasks with a continuation.
+	std::atomic<uint32_t> m_numPacketsLeft{ 0 };
 };
 
 struct TaskPacket
@@ -62,61 +83,280 @@ struct TaskPacket
 };
 
 
+// Time threads spent blocked in TaskSystem::WaitForCounter with nothing left to help with.
+struct TaskWaitStats
+{
+	kt::Duration m_spinTime = kt::Duration::Zero();
+	kt::Duration m_parkedTime = kt::Duration::Zero();
+
+	uint32_t m_numWaits = 0;
+	uint32_t m_numParks = 0;
+};
+
+// Thread scratch arenas since the last TaskSystem::ResetAllocators, for sizing them from what frames actually use.
+struct ScratchStats
+{
+	// Largest high-water mark of any one thread, and the sum over all threads.
+	size_t m_maxThreadHighWaterBytes = 0;
+	size_t m_totalHighWaterBytes = 0;
+
+	size_t m_committedBytes = 0;
+	uint32_t m_numBlocks = 0;
+
+	// Threads whose arenas are on large pages.
+	uint32_t m_numLargePageThreads = 0;
+};
+
+// Where worker threads run.
+enum class WorkerPlacement : uint32_t
+{
+	// One worker per logical core, left to the OS scheduler.
+	Unpinned,
+
+	// One worker pinned to each logical core, filling every physical core before any SMT siblings.
+	AllLogicalCores,
+
+	// One worker per physical core, pinned to that core (any of its SMT siblings), so workers never share L1/L2.
+	OnePerPhysicalCore,
+
+	// One worker per logical core, free to run anywhere on its NUMA node and stealing from its own node first.
+	NumaNodePools
+};
+
+struct WorkerConfig
+{
+	static uint32_t const c_maxWorkers = 0xFFFFFFFF;
+
+	// Not counting the main thread, clamped to the cores the placement provides minus one for the main thread.
+	uint32_t m_numWorkers = c_maxWorkers;
+
+	WorkerPlacement m_placement = WorkerPlacement::AllLogicalCores;
+};
+
 class TaskSystem
 {
 public:
+	// Capacity of each thread's deque.
 	static uint32_t const MAX_TASK_PACKETS = 1 << 16;
 	static uint32_t const QUEUE_MASK = MAX_TASK_PACKETS - 1;
 
 	static uint32_t TlsThreadIdx();
 
 	TaskSystem()
-		: m_numEntriesInQueue(0)
-		, m_keepRunning(1)
-		, m_numActiveWorkers(0)
+		: m_keepRunning(1)
+		, m_numSleepingWorkers(0)
+		, m_numParkedWaiters(0)
 	{}
 
-	void InitFromMainThread(uint32_t const _numWorkers);
+	// Each thread's scratch arena is committed on demand by that thread, on its NUMA node.
+	void InitFromMainThread(WorkerConfig const& _config);
 	void WaitAndShutdown();
 
+	// Pushes to the calling thread's deque, so must be called from the main thread or from within a task.
+	// Continuations are added to the counter of the task they continue from before it is decremented, so a counter shared by a whole chain only hits zero once the chain is done.
 	void PushTask(Task* _task);
 
 	void SyncAndWaitForAll();
 
+	// Call _fn(begin, end) over [0, _count) in ranges of up to _grain indices on any thread, returning once every range is done (running packets meanwhile, as WaitForCounter).
+	// Like PushTask, call from the main thread or from within a task. _fn can use ThreadAllocator() (c_userScratchSet) for scratch memory, scoped with ScratchArena::AllocScope.
+	template <typename FnT>
+	void ParallelFor(uint32_t _count, uint32_t _grain, FnT const& _fn);
+
+	// Runs queued packets until _counter hits zero. If there is nothing left to run it spins briefly, then parks until the last packet of the counter wakes it.
 	void WaitForCounter(std::atomic<uint32_t>* _counter);
 
+	// Summed over all threads, since the last ResetWaitStats. Only exact when no thread is inside WaitForCounter.
+	TaskWaitStats GetWaitStats() const;
+	void ResetWaitStats();
+
 	uint32_t TotalThreadsIncludingMainThread() const;
 
-	ThreadScratchAllocator& ThreadAllocator() const;
-	void ResetAllocators();
+	// Each thread has c_maxScratchSets arenas, so frames in flight at once can each use their own.
+	static uint32_t const c_maxScratchSets = 3;
+
+	// The last set is never used by RenderContext frames, it is for tasks outside of them (e.g. ParallelFor at load time). Only its user rewinds it.
+	static uint32_t const c_userScratchSet = c_maxScratchSets - 1;
+
+	ThreadScratchAllocator& ThreadAllocator(uint32_t _set = c_userScratchSet) const;
+
+	// Rewinds every arena of _set and starts new high-water marks. Committed memory is kept for reuse.
+	void ResetAllocators(uint32_t _set = c_userScratchSet);
+
+	// Rewinds every arena of _set but keeps the high-water marks, to reuse scratch memory part way through a frame. No thread may be using its arena of the set.
+	void RewindAllocators(uint32_t _set = c_userScratchSet);
+
+	// Only exact when no tasks are using _set.
+	ScratchStats GetScratchStats(uint32_t _set = c_userScratchSet) const;
 
 private:
 	void WorkerLoop(uint32_t _threadId);
 
-	bool TryRunOnePacket_NoLock();
-	bool TryPopPacket_WithLock(TaskPacket& o_packet);
+	// Called by each thread (main included) before it takes any work, allocates its deque and sets up its scratch arena on its node.
+	void InitThreadLocal(uint32_t _threadIdx);
+
+	bool TryRunOnePacket();
+	void RunPacket(TaskPacket const& _packet, uint32_t _threadIdx);
+	bool TryPopOrStealPacket(uint32_t _threadIdx, TaskPacket& o_packet);
+	bool HasQueuedPackets() const;
+
+	// Wake up to _numPackets sleeping workers.
+	void WakeWorkers(uint32_t _numPackets);
+
+	// Chase-Lev work stealing deque. The owning thread pushes and pops at the bottom, other threads steal from the top.
+	struct alignas(64) WorkerDeque
+	{
+		bool Push(TaskPacket const* _packets, uint32_t _num);
+		bool Pop(TaskPacket& o_packet);
+		bool Steal(TaskPacket& o_packet);
+		bool Empty() const;
+
+		std::atomic<int64_t> m_top{ 0 };
+
+		// Owner side on its own cache line.
+		alignas(64) std::atomic<int64_t> m_bottom{ 0 };
+		TaskPacket* m_packets = nullptr;
+
+		// Xorshift state for picking steal victims.
+		uint32_t m_rng = 0;
+
+		// Of the owning thread, victims on the same node are tried first.
+		uint32_t m_numaNode = 0;
+
+		TaskWaitStats m_waitStats;
+	};
 
 	// Align to cache line to avoid false sharing
 	struct alignas(64) PaddedScratchAllocator : ThreadScratchAllocator {};
 
+	// c_maxScratchSets per thread, one thread's after another.
 	PaddedScratchAllocator* m_allocators = nullptr;
 
 	kt::Thread* m_threads = nullptr;
 	uint32_t m_numWorkers = 0;
 
-	TaskPacket* m_packets = nullptr;
-	
-	uint32_t m_queueHead = 0;
-	uint32_t m_queueTail = 0;
-	std::atomic<uint32_t> m_numEntriesInQueue;
+	// Threads are spread over more than one node.
+	bool m_multipleNumaNodes = false;
+
+	// One per thread, including the main thread.
+	WorkerDeque* m_deques = nullptr;
 
-	// Todo: lock free
+	// Only taken to put workers to sleep and wake them up.
 	std::mutex m_mutex;
 	std::condition_variable m_condVar;
 
 	std::atomic<uint32_t> m_keepRunning;
 
-	std::atomic<uint32_t> m_numActiveWorkers;
+	// Both guarded by m_mutex. Each wake token lets one sleeping worker through.
+	std::atomic<uint32_t> m_numSleepingWorkers;
+	uint32_t m_numWakeTokens = 0;
+
+	// Threads parked in WaitForCounter, so finishing a counter only makes a wake call when someone may be waiting on it.
+	std::atomic<uint32_t> m_numParkedWaiters;
 };
 
+// Work started on the task system and finished later with Wait, so the starting thread can get on with something else meanwhile.
+// The function is copied into the handle, which must stay put until the work is done. Starting again or destroying the handle waits first.
+class TaskHandle
+{
+public:
+	KT_NO_COPY(TaskHandle);
+
+	TaskHandle() = default;
+	~TaskHandle();
+
+	// Call _fn() on any thread.
+	template <typename FnT>
+	void Run(TaskSystem& _taskSystem, FnT const& _fn);
+
+	// Call _fn(begin, end) over [0, _count) in ranges of up to _grain indices, as TaskSystem::ParallelFor but without waiting.
+	template <typename FnT>
+	void RunFor(TaskSystem& _taskSystem, uint32_t _count, uint32_t _grain, FnT const& _fn);
+
+	// Runs packets until the work is done (see TaskSystem::WaitForCounter). Must be called by a thread that can push tasks.
+	void Wait();
+
+	bool IsDone() const;
+
+private:
+	// Captures by reference fit easily, copy anything bigger in by pointer.
+	static uint32_t const c_maxFnSize = 64;
+
+	template <typename FnT>
+	void Start(TaskSystem& _taskSystem, TaskFn _fn, uint32_t _count, uint32_t _grain, FnT const& _userFn);
+
+	KT_ALIGNAS(16) uint8_t m_userFn[c_maxFnSize];
+
+	TaskSystem* m_taskSystem = nullptr;
+	std::atomic<uint32_t> m_counter{ 0 };
+	Task m_task;
+};
+
+template <typename FnT>
+void TaskSystem::ParallelFor(uint32_t _count, uint32_t _grain, FnT const& _fn)
+{
+	_grain = _grain ? _grain : 1;
+
+	// Not worth a packet.
+	if (_count <= _grain)
+	{
+		if (_count)
+		{
+			_fn(0u, _count);
+		}
+		return;
+	}
+
+	auto taskFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+	{
+		(*(FnT const*)_task->m_userData)(_start, _end);
+	};
+
+	std::atomic<uint32_t> counter{ 0 };
+	Task task(taskFn, _count, _grain, (void*)&_fn, &counter);
+	PushTask(&task);
+	WaitForCounter(&counter);
+}
+
+template <typename FnT>
+void TaskHandle::Run(TaskSystem& _taskSystem, FnT const& _fn)
+{
+	auto taskFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+	{
+		(*(FnT const*)_task->m_userData)();
+	};
+
+	Start(_taskSystem, taskFn, 1, 1, _fn);
+}
+
+template <typename FnT>
+void TaskHandle::RunFor(TaskSystem& _taskSystem, uint32_t _count, uint32_t _grain, FnT const& _fn)
+{
+	auto taskFn = [](Task const* _task, uint32_t _threadIdx, uint32_t _start, uint32_t _end)
+	{
+		(*(FnT const*)_task->m_userData)(_start, _end);
+	};
+
+	Start(_taskSystem, taskFn, _count, _grain ? _grain : 1, _fn);
+}
+
+template <typename FnT>
+void TaskHandle::Start(TaskSystem& _taskSystem, TaskFn _fn, uint32_t _count, uint32_t _grain, FnT const& _userFn)
+{
+	static_assert(sizeof(FnT) <= c_maxFnSize && KT_ALIGNOF(FnT) <= 16, "Function too big for a TaskHandle, capture by reference.");
+	static_assert(std::is_trivially_destructible<FnT>::value, "TaskHandle functions are never destroyed.");
+
+	Wait();
+
+	if (!_count)
+	{
+		return;
+	}
+
+	m_taskSystem = &_taskSystem;
+	FnT* userFn = kt::PlacementNew<FnT>((FnT*)m_userFn, _userFn);
+	m_task.Set(_fn, _count, _grain, userFn, &m_counter);
+	_taskSystem.PushTask(&m_task);
+}
+
 }
\ No newline at end of file
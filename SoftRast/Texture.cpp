@@ -6,10 +6,10 @@
 #include <kt/Logging.h>
 
 #include "Texture.h"
+#include "BlockCompression.h"
+#include "TaskSystem.h"
+#include "VirtualTexture.h"
 #include "stb_image.h"
-#include "stb_image_resize.h"
-
-#define SR_TILE_TEXTURES (1)
 
 namespace kt
 {
@@ -18,11 +18,12 @@ template <>
 void Serialize(ISerializer* _s, sr::Tex::TextureData& _tex)
 {
 	Serialize(_s, _tex.m_texels);
-	Serialize(_s, _tex.m_widthLog2);
-	Serialize(_s, _tex.m_heightLog2);
+	Serialize(_s, _tex.m_width);
+	Serialize(_s, _tex.m_height);
 	Serialize(_s, _tex.m_bytesPerPixel);
 	Serialize(_s, _tex.m_mipOffsets);
 	Serialize(_s, _tex.m_numMips);
+	Serialize(_s, _tex.m_format);
 }
 
 }
@@ -66,41 +67,360 @@ static __m256i MortonEncode_AVX(__m256i _x, __m256i _y)
 	return _mm256_or_si256(interleaved_x, _mm256_slli_epi32(interleaved_y, 1));
 }
 
-constexpr uint32_t c_texTileSizeLog2 = 5;
-constexpr uint32_t c_texTileSize = 1 << c_texTileSizeLog2;
-constexpr uint32_t c_texTileMask = c_texTileSize - 1;
+// Block compressed textures use the same tiles, morton ordered at block granularity.
+constexpr uint32_t c_texBlockTileSizeLog2 = c_texTileSizeLog2 - c_bcBlockDimLog2;
+constexpr uint32_t c_texBlockTileMask = (1 << c_texBlockTileSizeLog2) - 1;
+
+static uint32_t FormatBytesPerTexel(TextureFormat _format)
+{
+	switch (_format)
+	{
+		case TextureFormat::R8: return 1;
+		case TextureFormat::RG8: return 2;
+		case TextureFormat::R16F: return 2;
+		case TextureFormat::RGBA8: return 4;
+		case TextureFormat::R32F: return 4;
+		default: return 0; // Block compressed.
+	}
+}
+
+// Texel index in tiled storage (not including bytes per texel).
+static uint32_t TiledTexelIndex(uint32_t _x, uint32_t _y, uint32_t _mipTileWidth)
+{
+	uint32_t const tileX = _x >> c_texTileSizeLog2;
+	uint32_t const tileY = _y >> c_texTileSizeLog2;
+	return (tileY * _mipTileWidth + tileX) * (c_texTileSize * c_texTileSize) + MortonEncode(_x & c_texTileMask, _y & c_texTileMask);
+}
+
+// Tile+swizzle texel rows [_yBegin, _yEnd) of a linear mip. _yBegin must be even.
+static void TileTextureRows(uint8_t const* _src, uint8_t* _dest, uint32_t const dimX_noPad, uint32_t const dimY_noPad, uint32_t const _yBegin, uint32_t const _yEnd, uint32_t const _bytesPerTexel)
+{
+#if SR_TILE_TEXTURES
+	uint32_t const mipTileWidth = uint32_t(kt::AlignUp(dimX_noPad, c_texTileSize)) >> c_texTileSizeLog2;
+
+	uint32_t yy = _yBegin;
+
+	if (_bytesPerTexel == 4 && dimX_noPad >= 8)
+	{
+		KT_ASSERT((_yBegin & 1) == 0);
+
+		uint32_t const* src = (uint32_t const*)_src;
+		uint32_t* dest = (uint32_t*)_dest;
+
+		// A 4x2 texel block aligned to 4x2 is 8 consecutive texels in morton order: row 0 (x0, x1), row 1 (x0, x1), row 0 (x2, x3), row 1 (x2, x3).
+		// So 8 texels of two rows give two such blocks, 16 texels apart.
+		for (; yy + 2 <= _yEnd; yy += 2)
+		{
+			uint32_t const* row0 = src + yy * dimX_noPad;
+			uint32_t const* row1 = row0 + dimX_noPad;
+
+			uint32_t xx = 0;
+			for (; xx + 8 <= dimX_noPad; xx += 8)
+			{
+				__m256i const r0 = _mm256_loadu_si256((__m256i const*)(row0 + xx));
+				__m256i const r1 = _mm256_loadu_si256((__m256i const*)(row1 + xx));
+
+				__m256i const lo = _mm256_unpacklo_epi64(r0, r1);
+				__m256i const hi = _mm256_unpackhi_epi64(r0, r1);
+
+				uint32_t const offs = TiledTexelIndex(xx, yy, mipTileWidth);
+				_mm256_storeu_si256((__m256i*)(dest + offs), _mm256_permute2x128_si256(lo, hi, 0x20));
+				_mm256_storeu_si256((__m256i*)(dest + offs + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+			}
+
+			// Non pow2 widths.
+			for (; xx < dimX_noPad; ++xx)
+			{
+				dest[TiledTexelIndex(xx, yy, mipTileWidth)] = row0[xx];
+				dest[TiledTexelIndex(xx, yy + 1, mipTileWidth)] = row1[xx];
+			}
+		}
+	}
+
+	// Tiny mips, smaller texels and odd heights go texel by texel.
+	for (; yy < _yEnd; ++yy)
+	{
+		for (uint32_t xx = 0; xx < dimX_noPad; ++xx)
+		{
+			memcpy(_dest + TiledTexelIndex(xx, yy, mipTileWidth) * _bytesPerTexel, _src + (yy * dimX_noPad + xx) * _bytesPerTexel, _bytesPerTexel);
+		}
+	}
+#else
+	(void)dimY_noPad;
+	memcpy(_dest + _yBegin * dimX_noPad * _bytesPerTexel, _src + _yBegin * dimX_noPad * _bytesPerTexel, (_yEnd - _yBegin) * dimX_noPad * _bytesPerTexel);
+#endif
+}
 
-static void TileTexture(uint8_t const* _src, uint8_t* _dest, uint32_t const dimX_noPad, uint32_t const dimY_noPad)
+// Convert RGBA8 texel rows [_yBegin, _yEnd) of a linear mip to a single/dual channel format and tile them.
+static void ConvertAndTileRows(uint8_t const* _src, uint8_t* _dest, uint32_t const dimX_noPad, uint32_t const _yBegin, uint32_t const _yEnd, TextureFormat _format)
 {
+	uint32_t const bytesPerTexel = FormatBytesPerTexel(_format);
+
 #if SR_TILE_TEXTURES
 	uint32_t const mipTileWidth = uint32_t(kt::AlignUp(dimX_noPad, c_texTileSize)) >> c_texTileSizeLog2;
+#endif
 
-	// Naive tile+swizzling of texture. 
-	// Go over the texture in linear order, find the tiled offset and morton code the inner tile coordinates.
-	for (uint32_t yy = 0; yy < dimY_noPad; ++yy)
+	for (uint32_t yy = _yBegin; yy < _yEnd; ++yy)
 	{
 		for (uint32_t xx = 0; xx < dimX_noPad; ++xx)
 		{
-			uint32_t const linearOffs = yy * dimX_noPad + xx;
+			uint8_t const* texel = _src + (yy * dimX_noPad + xx) * 4;
 
-			uint32_t const tileX = xx >> c_texTileSizeLog2;
-			uint32_t const tileY = yy >> c_texTileSizeLog2;
+#if SR_TILE_TEXTURES
+			uint8_t* out = _dest + TiledTexelIndex(xx, yy, mipTileWidth) * bytesPerTexel;
+#else
+			uint8_t* out = _dest + (yy * dimX_noPad + xx) * bytesPerTexel;
+#endif
+
+			switch (_format)
+			{
+				case TextureFormat::R8: out[0] = texel[0]; break;
+				case TextureFormat::RG8: out[0] = texel[0]; out[1] = texel[1]; break;
+				case TextureFormat::R16F: 
+				{
+					uint16_t const half = uint16_t(_cvtss_sh(float(texel[0]) * (1.0f / 255.0f), 0));
+					memcpy(out, &half, sizeof(half));
+				} break;
+				case TextureFormat::R32F:
+				{
+					float const f = float(texel[0]) * (1.0f / 255.0f);
+					memcpy(out, &f, sizeof(f));
+				} break;
+				default: KT_ASSERT(false); break;
+			}
+		}
+	}
+}
+
+// 2x2 box filter of 4 texels from each of two rows, returns 2 texels as 16 bit channels.
+static __m128i BoxFilter4x2(uint32_t const* _row0, uint32_t const* _row1)
+{
+	__m256i const sum = _mm256_add_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const*)_row0)), _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const*)_row1)));
+
+	// [t0, t1, t2, t3] -> [t0, t2 | t1, t3], then sum the halves for [t0 + t1, t2 + t3].
+	__m256i const perm = _mm256_permute4x64_epi64(sum, _MM_SHUFFLE(3, 1, 2, 0));
+	__m128i const quad = _mm_add_epi16(_mm256_castsi256_si128(perm), _mm256_extracti128_si256(perm, 1));
+	return _mm_srli_epi16(_mm_add_epi16(quad, _mm_set1_epi16(2)), 2);
+}
+
+// Box filter rows [_yBegin, _yEnd) of the destination mip from the previous (linear) mip.
+// Halving an odd dimension drops a texel, so the last destination row/column of an odd source filters the last 3 source rows/columns.
+static void DownsampleMipRows(uint8_t const* _src, uint32_t const _srcDimX, uint32_t const _srcDimY, uint8_t* _dest, uint32_t const _destDimX, uint32_t const _destDimY, uint32_t const _yBegin, uint32_t const _yEnd)
+{
+	uint32_t const* src = (uint32_t const*)_src;
+	uint32_t* dest = (uint32_t*)_dest;
+
+	// One of the dimensions may already be 1 texel, which is not odd here as it isn't halved.
+	bool const oddX = _srcDimX > 1 && (_srcDimX & 1);
+	bool const oddY = _srcDimY > 1 && (_srcDimY & 1);
+
+	for (uint32_t yy = _yBegin; yy < _yEnd; ++yy)
+	{
+		uint32_t const numRows = oddY && yy == _destDimY - 1 ? 3 : 2;
 
-			uint32_t const inTileAddressX = xx & c_texTileMask;
-			uint32_t const inTileAddressY = yy & c_texTileMask;
+		uint32_t const* rows[3];
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			rows[i] = src + kt::Min(yy * 2 + i, _srcDimY - 1) * _srcDimX;
+		}
+
+		uint32_t* destRow = dest + yy * _destDimX;
+
+		uint32_t xx = 0;
 
-			uint32_t const morton = MortonEncode(inTileAddressX, inTileAddressY);
+		if (_srcDimX > 1 && numRows == 2)
+		{
+			uint32_t const* row0 = rows[0];
+			uint32_t const* row1 = rows[1];
+
+			for (; xx + 8 + (oddX ? 1 : 0) <= _destDimX; xx += 8)
+			{
+				uint32_t const srcX = xx * 2;
+				__m128i const t01 = _mm_packus_epi16(BoxFilter4x2(row0 + srcX, row1 + srcX), BoxFilter4x2(row0 + srcX + 4, row1 + srcX + 4));
+				__m128i const t23 = _mm_packus_epi16(BoxFilter4x2(row0 + srcX + 8, row1 + srcX + 8), BoxFilter4x2(row0 + srcX + 12, row1 + srcX + 12));
+				_mm_storeu_si128((__m128i*)(destRow + xx), t01);
+				_mm_storeu_si128((__m128i*)(destRow + xx + 4), t23);
+			}
+		}
 
-			uint32_t const tiledOffs = (tileY * mipTileWidth + tileX) * (c_texTileSize * c_texTileSize) + morton;
-			memcpy(_dest + tiledOffs * 4, _src + linearOffs * 4, 4);
+		for (; xx < _destDimX; ++xx)
+		{
+			uint32_t const numCols = oddX && xx == _destDimX - 1 ? 3 : 2;
+			uint32_t const numTexels = numRows * numCols;
+
+			uint32_t sum[4] = {};
+			for (uint32_t row = 0; row < numRows; ++row)
+			{
+				for (uint32_t col = 0; col < numCols; ++col)
+				{
+					uint8_t const* texel = (uint8_t const*)(rows[row] + kt::Min(xx * 2 + col, _srcDimX - 1));
+					for (uint32_t c = 0; c < 4; ++c)
+					{
+						sum[c] += texel[c];
+					}
+				}
+			}
+
+			uint8_t* out = (uint8_t*)(destRow + xx);
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				out[c] = uint8_t((sum[c] + numTexels / 2) / numTexels);
+			}
 		}
 	}
+}
+
+using EncodeBlockFn = void(*)(uint8_t const (&_texels)[c_bcBlockTexels][4], uint8_t* o_block);
+
+// Compress and tile block rows [_blockYBegin, _blockYEnd), including padding blocks.
+static void CompressAndTileBlocks(uint8_t const* _src, uint8_t* _dest, uint32_t const dimX_noPad, uint32_t const dimY_noPad, uint32_t const _blockYBegin, uint32_t const _blockYEnd, uint32_t const _blockBytes, EncodeBlockFn _encodeFn)
+{
+#if SR_TILE_TEXTURES
+	uint32_t const dimX_pad = uint32_t(kt::AlignUp(dimX_noPad, c_texTileSize));
+	uint32_t const dimY_pad = uint32_t(kt::AlignUp(dimY_noPad, c_texTileSize));
+	uint32_t const mipTileWidth = dimX_pad >> c_texTileSizeLog2;
 #else
-	memcpy(_dest, _src, dimX_noPad * dimY_noPad * sizeof(uint32_t));
+	uint32_t const dimX_pad = uint32_t(kt::AlignUp(dimX_noPad, c_bcBlockDim));
+	uint32_t const dimY_pad = uint32_t(kt::AlignUp(dimY_noPad, c_bcBlockDim));
 #endif
+
+	(void)dimY_pad;
+	uint32_t const blocksX = dimX_pad >> c_bcBlockDimLog2;
+
+	for (uint32_t blockY = _blockYBegin; blockY < _blockYEnd; ++blockY)
+	{
+		for (uint32_t blockX = 0; blockX < blocksX; ++blockX)
+		{
+			// Padding (and mips smaller than a block) replicate the edge texels.
+			uint8_t blockTexels[c_bcBlockTexels][4];
+			for (uint32_t y = 0; y < c_bcBlockDim; ++y)
+			{
+				uint32_t const srcY = kt::Min(blockY * c_bcBlockDim + y, dimY_noPad - 1);
+				for (uint32_t x = 0; x < c_bcBlockDim; ++x)
+				{
+					uint32_t const srcX = kt::Min(blockX * c_bcBlockDim + x, dimX_noPad - 1);
+					memcpy(blockTexels[y * c_bcBlockDim + x], _src + (srcY * dimX_noPad + srcX) * 4, 4);
+				}
+			}
+
+#if SR_TILE_TEXTURES
+			uint32_t const tileX = blockX >> c_texBlockTileSizeLog2;
+			uint32_t const tileY = blockY >> c_texBlockTileSizeLog2;
+			uint32_t const morton = MortonEncode(blockX & c_texBlockTileMask, blockY & c_texBlockTileMask);
+			uint32_t const blockOffs = ((tileY * mipTileWidth + tileX) << (2 * c_texBlockTileSizeLog2)) + morton;
+#else
+			uint32_t const blockOffs = blockY * blocksX + blockX;
+#endif
+			_encodeFn(blockTexels, _dest + blockOffs * _blockBytes);
+		}
+	}
+}
+
+static uint32_t MipStorageSize(TextureFormat _format, uint32_t const dimX_noPad, uint32_t const dimY_noPad)
+{
+	uint32_t const bytesPerTexel = FormatBytesPerTexel(_format);
+
+	// Align the size to account for tiling
+#if SR_TILE_TEXTURES
+	uint32_t const dimX_pad = uint32_t(kt::AlignUp(dimX_noPad, c_texTileSize));
+	uint32_t const dimY_pad = uint32_t(kt::AlignUp(dimY_noPad, c_texTileSize));
+#else
+	uint32_t const dimX_pad = bytesPerTexel ? dimX_noPad : uint32_t(kt::AlignUp(dimX_noPad, c_bcBlockDim));
+	uint32_t const dimY_pad = bytesPerTexel ? dimY_noPad : uint32_t(kt::AlignUp(dimY_noPad, c_bcBlockDim));
+#endif
+
+	switch (_format)
+	{
+		case TextureFormat::BC1: return (dimX_pad >> c_bcBlockDimLog2) * (dimY_pad >> c_bcBlockDimLog2) * c_bc1BlockBytes;
+		case TextureFormat::BC3: return (dimX_pad >> c_bcBlockDimLog2) * (dimY_pad >> c_bcBlockDimLog2) * c_bc3BlockBytes;
+		default: KT_ASSERT(bytesPerTexel); return dimX_pad * dimY_pad * bytesPerTexel;
+	}
 }
 
-void TextureData::CreateFromFile(char const* _file)
+// Mips are stored in groups of c_bcBlockDim texel rows, which is the unit of work when generating them in parallel.
+static uint32_t MipRowGroups(TextureFormat _format, uint32_t const dimY_noPad)
+{
+	if (FormatBytesPerTexel(_format))
+	{
+		return (dimY_noPad + c_bcBlockDim - 1) >> c_bcBlockDimLog2;
+	}
+
+	// Block compressed formats also have to write the padding blocks.
+#if SR_TILE_TEXTURES
+	return uint32_t(kt::AlignUp(dimY_noPad, c_texTileSize)) >> c_bcBlockDimLog2;
+#else
+	return uint32_t(kt::AlignUp(dimY_noPad, c_bcBlockDim)) >> c_bcBlockDimLog2;
+#endif
+}
+
+// Write row groups [_groupBegin, _groupEnd) of a linear RGBA8 mip into its final (tiled and/or compressed) storage.
+static void StoreMipRows(TextureFormat _format, uint8_t const* _src, uint8_t* _dest, uint32_t const dimX_noPad, uint32_t const dimY_noPad, uint32_t const _groupBegin, uint32_t const _groupEnd)
+{
+	switch (_format)
+	{
+		case TextureFormat::RGBA8: TileTextureRows(_src, _dest, dimX_noPad, dimY_noPad, _groupBegin * c_bcBlockDim, kt::Min(_groupEnd * c_bcBlockDim, dimY_noPad), 4); break;
+		case TextureFormat::BC1: CompressAndTileBlocks(_src, _dest, dimX_noPad, dimY_noPad, _groupBegin, _groupEnd, c_bc1BlockBytes, EncodeBC1Block); break;
+		case TextureFormat::BC3: CompressAndTileBlocks(_src, _dest, dimX_noPad, dimY_noPad, _groupBegin, _groupEnd, c_bc3BlockBytes, EncodeBC3Block); break;
+		default: ConvertAndTileRows(_src, _dest, dimX_noPad, _groupBegin * c_bcBlockDim, kt::Min(_groupEnd * c_bcBlockDim, dimY_noPad), _format); break;
+	}
+}
+
+struct MipGenJob
+{
+	TextureFormat m_format;
+
+	// Previous mip (linear), null for mip 0.
+	uint8_t const* m_srcLinear;
+	uint32_t m_srcDims[2];
+
+	// This mip, linear and final storage.
+	uint8_t* m_destLinear;
+	uint8_t* m_destStorage;
+	uint32_t m_destDims[2];
+};
+
+static void MipGenRowGroups(MipGenJob const& _job, uint32_t _groupBegin, uint32_t _groupEnd)
+{
+	if (_job.m_srcLinear)
+	{
+		uint32_t const yBegin = kt::Min(_groupBegin * c_bcBlockDim, _job.m_destDims[1]);
+		uint32_t const yEnd = kt::Min(_groupEnd * c_bcBlockDim, _job.m_destDims[1]);
+		DownsampleMipRows(_job.m_srcLinear, _job.m_srcDims[0], _job.m_srcDims[1], _job.m_destLinear, _job.m_destDims[0], _job.m_destDims[1], yBegin, yEnd);
+	}
+
+	StoreMipRows(_job.m_format, _job.m_destLinear, _job.m_destStorage, _job.m_destDims[0], _job.m_destDims[1], _groupBegin, _groupEnd);
+}
+
+// Generate one mip, split across workers if it is large enough.
+static void RunMipGenJob(MipGenJob const& _job, TaskSystem* _taskSystem)
+{
+	uint32_t const numGroups = MipRowGroups(_job.m_format, _job.m_destDims[1]);
+	uint32_t const groupTexels = _job.m_destDims[0] * c_bcBlockDim;
+	uint32_t const groupsPerTask = kt::Max(1u, Config::c_mipGenTexelsPerTask / groupTexels);
+
+	if (!_taskSystem)
+	{
+		MipGenRowGroups(_job, 0, numGroups);
+		return;
+	}
+
+	_taskSystem->ParallelFor(numGroups, groupsPerTask, [&_job](uint32_t _start, uint32_t _end) { MipGenRowGroups(_job, _start, _end); });
+}
+
+static TextureFormat ResolveAutoFormat(uint8_t const* _texels, uint32_t _numTexels)
+{
+	for (uint32_t i = 0; i < _numTexels; ++i)
+	{
+		if (_texels[i * 4 + 3] != 0xFF)
+		{
+			return TextureFormat::BC3;
+		}
+	}
+
+	return TextureFormat::BC1;
+}
+
+void TextureData::CreateFromFile(char const* _file, TextureFormat _format /*= TextureFormat::RGBA8*/, TaskSystem* _taskSystem /*= nullptr*/)
 {
 	Clear();
 	static uint32_t const req_comp = 4;
@@ -113,94 +433,138 @@ void TextureData::CreateFromFile(char const* _file)
 	}
 
 	KT_SCOPE_EXIT(stbi_image_free(srcImageData));
-	CreateFromRGBA8(srcImageData, uint32_t(x), uint32_t(y), true);
+	CreateFromRGBA8(srcImageData, uint32_t(x), uint32_t(y), true, _format, _taskSystem);
 }
 
-void TextureData::CreateFromRGBA8(uint8_t const* _texels, uint32_t _width, uint32_t _height, bool _calcMips /*= false*/)
+void TextureData::CreateFromRGBA8(uint8_t const* _texels, uint32_t _width, uint32_t _height, bool _calcMips /*= false*/, TextureFormat _format /*= TextureFormat::RGBA8*/, TaskSystem* _taskSystem /*= nullptr*/)
 {
+	// Non pow2 sizes are fine, mips are stored padded to whole tiles.
+	KT_ASSERT(_width && _height);
+	KT_ASSERT(kt::FloorLog2(kt::Max(_width, _height)) < Config::c_maxTexDimLog2);
 
-	KT_ASSERT(kt::IsPow2(_width) && kt::IsPow2(_height));
+	m_width = _width;
+	m_height = _height;
 
-	m_widthLog2 = kt::FloorLog2(uint32_t(_width));
-	m_heightLog2 = kt::FloorLog2(uint32_t(_height));
+	if (_format == TextureFormat::BC_Auto)
+	{
+		_format = ResolveAutoFormat(_texels, _width * _height);
+	}
 
-	KT_ASSERT(m_heightLog2 < Config::c_maxTexDimLog2);
-	KT_ASSERT(m_widthLog2 < Config::c_maxTexDimLog2);
-	KT_ASSERT((_width % c_texTileSize) == 0);
-	KT_ASSERT((_height % c_texTileSize) == 0); // TODO: Pad if this isn't true (but will be with 2^x x>=5)
+	m_format = _format;
+	m_bytesPerPixel = FormatBytesPerTexel(m_format);
 
-	m_bytesPerPixel = 4;
+	uint32_t const fullMipChainLen = _calcMips ? kt::FloorLog2(kt::Max(uint32_t(_width), uint32_t(_height))) + 1 : 1; // +1 for base tex.
+	m_numMips = fullMipChainLen;
 
-	if (!_calcMips)
+	uint32_t mipDims[Config::c_maxTexDimLog2][2];
+	uint32_t curMipDataOffset = 0;
+
+	for (uint32_t mipIdx = 0; mipIdx < fullMipChainLen; ++mipIdx)
 	{
-		m_numMips = 1;
-		m_mipOffsets[0] = 0;
+		CalcMipDims2D(uint32_t(_width), uint32_t(_height), mipIdx, mipDims[mipIdx]);
+		m_mipOffsets[mipIdx] = curMipDataOffset;
 
-		m_texels.Resize(_width * _height * m_bytesPerPixel);
-		TileTexture(_texels, m_texels.Data(), _width, _height);
-		return;
+		curMipDataOffset += MipStorageSize(m_format, mipDims[mipIdx][0], mipDims[mipIdx][1]);
 	}
 
-	// Calculate mips.
-
-	uint32_t const fullMipChainLen = kt::FloorLog2(kt::Max(uint32_t(_width), uint32_t(_height))) + 1; // +1 for base tex.
-	m_numMips = fullMipChainLen;
+	m_texels.Resize(curMipDataOffset + c_texFetchSlackBytes);
 
-	struct MipInfo
-	{
-		uint32_t m_offs;
-		uint32_t m_dims[2];
-	};
+	// Each mip is filtered from the previous one (as RGBA8), so only the last two linear mips are needed.
+	uint32_t const mip1Size = fullMipChainLen > 1 ? mipDims[1][0] * mipDims[1][1] * 4 : 0;
+	uint32_t const mip2Size = fullMipChainLen > 2 ? mipDims[2][0] * mipDims[2][1] * 4 : 0;
+	uint8_t* tempMipBuff = mip1Size ? (uint8_t*)kt::Malloc(mip1Size + mip2Size) : nullptr;
+	KT_SCOPE_EXIT(kt::Free(tempMipBuff));
 
-	uint32_t curMipDataOffset = 0;
+	uint8_t* linearMips[2] = { tempMipBuff, tempMipBuff + mip1Size };
 
-	MipInfo* mipInfos = (MipInfo*)KT_ALLOCA(sizeof(MipInfo) * fullMipChainLen);
+	MipGenJob job;
+	job.m_format = m_format;
+	job.m_srcLinear = nullptr;
+	job.m_srcDims[0] = job.m_srcDims[1] = 0;
 
 	for (uint32_t mipIdx = 0; mipIdx < fullMipChainLen; ++mipIdx)
 	{
-		CalcMipDims2D(uint32_t(_width), uint32_t(_height), mipIdx, mipInfos[mipIdx].m_dims);
-		mipInfos[mipIdx].m_offs = curMipDataOffset;
-		m_mipOffsets[mipIdx] = curMipDataOffset;
+		job.m_destLinear = mipIdx == 0 ? (uint8_t*)_texels : linearMips[(mipIdx - 1) & 1];
+		job.m_destStorage = m_texels.Data() + m_mipOffsets[mipIdx];
+		job.m_destDims[0] = mipDims[mipIdx][0];
+		job.m_destDims[1] = mipDims[mipIdx][1];
 
-		// Align the offset to account for tiling
-#if SR_TILE_TEXTURES
-		uint32_t const mipDimX_tilePad = uint32_t(kt::AlignUp(mipInfos[mipIdx].m_dims[0], c_texTileSize));
-		uint32_t const mipDimY_tilePad = uint32_t(kt::AlignUp(mipInfos[mipIdx].m_dims[1], c_texTileSize));
-#else
-		uint32_t const mipDimX_tilePad = mipInfos[mipIdx].m_dims[0];
-		uint32_t const mipDimY_tilePad = mipInfos[mipIdx].m_dims[1];
-#endif
+		RunMipGenJob(job, _taskSystem);
 
-		curMipDataOffset += mipDimX_tilePad * mipDimY_tilePad * m_bytesPerPixel;
+		job.m_srcLinear = job.m_destLinear;
+		job.m_srcDims[0] = job.m_destDims[0];
+		job.m_srcDims[1] = job.m_destDims[1];
 	}
+}
+
+void TextureData::CreateFromTexels(void const* _texels, uint32_t _width, uint32_t _height, TextureFormat _format)
+{
+	KT_ASSERT(FormatBytesPerTexel(_format) && "Block compressed textures must be created from RGBA8.");
+	KT_ASSERT(kt::FloorLog2(kt::Max(_width, _height)) < Config::c_maxTexDimLog2);
+
+	m_width = _width;
+	m_height = _height;
+	m_format = _format;
+	m_bytesPerPixel = FormatBytesPerTexel(_format);
 
+	m_numMips = 1;
+	m_mipOffsets[0] = 0;
 
-	m_texels.Resize(curMipDataOffset);
-	uint8_t* texWritePointer = m_texels.Data();
+	m_texels.Resize(MipStorageSize(m_format, _width, _height) + c_texFetchSlackBytes);
+	TileTextureRows((uint8_t const*)_texels, m_texels.Data(), _width, _height, 0, _height, m_bytesPerPixel);
+}
 
-	// tile mip 0
-	TileTexture(_texels, texWritePointer, mipInfos[0].m_dims[0], mipInfos[0].m_dims[1]);
+uint32_t TexturePageBytes(TextureFormat _format)
+{
+	return MipStorageSize(_format, c_texTileSize, c_texTileSize);
+}
 
-	uint32_t const largestMipSize = _width * _height * m_bytesPerPixel;
-	uint8_t* tempResizeBuff = (uint8_t*)kt::Malloc(largestMipSize);
-	KT_SCOPE_EXIT(kt::Free(tempResizeBuff));
+bool TextureLayoutValid(TextureData const& _tex, uint32_t _texelBytes)
+{
+	if (!_tex.m_numMips)
+	{
+		return _texelBytes == 0;
+	}
 
-	for (uint32_t mipIdx = 1; mipIdx < fullMipChainLen; ++mipIdx)
+	if (_tex.m_format >= TextureFormat::BC_Auto
+		|| !_tex.m_width
+		|| !_tex.m_height
+		|| kt::FloorLog2(kt::Max(_tex.m_width, _tex.m_height)) >= Config::c_maxTexDimLog2
+		|| _tex.m_numMips > kt::FloorLog2(kt::Max(_tex.m_width, _tex.m_height)) + 1
+		|| _tex.m_bytesPerPixel != FormatBytesPerTexel(_tex.m_format))
 	{
-		MipInfo const& mipInfo = mipInfos[mipIdx];
-		uint8_t* mipPtr = texWritePointer + mipInfo.m_offs;
+		return false;
+	}
+
+	uint64_t curMipDataOffset = 0;
 
-		uint32_t const mipDimX = mipInfo.m_dims[0];
-		uint32_t const mipDimY = mipInfo.m_dims[1];
+	for (uint32_t mipIdx = 0; mipIdx < _tex.m_numMips; ++mipIdx)
+	{
+		if (_tex.m_mipOffsets[mipIdx] != curMipDataOffset)
+		{
+			return false;
+		}
 
-		stbir_resize_uint8(_texels, _width, _height, 0, tempResizeBuff, mipDimX, mipDimY, 0, m_bytesPerPixel);
-		TileTexture(tempResizeBuff, mipPtr, mipDimX, mipDimY);
+		uint32_t mipDims[2];
+		CalcMipDims2D(_tex.m_width, _tex.m_height, mipIdx, mipDims);
+		curMipDataOffset += MipStorageSize(_tex.m_format, mipDims[0], mipDims[1]);
 	}
+
+	return _texelBytes == 0 || curMipDataOffset + c_texFetchSlackBytes <= _texelBytes;
+}
+
+void TextureData::SetExternalTexels(uint8_t const* _texels, uint32_t _size)
+{
+	m_texels.ClearAndFree();
+	m_externalTexels = _texels;
+	m_externalTexelBytes = _size;
 }
 
 void TextureData::Clear()
 {
 	m_texels.ClearAndFree();
+	m_externalTexels = nullptr;
+	m_externalTexelBytes = 0;
 }
 
 void CalcMipDims2D(uint32_t _x, uint32_t _y, uint32_t _level, uint32_t o_dims[2])
@@ -209,10 +573,10 @@ void CalcMipDims2D(uint32_t _x, uint32_t _y, uint32_t _level, uint32_t o_dims[2]
 	o_dims[1] = kt::Max<uint32_t>(1u, _y >> _level);
 }
 
-__m256i CalcMipLevels(TextureData const& _tex, __m256 _dudx, __m256 _dudy, __m256 _dvdx, __m256 _dvdy)
+static __m256i CalcMipLevels(TextureData const& _tex, __m256 _dudx, __m256 _dudy, __m256 _dvdx, __m256 _dvdy)
 {
-	__m256 const height = _mm256_set1_ps(float(1u << _tex.m_heightLog2));
-	__m256 const width = _mm256_set1_ps(float(1u << _tex.m_widthLog2));
+	__m256 const height = _mm256_set1_ps(float(_tex.m_height));
+	__m256 const width = _mm256_set1_ps(float(_tex.m_width));
 	
 	__m256 const dudx_tex = _mm256_mul_ps(_dudx, width);
 	__m256 const dudy_tex = _mm256_mul_ps(_dudy, height);
@@ -232,224 +596,868 @@ __m256i CalcMipLevels(TextureData const& _tex, __m256 _dudx, __m256 _dudy, __m25
 	return _mm256_min_epi32(_mm256_set1_epi32(_tex.m_numMips - 1), _mm256_max_epi32(_mm256_setzero_si256(), simdutil::ExtractExponent(maxCoord)));
 }
 
-
-static __m256i BoundCoordsWrap(__m256i _coord, __m256i _bound)
+// Fractional mip level clamped to [0, numMips - 1].
+static __m256 CalcMipLod(TextureData const& _tex, __m256 _dudx, __m256 _dudy, __m256 _dvdx, __m256 _dvdy)
 {
-	// Assuming width and height are powers of two.
-	__m256i const one = _mm256_set1_epi32(1);
-	return _mm256_and_si256(_coord, _mm256_sub_epi32(_bound, one));
+	__m256 const height = _mm256_set1_ps(float(_tex.m_height));
+	__m256 const width = _mm256_set1_ps(float(_tex.m_width));
+
+	__m256 const dudx_tex = _mm256_mul_ps(_dudx, width);
+	__m256 const dudy_tex = _mm256_mul_ps(_dudy, height);
+
+	__m256 const dvdx_tex = _mm256_mul_ps(_dvdx, width);
+	__m256 const dvdy_tex = _mm256_mul_ps(_dvdy, height);
+
+	__m256 const du_dot2 = _mm256_fmadd_ps(dudx_tex, dudx_tex, _mm256_mul_ps(dudy_tex, dudy_tex));
+	__m256 const dv_dot2 = _mm256_fmadd_ps(dvdx_tex, dvdx_tex, _mm256_mul_ps(dvdy_tex, dvdy_tex));
+
+	// log2(x^(1/2)) == 0.5 * log2(x), so no sqrt needed.
+	__m256 const lod = _mm256_mul_ps(_mm256_set1_ps(0.5f), simdutil::Log2(_mm256_max_ps(du_dot2, dv_dot2)));
+
+	// Operand order matters: max/min return the second operand on NaN, so garbage in inactive lanes is clamped to a valid mip.
+	return _mm256_min_ps(_mm256_max_ps(lod, _mm256_setzero_ps()), _mm256_set1_ps(float(_tex.m_numMips - 1)));
 }
 
-static void GatherQuadsAndInterpolate
-(
-	TextureData const& _tex, 
-	uint32_t _mips[8], 
-	__m256i _mipWidth, 
-	__m256i _x0, 
-	__m256i _y0, 
-	__m256i _x1,
-	__m256i _y1,
-	__m256& o_r,
-	__m256& o_g,
-	__m256& o_b,
-	__m256& o_a,
-	float _interpU[8],
-	float _interpV[8],
-	uint32_t _execMask
-)
+// True if every active lane has the same value as lane 0.
+static bool AllActiveLanesEqual(__m256i _v, uint32_t _execMask)
 {
-	// Compute the tile offsets.
-	KT_ALIGNAS(32) uint32_t morton_x0y0[8];
-	KT_ALIGNAS(32) uint32_t morton_x1y0[8];
-	KT_ALIGNAS(32) uint32_t morton_x1y1[8];
-	KT_ALIGNAS(32) uint32_t morton_x0y1[8];
+	__m256i const lane0 = _mm256_permutevar8x32_epi32(_v, _mm256_setzero_si256());
+	uint32_t const eqMask = uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_v, lane0))));
+	return (eqMask & _execMask) == _execMask;
+}
 
-#if SR_TILE_TEXTURES
+
+// Bound integer texel coordinates to [0, _bound), for any (including garbage) input.
+template <AddressMode AddressT>
+static __m256i BoundCoords(__m256i _coord, __m256i _bound)
+{
+	switch (AddressT)
 	{
-		__m256i const tileX0 = _mm256_srli_epi32(_x0, c_texTileSizeLog2);
-		__m256i const tileY0 = _mm256_srli_epi32(_y0, c_texTileSizeLog2);
-		__m256i const tileX1 = _mm256_srli_epi32(_x1, c_texTileSizeLog2);
-		__m256i const tileY1 = _mm256_srli_epi32(_y1, c_texTileSizeLog2);
+		case AddressMode::Wrap:
+		{
+			// Wrapped coordinates are in [0, _bound] (inclusive due to rounding and the +1 tap), anything else is garbage from inactive lanes.
+			__m256i const clamped = _mm256_min_epu32(_coord, _bound);
+			return _mm256_sub_epi32(clamped, _mm256_and_si256(_bound, _mm256_cmpeq_epi32(clamped, _bound)));
+		}
 
-		__m256i const c_texTileMaskAvx = _mm256_set1_epi32(c_texTileMask);
+		case AddressMode::Clamp:
+		case AddressMode::Mirror:
+		{
+			// Mirror only needs the edge texel repeated here, the flip is done on the float coordinate.
+			return _mm256_min_epu32(_coord, _mm256_sub_epi32(_bound, _mm256_set1_epi32(1)));
+		}
 
-		// Compute the inner-tile coordinates.
-		__m256i const inTileAddressX0 = _mm256_and_si256(_x0, c_texTileMaskAvx);
-		__m256i const inTileAddressY0 = _mm256_and_si256(_y0, c_texTileMaskAvx);
-		__m256i const inTileAddressX1 = _mm256_and_si256(_x1, c_texTileMaskAvx);
-		__m256i const inTileAddressY1 = _mm256_and_si256(_y1, c_texTileMaskAvx);
+		default: KT_UNREACHABLE;
+	}
+}
+
+// Map a texture coordinate to [0, 1].
+template <AddressMode AddressT>
+static __m256 AddressCoords(__m256 _u)
+{
+	switch (AddressT)
+	{
+		case AddressMode::Wrap:
+		{
+			return _mm256_sub_ps(_u, _mm256_floor_ps(_u));
+		}
 
-		// TODO: Broken for non pow2 textures (we assert not supporting those though!)
-		__m256i const texTileSize = _mm256_set1_epi32(c_texTileSize);
-		__m256i const mipTileWidth = _mm256_srli_epi32(_mm256_max_epi32(_mipWidth, texTileSize), c_texTileSizeLog2);
+		case AddressMode::Clamp:
+		{
+			return _mm256_min_ps(_mm256_max_ps(_u, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+		}
 
-		// Compute the linear offset to the start of each tile (not including bytes per pixel).
-		__m256i const offs_x0y0 = _mm256_mullo_epi32(_mm256_set1_epi32(c_texTileSize * c_texTileSize), _mm256_add_epi32(_mm256_mullo_epi32(tileY0, mipTileWidth), tileX0));
-		__m256i const offs_x1y0 = _mm256_mullo_epi32(_mm256_set1_epi32(c_texTileSize * c_texTileSize), _mm256_add_epi32(_mm256_mullo_epi32(tileY0, mipTileWidth), tileX1));
-		__m256i const offs_x0y1 = _mm256_mullo_epi32(_mm256_set1_epi32(c_texTileSize * c_texTileSize), _mm256_add_epi32(_mm256_mullo_epi32(tileY1, mipTileWidth), tileX0));
-		__m256i const offs_x1y1 = _mm256_mullo_epi32(_mm256_set1_epi32(c_texTileSize * c_texTileSize), _mm256_add_epi32(_mm256_mullo_epi32(tileY1, mipTileWidth), tileX1));
+		case AddressMode::Mirror:
+		{
+			// Period of 2, the second half flipped.
+			__m256 const two = _mm256_set1_ps(2.0f);
+			__m256 const t = _mm256_fnmadd_ps(two, _mm256_floor_ps(_mm256_mul_ps(_u, _mm256_set1_ps(0.5f))), _u);
+			return _mm256_min_ps(t, _mm256_sub_ps(two, t));
+		}
 
-		// Add offset to morton encoded inner tile coordinates, multiply by 4 for bytes per pixel.
-		// This is the final pixel offset.
-		_mm256_store_si256((__m256i*)morton_x0y0, _mm256_slli_epi32(_mm256_add_epi32(offs_x0y0, MortonEncode_AVX(inTileAddressX0, inTileAddressY0)), 2));
-		_mm256_store_si256((__m256i*)morton_x1y0, _mm256_slli_epi32(_mm256_add_epi32(offs_x1y0, MortonEncode_AVX(inTileAddressX1, inTileAddressY0)), 2));
-		_mm256_store_si256((__m256i*)morton_x1y1, _mm256_slli_epi32(_mm256_add_epi32(offs_x1y1, MortonEncode_AVX(inTileAddressX1, inTileAddressY1)), 2));
-		_mm256_store_si256((__m256i*)morton_x0y1, _mm256_slli_epi32(_mm256_add_epi32(offs_x0y1, MortonEncode_AVX(inTileAddressX0, inTileAddressY1)), 2));
+		default: KT_UNREACHABLE;
 	}
+}
+
+// Texel index relative to the start of the mip (not including bytes per texel).
+static __m256i TexelIndices(__m256i _x, __m256i _y, __m256i _mipWidth)
+{
+#if SR_TILE_TEXTURES
+	__m256i const tileX = _mm256_srli_epi32(_x, c_texTileSizeLog2);
+	__m256i const tileY = _mm256_srli_epi32(_y, c_texTileSizeLog2);
+
+	__m256i const c_texTileMaskAvx = _mm256_set1_epi32(c_texTileMask);
+
+	// Compute the inner-tile coordinates.
+	__m256i const inTileAddressX = _mm256_and_si256(_x, c_texTileMaskAvx);
+	__m256i const inTileAddressY = _mm256_and_si256(_y, c_texTileMaskAvx);
+
+	// Mips are padded to whole tiles.
+	__m256i const mipTileWidth = _mm256_srli_epi32(_mm256_add_epi32(_mipWidth, c_texTileMaskAvx), c_texTileSizeLog2);
+
+	// Compute the linear offset to the start of each tile.
+	__m256i const tileOffs = _mm256_mullo_epi32(_mm256_set1_epi32(c_texTileSize * c_texTileSize), _mm256_add_epi32(_mm256_mullo_epi32(tileY, mipTileWidth), tileX));
+
+	// Add offset to morton encoded inner tile coordinates.
+	return _mm256_add_epi32(tileOffs, MortonEncode_AVX(inTileAddressX, inTileAddressY));
+#else
+	return _mm256_add_epi32(_x, _mm256_mullo_epi32(_y, _mipWidth));
+#endif
+}
+
+// Index of the 4x4 block containing each texel, relative to the start of the mip. Same tiling as uncompressed formats but at block granularity.
+static __m256i BlockIndices(__m256i _x, __m256i _y, __m256i _mipWidth)
+{
+	__m256i const blockX = _mm256_srli_epi32(_x, c_bcBlockDimLog2);
+	__m256i const blockY = _mm256_srli_epi32(_y, c_bcBlockDimLog2);
+
+#if SR_TILE_TEXTURES
+	__m256i const tileX = _mm256_srli_epi32(_x, c_texTileSizeLog2);
+	__m256i const tileY = _mm256_srli_epi32(_y, c_texTileSizeLog2);
+
+	__m256i const blockTileMask = _mm256_set1_epi32(c_texBlockTileMask);
+
+	__m256i const mipTileWidth = _mm256_srli_epi32(_mm256_add_epi32(_mipWidth, _mm256_set1_epi32(c_texTileMask)), c_texTileSizeLog2);
+
+	__m256i const tileOffs = _mm256_slli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(tileY, mipTileWidth), tileX), 2 * c_texBlockTileSizeLog2);
+	return _mm256_add_epi32(tileOffs, MortonEncode_AVX(_mm256_and_si256(blockX, blockTileMask), _mm256_and_si256(blockY, blockTileMask)));
 #else
+	__m256i const blocksWide = _mm256_srli_epi32(_mm256_add_epi32(_mipWidth, _mm256_set1_epi32(c_bcBlockDim - 1)), c_bcBlockDimLog2);
+	return _mm256_add_epi32(blockX, _mm256_mullo_epi32(blockY, blocksWide));
+#endif
+}
+
+static __m256i BlockTexelIndices(__m256i _x, __m256i _y)
+{
+	__m256i const mask = _mm256_set1_epi32(c_bcBlockDim - 1);
+	return _mm256_or_si256(_mm256_and_si256(_x, mask), _mm256_slli_epi32(_mm256_and_si256(_y, mask), c_bcBlockDimLog2));
+}
+
+static __m256i ExpandRGB565(__m256i _c)
+{
+	__m256i const r5 = _mm256_and_si256(_mm256_srli_epi32(_c, 11), _mm256_set1_epi32(0x1F));
+	__m256i const g6 = _mm256_and_si256(_mm256_srli_epi32(_c, 5), _mm256_set1_epi32(0x3F));
+	__m256i const b5 = _mm256_and_si256(_c, _mm256_set1_epi32(0x1F));
+
+	__m256i const r8 = _mm256_or_si256(_mm256_slli_epi32(r5, 3), _mm256_srli_epi32(r5, 2));
+	__m256i const g8 = _mm256_or_si256(_mm256_slli_epi32(g6, 2), _mm256_srli_epi32(g6, 4));
+	__m256i const b8 = _mm256_or_si256(_mm256_slli_epi32(b5, 3), _mm256_srli_epi32(b5, 2));
+
+	return _mm256_or_si256(r8, _mm256_or_si256(_mm256_slli_epi32(g8, 8), _mm256_slli_epi32(b8, 16)));
+}
+
+// Decode one texel per lane from BC1 colour blocks. BC3 colour blocks are always in 4 colour mode (ForceFourColourT).
+template <bool ForceFourColourT>
+static __m256i DecodeBC1Texels(__m256i _endpoints, __m256i _indices, __m256i _texelIdx)
+{
+	__m256i const c0 = _mm256_and_si256(_endpoints, _mm256_set1_epi32(0xFFFF));
+	__m256i const c1 = _mm256_srli_epi32(_endpoints, 16);
+
+	__m256i const rgb0 = ExpandRGB565(c0);
+	__m256i const rgb1 = ExpandRGB565(c1);
+
+	__m256i const paletteIdx = _mm256_and_si256(_mm256_srlv_epi32(_indices, _mm256_slli_epi32(_texelIdx, 1)), _mm256_set1_epi32(3));
+
+	// Palette weights in sixths, entries 4-7 are for 3 colour mode (c0 <= c1) where index 3 is transparent black.
+	__m256i const w0Table = _mm256_setr_epi32(6, 0, 4, 2, 6, 0, 3, 0);
+	__m256i const w1Table = _mm256_setr_epi32(0, 6, 2, 4, 0, 6, 3, 0);
+
+	__m256i tableIdx = paletteIdx;
+	__m256i transparent = _mm256_setzero_si256();
+
+	if (!ForceFourColourT)
 	{
-		_mm256_store_si256((__m256i*)morton_x0y0, _mm256_slli_epi32(_mm256_add_epi32(_x0, _mm256_mullo_epi32(_y0, _mipWidth)), 2));
-		_mm256_store_si256((__m256i*)morton_x0y1, _mm256_slli_epi32(_mm256_add_epi32(_x0, _mm256_mullo_epi32(_y1, _mipWidth)), 2));
-		_mm256_store_si256((__m256i*)morton_x1y0, _mm256_slli_epi32(_mm256_add_epi32(_x1, _mm256_mullo_epi32(_y0, _mipWidth)), 2));
-		_mm256_store_si256((__m256i*)morton_x1y1, _mm256_slli_epi32(_mm256_add_epi32(_x1, _mm256_mullo_epi32(_y1, _mipWidth)), 2));
+		__m256i const threeColour = _mm256_xor_si256(_mm256_cmpgt_epi32(c0, c1), _mm256_set1_epi32(-1));
+		tableIdx = _mm256_or_si256(paletteIdx, _mm256_and_si256(threeColour, _mm256_set1_epi32(4)));
+		transparent = _mm256_and_si256(threeColour, _mm256_cmpeq_epi32(paletteIdx, _mm256_set1_epi32(3)));
 	}
-#endif
 
-	// | denotes ymm reg split. Each row is a ymm reg. 
-	// If we load AoS with stride like this than we can tranpose independent 4x4 sub matrix in registers without cross lane permutes.
-	//      AoS					SoA
-	// [rgba0|rgba4]		[r0123|r4567]
-	// [rgba1|rgba5]		[g0123|g4567]
-	// [rgba2|rgba6]	->	[b0123|b4567]
-	// [rgba3|rgba7]		[b0123|b4567]
+	__m256i const w0 = _mm256_permutevar8x32_epi32(w0Table, tableIdx);
+	__m256i const w1 = _mm256_permutevar8x32_epi32(w1Table, tableIdx);
+
+	__m256i const weight0 = _mm256_or_si256(w0, _mm256_slli_epi32(w0, 16));
+	__m256i const weight1 = _mm256_or_si256(w1, _mm256_slli_epi32(w1, 16));
 
-	// f(x) = float offest
-	// f(0) = 0
-	// f(1) = 8
-	// f(2) = 16
-	// f(3) = 24
-	// f(4) = 4
-	// f(5) = 12
-	// f(6) = 20
-	// f(7) = 28
+	// (x * 10923) >> 16 == x / 6 for x <= 6 * 255.
+	__m256i const divSix = _mm256_set1_epi16(10923);
+	__m256i const evenMask = _mm256_set1_epi32(0x00FF00FF);
 
-	// f = x >= 4 ? (x%4)*8+4 : x*8
+	__m256i const rb = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_and_si256(rgb0, evenMask), weight0), _mm256_mullo_epi16(_mm256_and_si256(rgb1, evenMask), weight1)), divSix);
+	// Expanded colours have zero alpha, so the upper half of each lane is zero here.
+	__m256i const g = _mm256_mulhi_epu16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_srli_epi16(rgb0, 8), weight0), _mm256_mullo_epi16(_mm256_srli_epi16(rgb1, 8), weight1)), divSix);
+
+	__m256i const alpha = _mm256_andnot_si256(transparent, _mm256_set1_epi32(0xFF000000));
+	return _mm256_or_si256(_mm256_or_si256(rb, _mm256_slli_epi16(g, 8)), alpha);
+}
+
+// Decode one alpha value per lane from BC3 alpha blocks. _lo/_hi are the first/second 32 bits of the block.
+static __m256i DecodeBC3Alpha(__m256i _lo, __m256i _hi, __m256i _texelIdx)
+{
+	__m256i const byteMask = _mm256_set1_epi32(0xFF);
+	__m256i const a0 = _mm256_and_si256(_lo, byteMask);
+	__m256i const a1 = _mm256_and_si256(_mm256_srli_epi32(_lo, 8), byteMask);
 
-	KT_ALIGNAS(32) float interpolatedTexels[8 * 4];
+	// 3 bit indices start at bit 16 of the block and may straddle the two words.
+	// Out of range variable shifts produce zero, so this selects the right word(s) per lane.
+	__m256i const shift = _mm256_add_epi32(_mm256_set1_epi32(16), _mm256_mullo_epi32(_texelIdx, _mm256_set1_epi32(3)));
+	__m256i const bits = _mm256_or_si256(_mm256_srlv_epi32(_lo, shift), _mm256_or_si256(_mm256_sllv_epi32(_hi, _mm256_sub_epi32(_mm256_set1_epi32(32), shift)), _mm256_srlv_epi32(_hi, _mm256_sub_epi32(shift, _mm256_set1_epi32(32)))));
+	__m256i const paletteIdx = _mm256_and_si256(bits, _mm256_set1_epi32(7));
 
-	// Todo: this assumes that we are shading in lanes and that the execution mask never has any holes, only some bits from msb stripped.
-	uint32_t const numQuads = kt::Popcnt(_execMask);
-	for (uint32_t i = 0; i < numQuads; ++i)
+	// a0 > a1: a0, a1, 6 values interpolated in sevenths.
+	// a0 <= a1: a0, a1, 4 values interpolated in fifths, 0, 255.
+	__m256i const eightAlpha = _mm256_cmpgt_epi32(a0, a1);
+
+	__m256i const w0 = _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(_mm256_setr_epi32(5, 0, 4, 3, 2, 1, 0, 0), paletteIdx), _mm256_permutevar8x32_epi32(_mm256_setr_epi32(7, 0, 6, 5, 4, 3, 2, 1), paletteIdx), eightAlpha);
+	__m256i const w1 = _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(_mm256_setr_epi32(0, 5, 1, 2, 3, 4, 0, 0), paletteIdx), _mm256_permutevar8x32_epi32(_mm256_setr_epi32(0, 7, 1, 2, 3, 4, 5, 6), paletteIdx), eightAlpha);
+	__m256 const recipDenom = _mm256_blendv_ps(_mm256_set1_ps(1.0f / 5.0f), _mm256_set1_ps(1.0f / 7.0f), _mm256_castsi256_ps(eightAlpha));
+
+	__m256i const weighted = _mm256_add_epi32(_mm256_mullo_epi32(a0, w0), _mm256_mullo_epi32(a1, w1));
+	__m256i const alpha = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(weighted), recipDenom));
+
+	__m256i const opaque = _mm256_andnot_si256(eightAlpha, _mm256_cmpeq_epi32(paletteIdx, _mm256_set1_epi32(7)));
+	return _mm256_blendv_epi8(alpha, byteMask, opaque);
+}
+
+// Byte offset of each texel's (block's) data relative to the start of its mip.
+template <TextureFormat FormatT>
+static __m256i TexelByteOffsets(__m256i _x, __m256i _y, __m256i _mipWidth)
+{
+	switch (FormatT)
 	{
-		uint8_t const* mipPtr = _tex.m_texels.Data() + _tex.m_mipOffsets[_mips[i]];
-		__m128 x0y0_tex, x1y1_tex, x1y0_tex, x0y1_tex;
-		// Convert each pixel in the quad and store.
+		case TextureFormat::R8: return TexelIndices(_x, _y, _mipWidth);
+		case TextureFormat::RG8: return _mm256_slli_epi32(TexelIndices(_x, _y, _mipWidth), 1);
+		case TextureFormat::R16F: return _mm256_slli_epi32(TexelIndices(_x, _y, _mipWidth), 1);
+		case TextureFormat::RGBA8: return _mm256_slli_epi32(TexelIndices(_x, _y, _mipWidth), 2);
+		case TextureFormat::R32F: return _mm256_slli_epi32(TexelIndices(_x, _y, _mipWidth), 2);
+		case TextureFormat::BC1: return _mm256_slli_epi32(BlockIndices(_x, _y, _mipWidth), 3);
+		case TextureFormat::BC3: return _mm256_slli_epi32(BlockIndices(_x, _y, _mipWidth), 4);
+		default: KT_UNREACHABLE;
+	}
+}
+
+// Low 16 bits of each lane as a half float.
+static __m256 HalfToFloat(__m256i _halves)
+{
+	// Values fit in 16 bits, so the unsigned saturating pack just moves them to [0..3 | 4..7] of each 128 bit lane.
+	__m256i const packed = _mm256_packus_epi32(_halves, _halves);
+	return _mm256_cvtph_ps(_mm256_castsi256_si128(_mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0))));
+}
+
+static __m256i FloatToUnorm8(__m256 _v)
+{
+	__m256 const saturated = _mm256_min_ps(_mm256_max_ps(_v, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	return _mm256_cvtps_epi32(_mm256_mul_ps(saturated, _mm256_set1_ps(255.0f)));
+}
+
+// Gather and decode one RGBA8 texel per lane, _offsets are byte offsets from _base as returned by TexelByteOffsets (plus the mip offset).
+// Missing channels are 0, alpha 1.
+template <TextureFormat FormatT>
+static __m256i FetchTexels(int const* _base, __m256i _offsets, __m256i _x, __m256i _y)
+{
+	__m256i const opaque = _mm256_set1_epi32(0xFF000000);
+
+	switch (FormatT)
+	{
+		case TextureFormat::RGBA8:
+		{
+			return _mm256_i32gather_epi32(_base, _offsets, 1);
+		}
+
+		case TextureFormat::R8:
+		{
+			return _mm256_or_si256(_mm256_and_si256(_mm256_i32gather_epi32(_base, _offsets, 1), _mm256_set1_epi32(0xFF)), opaque);
+		}
+
+		case TextureFormat::RG8:
+		{
+			return _mm256_or_si256(_mm256_and_si256(_mm256_i32gather_epi32(_base, _offsets, 1), _mm256_set1_epi32(0xFFFF)), opaque);
+		}
+
+		case TextureFormat::R16F:
+		{
+			__m256i const halves = _mm256_and_si256(_mm256_i32gather_epi32(_base, _offsets, 1), _mm256_set1_epi32(0xFFFF));
+			return _mm256_or_si256(FloatToUnorm8(HalfToFloat(halves)), opaque);
+		}
+
+		case TextureFormat::R32F:
+		{
+			return _mm256_or_si256(FloatToUnorm8(_mm256_i32gather_ps((float const*)_base, _offsets, 1)), opaque);
+		}
+
+		case TextureFormat::BC1:
+		{
+			__m256i const endpoints = _mm256_i32gather_epi32(_base, _offsets, 1);
+			__m256i const indices = _mm256_i32gather_epi32(_base + 1, _offsets, 1);
+			return DecodeBC1Texels<false>(endpoints, indices, BlockTexelIndices(_x, _y));
+		}
+
+		case TextureFormat::BC3:
+		{
+			__m256i const alphaLo = _mm256_i32gather_epi32(_base, _offsets, 1);
+			__m256i const alphaHi = _mm256_i32gather_epi32(_base + 1, _offsets, 1);
+			__m256i const endpoints = _mm256_i32gather_epi32(_base + 2, _offsets, 1);
+			__m256i const indices = _mm256_i32gather_epi32(_base + 3, _offsets, 1);
+
+			__m256i const texelIdx = BlockTexelIndices(_x, _y);
+			__m256i const rgb = _mm256_and_si256(DecodeBC1Texels<true>(endpoints, indices, texelIdx), _mm256_set1_epi32(0x00FFFFFF));
+			return _mm256_or_si256(rgb, _mm256_slli_epi32(DecodeBC3Alpha(alphaLo, alphaHi, texelIdx), 24));
+		}
+
+		default:
+		{
+			KT_UNREACHABLE;
+		}
+	}
+}
+
+// Gather the red channel of one texel per lane as float. Single channel formats need one gather and no unpacking.
+template <TextureFormat FormatT>
+static __m256 FetchTexelsR(int const* _base, __m256i _offsets, __m256i _x, __m256i _y)
+{
+	__m256 const unormScale = _mm256_set1_ps(1.0f / 255.0f);
+
+	switch (FormatT)
+	{
+		case TextureFormat::R8:
+		case TextureFormat::RG8:
 		{
-			uint8_t const* pix_x0y0 = mipPtr + morton_x0y0[i];
-			__m128i const x0y0 = _mm_cvtsi32_si128(*(uint32_t*)pix_x0y0);
-			x0y0_tex = _mm_mul_ps(_mm_set1_ps(1.0f / 255.0f), _mm_cvtepi32_ps(_mm_cvtepu8_epi32(x0y0)));
+			__m256i const r = _mm256_and_si256(_mm256_i32gather_epi32(_base, _offsets, 1), _mm256_set1_epi32(0xFF));
+			return _mm256_mul_ps(_mm256_cvtepi32_ps(r), unormScale);
 		}
 
+		case TextureFormat::R16F:
 		{
-			uint8_t const* pix_x1y0 = mipPtr + morton_x1y0[i];
-			__m128i const x1y0 = _mm_cvtsi32_si128(*(uint32_t*)pix_x1y0);
-			x1y0_tex = _mm_mul_ps(_mm_set1_ps(1.0f / 255.0f), _mm_cvtepi32_ps(_mm_cvtepu8_epi32(x1y0)));
+			return HalfToFloat(_mm256_and_si256(_mm256_i32gather_epi32(_base, _offsets, 1), _mm256_set1_epi32(0xFFFF)));
 		}
 
+		case TextureFormat::R32F:
 		{
-			uint8_t const* pix_x1y1 = mipPtr + morton_x1y1[i];
-			__m128i const x1y1 = _mm_cvtsi32_si128(*(uint32_t*)pix_x1y1);
-			x1y1_tex = _mm_mul_ps(_mm_set1_ps(1.0f / 255.0f), _mm_cvtepi32_ps(_mm_cvtepu8_epi32(x1y1)));
+			return _mm256_i32gather_ps((float const*)_base, _offsets, 1);
 		}
 
+		default:
 		{
-			uint8_t const* pix_x0y1 = mipPtr + morton_x0y1[i];
-			__m128i const x0y1 = _mm_cvtsi32_si128(*(uint32_t*)pix_x0y1);
-			x0y1_tex = _mm_mul_ps(_mm_set1_ps(1.0f / 255.0f), _mm_cvtepi32_ps(_mm_cvtepu8_epi32(x0y1)));
+			__m256i const r = _mm256_and_si256(FetchTexels<FormatT>(_base, _offsets, _x, _y), _mm256_set1_epi32(0xFF));
+			return _mm256_mul_ps(_mm256_cvtepi32_ps(r), unormScale);
 		}
+	}
+}
+
+// Virtual page of each texel of a paged texture.
+static __m256i VirtualPageIndices(PagedTexture const& _paged, __m256i _mipLevels, __m256i _mipWidth, __m256i _x, __m256i _y)
+{
+	__m256i const mipTileWidth = _mm256_srli_epi32(_mm256_add_epi32(_mipWidth, _mm256_set1_epi32(c_texTileMask)), c_texTileSizeLog2);
+	__m256i const tileIdx = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(_y, c_texTileSizeLog2), mipTileWidth), _mm256_srli_epi32(_x, c_texTileSizeLog2));
+	return _mm256_add_epi32(_mm256_i32gather_epi32((int const*)_paged.m_mipPageOffsets, _mipLevels, 4), tileIdx);
+}
+
+// Translate mip relative byte offsets of a paged texture to offsets from its page pool. _mipPageOffsets is the first virtual page of each lane's mip.
+// Only active lanes are resolved to resident pages, inactive lanes on a page that isn't resident read page 0 instead of before the pool.
+static __m256i TranslatePagedOffsets(PagedTexture const& _paged, __m256i _mipPageOffsets, __m256i _offsets)
+{
+	__m128i const pageShift = _mm_cvtsi32_si128(int(_paged.m_pageBytesLog2));
+	__m256i const vpage = _mm256_add_epi32(_mipPageOffsets, _mm256_srl_epi32(_offsets, pageShift));
+	__m256i const physPage = _mm256_max_epi32(_mm256_i32gather_epi32((int const*)_paged.m_pageTable, vpage, 4), _mm256_setzero_si256());
+	return _mm256_add_epi32(_mm256_sll_epi32(physPage, pageShift), _mm256_and_si256(_offsets, _mm256_set1_epi32(_paged.m_pageBytes - 1)));
+}
+
+// Bilinear footprint of each lane in a mip.
+struct QuadCoords
+{
+	__m256i m_width;
+	__m256i m_x0;
+	__m256i m_y0;
+	__m256i m_x1;
+	__m256i m_y1;
+	__m256 m_interpU;
+	__m256 m_interpV;
+};
+
+// Byte offsets from the returned base of the quad's taps, in the order x0y0, x1y0, x1y1, x0y1. Point sampling only needs the first.
+// UniformMipT: all active lanes sample the same mip, so the mip offset is applied once instead of gathered per lane.
+// PagedT: texels are read through the page table, the pages of active lanes must be resident (see ResolveResidentMips).
+template <TextureFormat FormatT, bool UniformMipT, bool PagedT, bool PointT>
+static int const* QuadTexelOffsets(TextureData const& _tex, __m256i _mipLevels, QuadCoords const& _coords, __m256i o_offsets[4])
+{
+	int const* base;
+	__m256i mipOffsets;
+
+	if (PagedT)
+	{
+		base = (int const*)_tex.m_paged->m_poolBase;
+		mipOffsets = UniformMipT 
+			? _mm256_set1_epi32(_tex.m_paged->m_mipPageOffsets[_mm256_cvtsi256_si32(_mipLevels)])
+			: _mm256_i32gather_epi32((int const*)_tex.m_paged->m_mipPageOffsets, _mipLevels, 4);
+	}
+	else if (UniformMipT)
+	{
+		base = (int const*)(_tex.Texels() + _tex.m_mipOffsets[_mm256_cvtsi256_si32(_mipLevels)]);
+		mipOffsets = _mm256_setzero_si256();
+	}
+	else
+	{
+		base = (int const*)_tex.Texels();
+		mipOffsets = _mm256_i32gather_epi32((int const*)_tex.m_mipOffsets, _mipLevels, 4);
+	}
+
+	uint32_t const numTaps = PointT ? 1 : 4;
+
+	o_offsets[0] = TexelByteOffsets<FormatT>(_coords.m_x0, _coords.m_y0, _coords.m_width);
+
+	if (!PointT)
+	{
+		o_offsets[1] = TexelByteOffsets<FormatT>(_coords.m_x1, _coords.m_y0, _coords.m_width);
+		o_offsets[2] = TexelByteOffsets<FormatT>(_coords.m_x1, _coords.m_y1, _coords.m_width);
+		o_offsets[3] = TexelByteOffsets<FormatT>(_coords.m_x0, _coords.m_y1, _coords.m_width);
+	}
+
+	for (uint32_t i = 0; i < numTaps; ++i)
+	{
+		o_offsets[i] = PagedT ? TranslatePagedOffsets(*_tex.m_paged, mipOffsets, o_offsets[i]) : _mm256_add_epi32(o_offsets[i], mipOffsets);
+	}
+
+	return base;
+}
+
+// Filter 8 quads (or point sample), one RGBA8 texel per lane. Bilinear uses 8 bit weights.
+template <TextureFormat FormatT, bool UniformMipT, bool PagedT, bool PointT>
+static void FilterQuads(TextureData const& _tex, __m256i _mipLevels, QuadCoords const& _coords, __m256i& o_texels)
+{
+	__m256i offsets[4];
+	int const* base = QuadTexelOffsets<FormatT, UniformMipT, PagedT, PointT>(_tex, _mipLevels, _coords, offsets);
+
+	__m256i const x0y0 = FetchTexels<FormatT>(base, offsets[0], _coords.m_x0, _coords.m_y0);
 
-		__m128 const interpU_broadcast = _mm_broadcast_ss(_interpU + i);
-		__m128 const interpV_broadcast = _mm_broadcast_ss(_interpV + i);
-		__m128 const left = simdutil::Lerp(x0y0_tex, x0y1_tex, interpV_broadcast);
-		__m128 const right = simdutil::Lerp(x1y0_tex, x1y1_tex, interpV_broadcast);
-		__m128 const finalInterp = simdutil::Lerp(left, right, interpU_broadcast);
+	if (PointT)
+	{
+		o_texels = x0y0;
+		return;
+	}
+
+	__m256i const x1y0 = FetchTexels<FormatT>(base, offsets[1], _coords.m_x1, _coords.m_y0);
+	__m256i const x1y1 = FetchTexels<FormatT>(base, offsets[2], _coords.m_x1, _coords.m_y1);
+	__m256i const x0y1 = FetchTexels<FormatT>(base, offsets[3], _coords.m_x0, _coords.m_y1);
+
+	// 8 bit fixed point weights in [0, 256], replicated into both 16 bit halves of each lane.
+	__m256 const weightScale = _mm256_set1_ps(256.0f);
+	__m256i const wU = _mm256_cvtps_epi32(_mm256_mul_ps(_coords.m_interpU, weightScale));
+	__m256i const wV = _mm256_cvtps_epi32(_mm256_mul_ps(_coords.m_interpV, weightScale));
+
+	__m256i const weightU = _mm256_or_si256(wU, _mm256_slli_epi32(wU, 16));
+	__m256i const weightV = _mm256_or_si256(wV, _mm256_slli_epi32(wV, 16));
+
+	__m256i const one = _mm256_set1_epi16(256);
+	__m256i const oneMinusWeightU = _mm256_sub_epi16(one, weightU);
+	__m256i const oneMinusWeightV = _mm256_sub_epi16(one, weightV);
+
+	__m256i const top = simdutil::LerpRGBA8(x0y0, x1y0, weightU, oneMinusWeightU);
+	__m256i const bottom = simdutil::LerpRGBA8(x0y1, x1y1, weightU, oneMinusWeightU);
+	o_texels = simdutil::LerpRGBA8(top, bottom, weightV, oneMinusWeightV);
+}
+
+// Filter 8 quads (or point sample), red channel only as float.
+template <TextureFormat FormatT, bool UniformMipT, bool PagedT, bool PointT>
+static void FilterQuads(TextureData const& _tex, __m256i _mipLevels, QuadCoords const& _coords, __m256& o_r)
+{
+	__m256i offsets[4];
+	int const* base = QuadTexelOffsets<FormatT, UniformMipT, PagedT, PointT>(_tex, _mipLevels, _coords, offsets);
+
+	__m256 const x0y0 = FetchTexelsR<FormatT>(base, offsets[0], _coords.m_x0, _coords.m_y0);
 
-		// See above comment.
-		uint32_t const writeIdx = i >= 4 ? (i & 3) * 8 + 4 : i * 8;
-		_mm_store_ps(interpolatedTexels + writeIdx, finalInterp);
+	if (PointT)
+	{
+		o_r = x0y0;
+		return;
 	}
 
-	o_r = _mm256_load_ps(interpolatedTexels);
-	o_g = _mm256_load_ps(interpolatedTexels + 8);
-	o_b = _mm256_load_ps(interpolatedTexels + 16);
-	o_a = _mm256_load_ps(interpolatedTexels + 24);
+	__m256 const x1y0 = FetchTexelsR<FormatT>(base, offsets[1], _coords.m_x1, _coords.m_y0);
+	__m256 const x1y1 = FetchTexelsR<FormatT>(base, offsets[2], _coords.m_x1, _coords.m_y1);
+	__m256 const x0y1 = FetchTexelsR<FormatT>(base, offsets[3], _coords.m_x0, _coords.m_y1);
 
-	simdutil::Transpose4x4SubMatricies(o_r, o_g, o_b, o_a);
+	__m256 const top = simdutil::Lerp(x0y0, x1y0, _coords.m_interpU);
+	__m256 const bottom = simdutil::Lerp(x0y1, x1y1, _coords.m_interpU);
+	o_r = simdutil::Lerp(top, bottom, _coords.m_interpV);
+}
 
+template <bool UniformMipT, bool PagedT, bool PointT, typename OutT>
+static void FilterQuads(TextureData const& _tex, __m256i _mipLevels, QuadCoords const& _coords, OutT& o_out)
+{
+	switch (_tex.m_format)
+	{
+		case TextureFormat::RGBA8: FilterQuads<TextureFormat::RGBA8, UniformMipT, PagedT, PointT>(_tex, _mipLevels, _coords, o_out); break;
+		case TextureFormat::BC1: FilterQuads<TextureFormat::BC1, UniformMipT, PagedT, PointT>(_tex, _mipLevels, _coords, o_out); break;
+		case TextureFormat::BC3: FilterQuads<TextureFormat::BC3, UniformMipT, PagedT, PointT>(_tex, _mipLevels, _coords, o_out); break;
+		case TextureFormat::R8: FilterQuads<TextureFormat::R8, UniformMipT, PagedT, PointT>(_tex, _mipLevels, _coords, o_out); break;
+		case TextureFormat::RG8: FilterQuads<TextureFormat::RG8, UniformMipT, PagedT, PointT>(_tex, _mipLevels, _coords, o_out); break;
+		case TextureFormat::R16F: FilterQuads<TextureFormat::R16F, UniformMipT, PagedT, PointT>(_tex, _mipLevels, _coords, o_out); break;
+		case TextureFormat::R32F: FilterQuads<TextureFormat::R32F, UniformMipT, PagedT, PointT>(_tex, _mipLevels, _coords, o_out); break;
+		default: KT_UNREACHABLE;
+	}
 }
 
-void SampleWrap
+static void UnpackRGBA8
 (
-	TextureData const& _tex,
-	__m256 _u,
-	__m256 _v,
-	__m256 _dudx,
-	__m256 _dudy,
-	__m256 _dvdx,
-	__m256 _dvdy,
+	__m256i _texels,
 	__m256& o_r,
 	__m256& o_g,
 	__m256& o_b,
-	__m256& o_a,
-	uint32_t _execMask
+	__m256& o_a
 )
 {
-	__m256i const mipFloor = CalcMipLevels(_tex, _dudx, _dudy, _dvdx, _dvdy);
+	__m256i const byteMask = _mm256_set1_epi32(0xFF);
+	__m256 const scale = _mm256_set1_ps(1.0f / 255.0f);
+
+	o_r = _mm256_mul_ps(scale, _mm256_cvtepi32_ps(_mm256_and_si256(_texels, byteMask)));
+	o_g = _mm256_mul_ps(scale, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(_texels, 8), byteMask)));
+	o_b = _mm256_mul_ps(scale, _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(_texels, 16), byteMask)));
+	o_a = _mm256_mul_ps(scale, _mm256_cvtepi32_ps(_mm256_srli_epi32(_texels, 24)));
+}
 
+template <AddressMode AddressT>
+static void CalcQuadCoords
+(
+	TextureData const& _tex,
+	__m256 _u,
+	__m256 _v,
+	__m256i _mipLevels,
+	bool _uniformMip,
+	QuadCoords& o_coords
+)
+{
 	__m256i const one = _mm256_set1_epi32(1);
 
-	__m256i const widthLog2 = _mm256_set1_epi32(_tex.m_widthLog2);
-	__m256i const heightLog2 = _mm256_set1_epi32(_tex.m_heightLog2);
+	// Calculate mip widths, non pow2 dimensions round down.
+	__m256i width;
+	__m256i height;
 
-	// Calculate mip widths.
-	__m256i const width = _mm256_sllv_epi32(one, _mm256_sub_epi32(widthLog2, _mm256_min_epi32(widthLog2, mipFloor)));
-	__m256i const height = _mm256_sllv_epi32(one, _mm256_sub_epi32(heightLog2, _mm256_min_epi32(heightLog2, mipFloor)));
+	if (_uniformMip)
+	{
+		uint32_t dims[2];
+		CalcMipDims2D(_tex.m_width, _tex.m_height, uint32_t(_mm256_cvtsi256_si32(_mipLevels)), dims);
+		width = _mm256_set1_epi32(dims[0]);
+		height = _mm256_set1_epi32(dims[1]);
+	}
+	else
+	{
+		width = _mm256_max_epi32(one, _mm256_srlv_epi32(_mm256_set1_epi32(_tex.m_width), _mipLevels));
+		height = _mm256_max_epi32(one, _mm256_srlv_epi32(_mm256_set1_epi32(_tex.m_height), _mipLevels));
+	}
 
-	__m256 const signBit = SR_AVX_LOAD_CONST_FLOAT(simdutil::c_avxSignBit);
+	__m256 const widthF = _mm256_cvtepi32_ps(width);
+	__m256 const heightF = _mm256_cvtepi32_ps(height);
 
-	// Perform wrapping of uv coordinates and account for sign.
+	__m256 const u_texSpace = _mm256_mul_ps(widthF, AddressCoords<AddressT>(_u));
+	__m256 const v_texSpace = _mm256_mul_ps(heightF, AddressCoords<AddressT>(_v));
 
-	__m256 const uSign = _mm256_and_ps(signBit, _u);
-	__m256 const vSign = _mm256_and_ps(signBit, _v);
+	__m256 const u_texSpace_floor = _mm256_floor_ps(u_texSpace);
+	__m256 const v_texSpace_floor = _mm256_floor_ps(v_texSpace);
 
-	__m256 const absU = _mm256_xor_ps(uSign, _u);
-	__m256 const absV = _mm256_xor_ps(vSign, _v);
+	o_coords.m_interpU = _mm256_sub_ps(u_texSpace, u_texSpace_floor);
+	o_coords.m_interpV = _mm256_sub_ps(v_texSpace, v_texSpace_floor);
 
-	__m256 const fracU = _mm256_sub_ps(absU, _mm256_floor_ps(absU));
-	__m256 const fracV = _mm256_sub_ps(absV, _mm256_floor_ps(absV));
+	__m256i const x0 = _mm256_cvtps_epi32(u_texSpace_floor);
+	__m256i const y0 = _mm256_cvtps_epi32(v_texSpace_floor);
 
-	__m256 const fracU_wrap = _mm256_blendv_ps(fracU, _mm256_sub_ps(_mm256_set1_ps(1.0f), fracU), uSign);
-	__m256 const fracV_wrap = _mm256_blendv_ps(fracV, _mm256_sub_ps(_mm256_set1_ps(1.0f), fracV), vSign);
+	o_coords.m_x0 = BoundCoords<AddressT>(x0, width);
+	o_coords.m_y0 = BoundCoords<AddressT>(y0, height);
 
-	__m256 const widthF = _mm256_cvtepi32_ps(width);
-	__m256 const heightF = _mm256_cvtepi32_ps(height);
+	o_coords.m_x1 = BoundCoords<AddressT>(_mm256_add_epi32(o_coords.m_x0, one), width);
+	o_coords.m_y1 = BoundCoords<AddressT>(_mm256_add_epi32(o_coords.m_y0, one), height);
 
-	__m256 const u_texSpace = _mm256_mul_ps(widthF, fracU_wrap);
-	__m256 const v_texSpace = _mm256_mul_ps(heightF, fracV_wrap);
+	o_coords.m_width = width;
+}
 
-	__m256 const u_texSpace_floor = _mm256_floor_ps(u_texSpace);
-	__m256 const v_texSpace_floor = _mm256_floor_ps(v_texSpace);
+// Mark the pages of active lanes as requested this frame.
+static void RecordPageRequests(PagedTexture const& _paged, __m256i _vpages, uint32_t _execMask)
+{
+	uint32_t const frameIdx = std::atomic_load_explicit(_paged.m_frameIdx, std::memory_order_relaxed);
+
+	auto touch = [&_paged, frameIdx](uint32_t _vpage)
+	{
+		// Avoid dirtying the cache line if it's already marked.
+		std::atomic<uint32_t>& lastRequested = _paged.m_pageLastRequested[_vpage];
+		if (std::atomic_load_explicit(&lastRequested, std::memory_order_relaxed) != frameIdx)
+		{
+			std::atomic_store_explicit(&lastRequested, frameIdx, std::memory_order_relaxed);
+		}
+	};
+
+	if (AllActiveLanesEqual(_vpages, _execMask))
+	{
+		touch(uint32_t(_mm256_cvtsi256_si32(_vpages)));
+		return;
+	}
+
+	KT_ALIGNAS(32) uint32_t vpages[8];
+	_mm256_store_si256((__m256i*)vpages, _vpages);
+
+	uint32_t mask = _execMask;
+	while (mask)
+	{
+		touch(vpages[kt::Cnttz(mask)]);
+		mask &= mask - 1;
+	}
+}
 
-	__m256 const u_interp = _mm256_sub_ps(u_texSpace, u_texSpace_floor);
-	__m256 const v_interp = _mm256_sub_ps(v_texSpace, v_texSpace_floor);
+// Record the requested pages of a paged texture, then move each lane to the finest mip at or above the requested one whose footprint is resident.
+// The mip tail is always resident so this terminates.
+template <AddressMode AddressT, bool PointT>
+static __m256i ResolveResidentMips(TextureData const& _tex, __m256 _u, __m256 _v, __m256i _mipLevels, uint32_t _execMask)
+{
+	PagedTexture const& paged = *_tex.m_paged;
+
+	__m256i const tailMip = _mm256_set1_epi32(paged.m_firstTailMip);
+	__m256i const one = _mm256_set1_epi32(1);
+
+	__m256i mipLevels = _mipLevels;
+	uint32_t unresolvedMask = _execMask;
+
+	for (bool requested = false; ; requested = true)
+	{
+		QuadCoords coords;
+		CalcQuadCoords<AddressT>(_tex, _u, _v, mipLevels, false, coords);
+
+		// Point sampling only touches the first tap.
+		__m256i const p00 = VirtualPageIndices(paged, mipLevels, coords.m_width, coords.m_x0, coords.m_y0);
+		__m256i const p10 = PointT ? p00 : VirtualPageIndices(paged, mipLevels, coords.m_width, coords.m_x1, coords.m_y0);
+		__m256i const p01 = PointT ? p00 : VirtualPageIndices(paged, mipLevels, coords.m_width, coords.m_x0, coords.m_y1);
+		__m256i const p11 = PointT ? p00 : VirtualPageIndices(paged, mipLevels, coords.m_width, coords.m_x1, coords.m_y1);
+
+		if (!requested)
+		{
+			RecordPageRequests(paged, p00, _execMask);
+
+			if (!PointT)
+			{
+				RecordPageRequests(paged, p10, _execMask);
+				RecordPageRequests(paged, p01, _execMask);
+				RecordPageRequests(paged, p11, _execMask);
+			}
+		}
+
+		// Non resident entries are negative.
+		__m256i pageBits = _mm256_i32gather_epi32((int const*)paged.m_pageTable, p00, 4);
+
+		if (!PointT)
+		{
+			pageBits = _mm256_or_si256
+			(
+				_mm256_or_si256(pageBits, _mm256_i32gather_epi32((int const*)paged.m_pageTable, p10, 4)),
+				_mm256_or_si256(_mm256_i32gather_epi32((int const*)paged.m_pageTable, p01, 4), _mm256_i32gather_epi32((int const*)paged.m_pageTable, p11, 4))
+			);
+		}
+
+		__m256i const missing = _mm256_and_si256(_mm256_srai_epi32(pageBits, 31), _mm256_cmpgt_epi32(tailMip, mipLevels));
+		unresolvedMask &= uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(missing)));
+
+		if (!unresolvedMask)
+		{
+			return mipLevels;
+		}
+
+		mipLevels = _mm256_add_epi32(mipLevels, _mm256_and_si256(missing, one));
+	}
+}
+
+// Sample one mip per lane. OutT is __m256i for RGBA8 texels or __m256 for the red channel.
+template <AddressMode AddressT, bool PointT, typename OutT>
+static void SampleMipLevels
+(
+	TextureData const& _tex,
+	__m256 _u,
+	__m256 _v,
+	__m256i _mipLevels,
+	uint32_t _execMask,
+	OutT& o_out
+)
+{
+	if (_tex.m_paged)
+	{
+		__m256i const mipLevels = ResolveResidentMips<AddressT, PointT>(_tex, _u, _v, _mipLevels, _execMask);
+
+		bool const uniformMip = AllActiveLanesEqual(mipLevels, _execMask);
+
+		QuadCoords coords;
+		CalcQuadCoords<AddressT>(_tex, _u, _v, mipLevels, uniformMip, coords);
+
+		if (uniformMip)
+		{
+			FilterQuads<true, true, PointT>(_tex, mipLevels, coords, o_out);
+		}
+		else
+		{
+			FilterQuads<false, true, PointT>(_tex, mipLevels, coords, o_out);
+		}
+		return;
+	}
+
+	bool const uniformMip = AllActiveLanesEqual(_mipLevels, _execMask);
+
+	QuadCoords coords;
+	CalcQuadCoords<AddressT>(_tex, _u, _v, _mipLevels, uniformMip, coords);
+
+	if (uniformMip)
+	{
+		FilterQuads<true, false, PointT>(_tex, _mipLevels, coords, o_out);
+	}
+	else
+	{
+		FilterQuads<false, false, PointT>(_tex, _mipLevels, coords, o_out);
+	}
+}
+
+static __m256i LerpMips(__m256i _texels0, __m256i _texels1, __m256 _lodFrac)
+{
+	__m256i const w = _mm256_cvtps_epi32(_mm256_mul_ps(_lodFrac, _mm256_set1_ps(256.0f)));
+	__m256i const weight = _mm256_or_si256(w, _mm256_slli_epi32(w, 16));
+	return simdutil::LerpRGBA8(_texels0, _texels1, weight, _mm256_sub_epi16(_mm256_set1_epi16(256), weight));
+}
+
+static __m256 LerpMips(__m256 _r0, __m256 _r1, __m256 _lodFrac)
+{
+	return simdutil::Lerp(_r0, _r1, _lodFrac);
+}
+
+template <AddressMode AddressT, typename OutT>
+static void SampleTrilinearMipLevels
+(
+	TextureData const& _tex,
+	__m256 _u,
+	__m256 _v,
+	__m256 _lod,
+	uint32_t _execMask,
+	OutT& o_out
+)
+{
+	__m256 const lodFloor = _mm256_floor_ps(_lod);
+	__m256 const lodFrac = _mm256_sub_ps(_lod, lodFloor);
+
+	__m256i const mip0 = _mm256_cvtps_epi32(lodFloor);
+
+	SampleMipLevels<AddressT, false>(_tex, _u, _v, mip0, _execMask, o_out);
+
+	// Skip the second mip if no active lane is between levels (magnification, smallest mip or exactly on a level).
+	uint32_t const blendMask = uint32_t(_mm256_movemask_ps(_mm256_cmp_ps(lodFrac, _mm256_setzero_ps(), _CMP_GT_OQ))) & _execMask;
+	if (!blendMask)
+	{
+		return;
+	}
 
-	__m256i const x0 = BoundCoordsWrap(_mm256_cvtps_epi32(u_texSpace_floor), width);
-	__m256i const y0 = BoundCoordsWrap(_mm256_cvtps_epi32(v_texSpace_floor), height);
+	__m256i const mip1 = _mm256_min_epi32(_mm256_add_epi32(mip0, _mm256_set1_epi32(1)), _mm256_set1_epi32(_tex.m_numMips - 1));
 
-	__m256i const x1 = BoundCoordsWrap(_mm256_add_epi32(x0, one), width);
-	__m256i const y1 = BoundCoordsWrap(_mm256_add_epi32(y0, one), height);
+	OutT second;
+	SampleMipLevels<AddressT, false>(_tex, _u, _v, mip1, _execMask, second);
+	o_out = LerpMips(o_out, second, lodFrac);
+}
 
-	KT_ALIGNAS(32) uint32_t mips[8];
-	_mm256_store_si256((__m256i*)mips, mipFloor);
+template <AddressMode AddressT, FilterMode FilterT, typename OutT>
+static void SampleImpl
+(
+	TextureData const& _tex,
+	__m256 _u,
+	__m256 _v,
+	__m256 _dudx,
+	__m256 _dudy,
+	__m256 _dvdx,
+	__m256 _dvdy,
+	uint32_t _execMask,
+	OutT& o_out
+)
+{
+	switch (FilterT)
+	{
+		case FilterMode::Point: SampleMipLevels<AddressT, true>(_tex, _u, _v, CalcMipLevels(_tex, _dudx, _dudy, _dvdx, _dvdy), _execMask, o_out); break;
+		case FilterMode::Bilinear: SampleMipLevels<AddressT, false>(_tex, _u, _v, CalcMipLevels(_tex, _dudx, _dudy, _dvdx, _dvdy), _execMask, o_out); break;
+		case FilterMode::Trilinear: SampleTrilinearMipLevels<AddressT>(_tex, _u, _v, CalcMipLod(_tex, _dudx, _dudy, _dvdx, _dvdy), _execMask, o_out); break;
+		default: KT_UNREACHABLE;
+	}
+}
 
-	KT_ALIGNAS(32) float interpU[8];
-	KT_ALIGNAS(32) float interpV[8];
+template <AddressMode AddressT, FilterMode FilterT>
+void Sample
+(
+	TextureData const& _tex,
+	__m256 _u,
+	__m256 _v,
+	__m256 _dudx,
+	__m256 _dudy,
+	__m256 _dvdx,
+	__m256 _dvdy,
+	__m256& o_r,
+	__m256& o_g,
+	__m256& o_b,
+	__m256& o_a,
+	uint32_t _execMask
+)
+{
+	if (_tex.m_format == TextureFormat::R16F || _tex.m_format == TextureFormat::R32F)
+	{
+		// Float formats keep full precision.
+		SampleImpl<AddressT, FilterT>(_tex, _u, _v, _dudx, _dudy, _dvdx, _dvdy, _execMask, o_r);
+		o_g = _mm256_setzero_ps();
+		o_b = _mm256_setzero_ps();
+		o_a = _mm256_set1_ps(1.0f);
+		return;
+	}
 
-	_mm256_store_ps(interpU, u_interp);
-	_mm256_store_ps(interpV, v_interp);
+	__m256i texels;
+	SampleImpl<AddressT, FilterT>(_tex, _u, _v, _dudx, _dudy, _dvdx, _dvdy, _execMask, texels);
+	UnpackRGBA8(texels, o_r, o_g, o_b, o_a);
+}
 
-	GatherQuadsAndInterpolate(_tex, mips, width, x0, y0, x1, y1, o_r, o_g, o_b, o_a, interpU, interpV, _execMask);
+template <AddressMode AddressT, FilterMode FilterT>
+void SampleRGBA8
+(
+	TextureData const& _tex,
+	__m256 _u,
+	__m256 _v,
+	__m256 _dudx,
+	__m256 _dudy,
+	__m256 _dvdx,
+	__m256 _dvdy,
+	uint32_t o_texels[8],
+	uint32_t _execMask
+)
+{
+	__m256i texels;
+	SampleImpl<AddressT, FilterT>(_tex, _u, _v, _dudx, _dudy, _dvdx, _dvdy, _execMask, texels);
+	_mm256_store_si256((__m256i*)o_texels, texels);
 }
 
+template <AddressMode AddressT, FilterMode FilterT>
+__m256 SampleR
+(
+	TextureData const& _tex,
+	__m256 _u,
+	__m256 _v,
+	__m256 _dudx,
+	__m256 _dudy,
+	__m256 _dvdx,
+	__m256 _dvdy,
+	uint32_t _execMask
+)
+{
+	__m256 r;
+	SampleImpl<AddressT, FilterT>(_tex, _u, _v, _dudx, _dudy, _dvdx, _dvdy, _execMask, r);
+	return r;
+}
+
+#define SR_INSTANTIATE_SAMPLERS(ADDRESS, FILTER) \
+	template void Sample<AddressMode::ADDRESS, FilterMode::FILTER>(TextureData const&, __m256, __m256, __m256, __m256, __m256, __m256, __m256&, __m256&, __m256&, __m256&, uint32_t); \
+	template void SampleRGBA8<AddressMode::ADDRESS, FilterMode::FILTER>(TextureData const&, __m256, __m256, __m256, __m256, __m256, __m256, uint32_t[8], uint32_t); \
+	template __m256 SampleR<AddressMode::ADDRESS, FilterMode::FILTER>(TextureData const&, __m256, __m256, __m256, __m256, __m256, __m256, uint32_t);
+
+SR_INSTANTIATE_SAMPLERS(Wrap, Point)
+SR_INSTANTIATE_SAMPLERS(Wrap, Bilinear)
+SR_INSTANTIATE_SAMPLERS(Wrap, Trilinear)
+SR_INSTANTIATE_SAMPLERS(Clamp, Point)
+SR_INSTANTIATE_SAMPLERS(Clamp, Bilinear)
+SR_INSTANTIATE_SAMPLERS(Clamp, Trilinear)
+SR_INSTANTIATE_SAMPLERS(Mirror, Point)
+SR_INSTANTIATE_SAMPLERS(Mirror, Bilinear)
+SR_INSTANTIATE_SAMPLERS(Mirror, Trilinear)
+
+#undef SR_INSTANTIATE_SAMPLERS
+
+}
 }
-}
\ No newline at end of file
@@ -13,9 +13,21 @@
 namespace sr
 {
 
+class TaskSystem;
+
 namespace Tex
 {
 
+struct PagedTexture;
+
+// Textures are stored in tiles of c_texTileSize^2 texels (if SR_TILE_TEXTURES), which are also the pages of virtual textures.
+constexpr uint32_t c_texTileSizeLog2 = 5;
+constexpr uint32_t c_texTileSize = 1 << c_texTileSizeLog2;
+constexpr uint32_t c_texTileMask = c_texTileSize - 1;
+
+// Texel fetches gather 4 bytes, so formats with smaller texels may read up to 3 bytes past the end of the texel data.
+constexpr uint32_t c_texFetchSlackBytes = 4;
+
 void CalcMipDims2D(uint32_t _x, uint32_t _y, uint32_t _level, uint32_t o_dims[2]);
 
 struct TextureData
@@ -26,21 +38,56 @@ struct TextureData
 	TextureData(TextureData&&) = default;
 	TextureData& operator=(TextureData&&) = default;
 		
-	void CreateFromFile(char const* _file);
-	void CreateFromRGBA8(uint8_t const* _texels, uint32_t _width, uint32_t _height, bool _calcMips = false);
+	// If _taskSystem is non null, large mips are generated across its workers.
+	void CreateFromFile(char const* _file, TextureFormat _format = TextureFormat::RGBA8, TaskSystem* _taskSystem = nullptr);
+	void CreateFromRGBA8(uint8_t const* _texels, uint32_t _width, uint32_t _height, bool _calcMips = false, TextureFormat _format = TextureFormat::RGBA8, TaskSystem* _taskSystem = nullptr);
+
+	// Texels already in an uncompressed _format (e.g. R32F shadow maps), no mips.
+	void CreateFromTexels(void const* _texels, uint32_t _width, uint32_t _height, TextureFormat _format);
+
+	// Sample _texels in place (e.g. from a mapped file) instead of m_texels. The other members must already describe them.
+	// They must outlive the texture and include c_texFetchSlackBytes of padding.
+	void SetExternalTexels(uint8_t const* _texels, uint32_t _size);
+
 	void Clear();
 
+	uint8_t const* Texels() const { return m_externalTexels ? m_externalTexels : m_texels.Data(); }
+	uint32_t TexelBytes() const { return m_externalTexels ? m_externalTexelBytes : m_texels.Size(); }
+
+	// False if there is nothing to sample.
+	bool HasTexels() const { return TexelBytes() != 0 || m_paged; }
+
 	kt::Array<uint8_t> m_texels;
+
+	uint8_t const* m_externalTexels = nullptr;
+	uint32_t m_externalTexelBytes = 0;
 	uint32_t m_mipOffsets[Config::c_maxTexDimLog2];
 
-	uint32_t m_widthLog2 = 0;
-	uint32_t m_heightLog2 = 0;
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
 	uint32_t m_numMips = 0;
 
+	// Bytes per texel, 0 for block compressed formats.
 	uint32_t m_bytesPerPixel = 0;
+
+	TextureFormat m_format = TextureFormat::RGBA8;
+
+	// Non null if mips are paged in on demand (m_texels is empty), owned by a VirtualTextureCache.
+	PagedTexture* m_paged = nullptr;
 };
 
-void SampleWrap
+// Bytes of one tile of the given format.
+uint32_t TexturePageBytes(TextureFormat _format);
+
+// Whether _tex's size, format and mip offsets describe a texture Create* could have made, with its texels fitting in _texelBytes (unless 0, e.g. for paged textures).
+// For textures read from a file rather than created, as samplers don't bounds check. A texture without mips is valid if it has no texels.
+bool TextureLayoutValid(TextureData const& _tex, uint32_t _texelBytes);
+
+// Samplers are explicitly instantiated for every address/filter mode, the texture's format is dispatched at runtime.
+// Point and bilinear sample the nearest lower mip, trilinear blends the two nearest mips by the fractional LOD.
+// Missing channels are 0 (alpha 1).
+template <AddressMode AddressT, FilterMode FilterT>
+void Sample
 (
 	TextureData const& _tex, 
 	__m256 _u, 
@@ -55,6 +102,84 @@ void SampleWrap
 	__m256& o_a,
 	uint32_t _execMask);
 
+// Same as Sample but outputs RGBA8 directly, for shaders that don't need float colour.
+template <AddressMode AddressT, FilterMode FilterT>
+void SampleRGBA8
+(
+	TextureData const& _tex, 
+	__m256 _u, 
+	__m256 _v, 
+	__m256 dudx, 
+	__m256 dudy, 
+	__m256 dvdx, 
+	__m256 dvdy, 
+	uint32_t o_texels[8],
+	uint32_t _execMask);
+
+// Red channel only, for shadow maps, masks etc. Single channel formats are fetched and filtered without unpacking.
+template <AddressMode AddressT, FilterMode FilterT>
+__m256 SampleR
+(
+	TextureData const& _tex, 
+	__m256 _u, 
+	__m256 _v, 
+	__m256 dudx, 
+	__m256 dudy, 
+	__m256 dvdx, 
+	__m256 dvdy, 
+	uint32_t _execMask);
+
+inline void SampleWrap
+(
+	TextureData const& _tex, 
+	__m256 _u, 
+	__m256 _v, 
+	__m256 dudx, 
+	__m256 dudy, 
+	__m256 dvdx, 
+	__m256 dvdy, 
+	__m256& o_r,
+	__m256& o_g,
+	__m256& o_b,
+	__m256& o_a,
+	uint32_t _execMask)
+{
+	Sample<AddressMode::Wrap, FilterMode::Bilinear>(_tex, _u, _v, dudx, dudy, dvdx, dvdy, o_r, o_g, o_b, o_a, _execMask);
+}
+
+inline void SampleWrapRGBA8
+(
+	TextureData const& _tex, 
+	__m256 _u, 
+	__m256 _v, 
+	__m256 dudx, 
+	__m256 dudy, 
+	__m256 dvdx, 
+	__m256 dvdy, 
+	uint32_t o_texels[8],
+	uint32_t _execMask)
+{
+	SampleRGBA8<AddressMode::Wrap, FilterMode::Bilinear>(_tex, _u, _v, dudx, dudy, dvdx, dvdy, o_texels, _execMask);
+}
+
+inline void SampleWrapTrilinear
+(
+	TextureData const& _tex, 
+	__m256 _u, 
+	__m256 _v, 
+	__m256 dudx, 
+	__m256 dudy, 
+	__m256 dvdx, 
+	__m256 dvdy, 
+	__m256& o_r,
+	__m256& o_g,
+	__m256& o_b,
+	__m256& o_a,
+	uint32_t _execMask)
+{
+	Sample<AddressMode::Wrap, FilterMode::Trilinear>(_tex, _u, _v, dudx, dudy, dvdx, dvdy, o_r, o_g, o_b, o_a, _execMask);
+}
+
 }
 }
 
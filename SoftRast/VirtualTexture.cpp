@@ -0,0 +1,390 @@
+#define _CRT_SECURE_NO_WARNINGS
+#include <string.h>
+
+#include <kt/Memory.h>
+#include <kt/Logging.h>
+#include <kt/Sort.h>
+
+#include "VirtualTexture.h"
+#include "Texture.h"
+
+namespace sr
+{
+
+namespace Tex
+{
+
+VirtualTextureCache::~VirtualTextureCache()
+{
+	Shutdown();
+}
+
+bool VirtualTextureCache::Init(char const* _pageFile)
+{
+	KT_ASSERT(!m_file);
+
+	m_file = fopen(_pageFile, "rb");
+	if (!m_file)
+	{
+		KT_LOG_ERROR("Failed to open texture page file %s", _pageFile);
+		return false;
+	}
+
+	std::atomic_store_explicit(&m_keepRunning, 1, std::memory_order_relaxed);
+
+	m_loaderThread.Run([](kt::Thread* _self)
+	{
+		((VirtualTextureCache*)_self->GetUserData())->LoaderLoop();
+	},
+	this, "SoftRast Texture Loader");
+
+	return true;
+}
+
+void VirtualTextureCache::Shutdown()
+{
+	if (!m_file)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lk(m_mutex);
+		std::atomic_store_explicit(&m_keepRunning, 0, std::memory_order_relaxed);
+	}
+
+	m_condVar.notify_all();
+	m_loaderThread.Join();
+
+	for (PagedTexture* paged : m_textures)
+	{
+		paged->m_tex->m_paged = nullptr;
+		kt::Free(paged->m_pageTable);
+		kt::Free(paged->m_pageLastRequested);
+		delete paged;
+	}
+
+	for (PagePool& pool : m_pools)
+	{
+		kt::Free(pool.m_mem);
+		pool.m_mem = nullptr;
+		pool.m_freePages.ClearAndFree();
+		pool.m_owners.ClearAndFree();
+		pool.m_evictionCandidates.ClearAndFree();
+	}
+
+	m_textures.ClearAndFree();
+	m_pendingLoads.ClearAndFree();
+	m_completedLoads.ClearAndFree();
+
+	fclose(m_file);
+	m_file = nullptr;
+}
+
+uint64_t VirtualTextureCache::WritePages(FILE* _pageFile, TextureData const& _tex)
+{
+	uint64_t const offset = uint64_t(_ftelli64(_pageFile));
+	fwrite(_tex.Texels(), 1, _tex.TexelBytes(), _pageFile);
+	return offset;
+}
+
+VirtualTextureCache::PagePool& VirtualTextureCache::PoolForFormat(TextureFormat _format)
+{
+	KT_ASSERT(_format < TextureFormat::BC_Auto);
+	PagePool& pool = m_pools[uint32_t(_format)];
+
+	if (!pool.m_mem)
+	{
+		pool.m_pageBytes = TexturePageBytes(_format);
+		pool.m_numPages = Config::c_vtPoolBytesPerFormat / pool.m_pageBytes;
+		pool.m_mem = (uint8_t*)kt::Malloc(size_t(pool.m_numPages) * pool.m_pageBytes + c_texFetchSlackBytes, 64);
+		pool.m_owners.Resize(pool.m_numPages);
+
+		// Reversed so pages are handed out from the start of the pool.
+		pool.m_freePages.Resize(pool.m_numPages);
+		for (uint32_t i = 0; i < pool.m_numPages; ++i)
+		{
+			pool.m_freePages[i] = pool.m_numPages - i - 1;
+		}
+	}
+
+	return pool;
+}
+
+void VirtualTextureCache::Register(TextureData& _tex, uint64_t _fileOffset)
+{
+	KT_ASSERT(m_file);
+	KT_ASSERT(!_tex.m_paged);
+
+#if !SR_TILE_TEXTURES
+	KT_ASSERT(!"Virtual textures require tiled textures.");
+#endif
+
+	PagePool& pool = PoolForFormat(_tex.m_format);
+
+	PagedTexture* paged = new PagedTexture;
+	paged->m_tex = &_tex;
+	paged->m_pageBytes = pool.m_pageBytes;
+	paged->m_pageBytesLog2 = kt::FloorLog2(pool.m_pageBytes);
+	paged->m_poolBase = pool.m_mem;
+	paged->m_fileOffset = _fileOffset;
+	paged->m_frameIdx = &m_frameIdx;
+
+	paged->m_firstTailMip = _tex.m_numMips - 1;
+
+	for (uint32_t mipIdx = 0; mipIdx < _tex.m_numMips; ++mipIdx)
+	{
+		KT_ASSERT((_tex.m_mipOffsets[mipIdx] & (pool.m_pageBytes - 1)) == 0);
+		paged->m_mipPageOffsets[mipIdx] = _tex.m_mipOffsets[mipIdx] >> paged->m_pageBytesLog2;
+
+		uint32_t dims[2];
+		CalcMipDims2D(_tex.m_width, _tex.m_height, mipIdx, dims);
+		if (dims[0] <= c_texTileSize && dims[1] <= c_texTileSize)
+		{
+			paged->m_firstTailMip = kt::Min(paged->m_firstTailMip, mipIdx);
+		}
+	}
+
+	// The last mip is always a single page.
+	paged->m_numPages = paged->m_mipPageOffsets[_tex.m_numMips - 1] + 1;
+
+	paged->m_pageTable = (uint32_t*)kt::Malloc(sizeof(uint32_t) * paged->m_numPages);
+	paged->m_pageLastRequested = (std::atomic<uint32_t>*)kt::Malloc(sizeof(std::atomic<uint32_t>) * paged->m_numPages);
+
+	for (uint32_t i = 0; i < paged->m_numPages; ++i)
+	{
+		paged->m_pageTable[i] = c_vtPageNotResident;
+		kt::PlacementNew(&paged->m_pageLastRequested[i], 0u);
+	}
+
+	// Load and pin the tail.
+	for (uint32_t vpage = paged->m_mipPageOffsets[paged->m_firstTailMip]; vpage < paged->m_numPages; ++vpage)
+	{
+		KT_ASSERT(pool.m_freePages.Size() && "Virtual texture pool too small for mip tails.");
+		uint32_t const page = pool.m_freePages.Back();
+		pool.m_freePages.PopBack();
+
+		PageOwner& owner = pool.m_owners[page];
+		owner.m_tex = paged;
+		owner.m_virtualPage = vpage;
+		owner.m_pinned = true;
+
+		ReadPage(*paged, vpage, page);
+		paged->m_pageTable[vpage] = page;
+	}
+
+	_tex.Clear();
+	_tex.m_paged = paged;
+
+	m_textures.PushBack(paged);
+}
+
+void VirtualTextureCache::ReadPage(PagedTexture const& _tex, uint32_t _virtualPage, uint32_t _physicalPage)
+{
+	uint8_t* dest = _tex.m_poolBase + size_t(_physicalPage) * _tex.m_pageBytes;
+
+	std::lock_guard<std::mutex> lk(m_fileMutex);
+	_fseeki64(m_file, int64_t(_tex.m_fileOffset + uint64_t(_virtualPage) * _tex.m_pageBytes), SEEK_SET);
+	if (fread(dest, 1, _tex.m_pageBytes, m_file) != _tex.m_pageBytes)
+	{
+		KT_LOG_ERROR("Failed to read texture page %u.", _virtualPage);
+		memset(dest, 0, _tex.m_pageBytes);
+	}
+}
+
+bool VirtualTextureCache::AllocPage(PagePool& _pool, uint32_t& o_page)
+{
+	if (_pool.m_freePages.Size())
+	{
+		o_page = _pool.m_freePages.Back();
+		_pool.m_freePages.PopBack();
+		return true;
+	}
+
+	uint32_t const frameIdx = std::atomic_load_explicit(&m_frameIdx, std::memory_order_relaxed);
+
+	auto lastRequested = [&_pool](uint32_t _page) -> uint32_t
+	{
+		PageOwner const& owner = _pool.m_owners[_page];
+		return std::atomic_load_explicit(&owner.m_tex->m_pageLastRequested[owner.m_virtualPage], std::memory_order_relaxed);
+	};
+
+	if (!_pool.m_evictionCandidatesValid)
+	{
+		_pool.m_evictionCandidatesValid = true;
+		_pool.m_nextEvictionCandidate = 0;
+		_pool.m_evictionCandidates.Clear();
+
+		for (uint32_t page = 0; page < _pool.m_numPages; ++page)
+		{
+			PageOwner const& owner = _pool.m_owners[page];
+
+			// Skip pinned and in flight pages, and anything used last frame.
+			if (owner.m_tex && !owner.m_pinned && owner.m_tex->m_pageTable[owner.m_virtualPage] == page && lastRequested(page) != frameIdx)
+			{
+				_pool.m_evictionCandidates.PushBack(page);
+			}
+		}
+
+		uint32_t* radixTemp = (uint32_t*)kt::Malloc(sizeof(uint32_t) * kt::Max(1u, _pool.m_evictionCandidates.Size()));
+		KT_SCOPE_EXIT(kt::Free(radixTemp));
+		kt::RadixSort(_pool.m_evictionCandidates.Data(), _pool.m_evictionCandidates.Data() + _pool.m_evictionCandidates.Size(), radixTemp, lastRequested);
+	}
+
+	if (_pool.m_nextEvictionCandidate == _pool.m_evictionCandidates.Size())
+	{
+		return false;
+	}
+
+	uint32_t const page = _pool.m_evictionCandidates[_pool.m_nextEvictionCandidate++];
+	PageOwner& owner = _pool.m_owners[page];
+	owner.m_tex->m_pageTable[owner.m_virtualPage] = c_vtPageNotResident;
+	owner.m_tex = nullptr;
+
+	o_page = page;
+	return true;
+}
+
+void VirtualTextureCache::Update()
+{
+	// Map pages that finished loading.
+	{
+		std::lock_guard<std::mutex> lk(m_mutex);
+		for (LoadRequest const& req : m_completedLoads)
+		{
+			req.m_tex->m_pageTable[req.m_virtualPage] = req.m_physicalPage;
+		}
+		m_completedLoads.Clear();
+	}
+
+	for (PagePool& pool : m_pools)
+	{
+		pool.m_evictionCandidatesValid = false;
+	}
+
+	uint32_t const frameIdx = std::atomic_load_explicit(&m_frameIdx, std::memory_order_relaxed);
+
+	LoadRequest* requests = (LoadRequest*)KT_ALLOCA(sizeof(LoadRequest) * Config::c_vtMaxPageLoadsPerFrame);
+	uint32_t numRequests = 0;
+
+	for (PagedTexture* paged : m_textures)
+	{
+		TextureData const& tex = *paged->m_tex;
+
+		uint32_t tilesX[Config::c_maxTexDimLog2];
+		uint32_t tilesY[Config::c_maxTexDimLog2];
+
+		for (uint32_t mipIdx = 0; mipIdx <= paged->m_firstTailMip; ++mipIdx)
+		{
+			uint32_t dims[2];
+			CalcMipDims2D(tex.m_width, tex.m_height, mipIdx, dims);
+			tilesX[mipIdx] = uint32_t(kt::AlignUp(dims[0], c_texTileSize)) >> c_texTileSizeLog2;
+			tilesY[mipIdx] = uint32_t(kt::AlignUp(dims[1], c_texTileSize)) >> c_texTileSizeLog2;
+		}
+
+		// Request the parent of every requested page, so there is a coarser mip to fall back to while loading and it stays warm in the LRU.
+		for (uint32_t mipIdx = 0; mipIdx + 1 < paged->m_firstTailMip; ++mipIdx)
+		{
+			uint32_t const mipBegin = paged->m_mipPageOffsets[mipIdx];
+			uint32_t const parentBegin = paged->m_mipPageOffsets[mipIdx + 1];
+
+			for (uint32_t tileY = 0; tileY < tilesY[mipIdx]; ++tileY)
+			{
+				for (uint32_t tileX = 0; tileX < tilesX[mipIdx]; ++tileX)
+				{
+					uint32_t const vpage = mipBegin + tileY * tilesX[mipIdx] + tileX;
+					if (std::atomic_load_explicit(&paged->m_pageLastRequested[vpage], std::memory_order_relaxed) == frameIdx)
+					{
+						uint32_t const parent = parentBegin + (tileY >> 1) * tilesX[mipIdx + 1] + (tileX >> 1);
+						std::atomic_store_explicit(&paged->m_pageLastRequested[parent], frameIdx, std::memory_order_relaxed);
+					}
+				}
+			}
+		}
+
+		// Coarse mips first, they cover the most screen area per page.
+		for (uint32_t mipIdx = paged->m_firstTailMip; mipIdx-- > 0 && numRequests < Config::c_vtMaxPageLoadsPerFrame;)
+		{
+			uint32_t const mipEnd = paged->m_mipPageOffsets[mipIdx] + tilesX[mipIdx] * tilesY[mipIdx];
+			for (uint32_t vpage = paged->m_mipPageOffsets[mipIdx]; vpage < mipEnd && numRequests < Config::c_vtMaxPageLoadsPerFrame; ++vpage)
+			{
+				if (paged->m_pageTable[vpage] == c_vtPageNotResident
+					&& std::atomic_load_explicit(&paged->m_pageLastRequested[vpage], std::memory_order_relaxed) == frameIdx)
+				{
+					LoadRequest& req = requests[numRequests++];
+					req.m_tex = paged;
+					req.m_virtualPage = vpage;
+				}
+			}
+		}
+	}
+
+	uint32_t numQueued = 0;
+
+	for (; numQueued < numRequests; ++numQueued)
+	{
+		LoadRequest& req = requests[numQueued];
+		PagePool& pool = m_pools[uint32_t(req.m_tex->m_tex->m_format)];
+
+		if (!AllocPage(pool, req.m_physicalPage))
+		{
+			// Everything resident is in use, try again next frame.
+			break;
+		}
+
+		PageOwner& owner = pool.m_owners[req.m_physicalPage];
+		owner.m_tex = req.m_tex;
+		owner.m_virtualPage = req.m_virtualPage;
+		owner.m_pinned = false;
+
+		req.m_tex->m_pageTable[req.m_virtualPage] = c_vtPageLoading;
+	}
+
+	if (numQueued)
+	{
+		{
+			std::lock_guard<std::mutex> lk(m_mutex);
+
+			// The loader pops from the back, keep the coarse pages there.
+			for (uint32_t i = numQueued; i-- > 0;)
+			{
+				m_pendingLoads.PushBack(requests[i]);
+			}
+		}
+
+		m_condVar.notify_one();
+	}
+
+	std::atomic_store_explicit(&m_frameIdx, frameIdx + 1, std::memory_order_relaxed);
+}
+
+void VirtualTextureCache::LoaderLoop()
+{
+	std::unique_lock<std::mutex> lk(m_mutex);
+
+	for (;;)
+	{
+		m_condVar.wait(lk, [this]()
+		{
+			return std::atomic_load_explicit(&m_keepRunning, std::memory_order_relaxed) == 0 || m_pendingLoads.Size() > 0;
+		});
+
+		if (!std::atomic_load_explicit(&m_keepRunning, std::memory_order_relaxed))
+		{
+			break;
+		}
+
+		LoadRequest const req = m_pendingLoads.Back();
+		m_pendingLoads.PopBack();
+
+		// The physical page isn't mapped until Update picks up the completed load, so nothing samples it while reading.
+		lk.unlock();
+		ReadPage(*req.m_tex, req.m_virtualPage, req.m_physicalPage);
+		lk.lock();
+
+		m_completedLoads.PushBack(req);
+	}
+}
+
+}
+}
@@ -0,0 +1,139 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include <kt/Array.h>
+#include <kt/Concurrency.h>
+
+#include "SoftRastTypes.h"
+#include "Config.h"
+
+namespace sr
+{
+
+namespace Tex
+{
+
+struct TextureData;
+class VirtualTextureCache;
+
+// Page table entries. Anything negative (as int32) is not resident.
+constexpr uint32_t c_vtPageNotResident = 0xFFFFFFFF;
+constexpr uint32_t c_vtPageLoading = 0xFFFFFFFE;
+
+// A texture whose mips are paged in on demand. A page is one c_texTileSize^2 tile of a mip, which is contiguous in tiled storage.
+// Virtual page i lives at byte i * m_pageBytes of the texture's (tiled) texel data, mips smaller than a tile are one padded page.
+struct PagedTexture
+{
+	TextureData* m_tex = nullptr;
+
+	// Physical page in m_poolBase for each virtual page.
+	uint32_t* m_pageTable = nullptr;
+
+	// Frame each virtual page was last sampled in, written by the sampler.
+	std::atomic<uint32_t>* m_pageLastRequested = nullptr;
+
+	// First virtual page of each mip.
+	uint32_t m_mipPageOffsets[Config::c_maxTexDimLog2];
+
+	uint32_t m_numPages = 0;
+
+	// Mips from here on are a single page each and always resident, so sampling can always fall back to them.
+	uint32_t m_firstTailMip = 0;
+
+	uint32_t m_pageBytes = 0;
+	uint32_t m_pageBytesLog2 = 0;
+
+	uint8_t* m_poolBase = nullptr;
+
+	// Offset of virtual page 0 in the page file.
+	uint64_t m_fileOffset = 0;
+
+	std::atomic<uint32_t> const* m_frameIdx = nullptr;
+};
+
+// Page residency for a set of paged textures backed by one page file (see WritePages).
+// Sampling requests are collected during the frame; Update, called between frames, maps pages that finished loading,
+// evicts the least recently requested pages when over budget and queues loads for the background loader thread.
+class VirtualTextureCache
+{
+public:
+	KT_NO_COPY(VirtualTextureCache);
+
+	VirtualTextureCache() = default;
+	~VirtualTextureCache();
+
+	bool Init(char const* _pageFile);
+	void Shutdown();
+
+	bool IsInitialized() const { return m_file != nullptr; }
+
+	// Append all texel data of _tex to a page file, returns the offset to pass to Register.
+	static uint64_t WritePages(FILE* _pageFile, TextureData const& _tex);
+
+	// Make _tex paged. Frees its texel data, the mip tail is loaded immediately.
+	void Register(TextureData& _tex, uint64_t _fileOffset);
+
+	// Must be called while nothing is being sampled (between frames).
+	void Update();
+
+private:
+	struct PageOwner
+	{
+		PagedTexture* m_tex = nullptr;
+		uint32_t m_virtualPage = 0;
+		bool m_pinned = false;
+	};
+
+	struct PagePool
+	{
+		uint8_t* m_mem = nullptr;
+		uint32_t m_pageBytes = 0;
+		uint32_t m_numPages = 0;
+
+		kt::Array<uint32_t> m_freePages;
+		kt::Array<PageOwner> m_owners;
+
+		// Evictable pages, least recently requested first. Built on the first eviction of each Update.
+		kt::Array<uint32_t> m_evictionCandidates;
+		uint32_t m_nextEvictionCandidate = 0;
+		bool m_evictionCandidatesValid = false;
+	};
+
+	struct LoadRequest
+	{
+		PagedTexture* m_tex;
+		uint32_t m_virtualPage;
+		uint32_t m_physicalPage;
+	};
+
+	PagePool& PoolForFormat(TextureFormat _format);
+
+	bool AllocPage(PagePool& _pool, uint32_t& o_page);
+	void ReadPage(PagedTexture const& _tex, uint32_t _virtualPage, uint32_t _physicalPage);
+
+	void LoaderLoop();
+
+	PagePool m_pools[uint32_t(TextureFormat::BC_Auto)];
+
+	kt::Array<PagedTexture*> m_textures;
+
+	std::atomic<uint32_t> m_frameIdx{ 1 };
+
+	FILE* m_file = nullptr;
+	std::mutex m_fileMutex;
+
+	kt::Thread m_loaderThread;
+	std::atomic<uint32_t> m_keepRunning{ 0 };
+
+	std::mutex m_mutex;
+	std::condition_variable m_condVar;
+	kt::Array<LoadRequest> m_pendingLoads;
+	kt::Array<LoadRequest> m_completedLoads;
+};
+
+}
+}
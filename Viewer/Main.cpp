@@ -1,4 +1,5 @@
 #include <iostream>
+#include <stdlib.h>
 
 #include <kt/Timer.h>
 #include <kt/Logging.h>
@@ -25,6 +26,53 @@ int main(int argc, char** argv)
 	kt::Duration totalTime = kt::Duration::Zero();
 
 	uint32_t logDtCounter = 0;
+
+	// Optional arguments after the scene path: -workers=<n> -placement=<unpinned|logical|physical|numa> -pipelined
+	sr::WorkerConfig workers;
+	sr::FrameMode frameMode = sr::FrameMode::Immediate;
+	for (int i = 2; i < argc; ++i)
+	{
+		std::string const arg = argv[i];
+		if (arg.find("-workers=") == 0)
+		{
+			char const* value = argv[i] + 9;
+			char* valueEnd = nullptr;
+			unsigned long const numWorkers = strtoul(value, &valueEnd, 10);
+
+			if (*value >= '0' && *value <= '9' && *valueEnd == '\0' && numWorkers <= UINT32_MAX)
+			{
+				workers.m_numWorkers = uint32_t(numWorkers);
+			}
+			else
+			{
+				KT_LOG_ERROR("Ignoring %s, expected -workers=<n>.", argv[i]);
+			}
+		}
+		else if (arg == "-placement=unpinned")
+		{
+			workers.m_placement = sr::WorkerPlacement::Unpinned;
+		}
+		else if (arg == "-placement=logical")
+		{
+			workers.m_placement = sr::WorkerPlacement::AllLogicalCores;
+		}
+		else if (arg == "-placement=physical")
+		{
+			workers.m_placement = sr::WorkerPlacement::OnePerPhysicalCore;
+		}
+		else if (arg == "-placement=numa")
+		{
+			workers.m_placement = sr::WorkerPlacement::NumaNodePools;
+		}
+		else if (arg == "-pipelined")
+		{
+			frameMode = sr::FrameMode::Pipelined;
+		}
+	}
+
+	sr::RenderContext renderCtx(workers, frameMode);
+	sr::FrameBuffer framebuffer(sr::Config::c_screenWidth, sr::Config::c_screenHeight);
+
 	sr::Scene* scene = nullptr;
 	sr::Obj::Model model;
 	if (argc < 2) {
@@ -32,17 +80,14 @@ int main(int argc, char** argv)
 	}
 	std::string file = argv[1];
 	if (false && file.find("sponza") == std::string::npos) {
-	  scene = new sr::SimpleModelScene(file.c_str(), sr::Obj::LoadFlags::FlipWinding);
+	  scene = new sr::SimpleModelScene(file.c_str(), sr::Obj::LoadFlags::FlipWinding | sr::Obj::LoadFlags::OptimizeMeshes | sr::Obj::LoadFlags::QuantizeVertices | sr::Obj::LoadFlags::GenerateLods | sr::Obj::LoadFlags::BuildMeshlets | sr::Obj::LoadFlags::BuildBvh, &renderCtx.GetTaskSystem());
 	} else {
-	  scene = new sr::SponzaScene(file.c_str(), sr::Obj::LoadFlags::FlipWinding | sr::Obj::LoadFlags::FlipUVs);
+	  scene = new sr::SponzaScene(file.c_str(), sr::Obj::LoadFlags::FlipWinding | sr::Obj::LoadFlags::FlipUVs | sr::Obj::LoadFlags::CompressTextures | sr::Obj::LoadFlags::OptimizeMeshes | sr::Obj::LoadFlags::QuantizeVertices | sr::Obj::LoadFlags::GenerateLods | sr::Obj::LoadFlags::BuildMeshlets | sr::Obj::LoadFlags::BuildBvh, &renderCtx.GetTaskSystem());
 	}
 	scene->Init(sr::Config::c_screenWidth, sr::Config::c_screenHeight);
 
 	kt::Duration frameTime = kt::Duration::FromMilliseconds(16.0);
 
-	sr::RenderContext renderCtx;
-	sr::FrameBuffer framebuffer(sr::Config::c_screenWidth, sr::Config::c_screenHeight);
-
 	while (!window.WantsQuit())
 	{
 		window.PumpMessageLoop();
@@ -52,8 +97,6 @@ int main(int argc, char** argv)
 
 		scene->Update(renderCtx, framebuffer, frameTime.Seconds());
 
-		renderCtx.EndFrame();
-
 		//static bool blitDepth = false;
 
 		//if (blitDepth)
@@ -65,6 +108,7 @@ int main(int argc, char** argv)
 			renderCtx.Blit(framebuffer, window.BackBufferData(), [](void* _ptr) { ((sr::Window_Win32*)_ptr)->Flip(); }, &window);
 		}
 
+		renderCtx.EndFrame();
 
 		kt::TimePoint const timeNow = kt::TimePoint::Now();
 		frameTime = timeNow - prevFrameTime;
@@ -73,7 +117,10 @@ int main(int argc, char** argv)
 
 		if (++logDtCounter % 10 == 0)
 		{
-			KT_LOG_INFO("Frame took: %.3fms fps %f", frameTime.Milliseconds(), 1000.0f / frameTime.Milliseconds());
+			sr::FrameStats const& stats = renderCtx.GetFrameStats();
+			KT_LOG_INFO("Frame took: %.3fms fps %f, culled %u/%u draws, waits spun %.3fms parked %.3fms in %u/%u waits", frameTime.Milliseconds(), 1000.0f / frameTime.Milliseconds(), stats.m_numDrawsCulled, stats.m_numDraws, stats.m_taskWaits.m_spinTime.Milliseconds(), stats.m_taskWaits.m_parkedTime.Milliseconds(), stats.m_taskWaits.m_numParks, stats.m_taskWaits.m_numWaits);
+			float const mb = 1.0f / (1024.0f * 1024.0f);
+			KT_LOG_INFO("Scratch peak %.1fMB per thread, %.1fMB total, %.1fMB committed in %u blocks, %u bin passes", stats.m_scratch.m_maxThreadHighWaterBytes * mb, stats.m_scratch.m_totalHighWaterBytes * mb, stats.m_scratch.m_committedBytes * mb, stats.m_scratch.m_numBlocks, stats.m_numBinPasses);
 		}
 	}
 
@@ -0,0 +1,1223 @@
+#include "MeshOptimize.h"
+
+#include <math.h>
+#include <string.h>
+#include <float.h>
+
+#include <kt/kt.h>
+#include <kt/Array.h>
+#include <kt/Sort.h>
+
+namespace sr
+{
+
+namespace MeshOpt
+{
+
+// Forsyth's scoring, see https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+constexpr uint32_t c_forsythCacheSize = 32;
+constexpr float c_forsythCacheDecayPower = 1.5f;
+constexpr float c_forsythLastTriScore = 0.75f;
+constexpr float c_forsythValenceBoostScale = 2.0f;
+constexpr float c_forsythValenceBoostPower = 0.5f;
+constexpr uint32_t c_forsythMaxValence = 64;
+
+// Cache used to find cluster boundaries in OptimizeOverdraw, roughly the size of a hardware post transform cache.
+constexpr uint32_t c_overdrawCacheSize = 16;
+
+struct ForsythScoreTable
+{
+	ForsythScoreTable()
+	{
+		for (uint32_t i = 0; i < c_forsythCacheSize; ++i)
+		{
+			if (i < 3)
+			{
+				// The last triangle's vertices, deliberately a fixed score so they aren't favoured over slightly older ones.
+				m_cache[i] = c_forsythLastTriScore;
+			}
+			else
+			{
+				float const scaler = 1.0f / float(c_forsythCacheSize - 3);
+				m_cache[i] = powf(1.0f - float(i - 3) * scaler, c_forsythCacheDecayPower);
+			}
+		}
+
+		m_cache[c_forsythCacheSize] = 0.0f;
+
+		m_valence[0] = 0.0f;
+		for (uint32_t i = 1; i < c_forsythMaxValence; ++i)
+		{
+			m_valence[i] = c_forsythValenceBoostScale * powf(float(i), -c_forsythValenceBoostPower);
+		}
+	}
+
+	// Indexed by cache position, c_forsythCacheSize is not in the cache.
+	float m_cache[c_forsythCacheSize + 1];
+
+	// Indexed by the number of remaining triangles, boosts vertices with few left so they are finished off.
+	float m_valence[c_forsythMaxValence];
+};
+
+static float ForsythVertexScore(ForsythScoreTable const& _table, uint32_t _cachePos, uint32_t _remainingTris)
+{
+	if (!_remainingTris)
+	{
+		return -1.0f;
+	}
+
+	return _table.m_cache[_cachePos] + _table.m_valence[kt::Min(_remainingTris, c_forsythMaxValence - 1)];
+}
+
+void OptimizeVertexCache(uint32_t const* _indices, uint32_t _numIndices, uint32_t _numVertices, uint32_t* o_indices)
+{
+	static ForsythScoreTable const s_scores;
+
+	KT_ASSERT(_indices != o_indices);
+
+	uint32_t const numTris = _numIndices / 3;
+	if (!numTris)
+	{
+		return;
+	}
+
+	// Triangles using each vertex, the not yet emitted ones are kept at the front of each list.
+	kt::Array<uint32_t> vertexTriOffsets;
+	kt::Array<uint32_t> vertexRemainingTris;
+	kt::Array<uint32_t> vertexTris;
+
+	vertexTriOffsets.Resize(_numVertices + 1);
+	vertexRemainingTris.Resize(_numVertices);
+	vertexTris.Resize(numTris * 3);
+
+	memset(vertexRemainingTris.Data(), 0, sizeof(uint32_t) * _numVertices);
+
+	for (uint32_t i = 0; i < numTris * 3; ++i)
+	{
+		++vertexRemainingTris[_indices[i]];
+	}
+
+	vertexTriOffsets[0] = 0;
+	for (uint32_t v = 0; v < _numVertices; ++v)
+	{
+		vertexTriOffsets[v + 1] = vertexTriOffsets[v] + vertexRemainingTris[v];
+		vertexRemainingTris[v] = 0;
+	}
+
+	for (uint32_t i = 0; i < numTris * 3; ++i)
+	{
+		uint32_t const v = _indices[i];
+		vertexTris[vertexTriOffsets[v] + vertexRemainingTris[v]++] = i / 3;
+	}
+
+	kt::Array<uint32_t> vertexCachePos;
+	kt::Array<float> vertexScores;
+	kt::Array<float> triScores;
+	kt::Array<uint8_t> triEmitted;
+
+	vertexCachePos.Resize(_numVertices);
+	vertexScores.Resize(_numVertices);
+	triScores.Resize(numTris);
+	triEmitted.Resize(numTris);
+
+	for (uint32_t v = 0; v < _numVertices; ++v)
+	{
+		vertexCachePos[v] = c_forsythCacheSize;
+		vertexScores[v] = ForsythVertexScore(s_scores, c_forsythCacheSize, vertexRemainingTris[v]);
+	}
+
+	for (uint32_t t = 0; t < numTris; ++t)
+	{
+		triScores[t] = vertexScores[_indices[t * 3]] + vertexScores[_indices[t * 3 + 1]] + vertexScores[_indices[t * 3 + 2]];
+	}
+
+	memset(triEmitted.Data(), 0, numTris);
+
+	// LRU cache with room for the 3 vertices pushed out by each triangle.
+	uint32_t cache[c_forsythCacheSize + 3];
+	uint32_t cacheSize = 0;
+
+	uint32_t bestTri = 0;
+	for (uint32_t t = 1; t < numTris; ++t)
+	{
+		bestTri = triScores[t] > triScores[bestTri] ? t : bestTri;
+	}
+
+	// Fallback for when nothing in the cache has triangles left.
+	uint32_t nextUnemitted = 0;
+
+	for (uint32_t emitted = 0; emitted < numTris; ++emitted)
+	{
+		if (bestTri == UINT32_MAX)
+		{
+			while (triEmitted[nextUnemitted])
+			{
+				++nextUnemitted;
+			}
+			bestTri = nextUnemitted;
+		}
+
+		uint32_t const* tri = _indices + bestTri * 3;
+		memcpy(o_indices + emitted * 3, tri, sizeof(uint32_t) * 3);
+		triEmitted[bestTri] = 1;
+
+		// Remove the triangle from its vertices' remaining lists.
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			uint32_t const v = tri[i];
+			uint32_t* tris = vertexTris.Data() + vertexTriOffsets[v];
+			uint32_t const remaining = vertexRemainingTris[v];
+
+			for (uint32_t j = 0; j < remaining; ++j)
+			{
+				if (tris[j] == bestTri)
+				{
+					tris[j] = tris[remaining - 1];
+					tris[remaining - 1] = bestTri;
+					break;
+				}
+			}
+
+			--vertexRemainingTris[v];
+		}
+
+		// Move the triangle's vertices to the front of the cache.
+		uint32_t newCache[c_forsythCacheSize + 3];
+		uint32_t newCacheSize = 0;
+
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			newCache[newCacheSize++] = tri[i];
+		}
+
+		for (uint32_t i = 0; i < cacheSize; ++i)
+		{
+			uint32_t const v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+			{
+				newCache[newCacheSize++] = v;
+			}
+		}
+
+		// Rescore everything that was in the cache, including the vertices that just fell out.
+		bestTri = UINT32_MAX;
+		float bestScore = -1.0f;
+
+		for (uint32_t i = 0; i < newCacheSize; ++i)
+		{
+			uint32_t const v = newCache[i];
+			uint32_t const cachePos = i < c_forsythCacheSize ? i : c_forsythCacheSize;
+			vertexCachePos[v] = cachePos;
+
+			float const newScore = ForsythVertexScore(s_scores, cachePos, vertexRemainingTris[v]);
+			float const scoreDelta = newScore - vertexScores[v];
+			vertexScores[v] = newScore;
+
+			uint32_t const* tris = vertexTris.Data() + vertexTriOffsets[v];
+			for (uint32_t j = 0; j < vertexRemainingTris[v]; ++j)
+			{
+				uint32_t const t = tris[j];
+				triScores[t] += scoreDelta;
+
+				if (triScores[t] > bestScore)
+				{
+					bestScore = triScores[t];
+					bestTri = t;
+				}
+			}
+		}
+
+		cacheSize = kt::Min(newCacheSize, c_forsythCacheSize);
+		memcpy(cache, newCache, sizeof(uint32_t) * cacheSize);
+	}
+}
+
+float CalcACMR(uint32_t const* _indices, uint32_t _numIndices, uint32_t _numVertices, uint32_t _cacheSize)
+{
+	if (_numIndices < 3)
+	{
+		return 0.0f;
+	}
+
+	// FIFO cache simulated with timestamps: a vertex is cached if it was inserted less than _cacheSize insertions ago.
+	kt::Array<uint32_t> timestamps;
+	timestamps.Resize(_numVertices);
+	memset(timestamps.Data(), 0, sizeof(uint32_t) * _numVertices);
+
+	uint32_t time = _cacheSize + 1;
+	uint32_t misses = 0;
+
+	for (uint32_t i = 0; i < _numIndices; ++i)
+	{
+		uint32_t const v = _indices[i];
+		if (time - timestamps[v] > _cacheSize)
+		{
+			timestamps[v] = time++;
+			++misses;
+		}
+	}
+
+	return float(misses) / float(_numIndices / 3);
+}
+
+static uint32_t FloatToSortableUint(float _f)
+{
+	uint32_t u;
+	memcpy(&u, &_f, sizeof(u));
+	return u ^ ((u & 0x80000000) ? 0xFFFFFFFF : 0x80000000);
+}
+
+void OptimizeOverdraw(uint32_t const* _indices, uint32_t _numIndices, float const* _positions, uint32_t _positionStride, uint32_t _numVertices, float _threshold, float _windingSign, uint32_t* o_indices)
+{
+	KT_ASSERT(_indices != o_indices);
+
+	uint32_t const numTris = _numIndices / 3;
+	if (!numTris)
+	{
+		return;
+	}
+
+	// Hard boundaries: triangles where the simulated cache missed every vertex, so starting a cluster there costs nothing.
+	kt::Array<uint32_t> timestamps;
+	timestamps.Resize(_numVertices);
+	memset(timestamps.Data(), 0, sizeof(uint32_t) * _numVertices);
+
+	kt::Array<uint32_t> hardClusters;
+
+	uint32_t time = c_overdrawCacheSize + 1;
+
+	auto cacheMisses = [&timestamps, &time](uint32_t const* _tri)
+	{
+		uint32_t misses = 0;
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			if (time - timestamps[_tri[i]] > c_overdrawCacheSize)
+			{
+				timestamps[_tri[i]] = time++;
+				++misses;
+			}
+		}
+		return misses;
+	};
+
+	for (uint32_t t = 0; t < numTris; ++t)
+	{
+		uint32_t const misses = cacheMisses(_indices + t * 3);
+
+		if (t == 0 || misses == 3)
+		{
+			hardClusters.PushBack(t);
+		}
+	}
+
+	// Soft boundaries: split hard clusters further wherever the cluster so far, drawn from a cold cache, is within _threshold of the
+	// whole hard cluster's miss ratio. Clusters are drawn in arbitrary order afterwards, so each starts with a cold cache.
+	kt::Array<uint32_t> clusters;
+
+	for (uint32_t hard = 0; hard < hardClusters.Size(); ++hard)
+	{
+		uint32_t const begin = hardClusters[hard];
+		uint32_t const end = hard + 1 < hardClusters.Size() ? hardClusters[hard + 1] : numTris;
+
+		// Advancing time past the cache size flushes it.
+		time += c_overdrawCacheSize + 1;
+
+		uint32_t totalMisses = 0;
+		for (uint32_t t = begin; t < end; ++t)
+		{
+			totalMisses += cacheMisses(_indices + t * 3);
+		}
+
+		float const target = _threshold * float(totalMisses) / float(end - begin);
+
+		clusters.PushBack(begin);
+
+		time += c_overdrawCacheSize + 1;
+
+		uint32_t clusterMisses = 0;
+		uint32_t clusterBegin = begin;
+
+		for (uint32_t t = begin; t < end; ++t)
+		{
+			clusterMisses += cacheMisses(_indices + t * 3);
+
+			if (t + 1 < end && float(clusterMisses) / float(t + 1 - clusterBegin) <= target)
+			{
+				clusters.PushBack(t + 1);
+				clusterBegin = t + 1;
+				clusterMisses = 0;
+				time += c_overdrawCacheSize + 1;
+			}
+		}
+	}
+
+	uint32_t const numClusters = clusters.Size();
+
+	auto position = [_positions, _positionStride](uint32_t _v, uint32_t _axis)
+	{
+		return *(float const*)((uint8_t const*)_positions + size_t(_v) * _positionStride + _axis * sizeof(float));
+	};
+
+	// Area weighted centroid and normal of each cluster.
+	kt::Array<float> clusterData;
+	clusterData.Resize(numClusters * 6);
+
+	float meshCentroid[3] = {};
+	float meshArea = 0.0f;
+
+	for (uint32_t c = 0; c < numClusters; ++c)
+	{
+		uint32_t const begin = clusters[c];
+		uint32_t const end = c + 1 < numClusters ? clusters[c + 1] : numTris;
+
+		float centroid[3] = {};
+		float normal[3] = {};
+		float area = 0.0f;
+
+		for (uint32_t t = begin; t < end; ++t)
+		{
+			uint32_t const* tri = _indices + t * 3;
+
+			float p[3][3];
+			for (uint32_t i = 0; i < 3; ++i)
+			{
+				for (uint32_t axis = 0; axis < 3; ++axis)
+				{
+					p[i][axis] = position(tri[i], axis);
+				}
+			}
+
+			float const e0[3] = { p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2] };
+			float const e1[3] = { p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2] };
+			float const n[3] = { e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0] };
+			float const triArea = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (uint32_t axis = 0; axis < 3; ++axis)
+			{
+				centroid[axis] += (p[0][axis] + p[1][axis] + p[2][axis]) * (triArea / 3.0f);
+				normal[axis] += n[axis];
+			}
+
+			area += triArea;
+		}
+
+		float const invArea = area > 0.0f ? 1.0f / area : 0.0f;
+		float const normalLen = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		float const invNormalLen = normalLen > 0.0f ? 1.0f / normalLen : 0.0f;
+
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			meshCentroid[axis] += centroid[axis];
+			clusterData[c * 6 + axis] = centroid[axis] * invArea;
+			clusterData[c * 6 + 3 + axis] = normal[axis] * (invNormalLen * _windingSign);
+		}
+
+		meshArea += area;
+	}
+
+	for (float& f : meshCentroid)
+	{
+		f = meshArea > 0.0f ? f / meshArea : 0.0f;
+	}
+
+	// Clusters further out along their normal are more likely to occlude others, so draw them first.
+	kt::Array<uint32_t> sortKeys;
+	kt::Array<uint32_t> order;
+	kt::Array<uint32_t> sortTemp;
+	sortKeys.Resize(numClusters);
+	order.Resize(numClusters);
+	sortTemp.Resize(numClusters);
+
+	for (uint32_t c = 0; c < numClusters; ++c)
+	{
+		float const* data = clusterData.Data() + c * 6;
+		float const dist = (data[0] - meshCentroid[0]) * data[3] + (data[1] - meshCentroid[1]) * data[4] + (data[2] - meshCentroid[2]) * data[5];
+
+		sortKeys[c] = ~FloatToSortableUint(dist);
+		order[c] = c;
+	}
+
+	uint32_t const* keys = sortKeys.Data();
+	kt::RadixSort(order.Data(), order.Data() + numClusters, sortTemp.Data(), [keys](uint32_t _c) { return keys[_c]; });
+
+	uint32_t writeIdx = 0;
+	for (uint32_t c : order)
+	{
+		uint32_t const begin = clusters[c];
+		uint32_t const end = c + 1 < numClusters ? clusters[c + 1] : numTris;
+
+		memcpy(o_indices + writeIdx, _indices + begin * 3, sizeof(uint32_t) * (end - begin) * 3);
+		writeIdx += (end - begin) * 3;
+	}
+
+	KT_ASSERT(writeIdx == numTris * 3);
+}
+
+// Boundary quadrics are weighted above the triangle planes so outlines are preserved.
+constexpr float c_simplifyBorderWeight = 10.0f;
+
+// Each pass only takes collapses up to this factor of the error of the collapse needed to hit the target, so error stays even across the mesh.
+constexpr float c_simplifyPassErrorScale = 1.5f;
+
+constexpr uint32_t c_simplifyMaxPasses = 64;
+
+enum class SimplifyVertexKind : uint8_t
+{
+	Manifold, // Interior, collapses onto any neighbour.
+	Border, // On one open boundary, collapses along it.
+	Locked // Attribute seam or non manifold, never moves.
+};
+
+// E(p) = p'Ap + 2b'p + c over the accumulated planes, divided by m_weight for the mean squared distance.
+struct Quadric
+{
+	float a00, a11, a22;
+	float a10, a20, a21;
+	float b0, b1, b2;
+	float c;
+	float weight;
+};
+
+static void QuadricFromPlane(Quadric& o_q, float const (&_n)[3], float _d, float _weight)
+{
+	o_q.a00 = _n[0] * _n[0] * _weight;
+	o_q.a11 = _n[1] * _n[1] * _weight;
+	o_q.a22 = _n[2] * _n[2] * _weight;
+	o_q.a10 = _n[1] * _n[0] * _weight;
+	o_q.a20 = _n[2] * _n[0] * _weight;
+	o_q.a21 = _n[2] * _n[1] * _weight;
+	o_q.b0 = _n[0] * _d * _weight;
+	o_q.b1 = _n[1] * _d * _weight;
+	o_q.b2 = _n[2] * _d * _weight;
+	o_q.c = _d * _d * _weight;
+	o_q.weight = _weight;
+}
+
+static void QuadricAdd(Quadric& _q, Quadric const& _other)
+{
+	float* dst = &_q.a00;
+	float const* src = &_other.a00;
+
+	for (uint32_t i = 0; i < sizeof(Quadric) / sizeof(float); ++i)
+	{
+		dst[i] += src[i];
+	}
+}
+
+static float QuadricError(Quadric const& _q, float const* _p)
+{
+	float const rx = _q.a00 * _p[0] + _q.a10 * _p[1] + _q.a20 * _p[2];
+	float const ry = _q.a10 * _p[0] + _q.a11 * _p[1] + _q.a21 * _p[2];
+	float const rz = _q.a20 * _p[0] + _q.a21 * _p[1] + _q.a22 * _p[2];
+
+	float const r = _p[0] * rx + _p[1] * ry + _p[2] * rz + 2.0f * (_q.b0 * _p[0] + _q.b1 * _p[1] + _q.b2 * _p[2]) + _q.c;
+	return _q.weight > 0.0f ? fabsf(r) / _q.weight : 0.0f;
+}
+
+static void Cross(float const* _a, float const* _b, float (&o_c)[3])
+{
+	o_c[0] = _a[1] * _b[2] - _a[2] * _b[1];
+	o_c[1] = _a[2] * _b[0] - _a[0] * _b[2];
+	o_c[2] = _a[0] * _b[1] - _a[1] * _b[0];
+}
+
+static float Dot(float const* _a, float const* _b)
+{
+	return _a[0] * _b[0] + _a[1] * _b[1] + _a[2] * _b[2];
+}
+
+static void Sub(float const* _a, float const* _b, float (&o_c)[3])
+{
+	o_c[0] = _a[0] - _b[0];
+	o_c[1] = _a[1] - _b[1];
+	o_c[2] = _a[2] - _b[2];
+}
+
+// Triangles using each vertex, in CSR form.
+struct TriAdjacency
+{
+	void Build(uint32_t const* _indices, uint32_t _numIndices, uint32_t _numVertices)
+	{
+		m_offsets.Resize(_numVertices + 1);
+		m_tris.Resize(_numIndices);
+		memset(m_offsets.Data(), 0, sizeof(uint32_t) * (_numVertices + 1));
+
+		for (uint32_t i = 0; i < _numIndices; ++i)
+		{
+			++m_offsets[_indices[i] + 1];
+		}
+
+		for (uint32_t v = 0; v < _numVertices; ++v)
+		{
+			m_offsets[v + 1] += m_offsets[v];
+		}
+
+		m_fill.Resize(_numVertices);
+		memcpy(m_fill.Data(), m_offsets.Data(), sizeof(uint32_t) * _numVertices);
+
+		for (uint32_t i = 0; i < _numIndices; ++i)
+		{
+			m_tris[m_fill[_indices[i]]++] = i / 3;
+		}
+	}
+
+	uint32_t Begin(uint32_t _v) const { return m_offsets[_v]; }
+	uint32_t End(uint32_t _v) const { return m_offsets[_v + 1]; }
+
+	kt::Array<uint32_t> m_offsets;
+	kt::Array<uint32_t> m_tris;
+	kt::Array<uint32_t> m_fill;
+};
+
+// o_remap[v] is the first vertex with the same position as v.
+static void BuildPositionRemap(float const* _positions, uint32_t _numVertices, uint32_t* o_remap)
+{
+	uint32_t const tableSize = 1u << (kt::FloorLog2(kt::Max(_numVertices, 1u)) + 2);
+	uint32_t const tableMask = tableSize - 1;
+
+	kt::Array<uint32_t> table;
+	table.Resize(tableSize);
+	memset(table.Data(), 0xFF, sizeof(uint32_t) * tableSize);
+
+	for (uint32_t v = 0; v < _numVertices; ++v)
+	{
+		float const* pos = _positions + v * 3;
+
+		uint32_t bits[3];
+		memcpy(bits, pos, sizeof(bits));
+
+		uint32_t slot = ((bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u)) & tableMask;
+
+		for (;;)
+		{
+			uint32_t const existing = table[slot];
+
+			if (existing == UINT32_MAX)
+			{
+				table[slot] = v;
+				o_remap[v] = v;
+				break;
+			}
+
+			if (memcmp(_positions + existing * 3, pos, sizeof(float) * 3) == 0)
+			{
+				o_remap[v] = existing;
+				break;
+			}
+
+			slot = (slot + 1) & tableMask;
+		}
+	}
+}
+
+// o_borderEdges[i] is set if edge i -> i+1 of its triangle has no opposite directed edge in any triangle.
+static void FindBorderEdges(uint32_t const* _indices, uint32_t _numIndices, TriAdjacency const& _adjacency, uint8_t* o_borderEdges)
+{
+	for (uint32_t i = 0; i < _numIndices; ++i)
+	{
+		uint32_t const a = _indices[i];
+		uint32_t const b = _indices[i - i % 3 + (i + 1) % 3];
+
+		bool hasOpposite = false;
+
+		for (uint32_t adj = _adjacency.Begin(b); adj < _adjacency.End(b) && !hasOpposite; ++adj)
+		{
+			uint32_t const* other = _indices + _adjacency.m_tris[adj] * 3;
+
+			for (uint32_t corner = 0; corner < 3; ++corner)
+			{
+				hasOpposite |= other[corner] == b && other[(corner + 1) % 3] == a;
+			}
+		}
+
+		o_borderEdges[i] = hasOpposite ? 0 : 1;
+	}
+}
+
+uint32_t Simplify(uint32_t const* _indices, uint32_t _numIndices, float const* _positions, uint32_t _positionStride, uint32_t _numVertices, uint32_t _targetIndices, float _maxError, uint32_t* o_indices, float* o_error)
+{
+	*o_error = 0.0f;
+
+	uint32_t numIndices = _numIndices - _numIndices % 3;
+
+	if (o_indices != _indices)
+	{
+		memcpy(o_indices, _indices, sizeof(uint32_t) * numIndices);
+	}
+
+	if (numIndices <= _targetIndices || !_numVertices)
+	{
+		return numIndices;
+	}
+
+	// Positions scaled so the bounding sphere has radius 1, making errors relative.
+	kt::Array<float> positions;
+	positions.Resize(_numVertices * 3);
+
+	float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (uint32_t v = 0; v < _numVertices; ++v)
+	{
+		float const* pos = (float const*)((uint8_t const*)_positions + size_t(v) * _positionStride);
+
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			boundsMin[axis] = kt::Min(boundsMin[axis], pos[axis]);
+			boundsMax[axis] = kt::Max(boundsMax[axis], pos[axis]);
+		}
+	}
+
+	float center[3];
+	float radiusSq = 0.0f;
+
+	for (uint32_t axis = 0; axis < 3; ++axis)
+	{
+		center[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+	}
+
+	for (uint32_t v = 0; v < _numVertices; ++v)
+	{
+		float const* pos = (float const*)((uint8_t const*)_positions + size_t(v) * _positionStride);
+		float d[3];
+		Sub(pos, center, d);
+		radiusSq = kt::Max(radiusSq, Dot(d, d));
+	}
+
+	float const invRadius = radiusSq > 0.0f ? 1.0f / sqrtf(radiusSq) : 1.0f;
+
+	for (uint32_t v = 0; v < _numVertices; ++v)
+	{
+		float const* pos = (float const*)((uint8_t const*)_positions + size_t(v) * _positionStride);
+
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			positions[v * 3 + axis] = (pos[axis] - center[axis]) * invRadius;
+		}
+	}
+
+	// Classify vertices on the original topology, with vertices sharing a position treated as one.
+	kt::Array<uint32_t> posRemap;
+	posRemap.Resize(_numVertices);
+	BuildPositionRemap(positions.Data(), _numVertices, posRemap.Data());
+
+	kt::Array<uint32_t> posIndices;
+	posIndices.Resize(numIndices);
+
+	for (uint32_t i = 0; i < numIndices; ++i)
+	{
+		posIndices[i] = posRemap[o_indices[i]];
+	}
+
+	TriAdjacency posAdjacency;
+	posAdjacency.Build(posIndices.Data(), numIndices, _numVertices);
+
+	// Edge i of a triangle is border if no triangle has the opposite directed edge.
+	kt::Array<uint8_t> borderEdges;
+	borderEdges.Resize(numIndices);
+
+	kt::Array<uint8_t> borderEdgeCounts;
+	borderEdgeCounts.Resize(_numVertices);
+	memset(borderEdgeCounts.Data(), 0, _numVertices);
+
+	FindBorderEdges(posIndices.Data(), numIndices, posAdjacency, borderEdges.Data());
+
+	for (uint32_t i = 0; i < numIndices; ++i)
+	{
+		if (borderEdges[i])
+		{
+			uint32_t const a = posIndices[i];
+			uint32_t const b = posIndices[i - i % 3 + (i + 1) % 3];
+			borderEdgeCounts[a] = uint8_t(kt::Min(borderEdgeCounts[a] + 1, 255));
+			borderEdgeCounts[b] = uint8_t(kt::Min(borderEdgeCounts[b] + 1, 255));
+		}
+	}
+
+	kt::Array<uint32_t> wedgeCounts;
+	wedgeCounts.Resize(_numVertices);
+	memset(wedgeCounts.Data(), 0, sizeof(uint32_t) * _numVertices);
+
+	for (uint32_t v = 0; v < _numVertices; ++v)
+	{
+		++wedgeCounts[posRemap[v]];
+	}
+
+	kt::Array<SimplifyVertexKind> kinds;
+	kinds.Resize(_numVertices);
+
+	for (uint32_t v = 0; v < _numVertices; ++v)
+	{
+		uint32_t const p = posRemap[v];
+
+		if (wedgeCounts[p] > 1 || (borderEdgeCounts[p] != 0 && borderEdgeCounts[p] != 2))
+		{
+			kinds[v] = SimplifyVertexKind::Locked;
+		}
+		else
+		{
+			kinds[v] = borderEdgeCounts[p] ? SimplifyVertexKind::Border : SimplifyVertexKind::Manifold;
+		}
+	}
+
+	// Quadrics of the triangle planes and boundary edges around each position.
+	kt::Array<Quadric> quadrics;
+	quadrics.Resize(_numVertices);
+	memset(quadrics.Data(), 0, sizeof(Quadric) * _numVertices);
+
+	for (uint32_t tri = 0; tri < numIndices / 3; ++tri)
+	{
+		float const* p[3];
+		for (uint32_t corner = 0; corner < 3; ++corner)
+		{
+			p[corner] = positions.Data() + posIndices[tri * 3 + corner] * 3;
+		}
+
+		float e0[3];
+		float e1[3];
+		float n[3];
+		Sub(p[1], p[0], e0);
+		Sub(p[2], p[0], e1);
+		Cross(e0, e1, n);
+
+		float const len = sqrtf(Dot(n, n));
+		if (len == 0.0f)
+		{
+			continue;
+		}
+
+		for (float& f : n)
+		{
+			f /= len;
+		}
+
+		Quadric q;
+		QuadricFromPlane(q, n, -Dot(n, p[0]), len * 0.5f);
+
+		for (uint32_t corner = 0; corner < 3; ++corner)
+		{
+			QuadricAdd(quadrics[posIndices[tri * 3 + corner]], q);
+
+			if (!borderEdges[tri * 3 + corner])
+			{
+				continue;
+			}
+
+			// Plane through the border edge, perpendicular to the triangle.
+			float const* a = p[corner];
+			float const* b = p[(corner + 1) % 3];
+
+			float edge[3];
+			float edgeNormal[3];
+			Sub(b, a, edge);
+			Cross(edge, n, edgeNormal);
+
+			float const edgeLen = sqrtf(Dot(edgeNormal, edgeNormal));
+			if (edgeLen == 0.0f)
+			{
+				continue;
+			}
+
+			for (float& f : edgeNormal)
+			{
+				f /= edgeLen;
+			}
+
+			Quadric edgeQ;
+			QuadricFromPlane(edgeQ, edgeNormal, -Dot(edgeNormal, a), edgeLen * edgeLen * c_simplifyBorderWeight);
+			QuadricAdd(quadrics[posIndices[tri * 3 + corner]], edgeQ);
+			QuadricAdd(quadrics[posIndices[tri * 3 + (corner + 1) % 3]], edgeQ);
+		}
+	}
+
+	float const maxErrorSq = _maxError * _maxError;
+	float resultErrorSq = 0.0f;
+
+	TriAdjacency adjacency;
+
+	kt::Array<uint32_t> collapseFrom;
+	kt::Array<uint32_t> collapseTo;
+	kt::Array<float> collapseErrors;
+	kt::Array<uint32_t> collapseKeys;
+	kt::Array<uint32_t> collapseOrder;
+	kt::Array<uint32_t> sortTemp;
+
+	kt::Array<uint32_t> remap;
+	kt::Array<uint8_t> collapseLocked;
+	remap.Resize(_numVertices);
+	collapseLocked.Resize(_numVertices);
+
+	for (uint32_t pass = 0; pass < c_simplifyMaxPasses && numIndices > _targetIndices; ++pass)
+	{
+		adjacency.Build(o_indices, numIndices, _numVertices);
+
+		collapseFrom.Clear();
+		collapseTo.Clear();
+		collapseErrors.Clear();
+
+		for (uint32_t i = 0; i < numIndices; ++i)
+		{
+			uint32_t const tri = i / 3;
+			uint32_t const v0 = o_indices[i];
+			uint32_t const v1 = o_indices[tri * 3 + (i + 1) % 3];
+
+			// Both directions of each edge, borders only along the border to another border (or locked) vertex.
+			for (uint32_t dir = 0; dir < 2; ++dir)
+			{
+				uint32_t const from = dir ? v1 : v0;
+				uint32_t const to = dir ? v0 : v1;
+
+				if (kinds[from] == SimplifyVertexKind::Locked
+					|| (kinds[from] == SimplifyVertexKind::Border && (!borderEdges[i] || kinds[to] == SimplifyVertexKind::Manifold)))
+				{
+					continue;
+				}
+
+				Quadric q = quadrics[posRemap[from]];
+				QuadricAdd(q, quadrics[posRemap[to]]);
+
+				collapseFrom.PushBack(from);
+				collapseTo.PushBack(to);
+				collapseErrors.PushBack(QuadricError(q, positions.Data() + to * 3));
+			}
+		}
+
+		uint32_t const numCollapses = collapseFrom.Size();
+		if (!numCollapses)
+		{
+			break;
+		}
+
+		collapseKeys.Resize(numCollapses);
+		collapseOrder.Resize(numCollapses);
+		sortTemp.Resize(numCollapses);
+
+		for (uint32_t i = 0; i < numCollapses; ++i)
+		{
+			collapseKeys[i] = FloatToSortableUint(collapseErrors[i]);
+			collapseOrder[i] = i;
+		}
+
+		uint32_t const* keys = collapseKeys.Data();
+		kt::RadixSort(collapseOrder.Data(), collapseOrder.Data() + numCollapses, sortTemp.Data(), [keys](uint32_t _i) { return keys[_i]; });
+
+		// Each collapse removes about two triangles.
+		uint32_t const trisToRemove = (numIndices - _targetIndices) / 3;
+		uint32_t const goalIdx = kt::Min(numCollapses - 1, (trisToRemove + 1) / 2);
+		float const passErrorLimit = kt::Min(maxErrorSq, collapseErrors[collapseOrder[goalIdx]] * c_simplifyPassErrorScale);
+
+		for (uint32_t v = 0; v < _numVertices; ++v)
+		{
+			remap[v] = v;
+		}
+
+		memset(collapseLocked.Data(), 0, _numVertices);
+
+		uint32_t removedTris = 0;
+
+		for (uint32_t orderIdx = 0; orderIdx < numCollapses && removedTris < trisToRemove; ++orderIdx)
+		{
+			uint32_t const c = collapseOrder[orderIdx];
+			float const error = collapseErrors[c];
+
+			if (error > passErrorLimit)
+			{
+				break;
+			}
+
+			uint32_t const from = collapseFrom[c];
+			uint32_t const to = collapseTo[c];
+
+			if (collapseLocked[from] || collapseLocked[to])
+			{
+				continue;
+			}
+
+			// Reject collapses that flip any remaining triangle around from.
+			float const* pFrom = positions.Data() + from * 3;
+			float const* pTo = positions.Data() + to * 3;
+
+			bool flips = false;
+			uint32_t sharedTris = 0;
+
+			for (uint32_t adj = adjacency.Begin(from); adj < adjacency.End(from) && !flips; ++adj)
+			{
+				uint32_t const* tri = o_indices + adjacency.m_tris[adj] * 3;
+
+				if (tri[0] == to || tri[1] == to || tri[2] == to)
+				{
+					++sharedTris;
+					continue;
+				}
+
+				uint32_t const corner = tri[0] == from ? 0 : (tri[1] == from ? 1 : 2);
+				float const* a = positions.Data() + tri[(corner + 1) % 3] * 3;
+				float const* b = positions.Data() + tri[(corner + 2) % 3] * 3;
+
+				float e0[3];
+				float e1[3];
+				float before[3];
+				float after[3];
+
+				Sub(a, pFrom, e0);
+				Sub(b, pFrom, e1);
+				Cross(e0, e1, before);
+
+				Sub(a, pTo, e0);
+				Sub(b, pTo, e1);
+				Cross(e0, e1, after);
+
+				flips = Dot(before, after) <= 0.0f;
+			}
+
+			if (flips)
+			{
+				continue;
+			}
+
+			remap[from] = to;
+			QuadricAdd(quadrics[posRemap[to]], quadrics[posRemap[from]]);
+
+			// Neighbouring collapses would invalidate the flip test, leave them for the next pass.
+			for (uint32_t adj = adjacency.Begin(from); adj < adjacency.End(from); ++adj)
+			{
+				uint32_t const* tri = o_indices + adjacency.m_tris[adj] * 3;
+				collapseLocked[tri[0]] = 1;
+				collapseLocked[tri[1]] = 1;
+				collapseLocked[tri[2]] = 1;
+			}
+
+			removedTris += kt::Max(sharedTris, 1u);
+			resultErrorSq = kt::Max(resultErrorSq, error);
+		}
+
+		if (!removedTris)
+		{
+			break;
+		}
+
+		uint32_t writeIdx = 0;
+
+		for (uint32_t tri = 0; tri < numIndices / 3; ++tri)
+		{
+			uint32_t const a = remap[o_indices[tri * 3]];
+			uint32_t const b = remap[o_indices[tri * 3 + 1]];
+			uint32_t const c = remap[o_indices[tri * 3 + 2]];
+
+			if (posRemap[a] == posRemap[b] || posRemap[b] == posRemap[c] || posRemap[a] == posRemap[c])
+			{
+				continue;
+			}
+
+			o_indices[writeIdx++] = a;
+			o_indices[writeIdx++] = b;
+			o_indices[writeIdx++] = c;
+		}
+
+		numIndices = writeIdx;
+
+		// Border flags are per triangle edge, rebuild them for the survivors.
+		posIndices.Resize(numIndices);
+		for (uint32_t i = 0; i < numIndices; ++i)
+		{
+			posIndices[i] = posRemap[o_indices[i]];
+		}
+
+		posAdjacency.Build(posIndices.Data(), numIndices, _numVertices);
+		FindBorderEdges(posIndices.Data(), numIndices, posAdjacency, borderEdges.Data());
+	}
+
+	*o_error = sqrtf(resultErrorSq);
+	return numIndices;
+}
+
+uint32_t OptimizeVertexFetch(uint32_t* _indices, uint32_t _numIndices, uint32_t _numVertices, uint32_t* o_remap)
+{
+	kt::Array<uint32_t> newIndices;
+	newIndices.Resize(_numVertices);
+	memset(newIndices.Data(), 0xFF, sizeof(uint32_t) * _numVertices);
+
+	uint32_t numUsed = 0;
+
+	for (uint32_t i = 0; i < _numIndices; ++i)
+	{
+		uint32_t const v = _indices[i];
+		if (newIndices[v] == UINT32_MAX)
+		{
+			newIndices[v] = numUsed;
+			o_remap[numUsed++] = v;
+		}
+
+		_indices[i] = newIndices[v];
+	}
+
+	return numUsed;
+}
+
+static void ComputeMeshletBounds(uint32_t const* _indices, float const* _positions, uint32_t _positionStride, Meshlet& _meshlet)
+{
+	auto position = [&](uint32_t _idx) { return (float const*)((uint8_t const*)_positions + _idx * _positionStride); };
+
+	uint32_t const* tris = _indices + _meshlet.m_firstTri * 3;
+	uint32_t const numIndices = _meshlet.m_numTris * 3;
+
+	float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (uint32_t i = 0; i < numIndices; ++i)
+	{
+		float const* p = position(tris[i]);
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			boundsMin[axis] = kt::Min(boundsMin[axis], p[axis]);
+			boundsMax[axis] = kt::Max(boundsMax[axis], p[axis]);
+		}
+	}
+
+	float radiusSq = 0.0f;
+
+	for (uint32_t axis = 0; axis < 3; ++axis)
+	{
+		_meshlet.m_center[axis] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+	}
+
+	for (uint32_t i = 0; i < numIndices; ++i)
+	{
+		float d[3];
+		Sub(position(tris[i]), _meshlet.m_center, d);
+		radiusSq = kt::Max(radiusSq, Dot(d, d));
+	}
+
+	_meshlet.m_radius = sqrtf(radiusSq);
+
+	// Cone around the average unit normal, as wide as the normal furthest from it.
+	auto triNormal = [&](uint32_t _tri, float (&o_n)[3]) -> bool
+	{
+		float e0[3], e1[3];
+		Sub(position(tris[_tri * 3 + 1]), position(tris[_tri * 3]), e0);
+		Sub(position(tris[_tri * 3 + 2]), position(tris[_tri * 3]), e1);
+		Cross(e0, e1, o_n);
+
+		float const len = sqrtf(Dot(o_n, o_n));
+		if (len <= 0.0f)
+		{
+			// Degenerate triangles never rasterize, so don't constrain the cone.
+			return false;
+		}
+
+		for (float& f : o_n)
+		{
+			f /= len;
+		}
+		return true;
+	};
+
+	float axis[3] = {};
+
+	for (uint32_t tri = 0; tri < _meshlet.m_numTris; ++tri)
+	{
+		float n[3];
+		if (triNormal(tri, n))
+		{
+			for (uint32_t i = 0; i < 3; ++i)
+			{
+				axis[i] += n[i];
+			}
+		}
+	}
+
+	float const axisLen = sqrtf(Dot(axis, axis));
+	float minDot = 1.0f;
+
+	if (axisLen > 0.0f)
+	{
+		for (float& f : axis)
+		{
+			f /= axisLen;
+		}
+
+		for (uint32_t tri = 0; tri < _meshlet.m_numTris; ++tri)
+		{
+			float n[3];
+			if (triNormal(tri, n))
+			{
+				minDot = kt::Min(minDot, Dot(n, axis));
+			}
+		}
+	}
+
+	if (axisLen <= 0.0f || minDot <= 0.0f)
+	{
+		// Spans more than a hemisphere (or nothing but degenerates), some triangle always faces the eye.
+		memset(_meshlet.m_coneAxis, 0, sizeof(_meshlet.m_coneAxis));
+		_meshlet.m_coneCutoff = 1.0f;
+	}
+	else
+	{
+		memcpy(_meshlet.m_coneAxis, axis, sizeof(axis));
+		_meshlet.m_coneCutoff = sqrtf(1.0f - minDot * minDot);
+	}
+}
+
+void BuildMeshlets(uint32_t const* _indices, uint32_t _numIndices, float const* _positions, uint32_t _positionStride, uint32_t _maxTris, kt::Array<Meshlet>& o_meshlets)
+{
+	KT_ASSERT(_maxTris);
+	uint32_t const numTris = _numIndices / 3;
+
+	// Vertices of the meshlet being built, searched linearly as there are at most 3 * _maxTris.
+	kt::Array<uint32_t> meshletVerts;
+	meshletVerts.Reserve(_maxTris * 3);
+
+	auto inMeshlet = [&meshletVerts](uint32_t _v)
+	{
+		for (uint32_t v : meshletVerts)
+		{
+			if (v == _v)
+			{
+				return true;
+			}
+		}
+		return false;
+	};
+
+	uint32_t firstTri = 0;
+
+	for (uint32_t tri = 0; tri < numTris; ++tri)
+	{
+		uint32_t const* triIndices = _indices + tri * 3;
+		uint32_t const curTris = tri - firstTri;
+
+		bool const full = curTris == _maxTris;
+		bool const disjoint = curTris >= _maxTris / 2 && !inMeshlet(triIndices[0]) && !inMeshlet(triIndices[1]) && !inMeshlet(triIndices[2]);
+
+		if (full || disjoint)
+		{
+			Meshlet& meshlet = o_meshlets.PushBack();
+			meshlet.m_firstTri = firstTri;
+			meshlet.m_numTris = curTris;
+			ComputeMeshletBounds(_indices, _positions, _positionStride, meshlet);
+
+			firstTri = tri;
+			meshletVerts.Clear();
+		}
+
+		for (uint32_t i = 0; i < 3; ++i)
+		{
+			if (!inMeshlet(triIndices[i]))
+			{
+				meshletVerts.PushBack(triIndices[i]);
+			}
+		}
+	}
+
+	if (firstTri < numTris)
+	{
+		Meshlet& meshlet = o_meshlets.PushBack();
+		meshlet.m_firstTri = firstTri;
+		meshlet.m_numTris = numTris - firstTri;
+		ComputeMeshletBounds(_indices, _positions, _positionStride, meshlet);
+	}
+}
+
+}
+
+}
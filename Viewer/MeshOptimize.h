@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+
+#include <kt/Array.h>
+
+#include "SoftRastTypes.h"
+
+namespace sr
+{
+
+namespace MeshOpt
+{
+
+// Load time reordering of indexed triangle lists. Indices are 32 bit and reference _numVertices vertices.
+
+// Reorder triangles for post transform vertex cache locality (Tom Forsyth's linear speed vertex cache optimisation).
+// _indices and o_indices may not alias.
+void OptimizeVertexCache(uint32_t const* _indices, uint32_t _numIndices, uint32_t _numVertices, uint32_t* o_indices);
+
+// Reorder clusters of a vertex cache optimized index buffer so outward facing clusters are drawn first, reducing overdraw
+// (Sander et al, "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw").
+// Clusters are only split where the cache miss ratio stays within _threshold (e.g. 1.05) of the input's.
+// _windingSign is 1 if cross(p1 - p0, p2 - p0) points out of the front face of a triangle (counter clockwise winding), -1 if it points in.
+void OptimizeOverdraw(uint32_t const* _indices, uint32_t _numIndices, float const* _positions, uint32_t _positionStride, uint32_t _numVertices, float _threshold, float _windingSign, uint32_t* o_indices);
+
+// Remap vertices into the order they are first referenced, for vertex fetch locality. Rewrites _indices in place.
+// o_remap[newIdx] = oldIdx, returns the number of referenced vertices (unreferenced ones are dropped).
+uint32_t OptimizeVertexFetch(uint32_t* _indices, uint32_t _numIndices, uint32_t _numVertices, uint32_t* o_remap);
+
+// Simplify to at most _targetIndices indices by quadric error edge collapse (Garland and Heckbert). Vertices are only collapsed onto
+// existing vertices, so the result indexes the same vertex buffer. Borders only collapse along themselves and attribute seams are kept.
+// Collapses stop at _maxError, an error of 1 being the mesh's bounding sphere radius. Returns the new index count and the error reached in o_error.
+// _indices and o_indices may alias.
+uint32_t Simplify(uint32_t const* _indices, uint32_t _numIndices, float const* _positions, uint32_t _positionStride, uint32_t _numVertices, uint32_t _targetIndices, float _maxError, uint32_t* o_indices, float* o_error);
+
+// Split the triangles into meshlets of consecutive triangles, appended to o_meshlets. A meshlet ends at _maxTris triangles, or early once
+// at least half full when the next triangle shares no vertex with it, so spatially disjoint runs of the index buffer get separate bounds.
+void BuildMeshlets(uint32_t const* _indices, uint32_t _numIndices, float const* _positions, uint32_t _positionStride, uint32_t _maxTris, kt::Array<Meshlet>& o_meshlets);
+
+// Average post transform cache misses per triangle for a FIFO cache of _cacheSize entries.
+float CalcACMR(uint32_t const* _indices, uint32_t _numIndices, uint32_t _numVertices, uint32_t _cacheSize);
+
+}
+
+}
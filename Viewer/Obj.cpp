@@ -1,45 +1,21 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include "Obj.h"
+#include "TaskSystem.h"
+#include "Renderer.h"
+#include "MeshOptimize.h"
 
 #include <stdio.h>
+#include <math.h>
+#include <float.h>
+#include <stddef.h>
+#include <immintrin.h>
+#include <atomic>
 
 #include <kt/Memory.h>
 #include <kt/HashMap.h>
 #include <kt/Logging.h>
 #include <kt/FilePath.h>
 #include <kt/File.h>
-#include <kt/Serialization.h>
-
-namespace kt
-{
-
-
-template<>
-void Serialize(ISerializer* _s, sr::Obj::Model& _model)
-{
-	Serialize(_s, _model.m_meshes);
-	Serialize(_s, _model.m_materials);
-}
-
-template<>
-void Serialize(ISerializer* _s, sr::Obj::Mesh& _mesh)
-{
-	Serialize(_s, _mesh.m_indexType);
-	Serialize(_s, _mesh.m_indexData);
-	Serialize(_s, _mesh.m_numIndices);
-	Serialize(_s, _mesh.m_vertexData);
-	Serialize(_s, _mesh.m_matIdx);
-}
-
-template<>
-void Serialize(ISerializer* _s, sr::Obj::Material& _mat)
-{
-	Serialize(_s, _mat.m_diffuse);
-	Serialize(_s, _mat.m_name);
-}
-
-
-}
 
 namespace sr
 {
@@ -60,81 +36,6 @@ bool operator==(TempFace const& _lhs, TempFace const& _rhs)
 	return _lhs.normIdx == _rhs.normIdx && _lhs.posIdx == _rhs.posIdx && _lhs.uvIdx == _rhs.uvIdx;
 }
 
-template <typename T>
-static void FlipMeshWinding(Mesh& _m, void* _idxBuff)
-{
-	T* buff = (T*)_idxBuff;
-	for (uint32_t i = 0; i < _m.m_numIndices; i += 3)
-	{
-		kt::Swap(buff[i + 1], buff[i + 2]);
-	}
-}
-
-
-struct MeshParserState
-{
-	MeshParserState(kt::IAllocator* _tempAllocator)
-		: m_faceMap(_tempAllocator)
-		, m_tempVertices(_tempAllocator)
-		, m_tempIndexBuffer(_tempAllocator)
-		, m_tempPos(_tempAllocator)
-		, m_tempUv(_tempAllocator)
-		, m_tempNormal(_tempAllocator)
-	{
-		m_faceMap.Reserve(4096);
-		m_tempPos.Reserve(2048);
-		m_tempUv.Reserve(2048);
-		m_tempNormal.Reserve(2048);
-		m_tempIndexBuffer.Reserve(2048);
-		m_tempVertices.Reserve(2048);
-	}
-
-	void FinalizeMesh(Mesh* m, uint32_t _matIdx)
-	{
-		m->Clear();
-		m->m_matIdx = _matIdx;
-		if (!m_tempVertices.Size())
-		{
-			return;
-		}
-
-		m->m_indexType = m_tempVertices.Size() > UINT16_MAX ? IndexType::u32 : IndexType::u16;
-
-		if (m->m_indexType == IndexType::u32)
-		{
-			uint32_t const allocSz = sizeof(uint32_t) * m_tempIndexBuffer.Size();
-			memcpy(m->m_indexData.PushBack_Raw(allocSz), m_tempIndexBuffer.Data(), allocSz);
-		}
-		else
-		{
-			uint32_t const allocSz = sizeof(uint16_t) * m_tempIndexBuffer.Size();
-			uint16_t *pDst = (uint16_t*)m->m_indexData.PushBack_Raw(allocSz);
-			for (uint32_t idx32 : m_tempIndexBuffer)
-			{
-				*pDst++ = (uint16_t)idx32;
-			}
-		}
-
-		m->m_numIndices = m_tempIndexBuffer.Size();
-		Vertex* vertexWrite = m->m_vertexData.PushBack_Raw(m_tempVertices.Size());
-		memcpy(vertexWrite, m_tempVertices.Data(), sizeof(Vertex) * m_tempVertices.Size());
-
-		m_faceMap.Clear();
-		m_tempVertices.Clear();
-		m_tempIndexBuffer.Clear();
-	}
-
-	// data is index into m_tempVertices
-	kt::HashMap<TempFace, uint32_t> m_faceMap;
-
-	kt::Array<Vertex> m_tempVertices;
-	kt::Array<uint32_t> m_tempIndexBuffer;
-
-	kt::Array<kt::Vec3> m_tempPos;
-	kt::Array<kt::Vec2> m_tempUv;
-	kt::Array<kt::Vec3> m_tempNormal;
-};
-
 static char* StripWhiteSpaceAndNewLine(char* _buff)
 {
 	char* ret = _buff;
@@ -163,162 +64,10 @@ static int32_t FixupFaceIdx(int32_t _idx, int32_t _totalVertices)
 	return _idx < 0 ? _totalVertices + _idx : _idx - 1;
 }
 
-static bool ParseFace(MeshParserState& _parserState, char const* _line)
+static void ParseMaterial(FILE* _file, Model& _model, kt::FilePath const& _rootPath, uint32_t const _flags, TaskSystem* _taskSystem)
 {
-	char const* p = _line + 2;
-
-	// 6 so we can expand quad into 2 tris
-	int32_t posIndices[6] = {};
-	int32_t texIndices[6] = {};
-	int32_t normIndices[6] = {};
-
-	int32_t numFaceVerts = 0;
-
-	while (*p && numFaceVerts < 4)
-	{
-		auto parseNum = [&p](int32_t& _output)
-		{
-			while (*p == ' ' || *p == '\t')
-			{
-				++p;
-			}
-
-			int32_t sign = 1;
-			if (*p == '-')
-			{
-				sign = -1;
-				++p;
-			}
-
-			int32_t i = 0;
-			while (*p >= '0' && *p <= '9')
-			{
-				i = i * 10 + *p - '0';
-				++p;
-			}
-
-			_output = i * sign;
-		};
-
-		int32_t vertIdx = numFaceVerts;
-
-		parseNum(posIndices[vertIdx]);
-
-		if (posIndices[vertIdx] == 0)
-		{
-			break;
-		}
-
-		++numFaceVerts;
-
-		if (*p != '/')
-		{
-			continue;
-		}
-		++p;
-
-		if (*p == '/')
-		{
-			++p;
-			// Missing tex idx
-			parseNum(normIndices[vertIdx]);
-			continue;
-		}
-
-		parseNum(texIndices[vertIdx]);
-
-		if (*p != '/')
-		{
-			continue;
-		}
-		++p;
-		parseNum(normIndices[vertIdx]);
-	}
-
-	// triangulate the quad
-	if (numFaceVerts == 4)
-	{
-		// dumb triangulation
-		posIndices[5] = posIndices[3];
-		normIndices[5] = normIndices[3];
-		texIndices[5] = texIndices[3];
-
-		posIndices[3] = posIndices[0];
-		normIndices[3] = normIndices[0];
-		texIndices[3] = texIndices[0];
-	
-		posIndices[4] = posIndices[2];
-		normIndices[4] = normIndices[2];
-		texIndices[4] = texIndices[2];
-		numFaceVerts = 6;
-	}
-
-
-	TempFace tempFace;
-	for (int32_t vId = 0; vId < numFaceVerts; ++vId)
-	{
-		tempFace.posIdx = FixupFaceIdx(posIndices[vId], (int32_t)_parserState.m_tempPos.Size());
-		tempFace.uvIdx = FixupFaceIdx(texIndices[vId], (int32_t)_parserState.m_tempUv.Size());
-		tempFace.normIdx = FixupFaceIdx(normIndices[vId], (int32_t)_parserState.m_tempNormal.Size());
-
-		kt::HashMap<TempFace, uint32_t>::Iterator it = _parserState.m_faceMap.Find(tempFace);
-		if (it != _parserState.m_faceMap.End())
-		{
-			_parserState.m_tempIndexBuffer.PushBack(it->m_val);
-		}
-		else
-		{
-			uint32_t const idx = _parserState.m_tempVertices.Size();
-			Vertex* v = _parserState.m_tempVertices.PushBack_Raw();
-			_parserState.m_tempIndexBuffer.PushBack(idx);
-
-			_parserState.m_faceMap[tempFace] = idx;
-
-			if (tempFace.posIdx >= _parserState.m_tempPos.Size())
-			{
-				KT_ASSERT(false);
-				return false;
-			}
-
-			memcpy(&v->pos, &_parserState.m_tempPos[tempFace.posIdx], sizeof(float) * 3);
-
-			if (_parserState.m_tempNormal.Size() != 0)
-			{
-				if (tempFace.normIdx >= _parserState.m_tempNormal.Size())
-				{
-					KT_ASSERT(false);
-					return false;
-				}
-
-				memcpy(&v->norm, &_parserState.m_tempNormal[tempFace.normIdx], sizeof(float) * 3);
-			}
-			else
-			{
-				memset(&v->norm, 0, sizeof(float) * 3);
-			}
-
-			if (_parserState.m_tempUv.Size() != 0)
-			{
-				if (tempFace.uvIdx >= _parserState.m_tempUv.Size())
-				{
-					KT_ASSERT(false);
-					return false;
-				}
-
-				memcpy(&v->uv, &_parserState.m_tempUv[tempFace.uvIdx], sizeof(float) * 2);
-			}
-			else
-			{
-				memset(&v->uv, 0, sizeof(float) * 2);
-			}
-		}
-	}
-
-	return true;
-}
+	TextureFormat const texFormat = (_flags & LoadFlags::CompressTextures) ? TextureFormat::BC_Auto : TextureFormat::RGBA8;
 
-static void ParseMaterial(FILE* _file, Model& _model, kt::FilePath const& _rootPath)
-{
 	char lineBuff[2048];
 
 	Material* curMat = nullptr;
@@ -343,7 +92,7 @@ static void ParseMaterial(FILE* _file, Model& _model, kt::FilePath const& _rootP
 					kt::FilePath diffusePath = _rootPath;
 
 					diffusePath.Append(fileName);
-					curMat->m_diffuse.CreateFromFile(diffusePath.Data());
+					curMat->m_diffuse.CreateFromFile(diffusePath.Data(), texFormat, _taskSystem);
 				}
 			} break;
 		
@@ -360,228 +109,1576 @@ static void ParseMaterial(FILE* _file, Model& _model, kt::FilePath const& _rootP
 	}
 }
 
-Model::~Model()
+// First run conversion: the OBJ is mapped and split into line aligned chunks which are parsed in parallel, then the faces
+// of each object/material group are triangulated and deduplicated in parallel.
+static uint32_t const c_parseChunkBytes = 512 * 1024;
+
+static char const* SkipSpaces(char const* _p, char const* _end)
 {
-	for (Mesh& m : m_meshes)
+	while (_p != _end && (*_p == ' ' || *_p == '\t'))
 	{
-		m.Clear();
+		++_p;
 	}
+	return _p;
+}
 
-	for (Material& mat : m_materials)
-	{
-		mat.m_diffuse.Clear();
-	}
+static bool IsDigit(char _c)
+{
+	return _c >= '0' && _c <= '9';
 }
 
-bool Model::Load(char const* _path, kt::IAllocator* _tempAllocator, uint32_t const _flags)
+// Decimal float with optional sign, fraction and exponent. Up to 19 significant digits are accumulated exactly, then scaled once.
+static bool ParseFloat(char const*& _p, char const* _end, float& o_val)
 {
-	kt::String1024 binpath;
-	binpath.AppendFmt("%s.bin", _path);
-	
-	if (kt::FileExists(binpath.Data()))
+	static double const c_pow10[] =
 	{
-		FILE* cacheFile = fopen(binpath.Data(), "rb");
-		if (cacheFile)
-		{
-			KT_LOG_INFO("Found OBJ cache %s", binpath.Data());
-			kt::FileReader reader(cacheFile);
-			kt::ISerializer serializer(&reader, 0);
-			kt::Serialize(&serializer, *this);
-			return true; // todo: error checking
-		}
-		else
-		{
-			KT_LOG_ERROR("Failed to open obj cache file %s", binpath.Data());
-		}
-	}
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
 
+	char const* p = SkipSpaces(_p, _end);
 
-	FILE* f = fopen(_path, "r");
-	if (!f)
+	bool const negative = p != _end && *p == '-';
+	if (p != _end && (*p == '-' || *p == '+'))
 	{
-		KT_LOG_ERROR("Failed to open obj file: %s", _path);
-		return false;
+		++p;
 	}
-	KT_SCOPE_EXIT(fclose(f));
-
-	KT_LOG_INFO("No cache found, parsing obj %s.", _path);
-
-	Clear();
 
-	char lineBuff[2048];
-
-	MeshParserState parserState(_tempAllocator);
-
-	kt::FilePath const rootPath(kt::FilePath(_path).GetPath());
+	uint64_t mantissa = 0;
+	int32_t exponent = 0;
+	uint32_t numDigits = 0;
+	bool anyDigits = false;
 
-	uint32_t curMatIdx = 0;
-
-	while (fgets(lineBuff, sizeof(lineBuff), f))
+	for (; p != _end && IsDigit(*p); ++p)
 	{
-		char* line = StripWhiteSpaceAndNewLine(lineBuff);
-
-		switch (line[0])
+		anyDigits = true;
+		if (numDigits < 19)
 		{
-			case 'v':
-			{
-				if (line[1] == ' ')
-				{
-					// pos				
-					float* readVtx = (float*)parserState.m_tempPos.PushBack_Raw();
-					int numRead = sscanf(line + 2, "%f %f %f", readVtx, readVtx + 1, readVtx + 2);
-					if (numRead != 3)
-					{
-						KT_LOG_ERROR("Failed to parse obj, Bad vertex pos!");
-						Clear();
-						return false;
-					}
-				}
-				else if (line[1] == 't')
-				{
-					// uv coord			
-					float* readUv = (float*)parserState.m_tempUv.PushBack_Raw();
-					int numRead = sscanf(line + 3, "%f %f", readUv, readUv + 1);
-
-					if (numRead != 2)
-					{
-						KT_LOG_ERROR("Failed to parse obj, Bad uv coord!");
-						Clear();
-						return false;
-					}
-
-					if (_flags & LoadFlags::FlipUVs)
-					{
-						readUv[1] = 1.0f - readUv[1];
-					}
-				}
-				else if (line[1] == 'n')
-				{
-					// normal	
-					float* readNormal = (float*)parserState.m_tempNormal.PushBack_Raw();
-					int numRead = sscanf(line + 3, "%f %f %f", readNormal, readNormal + 1, readNormal + 2);
-					if (numRead != 3)
-					{
-						KT_LOG_ERROR("Failed to parse obj, Bad vertex normal!");
-						Clear();
-						return false;
-					}
-				}
-			} break;
-
-			case 'f':
-			{
-				if (!ParseFace(parserState, line))
-				{
-					KT_LOG_ERROR("Failed to parse obj, Bad vertex face!");
-					Clear();
-					return false;
-				}
-			} break;
-
-			case 'g':
-			{
-				if (parserState.m_tempVertices.Size())
-				{
-					parserState.FinalizeMesh(&m_meshes.PushBack(), curMatIdx);
-				}
-			} break;
-
-			case 'u':
-			{
-				static uint32_t const usemtl_len = 6;
-				if (strncmp(line, "usemtl", usemtl_len) == 0)
-				{
-					char* mtl = StripWhiteSpaceAndNewLine(line + usemtl_len);
-					for (uint32_t mtlIdx = 0; mtlIdx < m_materials.Size(); ++mtlIdx)
-					{
-						if (m_materials[mtlIdx].m_name == mtl)
-						{
-							curMatIdx = mtlIdx;
-							break;
-						}
-					}
-				}
-			} break;
+			mantissa = mantissa * 10 + uint32_t(*p - '0');
+			numDigits += mantissa != 0;
+		}
+		else
+		{
+			++exponent;
+		}
+	}
 
-			case 'm':
+	if (p != _end && *p == '.')
+	{
+		for (++p; p != _end && IsDigit(*p); ++p)
+		{
+			anyDigits = true;
+			if (numDigits < 19)
 			{
-				static uint32_t const mtlliblen = 6;
-				if (strncmp("mtllib", line, mtlliblen) == 0)
-				{
-					char* mtlName = line + mtlliblen;
-					while (*mtlName && (*mtlName == ' ' || *mtlName == '\t')) { ++mtlName; }
-
-					if (!(*mtlName))
-					{
-						KT_LOG_ERROR("Invalid material name in obj file: %s", _path);
-						break;
-					}
-
-					kt::FilePath mtlPath = rootPath;
-					mtlPath.Append(mtlName);
-
-					FILE* mtlFile = fopen(mtlPath.Data(), "r");
-					KT_SCOPE_EXIT(fclose(mtlFile));
-					if (!mtlFile)
-					{
-						KT_LOG_ERROR("Failed to open material file: %s", mtlPath.Data());
-					}
-					ParseMaterial(mtlFile, *this, rootPath);
-				}
-			} break;
+				mantissa = mantissa * 10 + uint32_t(*p - '0');
+				numDigits += mantissa != 0;
+				--exponent;
+			}
 		}
 	}
 
-	if (parserState.m_tempVertices.Size())
+	if (!anyDigits)
 	{
-		parserState.FinalizeMesh(&m_meshes.PushBack(), curMatIdx);
+		return false;
 	}
 
-	if (_flags & LoadFlags::FlipWinding)
+	if (p != _end && (*p == 'e' || *p == 'E'))
 	{
-		for (Mesh& mesh : m_meshes)
+		char const* expP = p + 1;
+		bool const expNegative = expP != _end && *expP == '-';
+		if (expP != _end && (*expP == '-' || *expP == '+'))
 		{
-			if (mesh.m_indexType == IndexType::u16)
-			{
-				FlipMeshWinding<uint16_t>(mesh, mesh.m_indexData.Data());
-			}
-			else
+			++expP;
+		}
+
+		if (expP != _end && IsDigit(*expP))
+		{
+			int32_t e = 0;
+			for (; expP != _end && IsDigit(*expP); ++expP)
 			{
-				FlipMeshWinding<uint32_t>(mesh, mesh.m_indexData.Data());
+				e = kt::Min(e * 10 + (*expP - '0'), 9999);
 			}
+			exponent += expNegative ? -e : e;
+			p = expP;
 		}
 	}
 
-	// Now serialize to binary.
-	FILE* cacheFile = fopen(binpath.Data(), "wb");
-	if (cacheFile)
+	double val = double(mantissa);
+	int32_t const absExp = exponent < 0 ? -exponent : exponent;
+
+	if (absExp <= 22)
 	{
-		kt::FileWriter writer(cacheFile);
-		kt::ISerializer serializer(&writer, 0);
-		kt::Serialize(&serializer, *this);
-		fclose(cacheFile);
+		val = exponent < 0 ? val / c_pow10[absExp] : val * c_pow10[absExp];
 	}
-	else
+	else if (mantissa)
 	{
-		KT_LOG_ERROR("Failed to write obj cache file %s.", binpath.Data());
+		val *= pow(10.0, double(exponent));
 	}
 
+	o_val = float(negative ? -val : val);
+	_p = p;
 	return true;
 }
 
-void Model::Clear()
+// Signed integer, 0 if there is none (OBJ indices are 1 based).
+static int32_t ParseIndex(char const*& _p, char const* _end)
 {
-	for (Mesh& m : m_meshes)
+	char const* p = _p;
+
+	int32_t sign = 1;
+	if (p != _end && *p == '-')
 	{
-		m.Clear();
+		sign = -1;
+		++p;
 	}
-	m_meshes.Clear();
+
+	int32_t i = 0;
+	for (; p != _end && IsDigit(*p); ++p)
+	{
+		i = i * 10 + (*p - '0');
+	}
+
+	_p = p;
+	return i * sign;
 }
 
-void Mesh::Clear()
+// Raw OBJ indices of a face corner: 1 based, negative is relative to the attributes parsed so far, 0 if missing.
+struct ObjFaceVertex
 {
-	m_vertexData.ClearAndFree();
-	m_indexData.ClearAndFree();
+	int32_t m_pos;
+	int32_t m_uv;
+	int32_t m_norm;
+};
+
+struct ObjFace
+{
+	uint32_t m_firstVertex;
+	uint32_t m_numVertices;
+
+	// Attributes parsed in the same chunk before this face, to resolve relative indices.
+	uint32_t m_numPos;
+	uint32_t m_numUv;
+	uint32_t m_numNorm;
+};
+
+enum class ObjEventType : uint32_t
+{
+	Group, // g or o
+	UseMtl,
+	MtlLib
+};
+
+// Statements that affect how faces are grouped, kept in file order.
+struct ObjEvent
+{
+	ObjEventType m_type;
+
+	// Faces of the chunk before this event.
+	uint32_t m_faceIdx;
+
+	// Argument, points into the mapped file.
+	char const* m_str;
+	uint32_t m_strLen;
+};
+
+struct ObjChunk
+{
+	char const* m_begin = nullptr;
+	char const* m_end = nullptr;
+
+	kt::Array<kt::Vec3> m_pos;
+	kt::Array<kt::Vec2> m_uv;
+	kt::Array<kt::Vec3> m_norm;
+
+	kt::Array<ObjFaceVertex> m_faceVertices;
+	kt::Array<ObjFace> m_faces;
+	kt::Array<ObjEvent> m_events;
+
+	// Attributes in all previous chunks.
+	uint32_t m_posBase = 0;
+	uint32_t m_uvBase = 0;
+	uint32_t m_normBase = 0;
+
+	bool m_ok = true;
+};
+
+// Faces [m_faceBegin, m_faceEnd) of a chunk.
+struct ObjGroupSpan
+{
+	uint32_t m_chunk;
+	uint32_t m_faceBegin;
+	uint32_t m_faceEnd;
+};
+
+// Faces with the same object and material, becomes one mesh.
+struct ObjGroup
+{
+	uint32_t m_spanBegin;
+	uint32_t m_spanEnd;
+	uint32_t m_matIdx;
+};
+
+struct ObjParseContext
+{
+	ObjParseContext(kt::IAllocator* _allocator)
+		: m_chunks(_allocator)
+		, m_pos(_allocator)
+		, m_uv(_allocator)
+		, m_norm(_allocator)
+		, m_spans(_allocator)
+		, m_groups(_allocator)
+	{}
+
+	kt::Array<ObjChunk> m_chunks;
+
+	kt::Array<kt::Vec3> m_pos;
+	kt::Array<kt::Vec2> m_uv;
+	kt::Array<kt::Vec3> m_norm;
+
+	kt::Array<ObjGroupSpan> m_spans;
+	kt::Array<ObjGroup> m_groups;
+
+	Mesh* m_meshes = nullptr;
+
+	uint32_t m_flags = 0;
+
+	std::atomic<uint32_t> m_failed{ 0 };
+};
+
+static void ParseChunk(ObjChunk& _chunk, uint32_t const _flags)
+{
+	char const* const end = _chunk.m_end;
+	char const* lineBegin = _chunk.m_begin;
+
+	while (lineBegin < end)
+	{
+		char const* lineEnd = (char const*)memchr(lineBegin, '\n', size_t(end - lineBegin));
+		lineEnd = lineEnd ? lineEnd : end;
+
+		char const* p = SkipSpaces(lineBegin, lineEnd);
+		char const* next = lineEnd + 1;
+
+		// Strip trailing whitespace.
+		char const* argEnd = lineEnd;
+		while (argEnd != p && (argEnd[-1] == ' ' || argEnd[-1] == '\t' || argEnd[-1] == '\r'))
+		{
+			--argEnd;
+		}
+
+		uint32_t const lineLen = uint32_t(argEnd - p);
+
+		auto pushEvent = [&_chunk, argEnd](ObjEventType _type, char const* _arg)
+		{
+			ObjEvent& ev = _chunk.m_events.PushBack();
+			ev.m_type = _type;
+			ev.m_faceIdx = _chunk.m_faces.Size();
+			ev.m_str = _arg;
+			ev.m_strLen = uint32_t(argEnd - _arg);
+		};
+
+		if (lineLen >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			kt::Vec3& pos = _chunk.m_pos.PushBack();
+			char const* c = p + 2;
+			if (!ParseFloat(c, argEnd, pos.x) || !ParseFloat(c, argEnd, pos.y) || !ParseFloat(c, argEnd, pos.z))
+			{
+				KT_LOG_ERROR("Failed to parse obj, Bad vertex pos!");
+				_chunk.m_ok = false;
+				return;
+			}
+		}
+		else if (lineLen >= 3 && p[0] == 'v' && p[1] == 't')
+		{
+			kt::Vec2& uv = _chunk.m_uv.PushBack();
+			char const* c = p + 2;
+			if (!ParseFloat(c, argEnd, uv.x) || !ParseFloat(c, argEnd, uv.y))
+			{
+				KT_LOG_ERROR("Failed to parse obj, Bad uv coord!");
+				_chunk.m_ok = false;
+				return;
+			}
+
+			if (_flags & LoadFlags::FlipUVs)
+			{
+				uv.y = 1.0f - uv.y;
+			}
+		}
+		else if (lineLen >= 3 && p[0] == 'v' && p[1] == 'n')
+		{
+			kt::Vec3& norm = _chunk.m_norm.PushBack();
+			char const* c = p + 2;
+			if (!ParseFloat(c, argEnd, norm.x) || !ParseFloat(c, argEnd, norm.y) || !ParseFloat(c, argEnd, norm.z))
+			{
+				KT_LOG_ERROR("Failed to parse obj, Bad vertex normal!");
+				_chunk.m_ok = false;
+				return;
+			}
+		}
+		else if (lineLen >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			ObjFace face;
+			face.m_firstVertex = _chunk.m_faceVertices.Size();
+			face.m_numVertices = 0;
+			face.m_numPos = _chunk.m_pos.Size();
+			face.m_numUv = _chunk.m_uv.Size();
+			face.m_numNorm = _chunk.m_norm.Size();
+
+			// Any number of corners: pos, pos/uv, pos//norm or pos/uv/norm.
+			char const* c = SkipSpaces(p + 2, argEnd);
+			while (c != argEnd)
+			{
+				ObjFaceVertex vtx = {};
+				vtx.m_pos = ParseIndex(c, argEnd);
+
+				if (c != argEnd && *c == '/')
+				{
+					++c;
+					vtx.m_uv = ParseIndex(c, argEnd);
+
+					if (c != argEnd && *c == '/')
+					{
+						++c;
+						vtx.m_norm = ParseIndex(c, argEnd);
+					}
+				}
+
+				if (!vtx.m_pos || (c != argEnd && *c != ' ' && *c != '\t'))
+				{
+					KT_LOG_ERROR("Failed to parse obj, Bad vertex face!");
+					_chunk.m_ok = false;
+					return;
+				}
+
+				_chunk.m_faceVertices.PushBack(vtx);
+				++face.m_numVertices;
+				c = SkipSpaces(c, argEnd);
+			}
+
+			if (face.m_numVertices >= 3)
+			{
+				_chunk.m_faces.PushBack(face);
+			}
+			else
+			{
+				_chunk.m_faceVertices.Resize(face.m_firstVertex);
+			}
+		}
+		else if (lineLen >= 1 && (p[0] == 'g' || p[0] == 'o') && (lineLen == 1 || p[1] == ' ' || p[1] == '\t'))
+		{
+			pushEvent(ObjEventType::Group, SkipSpaces(p + 1, argEnd));
+		}
+		else if (lineLen > 6 && strncmp(p, "usemtl", 6) == 0)
+		{
+			pushEvent(ObjEventType::UseMtl, SkipSpaces(p + 6, argEnd));
+		}
+		else if (lineLen > 6 && strncmp(p, "mtllib", 6) == 0)
+		{
+			pushEvent(ObjEventType::MtlLib, SkipSpaces(p + 6, argEnd));
+		}
+
+		lineBegin = next;
+	}
+}
+
+// Vertex cache order first, then clusters of that reordered for overdraw, then vertices remapped into fetch order.
+// _flippedWinding if the triangles are clockwise (LoadFlags::FlipWinding), so face normals point the other way.
+static void OptimizeMesh(kt::Array<Vertex>& _vertices, kt::Array<uint32_t>& _indices, bool _flippedWinding)
+{
+	static float const c_overdrawThreshold = 1.05f;
+
+	uint32_t const numIndices = _indices.Size();
+	uint32_t const numVertices = _vertices.Size();
+
+	if (numIndices < 3)
+	{
+		return;
+	}
+
+	kt::Array<uint32_t> temp;
+	temp.Resize(numIndices);
+
+	MeshOpt::OptimizeVertexCache(_indices.Data(), numIndices, numVertices, temp.Data());
+	MeshOpt::OptimizeOverdraw(temp.Data(), numIndices, &_vertices[0].pos.x, sizeof(Vertex), numVertices, c_overdrawThreshold, _flippedWinding ? -1.0f : 1.0f, _indices.Data());
+
+	kt::Array<uint32_t> remap;
+	remap.Resize(numVertices);
+	uint32_t const numUsed = MeshOpt::OptimizeVertexFetch(_indices.Data(), numIndices, numVertices, remap.Data());
+
+	kt::Array<Vertex> remapped;
+	remapped.Resize(numUsed);
+
+	for (uint32_t i = 0; i < numUsed; ++i)
+	{
+		remapped[i] = _vertices[remap[i]];
+	}
+
+	_vertices = std::move(remapped);
+}
+
+static void ComputeBounds(kt::Array<Vertex> const& _vertices, Mesh& _mesh)
+{
+	float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (Vertex const& v : _vertices)
+	{
+		float const* pos = &v.pos.x;
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			boundsMin[axis] = kt::Min(boundsMin[axis], pos[axis]);
+			boundsMax[axis] = kt::Max(boundsMax[axis], pos[axis]);
+		}
+	}
+
+	if (!_vertices.Size())
+	{
+		return;
+	}
+
+	// Centred on the bounding box, as MeshOpt::Simplify measures its error against the same sphere.
+	kt::Vec3 const center((boundsMin[0] + boundsMax[0]) * 0.5f, (boundsMin[1] + boundsMax[1]) * 0.5f, (boundsMin[2] + boundsMax[2]) * 0.5f);
+	float radiusSq = 0.0f;
+
+	for (Vertex const& v : _vertices)
+	{
+		float const dx = v.pos.x - center.x;
+		float const dy = v.pos.y - center.y;
+		float const dz = v.pos.z - center.z;
+		radiusSq = kt::Max(radiusSq, dx * dx + dy * dy + dz * dz);
+	}
+
+	_mesh.m_boundsCenter = center;
+	_mesh.m_boundsExtents = kt::Vec3((boundsMax[0] - boundsMin[0]) * 0.5f, (boundsMax[1] - boundsMin[1]) * 0.5f, (boundsMax[2] - boundsMin[2]) * 0.5f);
+	_mesh.m_boundsRadius = sqrtf(radiusSq);
+}
+
+// Each LOD is simplified from LOD 0 to half the previous LOD's triangles, and appended to _indices.
+static void BuildMeshLods(kt::Array<Vertex> const& _vertices, kt::Array<uint32_t>& _indices, bool _optimize, Mesh& _mesh)
+{
+	static float const c_lodMaxError = 0.1f;
+	static float const c_lodReduction = 0.5f;
+
+	// Stop once simplification stalls (e.g. locked by seams) and the next LOD would barely be smaller.
+	static float const c_lodMinReduction = 0.85f;
+
+	uint32_t const numBaseIndices = _indices.Size();
+
+	kt::Array<uint32_t> lodIndices;
+	lodIndices.Resize(numBaseIndices);
+
+	kt::Array<uint32_t> temp;
+	if (_optimize)
+	{
+		temp.Resize(numBaseIndices);
+	}
+
+	while (_mesh.m_numLods < Mesh::c_maxLods)
+	{
+		Mesh::Lod const& prevLod = _mesh.m_lods[_mesh.m_numLods - 1];
+		uint32_t const target = uint32_t(float(prevLod.m_numIndices / 3) * c_lodReduction) * 3;
+
+		float error;
+		uint32_t const numIndices = MeshOpt::Simplify(_indices.Data(), numBaseIndices, &_vertices[0].pos.x, sizeof(Vertex), _vertices.Size(), target, c_lodMaxError, lodIndices.Data(), &error);
+
+		if (!numIndices || float(numIndices) > float(prevLod.m_numIndices) * c_lodMinReduction)
+		{
+			break;
+		}
+
+		uint32_t const* src = lodIndices.Data();
+
+		if (_optimize)
+		{
+			MeshOpt::OptimizeVertexCache(lodIndices.Data(), numIndices, _vertices.Size(), temp.Data());
+			src = temp.Data();
+		}
+
+		Mesh::Lod& lod = _mesh.m_lods[_mesh.m_numLods++];
+		lod.m_firstIndex = _indices.Size();
+		lod.m_numIndices = numIndices;
+		lod.m_error = error;
+
+		memcpy(_indices.PushBack_Raw(numIndices), src, sizeof(uint32_t) * numIndices);
+	}
+}
+
+// Triangles per meshlet, small enough that culling usually removes whole meshlets but large enough to amortise the test.
+static uint32_t const c_meshletMaxTris = 64;
+
+static void BuildLodMeshlets(kt::Array<Vertex> const& _vertices, kt::Array<uint32_t> const& _indices, Mesh& _mesh)
+{
+	for (uint32_t lodIdx = 0; lodIdx < _mesh.m_numLods; ++lodIdx)
+	{
+		Mesh::Lod& lod = _mesh.m_lods[lodIdx];
+		lod.m_firstMeshlet = _mesh.m_meshletData.Size();
+		MeshOpt::BuildMeshlets(_indices.Data() + lod.m_firstIndex, lod.m_numIndices, &_vertices[0].pos.x, sizeof(Vertex), c_meshletMaxTris, _mesh.m_meshletData);
+		lod.m_numMeshlets = _mesh.m_meshletData.Size() - lod.m_firstMeshlet;
+	}
+
+	_mesh.m_numMeshlets = _mesh.m_meshletData.Size();
+}
+
+static void OctEncode(kt::Vec3 const& _n, int16_t (&o_oct)[2])
+{
+	float const l1 = fabsf(_n.x) + fabsf(_n.y) + fabsf(_n.z);
+
+	// Missing normals encode as +z.
+	float x = l1 > 0.0f ? _n.x / l1 : 0.0f;
+	float y = l1 > 0.0f ? _n.y / l1 : 0.0f;
+
+	if (l1 > 0.0f && _n.z < 0.0f)
+	{
+		// Fold the lower hemisphere over the diagonals.
+		float const foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float const foldedY = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = foldedX;
+		y = foldedY;
+	}
+
+	o_oct[0] = int16_t(lroundf(kt::Clamp(x, -1.0f, 1.0f) * 32767.0f));
+	o_oct[1] = int16_t(lroundf(kt::Clamp(y, -1.0f, 1.0f) * 32767.0f));
+}
+
+// Positions as unorm16 over the mesh bounds, octahedral snorm16 normals and half uvs.
+static void QuantizeMeshVertices(kt::Array<Vertex> const& _vertices, Mesh& _mesh)
+{
+	float boundsMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+	float boundsMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	for (Vertex const& v : _vertices)
+	{
+		float const* pos = &v.pos.x;
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			boundsMin[axis] = kt::Min(boundsMin[axis], pos[axis]);
+			boundsMax[axis] = kt::Max(boundsMax[axis], pos[axis]);
+		}
+	}
+
+	float scale[3];
+	float invScale[3];
+
+	for (uint32_t axis = 0; axis < 3; ++axis)
+	{
+		float const extent = _vertices.Size() ? boundsMax[axis] - boundsMin[axis] : 0.0f;
+		boundsMin[axis] = _vertices.Size() ? boundsMin[axis] : 0.0f;
+		scale[axis] = extent / 65535.0f;
+		invScale[axis] = extent > 0.0f ? 65535.0f / extent : 0.0f;
+	}
+
+	_mesh.m_quantized = true;
+	_mesh.m_posScale = kt::Vec3(scale[0], scale[1], scale[2]);
+	_mesh.m_posOffset = kt::Vec3(boundsMin[0], boundsMin[1], boundsMin[2]);
+
+	QuantizedVertex* out = _mesh.m_quantizedVertexData.PushBack_Raw(_vertices.Size());
+
+	for (Vertex const& v : _vertices)
+	{
+		QuantizedVertex& q = *out++;
+		float const* pos = &v.pos.x;
+
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			q.pos[axis] = uint16_t(kt::Clamp((pos[axis] - boundsMin[axis]) * invScale[axis] + 0.5f, 0.0f, 65535.0f));
+		}
+
+		OctEncode(v.norm, q.norm);
+		q.uv[0] = _cvtss_sh(v.uv.x, 0);
+		q.uv[1] = _cvtss_sh(v.uv.y, 0);
+		q.pad = 0;
+	}
+}
+
+// Decoded positions move by up to half a quantization step per axis, bounds computed from the float positions grow by this much.
+static float PositionQuantizationError(kt::Vec3 const& _posScale)
+{
+	return 0.5f * sqrtf(_posScale.x * _posScale.x + _posScale.y * _posScale.y + _posScale.z * _posScale.z);
+}
+
+// The bounding box of the positions as decoded by the front end.
+static kt::Vec3 DecodedBoundsExtents(Mesh const& _mesh)
+{
+	return _mesh.m_quantized ? _mesh.m_boundsExtents + _mesh.m_posScale * 0.5f : _mesh.m_boundsExtents;
+}
+
+// Triangulate (as a fan) and deduplicate the faces of one group into _mesh.
+static bool ResolveGroup(ObjParseContext const& _ctx, ObjGroup const& _group, Mesh& _mesh)
+{
+	kt::HashMap<TempFace, uint32_t> faceMap(kt::GetDefaultAllocator());
+	kt::Array<Vertex> vertices;
+	kt::Array<uint32_t> indices;
+
+	bool const flipWinding = (_ctx.m_flags & LoadFlags::FlipWinding) != 0;
+
+	uint32_t const numPos = _ctx.m_pos.Size();
+	uint32_t const numUv = _ctx.m_uv.Size();
+	uint32_t const numNorm = _ctx.m_norm.Size();
+
+	for (uint32_t spanIdx = _group.m_spanBegin; spanIdx < _group.m_spanEnd; ++spanIdx)
+	{
+		ObjGroupSpan const& span = _ctx.m_spans[spanIdx];
+		ObjChunk const& chunk = _ctx.m_chunks[span.m_chunk];
+
+		for (uint32_t faceIdx = span.m_faceBegin; faceIdx < span.m_faceEnd; ++faceIdx)
+		{
+			ObjFace const& face = chunk.m_faces[faceIdx];
+			ObjFaceVertex const* faceVerts = chunk.m_faceVertices.Data() + face.m_firstVertex;
+
+			auto addCorner = [&](ObjFaceVertex const& _vtx) -> bool
+			{
+				TempFace tempFace;
+				tempFace.posIdx = uint32_t(FixupFaceIdx(_vtx.m_pos, int32_t(chunk.m_posBase + face.m_numPos)));
+				tempFace.uvIdx = uint32_t(FixupFaceIdx(_vtx.m_uv, int32_t(chunk.m_uvBase + face.m_numUv)));
+				tempFace.normIdx = uint32_t(FixupFaceIdx(_vtx.m_norm, int32_t(chunk.m_normBase + face.m_numNorm)));
+
+				kt::HashMap<TempFace, uint32_t>::Iterator it = faceMap.Find(tempFace);
+				if (it != faceMap.End())
+				{
+					indices.PushBack(it->m_val);
+					return true;
+				}
+
+				if (tempFace.posIdx >= numPos || (numUv && tempFace.uvIdx >= numUv) || (numNorm && tempFace.normIdx >= numNorm))
+				{
+					return false;
+				}
+
+				uint32_t const idx = vertices.Size();
+				Vertex& v = vertices.PushBack();
+				indices.PushBack(idx);
+				faceMap[tempFace] = idx;
+
+				v.pos = _ctx.m_pos[tempFace.posIdx];
+				v.norm = numNorm ? _ctx.m_norm[tempFace.normIdx] : kt::Vec3(0.0f);
+				v.uv = numUv ? _ctx.m_uv[tempFace.uvIdx] : kt::Vec2(0.0f);
+				return true;
+			};
+
+			for (uint32_t i = 1; i + 1 < face.m_numVertices; ++i)
+			{
+				uint32_t const b = flipWinding ? i + 1 : i;
+				uint32_t const c = flipWinding ? i : i + 1;
+
+				if (!addCorner(faceVerts[0]) || !addCorner(faceVerts[b]) || !addCorner(faceVerts[c]))
+				{
+					KT_LOG_ERROR("Failed to parse obj, face index out of range!");
+					return false;
+				}
+			}
+		}
+	}
+
+	_mesh.Clear();
+	_mesh.m_matIdx = _group.m_matIdx;
+
+	if (_ctx.m_flags & LoadFlags::OptimizeMeshes)
+	{
+		OptimizeMesh(vertices, indices, flipWinding);
+	}
+
+	ComputeBounds(vertices, _mesh);
+
+	_mesh.m_numLods = 1;
+	_mesh.m_lods[0].m_numIndices = indices.Size();
+
+	if ((_ctx.m_flags & LoadFlags::GenerateLods) && indices.Size())
+	{
+		BuildMeshLods(vertices, indices, (_ctx.m_flags & LoadFlags::OptimizeMeshes) != 0, _mesh);
+	}
+
+	if ((_ctx.m_flags & LoadFlags::BuildMeshlets) && indices.Size())
+	{
+		BuildLodMeshlets(vertices, indices, _mesh);
+	}
+
+	_mesh.m_indexType = vertices.Size() > UINT16_MAX ? IndexType::u32 : IndexType::u16;
+
+	if (_mesh.m_indexType == IndexType::u32)
+	{
+		uint32_t const allocSz = sizeof(uint32_t) * indices.Size();
+		memcpy(_mesh.m_indexData.PushBack_Raw(allocSz), indices.Data(), allocSz);
+	}
+	else
+	{
+		uint32_t const allocSz = sizeof(uint16_t) * indices.Size();
+		uint16_t* pDst = (uint16_t*)_mesh.m_indexData.PushBack_Raw(allocSz);
+		for (uint32_t idx32 : indices)
+		{
+			*pDst++ = (uint16_t)idx32;
+		}
+	}
+
+	_mesh.m_numIndices = indices.Size();
+	_mesh.m_numVertices = vertices.Size();
+
+	if (_ctx.m_flags & LoadFlags::QuantizeVertices)
+	{
+		QuantizeMeshVertices(vertices, _mesh);
+
+		float const quantizationError = PositionQuantizationError(_mesh.m_posScale);
+		for (Meshlet& meshlet : _mesh.m_meshletData)
+		{
+			meshlet.m_radius += quantizationError;
+		}
+	}
+	else
+	{
+		memcpy(_mesh.m_vertexData.PushBack_Raw(vertices.Size()), vertices.Data(), sizeof(Vertex) * vertices.Size());
+	}
+
+	return true;
+}
+
+// Call _fn(begin, end) over [0, _count) on the task system, or inline without one.
+template <typename FnT>
+static void ParallelFor(TaskSystem* _taskSystem, uint32_t _count, FnT const& _fn)
+{
+	if (_taskSystem)
+	{
+		_taskSystem->ParallelFor(_count, 1, _fn);
+	}
+	else if (_count)
+	{
+		_fn(0u, _count);
+	}
+}
+
+// Chunks are parsed by workers with their own (default allocator) arrays, everything else uses _tempAllocator.
+static bool ParseObj(Model& _model, char const* _path, kt::IAllocator* _tempAllocator, uint32_t const _flags, TaskSystem* _taskSystem)
+{
+	MappedFile objFile;
+	if (!objFile.Open(_path))
+	{
+		KT_LOG_ERROR("Failed to open obj file: %s", _path);
+		return false;
+	}
+
+	ObjParseContext ctx(_tempAllocator);
+	ctx.m_flags = _flags;
+
+	// Split into line aligned chunks.
+	char const* const fileBegin = (char const*)objFile.Data();
+	char const* const fileEnd = fileBegin + objFile.Size();
+
+	for (char const* chunkBegin = fileBegin; chunkBegin < fileEnd; )
+	{
+		char const* chunkEnd = chunkBegin + kt::Min<uint64_t>(c_parseChunkBytes, uint64_t(fileEnd - chunkBegin));
+		if (chunkEnd < fileEnd)
+		{
+			char const* newline = (char const*)memchr(chunkEnd, '\n', size_t(fileEnd - chunkEnd));
+			chunkEnd = newline ? newline + 1 : fileEnd;
+		}
+
+		ObjChunk& chunk = ctx.m_chunks.PushBack();
+		chunk.m_begin = chunkBegin;
+		chunk.m_end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+
+	ParallelFor(_taskSystem, ctx.m_chunks.Size(), [&ctx](uint32_t _start, uint32_t _end)
+	{
+		for (uint32_t i = _start; i < _end; ++i)
+		{
+			ParseChunk(ctx.m_chunks[i], ctx.m_flags);
+		}
+	});
+
+	// Concatenate attributes and record where each chunk's start.
+	uint32_t numPos = 0;
+	uint32_t numUv = 0;
+	uint32_t numNorm = 0;
+
+	for (ObjChunk& chunk : ctx.m_chunks)
+	{
+		if (!chunk.m_ok)
+		{
+			return false;
+		}
+
+		chunk.m_posBase = numPos;
+		chunk.m_uvBase = numUv;
+		chunk.m_normBase = numNorm;
+		numPos += chunk.m_pos.Size();
+		numUv += chunk.m_uv.Size();
+		numNorm += chunk.m_norm.Size();
+	}
+
+	ctx.m_pos.Resize(numPos);
+	ctx.m_uv.Resize(numUv);
+	ctx.m_norm.Resize(numNorm);
+
+	for (ObjChunk& chunk : ctx.m_chunks)
+	{
+		memcpy(ctx.m_pos.Data() + chunk.m_posBase, chunk.m_pos.Data(), sizeof(kt::Vec3) * chunk.m_pos.Size());
+		memcpy(ctx.m_uv.Data() + chunk.m_uvBase, chunk.m_uv.Data(), sizeof(kt::Vec2) * chunk.m_uv.Size());
+		memcpy(ctx.m_norm.Data() + chunk.m_normBase, chunk.m_norm.Data(), sizeof(kt::Vec3) * chunk.m_norm.Size());
+		chunk.m_pos.ClearAndFree();
+		chunk.m_uv.ClearAndFree();
+		chunk.m_norm.ClearAndFree();
+	}
+
+	// Walk the grouping statements in file order. A new group starts at every g/o and every material change.
+	kt::FilePath const rootPath(kt::FilePath(_path).GetPath());
+
+	uint32_t curMatIdx = 0;
+	ObjGroup curGroup = { 0, 0, 0 };
+
+	auto closeGroup = [&ctx, &curGroup, &curMatIdx]()
+	{
+		curGroup.m_spanEnd = ctx.m_spans.Size();
+		if (curGroup.m_spanEnd != curGroup.m_spanBegin)
+		{
+			ctx.m_groups.PushBack(curGroup);
+		}
+		curGroup.m_spanBegin = curGroup.m_spanEnd;
+		curGroup.m_matIdx = curMatIdx;
+	};
+
+	auto addSpan = [&ctx](uint32_t _chunk, uint32_t _faceBegin, uint32_t _faceEnd)
+	{
+		if (_faceEnd > _faceBegin)
+		{
+			ctx.m_spans.PushBack(ObjGroupSpan{ _chunk, _faceBegin, _faceEnd });
+		}
+	};
+
+	for (uint32_t chunkIdx = 0; chunkIdx < ctx.m_chunks.Size(); ++chunkIdx)
+	{
+		ObjChunk const& chunk = ctx.m_chunks[chunkIdx];
+		uint32_t faceBegin = 0;
+
+		for (ObjEvent const& ev : chunk.m_events)
+		{
+			addSpan(chunkIdx, faceBegin, ev.m_faceIdx);
+			faceBegin = ev.m_faceIdx;
+
+			kt::String1024 arg;
+			arg.AppendFmt("%.*s", int(ev.m_strLen), ev.m_str);
+
+			switch (ev.m_type)
+			{
+				case ObjEventType::Group:
+				{
+					closeGroup();
+				} break;
+
+				case ObjEventType::UseMtl:
+				{
+					for (uint32_t mtlIdx = 0; mtlIdx < _model.m_materials.Size(); ++mtlIdx)
+					{
+						if (_model.m_materials[mtlIdx].m_name == arg.Data())
+						{
+							curMatIdx = mtlIdx;
+							break;
+						}
+					}
+
+					if (curMatIdx != curGroup.m_matIdx)
+					{
+						closeGroup();
+					}
+				} break;
+
+				case ObjEventType::MtlLib:
+				{
+					if (!ev.m_strLen)
+					{
+						KT_LOG_ERROR("Invalid material name in obj file: %s", _path);
+						break;
+					}
+
+					kt::FilePath mtlPath = rootPath;
+					mtlPath.Append(arg.Data());
+
+					FILE* mtlFile = fopen(mtlPath.Data(), "r");
+					if (!mtlFile)
+					{
+						KT_LOG_ERROR("Failed to open material file: %s", mtlPath.Data());
+						break;
+					}
+
+					KT_SCOPE_EXIT(fclose(mtlFile));
+					ParseMaterial(mtlFile, _model, rootPath, _flags, _taskSystem);
+				} break;
+			}
+		}
+
+		addSpan(chunkIdx, faceBegin, chunk.m_faces.Size());
+	}
+
+	closeGroup();
+
+	_model.m_meshes.Resize(ctx.m_groups.Size());
+	ctx.m_meshes = _model.m_meshes.Data();
+
+	ParallelFor(_taskSystem, ctx.m_groups.Size(), [&ctx](uint32_t _start, uint32_t _end)
+	{
+		for (uint32_t i = _start; i < _end; ++i)
+		{
+			if (!ResolveGroup(ctx, ctx.m_groups[i], ctx.m_meshes[i]))
+			{
+				ctx.m_failed.store(1, std::memory_order_relaxed);
+			}
+		}
+	});
+
+	return ctx.m_failed.load(std::memory_order_relaxed) == 0;
+}
+
+static bool WriteTexturePages(Model& _model, char const* _path)
+{
+	kt::String1024 pagePath;
+	pagePath.AppendFmt("%s.pages", _path);
+
+	FILE* pageFile = fopen(pagePath.Data(), "wb");
+	if (!pageFile)
+	{
+		KT_LOG_ERROR("Failed to write texture page file %s, textures will stay resident.", pagePath.Data());
+		return false;
+	}
+
+	KT_SCOPE_EXIT(fclose(pageFile));
+
+	for (Material& mat : _model.m_materials)
+	{
+		if (mat.m_diffuse.m_numMips)
+		{
+			mat.m_diffusePageFileOffset = Tex::VirtualTextureCache::WritePages(pageFile, mat.m_diffuse);
+			mat.m_diffuse.m_texels.ClearAndFree();
+		}
+	}
+
+	return true;
+}
+
+static void InitVirtualTextures(Model& _model, char const* _path)
+{
+	kt::String1024 pagePath;
+	pagePath.AppendFmt("%s.pages", _path);
+
+	if (!_model.m_virtualTextures.Init(pagePath.Data()))
+	{
+		return;
+	}
+
+	for (Material& mat : _model.m_materials)
+	{
+		if (mat.m_diffuse.m_numMips)
+		{
+			_model.m_virtualTextures.Register(mat.m_diffuse, mat.m_diffusePageFileOffset);
+		}
+	}
+}
+
+// The cache is mapped and used in place: meshes and textures point straight into the mapping.
+// Layout: CacheHeader | CacheMesh[m_numMeshes] | CacheMaterial[m_numMaterials] | BvhNode[m_numBvhNodes] | index, vertex, meshlet and texel blobs.
+// Every section starts at a multiple of c_cacheAlignment and all offsets are from the start of the file, so it can be mapped anywhere.
+// Bump c_cacheVersion whenever the layout (or anything it contains, e.g. Vertex, QuantizedVertex, Meshlet, BvhNode or texture tiling) changes.
+static uint32_t const c_cacheMagic = 0x4A424F53; // 'SOBJ'
+static uint32_t const c_cacheVersion = 8;
+static uint32_t const c_cacheAlignment = 64;
+
+struct CacheHeader
+{
+	uint32_t m_magic;
+	uint32_t m_version;
+	uint32_t m_flags;
+	uint32_t m_numMeshes;
+	uint32_t m_numMaterials;
+	uint32_t m_numBvhNodes;
+	uint64_t m_meshTableOffset;
+	uint64_t m_materialTableOffset;
+	uint64_t m_bvhOffset;
+	uint64_t m_fileSize;
+};
+
+struct CacheMesh
+{
+	uint64_t m_indexDataOffset;
+	uint64_t m_vertexDataOffset;
+	uint64_t m_meshletDataOffset;
+	uint32_t m_indexDataBytes;
+	uint32_t m_numIndices;
+	uint32_t m_numVertices;
+	uint32_t m_indexType;
+	uint32_t m_matIdx;
+	uint32_t m_quantized;
+	float m_posScale[3];
+	float m_posOffset[3];
+	float m_boundsCenter[3];
+	float m_boundsExtents[3];
+	float m_boundsRadius;
+	uint32_t m_numLods;
+	uint32_t m_lodFirstIndex[Mesh::c_maxLods];
+	uint32_t m_lodNumIndices[Mesh::c_maxLods];
+	float m_lodError[Mesh::c_maxLods];
+	uint32_t m_lodFirstMeshlet[Mesh::c_maxLods];
+	uint32_t m_lodNumMeshlets[Mesh::c_maxLods];
+	uint32_t m_numMeshlets;
+	uint32_t m_pad;
+};
+
+struct CacheMaterial
+{
+	char m_name[128];
+	uint64_t m_texelOffset;
+	uint64_t m_pageFileOffset;
+	uint32_t m_texelBytes;
+	uint32_t m_width;
+	uint32_t m_height;
+	uint32_t m_numMips;
+	uint32_t m_bytesPerPixel;
+	uint32_t m_format;
+	uint32_t m_mipOffsets[Config::c_maxTexDimLog2];
+};
+
+static_assert(sizeof(CacheHeader) % 8 == 0 && sizeof(CacheMesh) % 8 == 0 && sizeof(CacheMaterial) % 8 == 0, "Cache structs must not need padding.");
+
+static uint64_t AlignCacheOffset(uint64_t _offset)
+{
+	return (_offset + c_cacheAlignment - 1) & ~uint64_t(c_cacheAlignment - 1);
+}
+
+// Write _size bytes and pad to c_cacheAlignment.
+static bool WriteCacheBlob(FILE* _file, void const* _data, uint64_t _size)
+{
+	static uint8_t const c_zeros[c_cacheAlignment] = {};
+
+	uint64_t const padding = AlignCacheOffset(_size) - _size;
+	return fwrite(_data, 1, size_t(_size), _file) == _size
+		&& fwrite(c_zeros, 1, size_t(padding), _file) == padding;
+}
+
+static bool WriteCache(Model const& _model, char const* _binPath, uint32_t const _flags)
+{
+	CacheHeader header = {};
+	header.m_magic = c_cacheMagic;
+	header.m_version = c_cacheVersion;
+	header.m_flags = _flags;
+	header.m_numMeshes = _model.m_meshes.Size();
+	header.m_numMaterials = _model.m_materials.Size();
+	header.m_numBvhNodes = _model.m_bvh.m_numNodes;
+
+	// Lay everything out up front so the tables can be written first.
+	uint64_t offset = AlignCacheOffset(sizeof(CacheHeader));
+	header.m_meshTableOffset = offset;
+	offset = AlignCacheOffset(offset + sizeof(CacheMesh) * header.m_numMeshes);
+	header.m_materialTableOffset = offset;
+	offset = AlignCacheOffset(offset + sizeof(CacheMaterial) * header.m_numMaterials);
+	header.m_bvhOffset = offset;
+	offset = AlignCacheOffset(offset + sizeof(BvhNode) * header.m_numBvhNodes);
+
+	kt::Array<CacheMesh> meshes;
+	meshes.Resize(header.m_numMeshes);
+
+	for (uint32_t i = 0; i < header.m_numMeshes; ++i)
+	{
+		Mesh const& mesh = _model.m_meshes[i];
+		CacheMesh& entry = meshes[i];
+		memset(&entry, 0, sizeof(entry));
+
+		entry.m_indexDataBytes = mesh.m_numIndices * uint32_t(mesh.m_indexType == IndexType::u16 ? sizeof(uint16_t) : sizeof(uint32_t));
+		entry.m_numIndices = mesh.m_numIndices;
+		entry.m_numVertices = mesh.m_numVertices;
+		entry.m_indexType = uint32_t(mesh.m_indexType);
+		entry.m_matIdx = mesh.m_matIdx;
+		entry.m_quantized = mesh.m_quantized ? 1 : 0;
+		memcpy(entry.m_posScale, &mesh.m_posScale.x, sizeof(entry.m_posScale));
+		memcpy(entry.m_posOffset, &mesh.m_posOffset.x, sizeof(entry.m_posOffset));
+		memcpy(entry.m_boundsCenter, &mesh.m_boundsCenter.x, sizeof(entry.m_boundsCenter));
+		memcpy(entry.m_boundsExtents, &mesh.m_boundsExtents.x, sizeof(entry.m_boundsExtents));
+		entry.m_boundsRadius = mesh.m_boundsRadius;
+
+		entry.m_numLods = mesh.m_numLods;
+		for (uint32_t lod = 0; lod < mesh.m_numLods; ++lod)
+		{
+			entry.m_lodFirstIndex[lod] = mesh.m_lods[lod].m_firstIndex;
+			entry.m_lodNumIndices[lod] = mesh.m_lods[lod].m_numIndices;
+			entry.m_lodError[lod] = mesh.m_lods[lod].m_error;
+			entry.m_lodFirstMeshlet[lod] = mesh.m_lods[lod].m_firstMeshlet;
+			entry.m_lodNumMeshlets[lod] = mesh.m_lods[lod].m_numMeshlets;
+		}
+
+		entry.m_numMeshlets = mesh.m_numMeshlets;
+
+		entry.m_indexDataOffset = offset;
+		offset = AlignCacheOffset(offset + entry.m_indexDataBytes);
+		entry.m_vertexDataOffset = offset;
+		offset = AlignCacheOffset(offset + mesh.VertexStride() * uint64_t(entry.m_numVertices));
+		entry.m_meshletDataOffset = offset;
+		offset = AlignCacheOffset(offset + sizeof(Meshlet) * uint64_t(entry.m_numMeshlets));
+	}
+
+	kt::Array<CacheMaterial> materials;
+	materials.Resize(header.m_numMaterials);
+
+	for (uint32_t i = 0; i < header.m_numMaterials; ++i)
+	{
+		Material const& mat = _model.m_materials[i];
+		Tex::TextureData const& tex = mat.m_diffuse;
+		CacheMaterial& entry = materials[i];
+		memset(&entry, 0, sizeof(entry));
+
+		strncpy(entry.m_name, mat.m_name.Data(), sizeof(entry.m_name) - 1);
+		entry.m_pageFileOffset = mat.m_diffusePageFileOffset;
+		entry.m_width = tex.m_width;
+		entry.m_height = tex.m_height;
+		entry.m_numMips = tex.m_numMips;
+		entry.m_bytesPerPixel = tex.m_bytesPerPixel;
+		entry.m_format = uint32_t(tex.m_format);
+		memcpy(entry.m_mipOffsets, tex.m_mipOffsets, sizeof(entry.m_mipOffsets));
+
+		// Paged textures keep their texels in the page file.
+		entry.m_texelBytes = tex.m_paged ? 0 : tex.TexelBytes();
+		entry.m_texelOffset = offset;
+		offset = AlignCacheOffset(offset + entry.m_texelBytes);
+	}
+
+	header.m_fileSize = offset;
+
+	FILE* file = fopen(_binPath, "wb");
+	if (!file)
+	{
+		KT_LOG_ERROR("Failed to write obj cache file %s.", _binPath);
+		return false;
+	}
+
+	bool ok = WriteCacheBlob(file, &header, sizeof(header))
+		&& WriteCacheBlob(file, meshes.Data(), sizeof(CacheMesh) * uint64_t(meshes.Size()))
+		&& WriteCacheBlob(file, materials.Data(), sizeof(CacheMaterial) * uint64_t(materials.Size()))
+		&& WriteCacheBlob(file, _model.m_bvh.Nodes(), sizeof(BvhNode) * uint64_t(header.m_numBvhNodes));
+
+	for (uint32_t i = 0; ok && i < header.m_numMeshes; ++i)
+	{
+		Mesh const& mesh = _model.m_meshes[i];
+		ok = WriteCacheBlob(file, mesh.Indices(), meshes[i].m_indexDataBytes)
+			&& WriteCacheBlob(file, mesh.VertexData(), mesh.VertexStride() * uint64_t(meshes[i].m_numVertices))
+			&& WriteCacheBlob(file, mesh.Meshlets(), sizeof(Meshlet) * uint64_t(meshes[i].m_numMeshlets));
+	}
+
+	for (uint32_t i = 0; ok && i < header.m_numMaterials; ++i)
+	{
+		ok = WriteCacheBlob(file, _model.m_materials[i].m_diffuse.Texels(), materials[i].m_texelBytes);
+	}
+
+	fclose(file);
+
+	if (!ok)
+	{
+		KT_LOG_ERROR("Failed to write obj cache file %s.", _binPath);
+		remove(_binPath);
+	}
+
+	return ok;
+}
+
+static bool CacheRangeValid(uint64_t _fileSize, uint64_t _offset, uint64_t _size)
+{
+	return (_offset % c_cacheAlignment) == 0 && _offset <= _fileSize && _size <= _fileSize - _offset;
+}
+
+// The renderer fetches vertices by index without checks.
+static bool CacheIndicesValid(uint8_t const* _indices, IndexType _type, uint32_t _numIndices, uint32_t _numVertices)
+{
+	uint32_t maxIndex = 0;
+
+	if (_type == IndexType::u16)
+	{
+		uint16_t const* indices = (uint16_t const*)_indices;
+		for (uint32_t i = 0; i < _numIndices; ++i)
+		{
+			maxIndex = kt::Max<uint32_t>(maxIndex, indices[i]);
+		}
+	}
+	else
+	{
+		uint32_t const* indices = (uint32_t const*)_indices;
+		for (uint32_t i = 0; i < _numIndices; ++i)
+		{
+			maxIndex = kt::Max(maxIndex, indices[i]);
+		}
+	}
+
+	return !_numIndices || maxIndex < _numVertices;
+}
+
+// Map the cache and point _model's meshes and textures into it. Returns false (leaving _model empty) if it is missing, stale or malformed.
+static bool LoadCache(Model& _model, char const* _binPath, uint32_t const _flags)
+{
+	if (!_model.m_cacheFile.Open(_binPath))
+	{
+		return false;
+	}
+
+	uint8_t const* base = _model.m_cacheFile.Data();
+	uint64_t const fileSize = _model.m_cacheFile.Size();
+
+	CacheHeader const* header = (CacheHeader const*)base;
+
+	bool const headerValid = fileSize >= sizeof(CacheHeader)
+		&& header->m_magic == c_cacheMagic
+		&& header->m_version == c_cacheVersion
+		&& header->m_flags == _flags
+		&& header->m_fileSize == fileSize
+		&& CacheRangeValid(fileSize, header->m_meshTableOffset, sizeof(CacheMesh) * uint64_t(header->m_numMeshes))
+		&& CacheRangeValid(fileSize, header->m_materialTableOffset, sizeof(CacheMaterial) * uint64_t(header->m_numMaterials))
+		&& CacheRangeValid(fileSize, header->m_bvhOffset, sizeof(BvhNode) * uint64_t(header->m_numBvhNodes));
+
+	if (!headerValid)
+	{
+		KT_LOG_INFO("OBJ cache %s is stale, rebuilding.", _binPath);
+		_model.m_cacheFile.Close();
+		return false;
+	}
+
+	CacheMesh const* meshes = (CacheMesh const*)(base + header->m_meshTableOffset);
+	CacheMaterial const* materials = (CacheMaterial const*)(base + header->m_materialTableOffset);
+
+	_model.m_meshes.Resize(header->m_numMeshes);
+
+	for (uint32_t i = 0; i < header->m_numMeshes; ++i)
+	{
+		CacheMesh const& entry = meshes[i];
+		uint32_t const indexBytes = uint32_t(entry.m_indexType == uint32_t(IndexType::u16) ? sizeof(uint16_t) : sizeof(uint32_t));
+		uint32_t const vertexStride = uint32_t(entry.m_quantized ? sizeof(QuantizedVertex) : sizeof(Vertex));
+
+		bool lodsValid = entry.m_numLods >= 1 && entry.m_numLods <= Mesh::c_maxLods;
+		for (uint32_t lod = 0; lodsValid && lod < entry.m_numLods; ++lod)
+		{
+			lodsValid = uint64_t(entry.m_lodFirstIndex[lod]) + entry.m_lodNumIndices[lod] <= entry.m_numIndices
+				&& uint64_t(entry.m_lodFirstMeshlet[lod]) + entry.m_lodNumMeshlets[lod] <= entry.m_numMeshlets;
+		}
+
+		bool const meshletsValid = CacheRangeValid(fileSize, entry.m_meshletDataOffset, sizeof(Meshlet) * uint64_t(entry.m_numMeshlets));
+
+		// The renderer trusts meshlet triangle ranges, so check them against their LOD.
+		for (uint32_t lod = 0; meshletsValid && lodsValid && lod < entry.m_numLods; ++lod)
+		{
+			Meshlet const* lodMeshlets = (Meshlet const*)(base + entry.m_meshletDataOffset) + entry.m_lodFirstMeshlet[lod];
+			for (uint32_t meshletIdx = 0; lodsValid && meshletIdx < entry.m_lodNumMeshlets[lod]; ++meshletIdx)
+			{
+				lodsValid = (uint64_t(lodMeshlets[meshletIdx].m_firstTri) + lodMeshlets[meshletIdx].m_numTris) * 3 <= entry.m_lodNumIndices[lod];
+			}
+		}
+
+		if (entry.m_indexType > uint32_t(IndexType::u32)
+			|| entry.m_quantized > 1
+			|| !lodsValid
+			|| !meshletsValid
+			|| uint64_t(entry.m_numIndices) * indexBytes != entry.m_indexDataBytes
+			|| !CacheRangeValid(fileSize, entry.m_indexDataOffset, entry.m_indexDataBytes)
+			|| !CacheRangeValid(fileSize, entry.m_vertexDataOffset, vertexStride * uint64_t(entry.m_numVertices))
+			|| !CacheIndicesValid(base + entry.m_indexDataOffset, IndexType(entry.m_indexType), entry.m_numIndices, entry.m_numVertices))
+		{
+			KT_LOG_ERROR("OBJ cache %s is corrupt, rebuilding.", _binPath);
+			_model.Clear();
+			return false;
+		}
+
+		Mesh& mesh = _model.m_meshes[i];
+		mesh.m_indexType = IndexType(entry.m_indexType);
+		mesh.m_numIndices = entry.m_numIndices;
+		mesh.m_numVertices = entry.m_numVertices;
+		mesh.m_matIdx = entry.m_matIdx;
+		mesh.m_mappedIndices = base + entry.m_indexDataOffset;
+		mesh.m_quantized = entry.m_quantized != 0;
+		mesh.m_posScale = kt::Vec3(entry.m_posScale[0], entry.m_posScale[1], entry.m_posScale[2]);
+		mesh.m_posOffset = kt::Vec3(entry.m_posOffset[0], entry.m_posOffset[1], entry.m_posOffset[2]);
+		mesh.m_boundsCenter = kt::Vec3(entry.m_boundsCenter[0], entry.m_boundsCenter[1], entry.m_boundsCenter[2]);
+		mesh.m_boundsExtents = kt::Vec3(entry.m_boundsExtents[0], entry.m_boundsExtents[1], entry.m_boundsExtents[2]);
+		mesh.m_boundsRadius = entry.m_boundsRadius;
+
+		mesh.m_numLods = entry.m_numLods;
+		for (uint32_t lod = 0; lod < entry.m_numLods; ++lod)
+		{
+			mesh.m_lods[lod].m_firstIndex = entry.m_lodFirstIndex[lod];
+			mesh.m_lods[lod].m_numIndices = entry.m_lodNumIndices[lod];
+			mesh.m_lods[lod].m_error = entry.m_lodError[lod];
+			mesh.m_lods[lod].m_firstMeshlet = entry.m_lodFirstMeshlet[lod];
+			mesh.m_lods[lod].m_numMeshlets = entry.m_lodNumMeshlets[lod];
+		}
+
+		mesh.m_numMeshlets = entry.m_numMeshlets;
+		mesh.m_mappedMeshlets = entry.m_numMeshlets ? (Meshlet const*)(base + entry.m_meshletDataOffset) : nullptr;
+
+		if (mesh.m_quantized)
+		{
+			mesh.m_mappedQuantizedVertices = (QuantizedVertex const*)(base + entry.m_vertexDataOffset);
+		}
+		else
+		{
+			mesh.m_mappedVertices = (Vertex const*)(base + entry.m_vertexDataOffset);
+		}
+	}
+
+	_model.m_materials.Resize(header->m_numMaterials);
+
+	for (uint32_t i = 0; i < header->m_numMaterials; ++i)
+	{
+		CacheMaterial const& entry = materials[i];
+
+		if (!CacheRangeValid(fileSize, entry.m_texelOffset, entry.m_texelBytes))
+		{
+			KT_LOG_ERROR("OBJ cache %s is corrupt, rebuilding.", _binPath);
+			_model.Clear();
+			return false;
+		}
+
+		Material& mat = _model.m_materials[i];
+
+		char name[sizeof(entry.m_name)];
+		memcpy(name, entry.m_name, sizeof(name));
+		name[sizeof(name) - 1] = '\0';
+		mat.m_name = name;
+
+		mat.m_diffusePageFileOffset = entry.m_pageFileOffset;
+
+		Tex::TextureData& tex = mat.m_diffuse;
+		tex.m_width = entry.m_width;
+		tex.m_height = entry.m_height;
+		tex.m_numMips = entry.m_numMips;
+		tex.m_bytesPerPixel = entry.m_bytesPerPixel;
+		tex.m_format = TextureFormat(entry.m_format);
+		memcpy(tex.m_mipOffsets, entry.m_mipOffsets, sizeof(tex.m_mipOffsets));
+
+		if (!Tex::TextureLayoutValid(tex, entry.m_texelBytes))
+		{
+			KT_LOG_ERROR("OBJ cache %s is corrupt, rebuilding.", _binPath);
+			_model.Clear();
+			return false;
+		}
+
+		if (entry.m_texelBytes)
+		{
+			tex.SetExternalTexels(base + entry.m_texelOffset, entry.m_texelBytes);
+		}
+	}
+
+	BvhNode const* bvhNodes = (BvhNode const*)(base + header->m_bvhOffset);
+
+	// Traversal follows child indices without checks.
+	for (uint32_t nodeIdx = 0; nodeIdx < header->m_numBvhNodes; ++nodeIdx)
+	{
+		for (uint32_t child : bvhNodes[nodeIdx].m_children)
+		{
+			bool const valid = child == BvhNode::c_empty
+				|| ((child & BvhNode::c_leafBit) ? (child & ~BvhNode::c_leafBit) < header->m_numMeshes : (child > nodeIdx && child < header->m_numBvhNodes));
+
+			if (!valid)
+			{
+				KT_LOG_ERROR("OBJ cache %s is corrupt, rebuilding.", _binPath);
+				_model.Clear();
+				return false;
+			}
+		}
+	}
+
+	_model.m_bvh.m_mappedNodes = header->m_numBvhNodes ? bvhNodes : nullptr;
+	_model.m_bvh.m_numNodes = header->m_numBvhNodes;
+
+	KT_LOG_INFO("Mapped OBJ cache %s", _binPath);
+	return true;
+}
+
+Model::~Model()
+{
+	for (Mesh& m : m_meshes)
+	{
+		m.Clear();
+	}
+
+	for (Material& mat : m_materials)
+	{
+		mat.m_diffuse.Clear();
+	}
+}
+
+static void BuildMeshBvh(Model& _model)
+{
+	kt::Array<kt::Vec3> centers;
+	kt::Array<kt::Vec3> extents;
+	centers.Resize(_model.m_meshes.Size());
+	extents.Resize(_model.m_meshes.Size());
+
+	for (uint32_t i = 0; i < _model.m_meshes.Size(); ++i)
+	{
+		centers[i] = _model.m_meshes[i].m_boundsCenter;
+		extents[i] = DecodedBoundsExtents(_model.m_meshes[i]);
+	}
+
+	_model.m_bvh.Build(centers.Data(), extents.Data(), _model.m_meshes.Size());
+}
+
+void Model::CullMeshes(kt::Mat4 const& _viewProj, bool _frontToBack, BvhCullScratch& _scratch, kt::Array<uint32_t>& o_visible) const
+{
+	if (m_bvh.m_numNodes)
+	{
+		m_bvh.Cull(_viewProj, _frontToBack, _scratch, o_visible);
+		return;
+	}
+
+	o_visible.Resize(m_meshes.Size());
+	for (uint32_t i = 0; i < m_meshes.Size(); ++i)
+	{
+		o_visible[i] = i;
+	}
+}
+
+bool Model::Load(char const* _path, kt::IAllocator* _tempAllocator, uint32_t const _flags, TaskSystem* _taskSystem /*= nullptr*/)
+{
+	kt::String1024 binpath;
+	binpath.AppendFmt("%s.bin", _path);
+	
+	if (kt::FileExists(binpath.Data()))
+	{
+		Clear();
+
+		if (LoadCache(*this, binpath.Data(), _flags))
+		{
+			if (_flags & LoadFlags::VirtualTextures)
+			{
+				InitVirtualTextures(*this, _path);
+			}
+			return true;
+		}
+	}
+
+	KT_LOG_INFO("No cache found, parsing obj %s.", _path);
+
+	Clear();
+
+	if (!ParseObj(*this, _path, _tempAllocator, _flags, _taskSystem))
+	{
+		Clear();
+		return false;
+	}
+
+	if (_flags & LoadFlags::BuildBvh)
+	{
+		BuildMeshBvh(*this);
+	}
+
+	// Texels of paged textures live in a separate page file rather than the cache.
+	bool const pagedTextures = (_flags & LoadFlags::VirtualTextures) && WriteTexturePages(*this, _path);
+
+	WriteCache(*this, binpath.Data(), _flags);
+
+	if (pagedTextures)
+	{
+		InitVirtualTextures(*this, _path);
+	}
+
+	return true;
+}
+
+void Model::Clear()
+{
+	m_virtualTextures.Shutdown();
+	m_bvh.Clear();
+
+	for (Mesh& m : m_meshes)
+	{
+		m.Clear();
+	}
+	m_meshes.Clear();
+
+	for (Material& mat : m_materials)
+	{
+		mat.m_diffuse.Clear();
+	}
+	m_materials.Clear();
+
+	m_cacheFile.Close();
+}
+
+void Mesh::Clear()
+{
+	m_vertexData.ClearAndFree();
+	m_quantizedVertexData.ClearAndFree();
+	m_indexData.ClearAndFree();
+	m_meshletData.ClearAndFree();
+	m_numVertices = 0;
+	m_numIndices = 0;
+	m_numLods = 0;
+	m_numMeshlets = 0;
+	m_boundsCenter = kt::Vec3(0.0f);
+	m_boundsExtents = kt::Vec3(0.0f);
+	m_boundsRadius = 0.0f;
+	m_quantized = false;
+	m_posScale = kt::Vec3(1.0f);
+	m_posOffset = kt::Vec3(0.0f);
+	m_mappedIndices = nullptr;
+	m_mappedVertices = nullptr;
+	m_mappedQuantizedVertices = nullptr;
+	m_mappedMeshlets = nullptr;
+}
+
+void Mesh::BindBuffers(DrawCall& _call, uint32_t _lod) const
+{
+	KT_ASSERT(_lod < m_numLods);
+	uint32_t const indexStride = m_indexType == IndexType::u16 ? sizeof(uint16_t) : sizeof(uint32_t);
+	_call.SetIndexBuffer((uint8_t const*)Indices() + m_lods[_lod].m_firstIndex * indexStride, indexStride, m_lods[_lod].m_numIndices);
+
+	kt::Vec3 const extents = DecodedBoundsExtents(*this);
+	_call.SetBoundingBox(m_boundsCenter - extents, m_boundsCenter + extents);
+
+	if (m_lods[_lod].m_numMeshlets)
+	{
+		_call.SetMeshlets(Meshlets() + m_lods[_lod].m_firstMeshlet, m_lods[_lod].m_numMeshlets);
+	}
+
+	if (!m_quantized)
+	{
+		_call.SetPositionBuffer(Vertices(), sizeof(Vertex), m_numVertices);
+		_call.SetAttributeBuffer(Vertices(), sizeof(Vertex), m_numVertices, offsetof(Vertex, uv) / sizeof(float));
+		return;
+	}
+
+	uint32_t uvVarying = 0;
+	VertexLayout layout;
+	layout.Add(AttributeFormat::Unorm16x3, offsetof(QuantizedVertex, pos))
+		.Add(AttributeFormat::OctSnorm16x2, offsetof(QuantizedVertex, norm))
+		.Add(AttributeFormat::Half2, offsetof(QuantizedVertex, uv), &uvVarying);
+
+	_call.SetPositionBuffer(QuantizedVertices(), sizeof(QuantizedVertex), m_numVertices, PositionFormat::Unorm16x3);
+	_call.SetPositionQuantization(m_posScale, m_posOffset);
+	_call.SetAttributeBuffer(QuantizedVertices(), sizeof(QuantizedVertex), m_numVertices, uvVarying);
+	_call.SetAttributeLayout(layout);
+}
+
+uint32_t Mesh::SelectLod(kt::Mat4 const& _viewProj, float _viewportHeight, float _maxErrorPixels) const
+{
+	if (m_numLods <= 1)
+	{
+		return 0;
+	}
+
+	// Clip w is view depth, so the nearest point of the sphere is at w - radius.
+	kt::Vec4 const center = _viewProj * kt::Vec4(m_boundsCenter, 1.0f);
+	float const nearestDepth = center.w - m_boundsRadius;
+
+	if (nearestDepth <= 0.0f)
+	{
+		return 0;
+	}
+
+	// Clip space y per unit of length, the projection's y scale whatever the view rotation.
+	float const yx = (_viewProj * kt::Vec4(1.0f, 0.0f, 0.0f, 0.0f)).y;
+	float const yy = (_viewProj * kt::Vec4(0.0f, 1.0f, 0.0f, 0.0f)).y;
+	float const yz = (_viewProj * kt::Vec4(0.0f, 0.0f, 1.0f, 0.0f)).y;
+	float const yScale = sqrtf(yx * yx + yy * yy + yz * yz);
+
+	float const projectedRadiusPixels = m_boundsRadius * yScale / nearestDepth * _viewportHeight * 0.5f;
+
+	for (uint32_t lod = m_numLods - 1; lod > 0; --lod)
+	{
+		if (m_lods[lod].m_error * projectedRadiusPixels <= _maxErrorPixels)
+		{
+			return lod;
+		}
+	}
+
+	return 0;
 }
 
 }
@@ -2,13 +2,18 @@
 #include <stdint.h>
 #include <kt/Array.h>
 #include <kt/Strings.h>
+#include <kt/Mat4.h>
 
 #include "SoftRastTypes.h"
 #include "Texture.h"
+#include "VirtualTexture.h"
+#include "SceneBvh.h"
+#include "Platform/MappedFile.h"
 
 namespace sr
 {
 
+struct DrawCall;
 
 namespace Obj
 {
@@ -21,6 +26,15 @@ struct Vertex
 };
 
 
+// 16 byte vertex, written instead of Vertex with LoadFlags::QuantizeVertices.
+struct QuantizedVertex
+{
+	uint16_t pos[3]; // Unorm, dequantized with Mesh::m_posScale and Mesh::m_posOffset.
+	int16_t norm[2]; // Octahedral snorm.
+	uint16_t uv[2]; // Half.
+	uint16_t pad;
+};
+
 struct Mesh
 {
 	KT_NO_COPY(Mesh);
@@ -31,12 +45,65 @@ struct Mesh
 
 	void Clear();
 
+	// Either the owned arrays or, if loaded from the cache, pointers into the mapped cache file.
+	Vertex const* Vertices() const { return m_mappedVertices ? m_mappedVertices : m_vertexData.Data(); }
+	QuantizedVertex const* QuantizedVertices() const { return m_mappedQuantizedVertices ? m_mappedQuantizedVertices : m_quantizedVertexData.Data(); }
+	void const* Indices() const { return m_mappedIndices ? m_mappedIndices : m_indexData.Data(); }
+	Meshlet const* Meshlets() const { return m_mappedMeshlets ? m_mappedMeshlets : m_meshletData.Data(); }
+
+	// Vertices() or QuantizedVertices().
+	void const* VertexData() const { return m_quantized ? (void const*)QuantizedVertices() : (void const*)Vertices(); }
+	uint32_t VertexStride() const { return m_quantized ? sizeof(QuantizedVertex) : sizeof(Vertex); }
+
+	// Set the index, position and attribute buffers and bounds of _call, and the LOD's meshlets if there are any. Either way the attributes decode to the 8 varyings of Vertex.
+	void BindBuffers(DrawCall& _call, uint32_t _lod = 0) const;
+
+	// Coarsest LOD whose simplification error projects to at most _maxErrorPixels, from the projected size of the bounding sphere.
+	uint32_t SelectLod(kt::Mat4 const& _viewProj, float _viewportHeight, float _maxErrorPixels = 1.0f) const;
+
+	struct Lod
+	{
+		uint32_t m_firstIndex = 0;
+		uint32_t m_numIndices = 0;
+		float m_error = 0.0f; // Relative to m_boundsRadius.
+
+		// Meshlet triangles are relative to m_firstIndex.
+		uint32_t m_firstMeshlet = 0;
+		uint32_t m_numMeshlets = 0;
+	};
+
+	static uint32_t const c_maxLods = 4;
+
 	kt::Array<uint8_t> m_indexData;
 
 	IndexType m_indexType = IndexType::u16;
-	uint32_t m_numIndices = 0;
+	uint32_t m_numIndices = 0; // Of every LOD.
+
+	// All LODs index the same vertices, LOD 0 is the full mesh.
+	Lod m_lods[c_maxLods];
+	uint32_t m_numLods = 0;
+
+	// Bounding box half size and bounding sphere radius, both around m_boundsCenter.
+	kt::Vec3 m_boundsCenter = kt::Vec3(0.0f);
+	kt::Vec3 m_boundsExtents = kt::Vec3(0.0f);
+	float m_boundsRadius = 0.0f;
+
+	// Of every LOD.
+	kt::Array<Meshlet> m_meshletData;
+	uint32_t m_numMeshlets = 0;
 
 	kt::Array<Vertex> m_vertexData;
+	uint32_t m_numVertices = 0;
+
+	kt::Array<QuantizedVertex> m_quantizedVertexData;
+	kt::Vec3 m_posScale = kt::Vec3(1.0f);
+	kt::Vec3 m_posOffset = kt::Vec3(0.0f);
+	bool m_quantized = false;
+
+	void const* m_mappedIndices = nullptr;
+	Vertex const* m_mappedVertices = nullptr;
+	QuantizedVertex const* m_mappedQuantizedVertices = nullptr;
+	Meshlet const* m_mappedMeshlets = nullptr;
 
 	uint32_t m_matIdx = 0;
 };
@@ -49,6 +116,9 @@ struct Material
 
 	kt::String128 m_name;
 	Tex::TextureData m_diffuse;
+
+	// Location of the diffuse texels in the page file, if loaded with LoadFlags::VirtualTextures.
+	uint64_t m_diffusePageFileOffset = 0;
 };
 
 enum LoadFlags : uint32_t
@@ -56,34 +126,42 @@ enum LoadFlags : uint32_t
 	None = 0x0,
 	FlipWinding = 0x1,
 	GenNormals = 0x2, // todo
-	FlipUVs = 0x4
+	FlipUVs = 0x4,
+	CompressTextures = 0x8, // Store diffuse textures as BC1/BC3.
+	VirtualTextures = 0x10, // Page diffuse textures in on demand from <path>.pages, call m_virtualTextures.Update() once per frame with no frame in flight (RenderContext::Flush).
+	OptimizeMeshes = 0x20, // Reorder indices and vertices for vertex cache, overdraw and fetch locality. Done once, the result is cached.
+	QuantizeVertices = 0x40, // Store QuantizedVertex (16 bytes) instead of Vertex (32 bytes), decoded by the front end.
+	GenerateLods = 0x80, // Simplify each mesh into up to Mesh::c_maxLods LODs, pick one per draw with Mesh::SelectLod.
+	BuildMeshlets = 0x100, // Split each LOD into meshlets of up to 64 triangles, culled as a whole before binning.
+	BuildBvh = 0x200 // Build Model::m_bvh over the mesh bounds, used by Model::CullMeshes.
 };
 
 struct Model
 {
 	~Model();
 
-	bool Load(char const* _path, kt::IAllocator* _tempAllocator, uint32_t const _flags);
+	// Builds <path>.bin on first load, which is mapped and used in place after that.
+	bool Load(char const* _path, kt::IAllocator* _tempAllocator, uint32_t const _flags, TaskSystem* _taskSystem = nullptr);
 	void Clear();
 
+	// Replace o_visible with the indices of the meshes intersecting the frustum of _viewProj, front to back by their bounds if _frontToBack.
+	// Without a BVH (no LoadFlags::BuildBvh) every mesh is visible, in order. _scratch is reused between calls to avoid allocating.
+	void CullMeshes(kt::Mat4 const& _viewProj, bool _frontToBack, BvhCullScratch& _scratch, kt::Array<uint32_t>& o_visible) const;
+
+	// Declared first so it outlives the meshes and textures pointing into it.
+	MappedFile m_cacheFile;
+
 	kt::Array<Mesh> m_meshes;
 	kt::Array<Material> m_materials;
-};
 
-}
+	// Items are mesh indices.
+	SceneBvh m_bvh;
 
+	// Declared after m_materials so it is shut down before the textures it references.
+	Tex::VirtualTextureCache m_virtualTextures;
+};
 
 }
 
-namespace kt
-{
-
-template<>
-void Serialize(ISerializer* _s, sr::Obj::Model& _model);
-
-template<>
-void Serialize(ISerializer* _s, sr::Obj::Mesh& _mesh);
 
-template<>
-void Serialize(ISerializer* _s, sr::Obj::Material& _mat);
-}
\ No newline at end of file
+}
@@ -0,0 +1,125 @@
+#include "MappedFile.h"
+#include <kt/Logging.h>
+
+#if defined(_WIN32)
+	#define WIN32_LEAN_AND_MEAN
+	#include <Windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace sr
+{
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(char const* _path)
+{
+	Close();
+
+	HANDLE const file = CreateFileA(_path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		KT_LOG_ERROR("Failed to open %s for mapping.", _path);
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+	{
+		CloseHandle(file);
+		return false;
+	}
+
+	HANDLE const mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	void const* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if (!data)
+	{
+		KT_LOG_ERROR("Failed to map %s.", _path);
+		if (mapping)
+		{
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+		return false;
+	}
+
+	m_file = file;
+	m_mapping = mapping;
+	m_data = (uint8_t const*)data;
+	m_size = uint64_t(size.QuadPart);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data)
+	{
+		UnmapViewOfFile(m_data);
+		CloseHandle(m_mapping);
+		CloseHandle(m_file);
+	}
+
+	m_data = nullptr;
+	m_size = 0;
+	m_file = nullptr;
+	m_mapping = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(char const* _path)
+{
+	Close();
+
+	int const fd = open(_path, O_RDONLY);
+	if (fd < 0)
+	{
+		KT_LOG_ERROR("Failed to open %s for mapping.", _path);
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	// The mapping keeps its own reference to the file.
+	void* data = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+	{
+		KT_LOG_ERROR("Failed to map %s.", _path);
+		return false;
+	}
+
+	m_data = (uint8_t const*)data;
+	m_size = uint64_t(st.st_size);
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_data)
+	{
+		munmap((void*)m_data, size_t(m_size));
+	}
+
+	m_data = nullptr;
+	m_size = 0;
+}
+
+#endif
+
+}
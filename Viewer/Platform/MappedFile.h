@@ -0,0 +1,36 @@
+#pragma once
+#include <stdint.h>
+#include <kt/kt.h>
+
+namespace sr
+{
+
+// Read only mapping of a whole file. Pages are faulted in on first access and shared between processes mapping the same file.
+class MappedFile
+{
+public:
+	KT_NO_COPY(MappedFile);
+
+	MappedFile() = default;
+	~MappedFile();
+
+	bool Open(char const* _path);
+	void Close();
+
+	bool IsOpen() const { return m_data != nullptr; }
+
+	// Page aligned.
+	uint8_t const* Data() const { return m_data; }
+	uint64_t Size() const { return m_size; }
+
+private:
+	uint8_t const* m_data = nullptr;
+	uint64_t m_size = 0;
+
+#if defined(_WIN32)
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
+
+}
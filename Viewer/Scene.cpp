@@ -6,9 +6,9 @@
 namespace sr
 {
 
-SimpleModelScene::SimpleModelScene(char const* _modelPath, uint32_t _loadFlags)
+SimpleModelScene::SimpleModelScene(char const* _modelPath, uint32_t _loadFlags, TaskSystem* _taskSystem)
 {
-	m_model.Load(_modelPath, kt::GetDefaultAllocator(), _loadFlags);
+	m_model.Load(_modelPath, kt::GetDefaultAllocator(), _loadFlags, _taskSystem);
 }
 
 void SimpleModelScene::Init(uint32_t _screenHeight, uint32_t _screenWidth)
@@ -31,24 +31,28 @@ void SimpleModelScene::Init(uint32_t _screenHeight, uint32_t _screenWidth)
 
 void SimpleModelScene::Update(RenderContext& _ctx, FrameBuffer& _fb, float _dt)
 {
+	// Pages Update maps or evicts may still be sampled by the frame in flight in FrameMode::Pipelined.
+	if (m_model.m_virtualTextures.IsInitialized())
+	{
+		_ctx.Flush();
+		m_model.m_virtualTextures.Update();
+	}
+
 	m_camController.UpdateViewGamepad(_dt);
 	_ctx.ClearFrameBuffer(_fb, 0);
 
-	for (sr::Obj::Mesh const& mesh : m_model.m_meshes)
+	kt::Mat4 const viewProj = m_camController.GetCam().GetCachedViewProj();
+	m_model.CullMeshes(viewProj, true, m_cullScratch, m_visibleMeshes);
+
+	for (uint32_t meshIdx : m_visibleMeshes)
 	{
+		sr::Obj::Mesh const& mesh = m_model.m_meshes[meshIdx];
+
 		sr::DrawCall call;
 		call.SetFrameBuffer(&_fb);
-		call.m_mvp = m_camController.GetCam().GetCachedViewProj();
-
-		call.SetAttributeBuffer(mesh.m_vertexData.Data(), sizeof(sr::Obj::Vertex), mesh.m_vertexData.Size(), offsetof(sr::Obj::Vertex, uv) / sizeof(float));
-
-		call.m_positionBuffer.m_ptr = (uint8_t*)mesh.m_vertexData.Data();
-		call.m_positionBuffer.m_stride = sizeof(sr::Obj::Vertex);
-		call.m_positionBuffer.m_num = mesh.m_vertexData.Size();
+		call.m_mvp = viewProj;
 
-		call.m_indexBuffer.m_ptr = mesh.m_indexData.Data();
-		call.m_indexBuffer.m_num = mesh.m_numIndices;
-		call.m_indexBuffer.m_stride = mesh.m_indexType == sr::IndexType::u16 ? sizeof(uint16_t) : sizeof(uint32_t);
+		mesh.BindBuffers(call, mesh.SelectLod(call.m_mvp, float(_fb.WritePlane()->m_height)));
 
 		if (mesh.m_matIdx < m_model.m_materials.Size())
 		{
@@ -5,6 +5,7 @@
 namespace sr
 {
 class RenderContext;
+class TaskSystem;
 struct FrameBuffer;
 
 struct Scene
@@ -17,13 +18,16 @@ struct Scene
 
 struct SimpleModelScene : Scene
 {
-	SimpleModelScene(char const* _modelPath, uint32_t _loadFlags);
+	SimpleModelScene(char const* _modelPath, uint32_t _loadFlags, TaskSystem* _taskSystem = nullptr);
 
 	void Init(uint32_t _screenHeight, uint32_t _screenWidth) override;
 	void Update(RenderContext& _ctx, FrameBuffer& _fb, float _dt) override;
 
 	sr::Obj::Model m_model;
 	FreeCamController m_camController;
+
+	kt::Array<uint32_t> m_visibleMeshes;
+	BvhCullScratch m_cullScratch;
 };
 
 }
\ No newline at end of file
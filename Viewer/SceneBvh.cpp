@@ -0,0 +1,321 @@
+#include "SceneBvh.h"
+
+#include <string.h>
+#include <float.h>
+#include <immintrin.h>
+
+#include <kt/Sort.h>
+
+namespace sr
+{
+
+// Traversal stack entries, set if every plane test already passed for the node's whole box.
+static uint32_t const c_bvhInsideBit = 0x80000000;
+static uint32_t const c_bvhMinStack = 256;
+
+static uint32_t FloatToSortableUint(float _f)
+{
+	uint32_t u;
+	memcpy(&u, &_f, sizeof(u));
+	return u ^ ((u & 0x80000000) ? 0xFFFFFFFF : 0x80000000);
+}
+
+struct BvhBuilder
+{
+	kt::Vec3 const* m_centers;
+	kt::Vec3 const* m_extents;
+
+	kt::Array<uint32_t> m_items;
+	kt::Array<uint32_t> m_sortTemp;
+	kt::Array<BvhNode>* m_nodes;
+
+	void Bounds(uint32_t _begin, uint32_t _end, float (&o_min)[3], float (&o_max)[3], bool _centroids) const
+	{
+		for (uint32_t axis = 0; axis < 3; ++axis)
+		{
+			o_min[axis] = FLT_MAX;
+			o_max[axis] = -FLT_MAX;
+		}
+
+		for (uint32_t i = _begin; i < _end; ++i)
+		{
+			float const* center = &m_centers[m_items[i]].x;
+			float const* extents = &m_extents[m_items[i]].x;
+
+			for (uint32_t axis = 0; axis < 3; ++axis)
+			{
+				float const e = _centroids ? 0.0f : extents[axis];
+				o_min[axis] = kt::Min(o_min[axis], center[axis] - e);
+				o_max[axis] = kt::Max(o_max[axis], center[axis] + e);
+			}
+		}
+	}
+
+	// Split [_begin, _end) at the median centroid along the axis the centroids spread furthest on.
+	uint32_t SplitMedian(uint32_t _begin, uint32_t _end)
+	{
+		float centroidMin[3], centroidMax[3];
+		Bounds(_begin, _end, centroidMin, centroidMax, true);
+
+		uint32_t axis = 0;
+		for (uint32_t i = 1; i < 3; ++i)
+		{
+			if (centroidMax[i] - centroidMin[i] > centroidMax[axis] - centroidMin[axis])
+			{
+				axis = i;
+			}
+		}
+
+		kt::Vec3 const* centers = m_centers;
+		kt::RadixSort(m_items.Data() + _begin, m_items.Data() + _end, m_sortTemp.Data(), [centers, axis](uint32_t _item) { return FloatToSortableUint((&centers[_item].x)[axis]); });
+		return _begin + (_end - _begin) / 2;
+	}
+
+	uint32_t BuildNode(uint32_t _begin, uint32_t _end)
+	{
+		uint32_t const nodeIdx = m_nodes->Size();
+		KT_ASSERT(nodeIdx < c_bvhInsideBit);
+		memset(&m_nodes->PushBack(), 0, sizeof(BvhNode));
+
+		// Binary median splits of the largest range until there is one range per child.
+		uint32_t ranges[8][2] = { { _begin, _end } };
+		uint32_t numRanges = 1;
+
+		while (numRanges < 8)
+		{
+			uint32_t largest = 0;
+			for (uint32_t i = 1; i < numRanges; ++i)
+			{
+				if (ranges[i][1] - ranges[i][0] > ranges[largest][1] - ranges[largest][0])
+				{
+					largest = i;
+				}
+			}
+
+			if (ranges[largest][1] - ranges[largest][0] <= 1)
+			{
+				break;
+			}
+
+			uint32_t const mid = SplitMedian(ranges[largest][0], ranges[largest][1]);
+			ranges[numRanges][0] = mid;
+			ranges[numRanges][1] = ranges[largest][1];
+			ranges[largest][1] = mid;
+			++numRanges;
+		}
+
+		uint32_t children[8];
+
+		for (uint32_t child = 0; child < 8; ++child)
+		{
+			if (child >= numRanges)
+			{
+				children[child] = BvhNode::c_empty;
+				continue;
+			}
+
+			uint32_t const begin = ranges[child][0];
+			uint32_t const end = ranges[child][1];
+			children[child] = end - begin == 1 ? (BvhNode::c_leafBit | m_items[begin]) : BuildNode(begin, end);
+		}
+
+		// Children may have grown the array, so only take the reference now.
+		BvhNode& node = (*m_nodes)[nodeIdx];
+
+		for (uint32_t child = 0; child < 8; ++child)
+		{
+			node.m_children[child] = children[child];
+
+			if (child >= numRanges)
+			{
+				continue;
+			}
+
+			float boundsMin[3], boundsMax[3];
+			Bounds(ranges[child][0], ranges[child][1], boundsMin, boundsMax, false);
+
+			for (uint32_t axis = 0; axis < 3; ++axis)
+			{
+				node.m_center[axis][child] = (boundsMin[axis] + boundsMax[axis]) * 0.5f;
+				node.m_extents[axis][child] = (boundsMax[axis] - boundsMin[axis]) * 0.5f;
+			}
+		}
+
+		return nodeIdx;
+	}
+};
+
+void SceneBvh::Clear()
+{
+	m_nodeData.ClearAndFree();
+	m_mappedNodes = nullptr;
+	m_numNodes = 0;
+}
+
+void SceneBvh::Build(kt::Vec3 const* _centers, kt::Vec3 const* _extents, uint32_t _num)
+{
+	Clear();
+
+	if (!_num)
+	{
+		return;
+	}
+
+	KT_ASSERT(_num < BvhNode::c_leafBit);
+
+	BvhBuilder builder;
+	builder.m_centers = _centers;
+	builder.m_extents = _extents;
+	builder.m_nodes = &m_nodeData;
+	builder.m_items.Resize(_num);
+	builder.m_sortTemp.Resize(_num);
+
+	for (uint32_t i = 0; i < _num; ++i)
+	{
+		builder.m_items[i] = i;
+	}
+
+	builder.BuildNode(0, _num);
+	m_numNodes = m_nodeData.Size();
+}
+
+void SceneBvh::Cull(kt::Mat4 const& _viewProj, bool _frontToBack, BvhCullScratch& _scratch, kt::Array<uint32_t>& o_visible) const
+{
+	o_visible.Clear();
+
+	if (!m_numNodes)
+	{
+		return;
+	}
+
+	// rows[i] dotted with (p, 1) is clip component i.
+	float rows[4][4];
+	for (uint32_t col = 0; col < 4; ++col)
+	{
+		kt::Vec4 const c = _viewProj * kt::Vec4(col == 0 ? 1.0f : 0.0f, col == 1 ? 1.0f : 0.0f, col == 2 ? 1.0f : 0.0f, col == 3 ? 1.0f : 0.0f);
+		for (uint32_t i = 0; i < 4; ++i)
+		{
+			rows[i][col] = c[i];
+		}
+	}
+
+	// Unnormalized planes, the box reach |n| . extents scales with them.
+	__m256 planes[6][4];
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		planes[0][i] = _mm256_set1_ps(rows[3][i] + rows[0][i]);
+		planes[1][i] = _mm256_set1_ps(rows[3][i] - rows[0][i]);
+		planes[2][i] = _mm256_set1_ps(rows[3][i] + rows[1][i]);
+		planes[3][i] = _mm256_set1_ps(rows[3][i] - rows[1][i]);
+		planes[4][i] = _mm256_set1_ps(rows[2][i]);
+		planes[5][i] = _mm256_set1_ps(rows[3][i] - rows[2][i]);
+	}
+
+	__m256 const depthRow[4] = { _mm256_set1_ps(rows[3][0]), _mm256_set1_ps(rows[3][1]), _mm256_set1_ps(rows[3][2]), _mm256_set1_ps(rows[3][3]) };
+	__m256 const absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	__m256i const emptyChild = _mm256_set1_epi32(int32_t(BvhNode::c_empty));
+
+	kt::Array<BvhCullScratch::VisibleItem>& visible = _scratch.m_visible;
+	visible.Clear();
+
+	BvhNode const* nodes = Nodes();
+
+	kt::Array<uint32_t>& stack = _scratch.m_stack;
+	if (stack.Size() < c_bvhMinStack)
+	{
+		stack.Resize(c_bvhMinStack);
+	}
+
+	uint32_t stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize)
+	{
+		uint32_t const entry = stack[--stackSize];
+		BvhNode const& node = nodes[entry & ~c_bvhInsideBit];
+
+		__m256 const center[3] = { _mm256_loadu_ps(node.m_center[0]), _mm256_loadu_ps(node.m_center[1]), _mm256_loadu_ps(node.m_center[2]) };
+		__m256i const children = _mm256_loadu_si256((__m256i const*)node.m_children);
+
+		uint32_t visibleMask = ~uint32_t(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(children, emptyChild)))) & 0xFF;
+		uint32_t insideMask = 0xFF;
+
+		if (!(entry & c_bvhInsideBit))
+		{
+			__m256 const extents[3] = { _mm256_loadu_ps(node.m_extents[0]), _mm256_loadu_ps(node.m_extents[1]), _mm256_loadu_ps(node.m_extents[2]) };
+			__m256 outside = _mm256_setzero_ps();
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+			for (__m256 const (&plane)[4] : planes)
+			{
+				__m256 dist = plane[3];
+				__m256 reach = _mm256_setzero_ps();
+
+				for (uint32_t axis = 0; axis < 3; ++axis)
+				{
+					dist = _mm256_fmadd_ps(plane[axis], center[axis], dist);
+					reach = _mm256_fmadd_ps(_mm256_and_ps(plane[axis], absMask), extents[axis], reach);
+				}
+
+				outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(dist, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_sub_ps(dist, reach), _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+
+			visibleMask &= ~uint32_t(_mm256_movemask_ps(outside));
+			insideMask = uint32_t(_mm256_movemask_ps(inside));
+		}
+
+		KT_ALIGNAS(32) float depths[8];
+		if (_frontToBack)
+		{
+			__m256 depth = depthRow[3];
+			for (uint32_t axis = 0; axis < 3; ++axis)
+			{
+				depth = _mm256_fmadd_ps(depthRow[axis], center[axis], depth);
+			}
+			_mm256_store_ps(depths, depth);
+		}
+
+		while (visibleMask)
+		{
+			uint32_t const child = kt::Cnttz(visibleMask);
+			visibleMask &= visibleMask - 1;
+
+			uint32_t const childIdx = node.m_children[child];
+
+			if (childIdx & BvhNode::c_leafBit)
+			{
+				BvhCullScratch::VisibleItem& item = visible.PushBack();
+				item.m_item = childIdx & ~BvhNode::c_leafBit;
+				item.m_depthKey = _frontToBack ? FloatToSortableUint(depths[child]) : 0;
+			}
+			else
+			{
+				if (stackSize == stack.Size())
+				{
+					stack.Resize(stackSize * 2);
+				}
+
+				stack[stackSize++] = childIdx | ((insideMask >> child) & 1 ? c_bvhInsideBit : 0);
+			}
+		}
+	}
+
+	if (_frontToBack && visible.Size())
+	{
+		if (_scratch.m_sortTemp.Size() < visible.Size())
+		{
+			_scratch.m_sortTemp.Resize(visible.Size());
+		}
+
+		kt::RadixSort(visible.Data(), visible.Data() + visible.Size(), _scratch.m_sortTemp.Data(), [](BvhCullScratch::VisibleItem const& _item) { return _item.m_depthKey; });
+	}
+
+	o_visible.Resize(visible.Size());
+	for (uint32_t i = 0; i < visible.Size(); ++i)
+	{
+		o_visible[i] = visible[i].m_item;
+	}
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+
+#include <kt/kt.h>
+#include <kt/Array.h>
+#include <kt/Mat4.h>
+#include <kt/Vec3.h>
+
+namespace sr
+{
+
+// A node of 8 children, stored SoA so all 8 child boxes are tested against a plane at once.
+struct BvhNode
+{
+	static uint32_t const c_leafBit = 0x80000000;
+	static uint32_t const c_empty = 0xFFFFFFFF;
+
+	float m_center[3][8];
+	float m_extents[3][8];
+
+	// c_leafBit | item index, a node index or c_empty.
+	uint32_t m_children[8];
+};
+
+// Working memory of SceneBvh::Cull, kept by the caller between calls so culling stops allocating once it has grown to fit the scene.
+struct BvhCullScratch
+{
+	struct VisibleItem
+	{
+		uint32_t m_item;
+		uint32_t m_depthKey;
+	};
+
+	kt::Array<VisibleItem> m_visible;
+	kt::Array<VisibleItem> m_sortTemp;
+
+	// Traversal stack, grown as deeper trees need it.
+	kt::Array<uint32_t> m_stack;
+};
+
+// Static bounding volume hierarchy over boxes (e.g. the meshes of a model), for culling them without visiting each one.
+struct SceneBvh
+{
+	KT_NO_COPY(SceneBvh);
+
+	SceneBvh() = default;
+	SceneBvh(SceneBvh&&) = default;
+	SceneBvh& operator=(SceneBvh&&) = default;
+
+	void Clear();
+
+	// Build over _num items given by box centers and half sizes. Node 0 is the root.
+	void Build(kt::Vec3 const* _centers, kt::Vec3 const* _extents, uint32_t _num);
+
+	// Replace o_visible with the items whose boxes intersect the clip volume of _viewProj (-w <= x, y <= w, 0 <= z <= w).
+	// If _frontToBack they are sorted by the clip w of their box centers, otherwise they come in tree order.
+	void Cull(kt::Mat4 const& _viewProj, bool _frontToBack, BvhCullScratch& _scratch, kt::Array<uint32_t>& o_visible) const;
+
+	// Either the owned nodes or, if loaded from a cache, a pointer into the mapping.
+	BvhNode const* Nodes() const { return m_mappedNodes ? m_mappedNodes : m_nodeData.Data(); }
+
+	kt::Array<BvhNode> m_nodeData;
+	BvhNode const* m_mappedNodes = nullptr;
+	uint32_t m_numNodes = 0;
+};
+
+}
@@ -72,7 +72,7 @@ KT_FORCEINLINE void UnlitDiffuseShader(void const* _uniforms, Interpolants const
 {
 	sr::Tex::TextureData* tex = (sr::Tex::TextureData*)_uniforms;
 
-	if (!tex || tex->m_texels.Size() == 0)
+	if (!tex || !tex->HasTexels())
 	{
 		memset(o_texels, 0xFFFFFFFF, 8 * sizeof(uint32_t));
 		return;
@@ -94,13 +94,7 @@ KT_FORCEINLINE void UnlitDiffuseShader(void const* _uniforms, Interpolants const
 	derivs.dvdx = _mm256_loadu_ps(_interpolants.m_dvdx);
 	derivs.dvdy = _mm256_loadu_ps(_interpolants.m_dvdy);
 
-	__m256 r;
-	__m256 g;
-	__m256 b;
-	__m256 a;
-
-	sr::Tex::SampleWrap(*tex, objVaryings.u, objVaryings.v, derivs.dudx, derivs.dudy, derivs.dvdx, derivs.dvdy, r, g, b, a, _execMask);
-	sr::simdutil::RGBA32SoA_To_RGBA8AoS(r, g, b, a, o_texels);
+	sr::Tex::SampleWrapRGBA8(*tex, objVaryings.u, objVaryings.v, derivs.dudx, derivs.dudy, derivs.dvdx, derivs.dvdy, o_texels, _execMask);
 }
 
 KT_FORCEINLINE void VisualizeNormalsShader(void const* _uniforms, Interpolants const& _interpolants, uint32_t o_texels[8], uint32_t _execMask)
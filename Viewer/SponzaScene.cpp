@@ -7,14 +7,13 @@
 namespace sr
 {
 
-// hack as a global for now.
-static SponzaScene::Constants g_constants;
-
 static void SponzaShader(void const* _uniforms, Interpolants const& _interpolants, uint32_t o_texels[8], uint32_t _execMask)
 {
-	sr::Tex::TextureData* tex = (sr::Tex::TextureData*)_uniforms;
+	SponzaScene::DrawUniforms const* uniforms = (SponzaScene::DrawUniforms const*)_uniforms;
+	SponzaScene::LightingUniforms const& lighting = *uniforms->m_lighting;
+	sr::Tex::TextureData const* tex = uniforms->m_diffuse;
 
-	if (!tex || tex->m_texels.Size() == 0)
+	if (!tex || !tex->HasTexels())
 	{
 		memset(o_texels, 0xFFFFFFFF, 8 * sizeof(uint32_t));
 		return;
@@ -41,7 +40,7 @@ static void SponzaShader(void const* _uniforms, Interpolants const& _interpolant
 
 	// sun
 	{
-		__m256 nDotL = simdutil::Dot3SoA(objVaryings.norm_x, objVaryings.norm_y, objVaryings.norm_z, g_constants.m_sunDir[0], g_constants.m_sunDir[1], g_constants.m_sunDir[2]);
+		__m256 nDotL = simdutil::Dot3SoA(objVaryings.norm_x, objVaryings.norm_y, objVaryings.norm_z, lighting.m_sunDir[0], lighting.m_sunDir[1], lighting.m_sunDir[2]);
 
 		// magic bias
 		nDotL = _mm256_max_ps(_mm256_set1_ps(0.1f), nDotL);
@@ -53,15 +52,11 @@ static void SponzaShader(void const* _uniforms, Interpolants const& _interpolant
 
 	for (uint32_t i = 0; i < SponzaScene::Constants::c_numPointLights; ++i)
 	{
-		SponzaScene::PointLight const& light = g_constants.m_pointLights[i];
-	
-		__m256 const lightPos_x = _mm256_broadcast_ss(&light.m_pos.x);
-		__m256 const lightPos_y = _mm256_broadcast_ss(&light.m_pos.y);
-		__m256 const lightPos_z = _mm256_broadcast_ss(&light.m_pos.z);
+		SponzaScene::LightingUniforms::PointLight const& light = lighting.m_pointLights[i];
 	
-		__m256 const pToL_x = _mm256_sub_ps(lightPos_x, objVaryings.pos_x);
-		__m256 const pToL_y = _mm256_sub_ps(lightPos_y, objVaryings.pos_y);
-		__m256 const pToL_z = _mm256_sub_ps(lightPos_z, objVaryings.pos_z);
+		__m256 const pToL_x = _mm256_sub_ps(light.m_pos[0], objVaryings.pos_x);
+		__m256 const pToL_y = _mm256_sub_ps(light.m_pos[1], objVaryings.pos_y);
+		__m256 const pToL_z = _mm256_sub_ps(light.m_pos[2], objVaryings.pos_z);
 
 		__m256 const distSq = simdutil::Dot3SoA(pToL_x, pToL_y, pToL_z, pToL_x, pToL_y, pToL_z);
 		__m256 const recipDist = _mm256_rsqrt_ps(distSq);
@@ -76,25 +71,25 @@ static void SponzaShader(void const* _uniforms, Interpolants const& _interpolant
 		__m256 const one = _mm256_set1_ps(1.0f);
 		
 		__m256 const atten = _mm256_rcp_ps(_mm256_add_ps(one, _mm256_fmadd_ps(_mm256_set1_ps(0.1f), dist, _mm256_mul_ps(distSq, _mm256_set1_ps(0.01f)))));
-		__m256 const lightRadiance = _mm256_mul_ps(nDotL, _mm256_mul_ps(_mm256_broadcast_ss(&light.m_intensity), atten));
+		__m256 const lightRadiance = _mm256_mul_ps(nDotL, _mm256_mul_ps(light.m_intensity, atten));
 
-		radiance[0] = _mm256_add_ps(radiance[0], _mm256_mul_ps(lightRadiance, _mm256_broadcast_ss(&light.m_colour.x)));
-		radiance[1] = _mm256_add_ps(radiance[1], _mm256_mul_ps(lightRadiance, _mm256_broadcast_ss(&light.m_colour.y)));
-		radiance[2] = _mm256_add_ps(radiance[2], _mm256_mul_ps(lightRadiance, _mm256_broadcast_ss(&light.m_colour.z)));
+		radiance[0] = _mm256_add_ps(radiance[0], _mm256_mul_ps(lightRadiance, light.m_colour[0]));
+		radiance[1] = _mm256_add_ps(radiance[1], _mm256_mul_ps(lightRadiance, light.m_colour[1]));
+		radiance[2] = _mm256_add_ps(radiance[2], _mm256_mul_ps(lightRadiance, light.m_colour[2]));
 	}
 
 
 	// Apply ambient term.
-	radiance[0] = _mm256_add_ps(radiance[0], g_constants.m_ambCol[0]);
-	radiance[1] = _mm256_add_ps(radiance[1], g_constants.m_ambCol[1]);
-	radiance[2] = _mm256_add_ps(radiance[2], g_constants.m_ambCol[2]);
+	radiance[0] = _mm256_add_ps(radiance[0], lighting.m_ambCol[0]);
+	radiance[1] = _mm256_add_ps(radiance[1], lighting.m_ambCol[1]);
+	radiance[2] = _mm256_add_ps(radiance[2], lighting.m_ambCol[2]);
 
 	__m256 r;
 	__m256 g;
 	__m256 b;
 	__m256 a;
 
-	sr::Tex::SampleWrap(*tex, objVaryings.u, objVaryings.v, derivs.dudx, derivs.dudy, derivs.dvdx, derivs.dvdy, r, g, b, a, _execMask);
+	sr::Tex::SampleWrapTrilinear(*tex, objVaryings.u, objVaryings.v, derivs.dudx, derivs.dudy, derivs.dvdx, derivs.dvdy, r, g, b, a, _execMask);
 
 	r = _mm256_mul_ps(radiance[0], r);
 	g = _mm256_mul_ps(radiance[1], g);
@@ -102,9 +97,9 @@ static void SponzaShader(void const* _uniforms, Interpolants const& _interpolant
 
 	sr::simdutil::RGBA32SoA_To_RGBA8AoS(r, g, b, a, o_texels);
 }
-SponzaScene::SponzaScene(char const* _modelPath, uint32_t _loadFlags)
+SponzaScene::SponzaScene(char const* _modelPath, uint32_t _loadFlags, TaskSystem* _taskSystem)
 {
-	m_model.Load(_modelPath, kt::GetDefaultAllocator(), _loadFlags);
+	m_model.Load(_modelPath, kt::GetDefaultAllocator(), _loadFlags, _taskSystem);
 }
 
 void SponzaScene::Init(uint32_t _screenHeight, uint32_t _screenWidth)
@@ -124,25 +119,15 @@ void SponzaScene::Init(uint32_t _screenHeight, uint32_t _screenWidth)
 	m_camController.SetProjectionParams(proj);
 	m_camController.SetPos({ 0.0f, 0.0f, 2.0f });
 
-	{
-		g_constants.m_ambCol[0] = _mm256_set1_ps(0.1f);
-		g_constants.m_ambCol[1] = _mm256_set1_ps(0.1f);
-		g_constants.m_ambCol[2] = _mm256_set1_ps(0.1f);
-	}
-
-	{
-		kt::Vec3 const sunDir = kt::Normalize(kt::Vec3(0.4f, 0.7f, 0.1f));
-		g_constants.m_sunDir[0] = _mm256_broadcast_ss(&sunDir.x);
-		g_constants.m_sunDir[1] = _mm256_broadcast_ss(&sunDir.x);
-		g_constants.m_sunDir[2] = _mm256_broadcast_ss(&sunDir.x);
-	}
+	m_constants.m_ambCol = kt::Vec3(0.1f);
+	m_constants.m_sunDir = kt::Normalize(kt::Vec3(0.4f, 0.7f, 0.1f));
 
 	kt::XorShift32 rng;
 
 	for (uint32_t i = 0; i < Constants::c_numPointLights; ++i)
 	{
-		PointLight& light = g_constants.m_pointLights[i];
-		PointLightAnim& anim = g_constants.m_pointLightAnim[i];
+		PointLight& light = m_constants.m_pointLights[i];
+		PointLightAnim& anim = m_constants.m_pointLightAnim[i];
 
 		anim.m_colourA = kt::Vec3(kt::RandomUnitFloat(rng), kt::RandomUnitFloat(rng), kt::RandomUnitFloat(rng));
 		anim.m_colourB = kt::Vec3(kt::RandomUnitFloat(rng), kt::RandomUnitFloat(rng), kt::RandomUnitFloat(rng));
@@ -165,6 +150,19 @@ void SponzaScene::Init(uint32_t _screenHeight, uint32_t _screenWidth)
 void SponzaScene::Update(RenderContext& _ctx, FrameBuffer& _fb, float _dt)
 {
 	m_camController.UpdateViewGamepad(_dt);
+	kt::Mat4 const viewProj = m_camController.GetCam().GetCachedViewProj();
+
+	// Front to back, so the current frame's depth rejects more fragments early. Culled on a worker while this thread clears and animates.
+	TaskHandle cull;
+	cull.Run(_ctx.GetTaskSystem(), [this, &viewProj]() { m_model.CullMeshes(viewProj, true, m_cullScratch, m_visibleMeshes); });
+
+	// Pages Update maps or evicts may still be sampled by the frame in flight in FrameMode::Pipelined.
+	if (m_model.m_virtualTextures.IsInitialized())
+	{
+		_ctx.Flush();
+		m_model.m_virtualTextures.Update();
+	}
+
 	_ctx.ClearFrameBuffer(_fb, 0);
 
 	float const sinT = (sinf(m_animPhase) * 0.5f + 0.5f);
@@ -173,8 +171,8 @@ void SponzaScene::Update(RenderContext& _ctx, FrameBuffer& _fb, float _dt)
 
 	for (uint32_t i = 0; i < Constants::c_numPointLights; ++i)
 	{
-		PointLight& light = g_constants.m_pointLights[i];
-		PointLightAnim& anim = g_constants.m_pointLightAnim[i];
+		PointLight& light = m_constants.m_pointLights[i];
+		PointLightAnim& anim = m_constants.m_pointLightAnim[i];
 
 		light.m_colour = kt::Lerp(anim.m_colourA, anim.m_colourB, sinT);
 
@@ -188,31 +186,56 @@ void SponzaScene::Update(RenderContext& _ctx, FrameBuffer& _fb, float _dt)
 		anim.m_angle += _dt;
 	}
 
-	for (sr::Obj::Mesh const& mesh : m_model.m_meshes)
-	{
-		sr::DrawCall call;
-		call.SetFrameBuffer(&_fb);
-		call.m_mvp = m_camController.GetCam().GetCachedViewProj();
-
-		call.SetAttributeBuffer(mesh.m_vertexData.Data(), sizeof(sr::Obj::Vertex), mesh.m_vertexData.Size(), offsetof(sr::Obj::Vertex, uv) / sizeof(float));
+	LightingUniforms* lighting = _ctx.AllocFrameUniforms<LightingUniforms>();
 
-		call.m_positionBuffer.m_ptr = (uint8_t*)mesh.m_vertexData.Data();
-		call.m_positionBuffer.m_stride = sizeof(sr::Obj::Vertex);
-		call.m_positionBuffer.m_num = mesh.m_vertexData.Size();
+	for (uint32_t i = 0; i < 3; ++i)
+	{
+		lighting->m_sunDir[i] = _mm256_set1_ps(m_constants.m_sunDir[i]);
+		lighting->m_ambCol[i] = _mm256_set1_ps(m_constants.m_ambCol[i]);
+	}
 
-		call.m_indexBuffer.m_ptr = mesh.m_indexData.Data();
-		call.m_indexBuffer.m_num = mesh.m_numIndices;
-		call.m_indexBuffer.m_stride = mesh.m_indexType == sr::IndexType::u16 ? sizeof(uint16_t) : sizeof(uint32_t);
-		call.m_pixelShader = SponzaShader;
+	for (uint32_t lightIdx = 0; lightIdx < Constants::c_numPointLights; ++lightIdx)
+	{
+		PointLight const& light = m_constants.m_pointLights[lightIdx];
+		LightingUniforms::PointLight& lightUniforms = lighting->m_pointLights[lightIdx];
 
-		if (mesh.m_matIdx < m_model.m_materials.Size())
+		for (uint32_t i = 0; i < 3; ++i)
 		{
-			call.m_pixelUniforms = &m_model.m_materials[mesh.m_matIdx].m_diffuse;
+			lightUniforms.m_pos[i] = _mm256_set1_ps(light.m_pos[i]);
+			lightUniforms.m_colour[i] = _mm256_set1_ps(light.m_colour[i]);
 		}
-		else
+		lightUniforms.m_intensity = _mm256_set1_ps(light.m_intensity);
+	}
+
+	cull.Wait();
+
+	// LODs are selected in parallel, draws are still submitted front to back from this thread.
+	float const viewportHeight = float(_fb.WritePlane()->m_height);
+	m_visibleLods.Resize(m_visibleMeshes.Size());
+
+	_ctx.GetTaskSystem().ParallelFor(m_visibleMeshes.Size(), 64, [this, &viewProj, viewportHeight](uint32_t _start, uint32_t _end)
+	{
+		for (uint32_t i = _start; i < _end; ++i)
 		{
-			call.m_pixelUniforms = nullptr;
+			m_visibleLods[i] = m_model.m_meshes[m_visibleMeshes[i]].SelectLod(viewProj, viewportHeight);
 		}
+	});
+
+	for (uint32_t i = 0; i < m_visibleMeshes.Size(); ++i)
+	{
+		sr::Obj::Mesh const& mesh = m_model.m_meshes[m_visibleMeshes[i]];
+
+		sr::DrawCall call;
+		call.SetFrameBuffer(&_fb);
+		call.m_mvp = viewProj;
+
+		mesh.BindBuffers(call, m_visibleLods[i]);
+		call.SetOcclusionCulling(&_fb);
+
+		DrawUniforms uniforms;
+		uniforms.m_lighting = lighting;
+		uniforms.m_diffuse = mesh.m_matIdx < m_model.m_materials.Size() ? &m_model.m_materials[mesh.m_matIdx].m_diffuse : nullptr;
+		call.SetPixelShader(SponzaShader, &uniforms, sizeof(uniforms));
 
 		_ctx.DrawIndexed(call);
 	}
@@ -8,7 +8,7 @@ namespace sr
 
 struct SponzaScene : Scene
 {
-	SponzaScene(char const* _modelPath, uint32_t _loadFlags);
+	SponzaScene(char const* _modelPath, uint32_t _loadFlags, TaskSystem* _taskSystem = nullptr);
 
 	void Init(uint32_t _screenHeight, uint32_t _screenWidth) override;
 	void Update(RenderContext& _ctx, FrameBuffer& _fb, float _dt) override;
@@ -37,17 +37,47 @@ struct SponzaScene : Scene
 	{
 		static uint32_t constexpr c_numPointLights = 1;
 
+		kt::Vec3 m_sunDir;
+		kt::Vec3 m_ambCol;
+
+		PointLight m_pointLights[c_numPointLights];
+		PointLightAnim m_pointLightAnim[c_numPointLights];
+	};
+
+	// Shader side lighting constants, scalars are pre-broadcast. Allocated once per frame from frame uniform memory.
+	struct LightingUniforms
+	{
+		struct PointLight
+		{
+			__m256 m_pos[3];
+			__m256 m_colour[3];
+			__m256 m_intensity;
+		};
+
 		__m256 m_sunDir[3];
 		__m256 m_ambCol[3];
 
+		PointLight m_pointLights[Constants::c_numPointLights];
+	};
 
-		PointLight m_pointLights[c_numPointLights];
-		PointLightAnim m_pointLightAnim[c_numPointLights];
+	// Per draw uniform block, copied into frame uniform memory by DrawIndexed.
+	struct DrawUniforms
+	{
+		Tex::TextureData const* m_diffuse;
+		LightingUniforms const* m_lighting;
 	};
 
 	sr::Obj::Model m_model;
 	FreeCamController m_camController;
 
+	kt::Array<uint32_t> m_visibleMeshes;
+	BvhCullScratch m_cullScratch;
+
+	// Mesh::SelectLod of each of m_visibleMeshes.
+	kt::Array<uint32_t> m_visibleLods;
+
+	Constants m_constants;
+
 	float m_animPhase = 0.0f;
 };
 